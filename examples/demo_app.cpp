@@ -38,7 +38,8 @@ int main() {
     auto end = std::chrono::high_resolution_clock::now();
 
     // print results
-    std::cout << "Addition performed on " << (device == Device::CPU ? "CPU" : "GPU") << std::endl;
+    std::cout << "Addition performed on " << device_name(device) << ": "
+              << Scheduler::getInstance().decisions().back().reason << std::endl;
     std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds" << std::endl;
     std::cout << "First few results: ";
     for (int i = 0; i < 5; ++i) {
@@ -1,7 +1,19 @@
 #pragma once
 
+#include "cpu_dispatch.h"
 #include "tensor.h"
 
+// Elementwise activations and their derivatives (taken with respect to the input), run by the
+// vector kernels of the active ISA (see cpu_dispatch.h). exp, sigmoid and tanh are the Cephes
+// polynomials of simd_math.h; maximum error against a double reference, measured over every
+// float of the range on SSE (separate multiply and add) and AVX2/AVX-512 (FMA):
+//  exp      [-87, 88]    1.3 ulp
+//  sigmoid  [-87, 88]    3.2 ulp
+//  tanh     [-20, 20]    1.4 ulp
+//  silu     [-87, 88]    3.6 ulp
+//  gelu     [-4, 10]     20 ulp, the rounding of its cubic argument is amplified by exp
+// Outside those ranges exp saturates at e^88 and e^-87, results that would be subnormal keep
+// an absolute error below 2e-38.
 namespace activation {
 
 Tensor relu(const Tensor& input);
@@ -13,4 +25,54 @@ Tensor sigmoid_derivative(const Tensor& input);
 Tensor tanh(const Tensor& input);
 Tensor tanh_derivative(const Tensor& input);
 
-}
\ No newline at end of file
+// tanh approximation of GELU, within 5e-4 of the erf definition
+Tensor gelu(const Tensor& input);
+Tensor gelu_derivative(const Tensor& input);
+
+// x * sigmoid(x)
+Tensor silu(const Tensor& input);
+Tensor silu_derivative(const Tensor& input);
+
+// x for x > 0, alpha * x otherwise
+Tensor leaky_relu(const Tensor& input, float alpha = 0.01f);
+Tensor leaky_relu_derivative(const Tensor& input, float alpha = 0.01f);
+
+// over the last dimension, each row shifted by its max first
+Tensor softmax(const Tensor& input);
+
+// write into a caller-owned output of the same shape, output may be input for in-place use
+void relu(const Tensor& input, Tensor& output);
+void relu_derivative(const Tensor& input, Tensor& output);
+
+void sigmoid(const Tensor& input, Tensor& output);
+void sigmoid_derivative(const Tensor& input, Tensor& output);
+
+void tanh(const Tensor& input, Tensor& output);
+void tanh_derivative(const Tensor& input, Tensor& output);
+
+void gelu(const Tensor& input, Tensor& output);
+void gelu_derivative(const Tensor& input, Tensor& output);
+
+void silu(const Tensor& input, Tensor& output);
+void silu_derivative(const Tensor& input, Tensor& output);
+
+void leaky_relu(const Tensor& input, Tensor& output, float alpha = 0.01f);
+void leaky_relu_derivative(const Tensor& input, Tensor& output, float alpha = 0.01f);
+
+void softmax(const Tensor& input, Tensor& output);
+
+// in place on a contiguous tensor
+void relu_inplace(Tensor& x);
+void sigmoid_inplace(Tensor& x);
+void tanh_inplace(Tensor& x);
+void gelu_inplace(Tensor& x);
+void silu_inplace(Tensor& x);
+void leaky_relu_inplace(Tensor& x, float alpha = 0.01f);
+void softmax_inplace(Tensor& x);
+
+// scalar std:: versions, the reference the kernels are tested and benchmarked against
+float reference(cpu::MapOp op, float x, float alpha = 0.01f);
+void map_baseline(cpu::MapOp op, const Tensor& input, Tensor& output, float alpha = 0.01f);
+void softmax_baseline(const Tensor& input, Tensor& output);
+
+}
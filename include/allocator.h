@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+struct AllocatorStats {
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    size_t bytes_allocated = 0;
+    size_t bytes_in_use = 0;
+    size_t peak_bytes_in_use = 0;
+    // requests that could not be served from cached memory and went to the system
+    size_t system_allocations = 0;
+    size_t system_bytes = 0;
+};
+
+// Source of tensor storage. Every block is aligned to kAlignment bytes.
+class Allocator {
+public:
+    static constexpr size_t kAlignment = 64;
+
+    virtual ~Allocator() = default;
+
+    virtual void* allocate(size_t bytes) = 0;
+    virtual void deallocate(void* ptr, size_t bytes) = 0;
+
+    AllocatorStats stats() const;
+    void reset_stats();
+
+    // process-wide pooled allocator, used when no AllocatorScope is active
+    static Allocator* default_allocator();
+    // allocator new tensors on this thread draw from
+    static Allocator* current();
+
+protected:
+    void record_allocation(size_t bytes, bool from_system, size_t system_bytes);
+    void record_deallocation(size_t bytes);
+
+    mutable std::mutex mutex_;
+    AllocatorStats stats_;
+
+private:
+    friend class AllocatorScope;
+    static thread_local Allocator* current_;
+};
+
+// Power-of-two size classes with free lists, freed blocks are kept for reuse
+// instead of being returned to the system.
+class PoolAllocator : public Allocator {
+public:
+    ~PoolAllocator() override;
+
+    void* allocate(size_t bytes) override;
+    void deallocate(void* ptr, size_t bytes) override;
+
+    // returns every cached block to the system
+    void release_cached();
+
+private:
+    static int size_class(size_t bytes);
+
+    std::vector<std::vector<void*>> free_lists_;
+};
+
+// Bump allocator for per-inference temporaries. deallocate is a no-op and reset()
+// frees everything at once, so reset only when no tensor from the arena is alive.
+class ArenaAllocator : public Allocator {
+public:
+    explicit ArenaAllocator(size_t chunk_bytes = 1 << 20);
+    ~ArenaAllocator() override;
+
+    void* allocate(size_t bytes) override;
+    void deallocate(void* ptr, size_t bytes) override;
+
+    // after a reset the arena holds one chunk large enough for the previous high-water
+    // mark, so a repeated inference never reaches the system allocator again
+    void reset();
+
+private:
+    struct Chunk {
+        char* data;
+        size_t size;
+    };
+
+    size_t chunk_bytes_;
+    std::vector<Chunk> chunks_;
+    size_t used_ = 0;
+    size_t total_used_ = 0;
+};
+
+// Growable float scratch from the default allocator for kernel temporaries. Only grows,
+// so a kernel called repeatedly with the same sizes stops allocating after the first call.
+class ScratchBuffer {
+public:
+    ScratchBuffer() = default;
+    ~ScratchBuffer();
+
+    ScratchBuffer(const ScratchBuffer&) = delete;
+    ScratchBuffer& operator=(const ScratchBuffer&) = delete;
+
+    float* reserve(size_t count);
+
+private:
+    float* data_ = nullptr;
+    size_t capacity_ = 0;
+};
+
+// Routes tensor allocations on this thread to an allocator for the lifetime of the scope.
+class AllocatorScope {
+public:
+    explicit AllocatorScope(Allocator& allocator);
+    ~AllocatorScope();
+
+    AllocatorScope(const AllocatorScope&) = delete;
+    AllocatorScope& operator=(const AllocatorScope&) = delete;
+
+private:
+    Allocator* previous_;
+};
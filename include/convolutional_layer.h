@@ -1,18 +1,65 @@
 #pragma once
 
 #include "tensor.h"
+#include "gemm.h"
+#include "layout.h"
+#include <cstdint>
 #include <vector>
 #include <memory>
 
+namespace quant {
+struct LayerState;
+struct QuantizedActivations;
+}
+
+enum class ConvAlgorithm {
+    // Winograd for 3x3 stride-1 kernels with at least 16 input channels, im2col otherwise
+    Auto,
+    Im2col,
+    Winograd2x2,
+    Winograd4x4
+};
+
 class ConvolutionalLayer {
 public:
     ConvolutionalLayer(int in_channels, int out_channels, int kernel_size, int stride = 1, int padding = 0);
     
     Tensor forward(const Tensor& input);
     Tensor backward(const Tensor& output_gradient, float learning_rate);
+
+    // writes into a caller-owned output of output_shape(input.shape()). lowered to the packed
+    // GEMM via im2col or Winograd (see ConvAlgorithm), bias and activation are fused in.
+    // NHWC and NCHW8c input and output run the direct kernels of direct_conv.h instead, shapes
+    // are then the layout::physical_shape ones. only NCHW keeps the input for backward
+    void forward(const Tensor& input, Tensor& output, gemm::Activation activation = gemm::Activation::None,
+                 Layout layout = Layout::NCHW);
+    // direct scalar convolution, reference for the GEMM path
+    void forward_baseline(const Tensor& input, Tensor& output);
     
     void update_parameters(float learning_rate);
 
+    std::vector<int> output_shape(const std::vector<int>& input_shape) const;
+    int in_channels() const { return in_channels_; }
+    int out_channels() const { return out_channels_; }
+
+    const Tensor& weights() const { return *weights_; }
+    // replaces the filters [out, in, k, k], transforms cached from the old ones are dropped
+    void set_weights(const Tensor& weights);
+
+    void set_algorithm(ConvAlgorithm algorithm) { algorithm_ = algorithm; }
+    // what forward runs for this input shape, Auto resolved
+    ConvAlgorithm select_algorithm(const std::vector<int>& input_shape) const;
+
+    // int8 NCHW forward (quantization.h): filters quantized per output channel, each image with
+    // its own range unless calibrated, lowered to the int8 GEMM through an im2row of bytes.
+    // the other layouts keep running the float direct kernels
+    void quantize_int8();
+    void dequantize();
+    bool is_quantized() const { return int8_ != nullptr; }
+    // while on, NCHW forward runs in float and records the range of its input. turning it off
+    // fixes the int8 activation scale to that range
+    void set_calibrating(bool calibrating);
+
 private:
     int in_channels_;
     int out_channels_;
@@ -23,7 +70,35 @@ private:
     std::shared_ptr<Tensor> weights_;
     std::shared_ptr<Tensor> bias_;
     std::shared_ptr<Tensor> input_;
+    // reused across calls, only the interior is rewritten so the border stays zero
+    std::shared_ptr<Tensor> padded_;
+
+    ConvAlgorithm algorithm_ = ConvAlgorithm::Auto;
+    // bumped on every weight change, transformed filters are rebuilt when they fall behind
+    uint64_t weights_version_ = 0;
+    std::shared_ptr<Tensor> winograd_filters_;
+    int winograd_tile_ = 0;
+    uint64_t winograd_version_ = 0;
+    std::shared_ptr<Tensor> packed_filters_;
+    Layout packed_layout_ = Layout::NCHW;
+    uint64_t packed_version_ = 0;
+    std::shared_ptr<quant::LayerState> int8_;
     
-    Tensor pad_input(const Tensor& input) const;
+    void pad_input(const Tensor& input, Tensor& padded) const;
+    // unrolls the receptive fields of one image into a (in_channels * k * k) x (out_h * out_w)
+    // matrix, out of bounds taps read as zero so no padded copy is needed
+    void im2col(const float* image, int height, int width, int output_height, int output_width, float* columns) const;
+    // output = act(kernel * im2col(input) + bias), bias may be null
+    void convolve(const Tensor& input, const Tensor& kernel, const float* bias,
+                  gemm::Activation activation, Tensor& output) const;
     Tensor convolve(const Tensor& input, const Tensor& kernel) const;
-};
\ No newline at end of file
+    void convolve_int8(const Tensor& input, gemm::Activation activation, Tensor& output);
+    // output pixels [begin, end) of a channel-minor byte image into rows of the packed
+    // activations, out of bounds taps read as pad (the zero point)
+    void im2row(const uint8_t* image, int height, int width, int output_width, uint8_t pad, int begin, int end,
+                quant::QuantizedActivations& rows) const;
+    // filters transformed for F(m x m, 3x3), recomputed only after a weight change
+    const Tensor& winograd_filters(int m);
+    // filters repacked for a channel-minor layout, same caching as the Winograd ones
+    const Tensor& packed_filters(Layout layout);
+};
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "gemm.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The hot CPU loops are compiled once per instruction set (kernels_sse.cpp, kernels_avx2.cpp,
+// kernels_avx512.cpp, kernels_avx512_vnni.cpp, each with its own -m flags) and one table of
+// them is picked at startup from cpuid. The rest of the library is built for baseline x86-64,
+// so one binary runs on any host and still uses FMA and AVX-512 where they exist.
+// ANNOF_CPU_ISA=sse|avx2|avx512|avx512vnni forces a lower ISA for A/B runs.
+namespace cpu {
+
+// ordered, each one implies the ones before it. AVX512 is F + BW, AVX512VNNI only swaps in
+// the int8 kernel (vpdpbusd instead of vpmaddubsw + vpmaddwd)
+enum class Isa {
+    SSE,
+    AVX2,
+    AVX512,
+    AVX512VNNI
+};
+
+const char* isa_name(Isa isa);
+// "sse", "avx2", "avx512" or "avx512vnni", false for anything else
+bool parse_isa(const std::string& name, Isa& isa);
+
+// best ISA both the processor and the OS (saved register state) support, AVX2 needs FMA and
+// F16C too
+Isa detect();
+
+// elementwise functions of Kernels::map, derivatives are with respect to the function's input
+enum class MapOp {
+    ReLU,
+    ReLUDerivative,
+    Sigmoid,
+    SigmoidDerivative,
+    Tanh,
+    TanhDerivative,
+    GELU,
+    GELUDerivative,
+    SiLU,
+    SiLUDerivative,
+    LeakyReLU,
+    LeakyReLUDerivative,
+    Scale
+};
+
+// binary functions of Kernels::binary
+enum class BinaryOp {
+    Add,
+    Subtract,
+    Multiply,
+    Divide
+};
+
+// epilogue of one micro-kernel tile, bias already offset to the tile's first row / column
+struct TileEpilogue {
+    const float* bias;
+    bool bias_per_row;
+    gemm::Activation activation;
+};
+
+// columns of one packed int8 weight panel, see quantization.h
+constexpr int kInt8Panel = 16;
+// largest quantized activation, 7 bits keep vpmaddubsw's 16-bit pair sums from saturating
+constexpr int kInt8MaxActivation = 127;
+
+// dequantizing epilogue of one int8 tile, pointers already offset to the tile's first row /
+// column: c = (acc - row_zero * column_sum) * row_scale * column_scale + bias, then activation.
+// row arrays hold int8_mr entries, column arrays kInt8Panel
+struct Int8Epilogue {
+    const float* row_scales;
+    const float* row_zeros;
+    const float* column_sums;
+    const float* column_scales;
+    const float* bias;
+    gemm::Activation activation;
+};
+
+// 16-bit float formats of half precision storage (see half.h). Float16 is IEEE binary16,
+// BFloat16 the upper half of a float
+enum class HalfFormat {
+    Float16,
+    BFloat16
+};
+
+// most rows of one Kernels::gemv call
+constexpr int kGemvRows = 4;
+
+// most rows of one Kernels::half_gemm call
+constexpr int kHalfRows = 4;
+
+// columns of a block of block-sparse weights (see sparse.h), one ymm of floats
+constexpr int kSparseBlockCols = 8;
+// most rows of one Kernels::sparse_panel call
+constexpr int kSparseRows = 4;
+
+struct Kernels {
+    Isa isa;
+
+    // GEMM register block, micro_kernel computes an mr x nr tile of C
+    int mr;
+    int nr;
+    // B panel of kc x nc values -> nr-column slivers, each k-major, edge slivers zero padded
+    void (*pack_b)(const float* b, std::ptrdiff_t row_stride, std::ptrdiff_t col_stride, int kc, int nc,
+                   float* packed);
+    // C tile = A sliver * B sliver (+ C when accumulate), then the epilogue when it is not null.
+    // a holds mr values per k step, b 64-byte aligned nr values
+    void (*micro_kernel)(int kc, const float* a, const float* b, float* c, int ldc, bool accumulate,
+                         const TileEpilogue* epilogue);
+    // c = a * b for rows <= kGemvRows rows of a and cols columns of row-major b, no packing:
+    // each row of b is loaded once for all the rows, for batches too small to fill a
+    // micro-kernel tile. the epilogue's bias is offset to the first column
+    void (*gemv)(int rows, int k, int cols, const float* a, int lda, const float* b, int ldb, float* c, int ldc,
+                 const TileEpilogue* epilogue);
+
+    // int8 GEMM register block, int8_micro_kernel computes int8_mr rows x kInt8Panel columns.
+    // a is a packed block of u8 activations (per group of 4 k values, 4 bytes of each row),
+    // b one packed panel of s8 weights, both k_groups long
+    int int8_mr;
+    void (*int8_micro_kernel)(int k_groups, const uint8_t* a, const int8_t* b, float* c, int ldc,
+                              const Int8Epilogue& epilogue);
+
+    // out[i] = clamp(round(in[i] * inverse_scale + zero), 0, kInt8MaxActivation), halves to even
+    void (*quantize)(const float* in, int count, float inverse_scale, float zero, uint8_t* out);
+    // smallest and largest of count > 0 values
+    void (*min_max)(const float* in, int count, float* min, float* max);
+
+    // gemv with b row-major 16-bit values of format, widened to float in registers as they are
+    // loaded, so the weights stream from memory at half the bytes. rows <= kHalfRows
+    void (*half_gemm)(int rows, int k, int cols, const float* a, int lda, const uint16_t* b, int ldb,
+                      HalfFormat format, float* c, int ldc, const TileEpilogue* epilogue);
+    // out[i] = in[i] in format, rounded to nearest even, NaN stays NaN
+    void (*to_half)(const float* in, uint16_t* out, int count, HalfFormat format);
+    // out[i] = in[i] as float, exact
+    void (*from_half)(const uint16_t* in, float* out, int count, HalfFormat format);
+
+    // rows <= kSparseRows rows x kSparseBlockCols columns of c = a * b for one column panel of
+    // block-sparse b: blocks of block_rows (1 or 4) x kSparseBlockCols values, row-major, the
+    // block starting at row starts[i] of b, rows of a read there. epilogue as for half_gemm
+    void (*sparse_panel)(int rows, int block_rows, int blocks, const int* starts, const float* values,
+                         const float* a, int lda, float* c, int ldc, const TileEpilogue* epilogue);
+
+    // out[i] = act(in[i]), out may be in
+    void (*activate)(const float* in, float* out, int count, gemm::Activation activation);
+    // out[i] = op(in[i]) with alpha the LeakyReLU slope or the Scale factor, out may be in
+    void (*map)(const float* in, float* out, int count, MapOp op, float alpha);
+    // softmax of each row of a rows x cols matrix, out may be in
+    void (*softmax)(const float* in, float* out, int rows, int cols);
+    // out[i] = a[i * a_step] op b[i * b_step], steps are 0 (one value broadcast over the run) or 1.
+    // out may be a or b
+    void (*binary)(const float* a, int a_step, const float* b, int b_step, float* out, int count, BinaryOp op);
+    // sum of (a[i] - b[i])^2
+    float (*sum_squared_difference)(const float* a, const float* b, int count);
+    // out[j] -= scale * sum_i rows[i * cols + j], the bias step of a fully connected backward
+    void (*subtract_column_sums)(const float* rows, int row_count, int cols, float scale, float* out);
+};
+
+// largest mr * nr of any table, for callers that stage an edge tile
+constexpr int kMaxTile = 12 * 32;
+// largest int8_mr of any table
+constexpr int kMaxInt8Rows = 12;
+
+// table of the active ISA
+const Kernels& kernels();
+Isa active_isa();
+// switches every later call to isa, false (and no change) when the host can't run it or the
+// compiler could not build it
+bool set_isa(Isa isa);
+
+// table for isa, null when the compiler could not build it. running it needs detect() >= isa
+const Kernels* kernels_for(Isa isa);
+
+// one per ISA translation unit
+const Kernels* sse_kernels();
+const Kernels* avx2_kernels();
+const Kernels* avx512_kernels();
+const Kernels* avx512_vnni_kernels();
+
+}
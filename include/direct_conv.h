@@ -0,0 +1,43 @@
+#pragma once
+
+#include "gemm.h"
+#include "layout.h"
+#include <cstddef>
+
+// Direct convolution on channel-minor layouts (NHWC and NCHW8c, see layout.h). Both keep the
+// channels of a pixel adjacent, so the inner loop broadcasts one input value and multiplies it
+// into 16 output channels loaded contiguously from the packed filters, for 6 output pixels
+// held in registers at once. No im2col matrix is built.
+// The kernels are built with AVX2 + FMA, call only when cpu::active_isa() is at least AVX2.
+namespace direct_conv {
+
+// filters [out, in, k, k] repacked for layout, output channels padded to a multiple of 8:
+//  NHWC    [out / 8, k, k, in, 8]
+//  NCHW8c  [out / 8, in / 8, k, k, 8 in, 8 out], input channels padded too
+size_t packed_filter_size(Layout layout, int out_channels, int in_channels, int kernel_size);
+void pack_filters(Layout layout, const float* filters, int out_channels, int in_channels, int kernel_size,
+                  float* packed);
+
+// output = act(conv(input, filters) + bias) with input and output both stored in layout,
+// output spatial size (height + 2 * padding - kernel_size) / stride + 1. bias may be null
+void conv2d(Layout layout, const float* input, int batch, int in_channels, int height, int width,
+            int kernel_size, int stride, int padding, const float* packed, int out_channels,
+            const float* bias, gemm::Activation activation, float* output);
+
+// conv2d's arguments, for the AVX2 half in direct_conv_avx2.cpp
+struct Conv {
+    Layout layout;
+    const float* input;
+    int in_channels, height, width, kernel_size, stride, padding;
+    const float* packed;
+    int out_channels;
+    const float* bias;
+    gemm::Activation activation;
+    float* output;
+};
+
+// conv2d tasks [begin, end), task (b * pairs + pair) * output_height + oh being output row oh of
+// image b for output channel blocks 2 * pair and 2 * pair + 1
+void conv2d_tasks(const Conv& conv, int begin, int end);
+
+}
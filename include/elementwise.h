@@ -0,0 +1,32 @@
+#pragma once
+
+#include "cpu_dispatch.h"
+#include "tensor.h"
+#include <vector>
+
+// Elementwise engine under the Tensor operators, activations and losses. Shapes broadcast the
+// NumPy way: aligned from the last dimension, each pair of sizes equal or one of them 1, missing
+// leading dimensions count as 1. Operands are walked through their strides, dimensions that are
+// contiguous in every operand are merged first, and each innermost run goes to the vector
+// kernels of the active ISA (see cpu_dispatch.h). Large tensors are split across the thread
+// pool in chunks sized by ThreadPool::grain_for.
+namespace elementwise {
+
+// most dimensions left after merging contiguous ones
+constexpr int kMaxDims = 8;
+
+// shape of a op b, throws std::invalid_argument when the shapes don't broadcast
+std::vector<int> broadcast_shape(const std::vector<int>& a, const std::vector<int>& b);
+
+// out = a op b with broadcasting. out must be contiguous and hold broadcast_shape(a, b)
+// elements, it may be a or b
+void binary(cpu::BinaryOp op, const Tensor& a, const Tensor& b, Tensor& out);
+Tensor binary(cpu::BinaryOp op, const Tensor& a, const Tensor& b);
+
+// out = op(in), alpha as for Kernels::map. out must be contiguous and the size of in, it may be in
+void unary(cpu::MapOp op, const Tensor& in, Tensor& out, float alpha = 0.0f);
+
+// sum of (a - b)^2 over two tensors of the same size, accumulated in double across blocks
+double sum_squared_difference(const Tensor& a, const Tensor& b);
+
+}
@@ -1,20 +1,98 @@
 #pragma once
 
 #include "tensor.h"
+#include "gemm.h"
+#include <cstdint>
 #include <memory>
+#include <vector>
+
+namespace quant {
+struct LayerState;
+}
+
+namespace sparse {
+struct BlockSparseWeights;
+}
 
 class FullyConnectedLayer {
 public:
     FullyConnectedLayer(int input_size, int output_size);
+    // drops the device copies of the parameters
+    ~FullyConnectedLayer();
     
     Tensor forward(const Tensor& input, bool use_gpu = false);
     Tensor forward_cpu(const Tensor& input);
     Tensor forward_gpu(const Tensor& input);
     Tensor backward(const Tensor& output_gradient, float learning_rate);
-    
+
+    // write into a caller-owned {batch, output_size} tensor. input may be N-D as long as
+    // its trailing dims flatten to input_size, so conv outputs need no explicit flatten
+    void forward(const Tensor& input, Tensor& output, bool use_gpu = false);
+    // bias and the optional activation are applied in the GEMM epilogue, no extra pass over output.
+    // batches of up to cpu::kGemvRows rows take gemm::gemv, the weights split by column across
+    // the thread pool, larger ones the packed sgemm
+    void forward_cpu(const Tensor& input, Tensor& output, gemm::Activation activation = gemm::Activation::None);
+    void forward_gpu(const Tensor& input, Tensor& output);
+    // batch rows shared between the CPU and the OpenCL device (SplitGemm), parameters stay
+    // resident on the device like in forward_gpu
+    void forward_split(const Tensor& input, Tensor& output, gemm::Activation activation = gemm::Activation::None);
+
+    std::vector<int> output_shape(const std::vector<int>& input_shape) const;
+
+    // parameters, for kernels that run the layer outside forward (GpuPipeline)
+    const Tensor& get_weights() const { return *weights; }
+    const Tensor& get_bias() const { return *bias; }
+    int input_size() const { return weights->shape()[0]; }
+    int output_size() const { return weights->shape()[1]; }
+
+    // int8 forward_cpu (quantization.h): weights quantized per output column, again after each
+    // backward, activations per row from their own range unless calibrated. off by default
+    void quantize_int8();
+    void dequantize();
+    bool is_quantized() const { return int8_ != nullptr; }
+    // while on, forward_cpu runs in float and records the range of its input. turning it off
+    // fixes the int8 activation scale to that range
+    void set_calibrating(bool calibrating);
+
+    // weight storage, Float32 by default. Float16 and BFloat16 round the weights once and keep
+    // only the 16-bit copy (half.h): half the memory, forward_cpu widens them in registers.
+    // backward goes through a float copy and rounds the updated weights again, so updates
+    // smaller than half an ulp of the format are lost. the GPU paths fall back to the CPU
+    void set_weight_dtype(DType dtype);
+    DType weight_dtype() const { return weights->dtype(); }
+
+    // block-sparse forward_cpu (sparse.h): only the blocks of block_rows (1 or 4) x 8 weights
+    // holding a nonzero are kept and multiplied, 0 turns it off. the blocks are rebuilt after
+    // each backward, which can fill pruned weights in again
+    void set_sparse(int block_rows);
+    bool is_sparse() const { return sparse_ != nullptr; }
+    // zeroes the fraction sparsity of the block_rows x 8 weight blocks with the smallest magnitude
+    void prune(float sparsity, int block_rows);
+    // fraction of those blocks still holding a nonzero weight
+    double weight_density(int block_rows) const;
+
+    // float forward_cpu with the weights packed once into the GEMM's panel layout instead of on
+    // every call (gemm::PackedB), for inference. costs a second copy of the weights, repacked on
+    // the first forward after a backward or an ISA switch. ignored by the int8, sparse and
+    // 16-bit paths and by gemv sized batches. off by default
+    void set_prepacked(bool prepacked);
+    bool is_prepacked() const { return packed_ != nullptr; }
 
 private:
+    void cache_input(const Tensor& input);
+    void forward_int8(int batch_size, Tensor& output, gemm::Activation activation);
+    void build_sparse(int block_rows);
+    void pack_weights();
+
     std::shared_ptr<Tensor> weights;
     std::shared_ptr<Tensor> bias;
     std::shared_ptr<Tensor> input;
-};
\ No newline at end of file
+
+    // bumped by backward, the int8, sparse and packed weights are rebuilt when they fall behind
+    uint64_t weights_version_ = 0;
+    std::shared_ptr<quant::LayerState> int8_;
+    std::shared_ptr<sparse::BlockSparseWeights> sparse_;
+    uint64_t sparse_version_ = 0;
+    std::shared_ptr<gemm::PackedB> packed_;
+    uint64_t packed_version_ = 0;
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "optimization_pass.h"
+
+// Folds an activation that is the only reader of a Convolution or FullyConnected node into
+// that node, so bias and activation run in the GEMM epilogue instead of as separate passes.
+class FusionPass : public OptimizationPass {
+public:
+    using OptimizationPass::apply;
+    void apply(Graph& graph) override;
+};
+
+// references this translation unit so the static registration is linked in
+void register_fusion_passes();
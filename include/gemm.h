@@ -0,0 +1,64 @@
+#pragma once
+
+#include "allocator.h"
+
+namespace gemm {
+
+enum class Activation {
+    None,
+    ReLU,
+    Sigmoid,
+    Tanh
+};
+
+// Work done on each output value before it is stored, while the tile is still in
+// registers: C = act(alpha * op(A) * op(B) + beta * C + bias).
+struct Epilogue {
+    // n values broadcast down the columns, or m values along the rows with bias_per_row
+    const float* bias = nullptr;
+    bool bias_per_row = false;
+    Activation activation = Activation::None;
+};
+
+// C = alpha * op(A) * op(B) + beta * C on row-major matrices.
+// op(A) is m x k and op(B) is k x n, trans_a / trans_b select the transpose of the stored matrix.
+// A and B are packed into cache-sized panels and C is partitioned across the thread pool.
+void sgemm(bool trans_a, bool trans_b, int m, int n, int k,
+           float alpha, const float* a, int lda,
+           const float* b, int ldb,
+           float beta, float* c, int ldc);
+
+void sgemm(bool trans_a, bool trans_b, int m, int n, int k,
+           float alpha, const float* a, int lda,
+           const float* b, int ldb,
+           float beta, float* c, int ldc,
+           const Epilogue& epilogue);
+
+// C = act(A * B + bias) for an m of a few rows, A and B row-major: no packing, each row of B is
+// read once per 4 rows of A (cpu::kGemvRows), and B is split by columns into strips on the
+// thread pool so every thread streams its own part of it. the bias is per column
+void gemv(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc,
+          const Epilogue& epilogue = Epilogue());
+
+// op(B) packed once into the slivers the micro-kernel reads, for a B that is multiplied many
+// times (inference weights), so sgemm_packed skips packing it on every call. Per block of the
+// kernel's kc rows, the n columns as nr-wide k-major slivers, the last one zero padded. Only
+// valid for the ISA tables whose nr it was packed with.
+struct PackedB {
+    int k = 0;
+    int n = 0;
+    int nr = 0;
+    const float* data = nullptr;
+    // keeps its memory when repacked with the same or a smaller size
+    ScratchBuffer storage;
+};
+
+// packs op(B) (k x n) for the active ISA into out
+void pack_b(bool trans_b, int k, int n, const float* b, int ldb, PackedB& out);
+
+// sgemm with a prepacked op(B), n and k from b. throws std::invalid_argument when b was packed
+// for a register block other than the active ISA's
+void sgemm_packed(bool trans_a, int m, float alpha, const float* a, int lda, const PackedB& b,
+                  float beta, float* c, int ldc, const Epilogue& epilogue = Epilogue());
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+// Completion of work enqueued on the OpenCL runtime, owns the event of the last command. The
+// host tensors an async call reads or writes must stay alive and untouched until wait()
+// returns. The destructor waits as well, so a dropped future never leaves a transfer running
+// into freed memory.
+class GpuFuture {
+public:
+    // already complete
+    GpuFuture() = default;
+    // takes over the reference to event
+    explicit GpuFuture(cl_event event) : event_(event) {}
+    ~GpuFuture();
+
+    GpuFuture(GpuFuture&& other) noexcept : event_(other.event_) { other.event_ = nullptr; }
+    GpuFuture& operator=(GpuFuture&& other) noexcept;
+    GpuFuture(const GpuFuture&) = delete;
+    GpuFuture& operator=(const GpuFuture&) = delete;
+
+    // blocks until the work is done, throws std::runtime_error when a command failed
+    void wait();
+    bool ready() const;
+    // for use in another command's wait list, still owned by the future
+    cl_event event() const { return event_; }
+
+private:
+    void release() noexcept;
+
+    cl_event event_ = nullptr;
+};
@@ -1,7 +1,10 @@
 #pragma once
 
+#include "gemm.h"
+#include "gpu_future.h"
 #include "tensor.h"
 #include <tuple>
+#include <vector>
 
 #ifdef __APPLE__
 #include <OpenCL/opencl.h>
@@ -9,12 +12,30 @@
 #include <CL/cl.h>
 #endif
 
+// Fully connected layer kernels on the shared OpenCLRuntime. Inputs and outputs go through
+// reused buffers. Weights and bias are uploaded on every call, unless the caller owns them and
+// passes resident_parameters: they then stay on the device between calls (OpenCLRuntime::resident)
+// and the owner invalidates and releases them, as FullyConnectedLayer does.
 namespace gpu_operations {
 
+// builds the kernels ahead of the first call, optional
 void initialize();
 void cleanup();
 
-Tensor fully_connected_forward(const Tensor& input, const Tensor& weights, const Tensor& bias);
+Tensor fully_connected_forward(const Tensor& input, const Tensor& weights, const Tensor& bias,
+                               bool resident_parameters = false);
+// uploads input, runs the layer and downloads into output without blocking; input must be
+// contiguous. input and output stay untouched until the future is waited on
+GpuFuture fully_connected_forward_async(const Tensor& input, const Tensor& weights, const Tensor& bias,
+                                        Tensor& output, gemm::Activation activation = gemm::Activation::None,
+                                        bool resident_parameters = false);
+// device to device, for chaining layers without a host round trip: output = act(input *
+// weights + bias) for a [batch_size, in] input buffer. the kernel waits for wait_for, done
+// receives its event when not null
+void fully_connected_forward(cl_mem input, int batch_size, const Tensor& weights, const Tensor& bias, cl_mem output,
+                             gemm::Activation activation = gemm::Activation::None,
+                             const std::vector<cl_event>& wait_for = {}, cl_event* done = nullptr,
+                             bool resident_parameters = false);
 std::tuple<Tensor, Tensor, Tensor> fully_connected_backward(const Tensor& output_gradient, const Tensor& input, const Tensor& weights);
 
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "fully_connected_layer.h"
+#include "gemm.h"
+#include "gpu_future.h"
+#include "tensor.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+class Network;
+
+// Fully connected layers run back to back on the OpenCL device: one upload, each layer reading
+// the previous layer's output buffer on the device, one download. forward_stream keeps two
+// input and output buffers so the next batch uploads and the previous one downloads while the
+// current batch computes.
+class GpuPipeline {
+public:
+    GpuPipeline();
+    // the network's layers with the ReLU Network puts after each. throws
+    // std::invalid_argument when it has convolutions, those have no GPU kernels
+    explicit GpuPipeline(const Network& network);
+
+    void add(std::shared_ptr<FullyConnectedLayer> layer, gemm::Activation activation = gemm::Activation::None);
+    size_t size() const { return stages_.size(); }
+    std::vector<int> output_shape(const std::vector<int>& input_shape) const;
+
+    // input [batch, in] must be contiguous; input and output stay untouched until the
+    // future is waited on
+    GpuFuture forward_async(const Tensor& input, Tensor& output);
+    void forward(const Tensor& input, Tensor& output);
+    // outputs[i] = forward(inputs[i]), overlapping transfers with compute. outputs are
+    // allocated by the caller
+    void forward_stream(const std::vector<Tensor>& inputs, std::vector<Tensor>& outputs);
+
+private:
+    struct Stage {
+        std::shared_ptr<FullyConnectedLayer> layer;
+        gemm::Activation activation;
+    };
+
+    // every stage from input to output on the device. the first kernel waits for wait_for,
+    // the last kernel's event is returned
+    cl_event enqueue(cl_mem input, int batch_size, cl_mem output, const std::vector<cl_event>& wait_for);
+    // hidden buffers sized for batch_size rows
+    void reserve(int batch_size);
+    void check_input(const Tensor& input, const Tensor& output) const;
+
+    std::vector<Stage> stages_;
+    // scratch buffer names are unique per pipeline
+    std::string name_;
+    cl_mem hidden_[2] = {nullptr, nullptr};
+};
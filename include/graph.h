@@ -0,0 +1,117 @@
+#pragma once
+
+#include "tensor.h"
+#include "gemm.h"
+#include "layout.h"
+#include "memory_planner.h"
+#include <memory>
+#include <vector>
+
+class FullyConnectedLayer;
+class ConvolutionalLayer;
+
+enum class OpType {
+    Input,
+    Convolution,
+    FullyConnected,
+    ReLU,
+    Sigmoid,
+    Tanh,
+    Reshape,
+    LayoutConvert,
+    MSELoss
+};
+
+const char* op_name(OpType op);
+
+// One operator. Edges are the ids of the producer nodes in inputs, the produced
+// tensor's logical NCHW shape is filled in by Graph::infer_shapes and its buffer is stored
+// in layout.
+struct GraphNode {
+    int id;
+    OpType op;
+    std::vector<int> inputs;
+    std::vector<int> shape;
+    // Convolution and LayoutConvert produce this layout, activations keep their input's,
+    // everything else is NCHW
+    Layout layout = Layout::NCHW;
+    bool removed = false;
+
+    std::shared_ptr<ConvolutionalLayer> conv;
+    std::shared_ptr<FullyConnectedLayer> fc;
+    // activation folded into the Convolution / FullyConnected epilogue by FusionPass
+    gemm::Activation activation = gemm::Activation::None;
+    // Reshape target, 0 copies the input dim and a single -1 is inferred
+    std::vector<int> target_shape;
+};
+
+// Dataflow graph of a network. Node ids are stable: removing a node only marks it,
+// so passes can hold on to ids while they rewrite.
+class Graph {
+public:
+    int add_input();
+    int add_convolution(int input, std::shared_ptr<ConvolutionalLayer> layer);
+    int add_fully_connected(int input, std::shared_ptr<FullyConnectedLayer> layer);
+    int add_activation(OpType op, int input);
+    int add_reshape(int input, const std::vector<int>& target_shape);
+    int add_layout_convert(int input, Layout layout);
+    int add_mse_loss(int predictions, int targets);
+
+    void set_output(int id);
+    int output() const { return output_; }
+    const std::vector<int>& inputs() const { return inputs_; }
+
+    GraphNode& node(int id) { return nodes_[id]; }
+    const GraphNode& node(int id) const { return nodes_[id]; }
+    std::vector<GraphNode>& nodes() { return nodes_; }
+    const std::vector<GraphNode>& nodes() const { return nodes_; }
+
+    // live nodes reading id
+    std::vector<int> consumers(int id) const;
+    // points every reader of from (and the output) at to
+    void replace_uses(int from, int to);
+    void remove_node(int id);
+    std::vector<int> topological_order() const;
+
+    // one shape per input node, in add_input order
+    void infer_shapes(const std::vector<std::vector<int>>& input_shapes);
+    std::vector<int> output_shape(const std::vector<std::vector<int>>& input_shapes) const;
+
+    // Computes shapes and buffer lifetimes for the given input shapes and packs every
+    // intermediate into one planned buffer. Activations run in place and reshapes are views.
+    void plan(const std::vector<std::vector<int>>& input_shapes);
+    const MemoryPlan& memory_plan() const { return memory_plan_; }
+    // keep every intermediate valid until the pass ends, layers need their inputs for backward
+    void set_keep_alive(bool keep_alive);
+    // call after rewriting nodes so the next execute re-plans
+    void invalidate_plan() { planned_ = false; }
+
+    // runs the planned graph, the output node writes straight into output. inputs and the
+    // output are NCHW, see LayoutPropagationPass for running the convolutions in another layout
+    void execute(const Tensor& input, Tensor& output);
+    void execute(const std::vector<Tensor>& inputs, Tensor& output);
+
+private:
+    int add_node(OpType op, const std::vector<int>& inputs);
+    std::vector<std::vector<int>> compute_shapes(const std::vector<std::vector<int>>& input_shapes) const;
+    void run(const Tensor* const* inputs, Tensor& output);
+    void bind(int id, const Tensor& source);
+    void check_layouts() const;
+
+    std::vector<GraphNode> nodes_;
+    std::vector<int> inputs_;
+    int output_ = -1;
+
+    bool planned_ = false;
+    bool keep_alive_ = false;
+    std::vector<std::vector<int>> planned_shapes_;
+    std::vector<int> order_;
+    // shape of every node's buffer in its layout
+    std::vector<std::vector<int>> buffer_shapes_;
+    // node whose buffer a node writes into: itself, or its input for in-place ops and views
+    std::vector<int> root_;
+    MemoryPlan memory_plan_;
+    std::shared_ptr<Tensor> storage_;
+    // tensor of every node, planned ones are views into storage_
+    std::vector<Tensor> values_;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "cpu_dispatch.h"
+#include "gemm.h"
+#include "tensor.h"
+#include <cstdint>
+
+// Half precision storage. Weights kept as 16-bit floats take half the memory and, in the
+// memory-bound small-batch GEMM of a fully connected layer, half the bandwidth. They are widened
+// to float in registers as they are loaded and all arithmetic stays float, so the results differ
+// from float weights only by the rounding of the weights: fp16 keeps 11 significant bits over
+// [6.1e-5, 65504] (subnormal below, Inf above), bf16 keeps 8 bits over the whole float range.
+namespace half {
+
+// the kernels' format of a 16-bit dtype, throws std::invalid_argument for Float32
+cpu::HalfFormat format_of(DType dtype);
+
+// single values, on the active ISA's kernels so they round the same way
+uint16_t from_float(float x, cpu::HalfFormat format);
+float to_float(uint16_t h, cpu::HalfFormat format);
+
+// count values, rounded to nearest even when narrowing, split across the thread pool
+void narrow(const float* in, uint16_t* out, int count, cpu::HalfFormat format);
+void widen(const uint16_t* in, float* out, int count, cpu::HalfFormat format);
+
+// up to this many rows gemm streams b through Kernels::half_gemm. above it b is widened into a
+// float scratch once per call and handed to sgemm, the GEMM is compute bound by then
+constexpr int kStreamRows = 16;
+
+// c = act(a * b + bias): a m x k floats with row stride lda, b k x n values of format with row
+// stride ldb, c m x n with row stride ldc. bias is per column. column strips of b go to the
+// thread pool, each read once for all m rows
+void gemm(int m, int n, int k, const float* a, int lda, const uint16_t* b, int ldb, cpu::HalfFormat format,
+          float* c, int ldc, const gemm::Epilogue& epilogue);
+
+}
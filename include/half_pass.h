@@ -0,0 +1,28 @@
+#pragma once
+
+#include "optimization_pass.h"
+#include "tensor.h"
+
+// Stores the weights of every fully connected layer of the graph as 16-bit floats (see half.h
+// and FullyConnectedLayer::set_weight_dtype). Registered as "convert_fp16" and "convert_bf16".
+// Layers are shared with the network that built the graph, they keep the new storage until
+// converted back with HalfPrecisionPass(DType::Float32).
+class HalfPrecisionPass : public OptimizationPass {
+public:
+    explicit HalfPrecisionPass(DType dtype = DType::Float16) : dtype_(dtype) {}
+
+    using OptimizationPass::apply;
+    void apply(Graph& graph) override;
+
+private:
+    DType dtype_;
+};
+
+// the bf16 flavour under its own name for the registrar
+class BFloat16Pass : public HalfPrecisionPass {
+public:
+    BFloat16Pass() : HalfPrecisionPass(DType::BFloat16) {}
+};
+
+// references this translation unit so the static registration is linked in
+void register_half_passes();
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "tensor.h"
+#include <vector>
+
+// Memory order of a 4-D activation. Shapes handed around the graph stay logical NCHW, the
+// buffer behind them is layout::physical_shape of it.
+//  NCHW    [n, c, h, w], what the caller, reshape and the fully connected layer see
+//  NHWC    [n, h, w, c], channels of a pixel are adjacent
+//  NCHW8c  [n, ceil(c / 8), h, w, 8], 8 channels of a pixel fill one __m256; the channels
+//          past c in the last block are padding and hold finite junk
+enum class Layout {
+    NCHW,
+    NHWC,
+    NCHW8c
+};
+
+const char* layout_name(Layout layout);
+
+namespace layout {
+
+constexpr int kChannelBlock = 8;
+
+std::vector<int> physical_shape(const std::vector<int>& shape, Layout layout);
+
+// copies source stored as from into destination stored as to, both of the same logical
+// NCHW shape. the channel count comes from whichever side is not blocked, converting
+// into NCHW8c zeroes the padding channels
+void convert(const Tensor& source, Layout from, Tensor& destination, Layout to);
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "layout.h"
+#include "optimization_pass.h"
+
+// Runs every convolution in layout and lets activations follow their producer, so a chain of
+// conv layers keeps one layout end to end. Conversions are inserted only where that region
+// meets an NCHW reader: after the graph input, before a reshape or fully connected layer, and
+// before the output. NHWC is the default, the faster of the two direct kernels in
+// tests/benchmark_conv.cpp. Inference only, layers keep their input for backward in NCHW alone.
+class LayoutPropagationPass : public OptimizationPass {
+public:
+    explicit LayoutPropagationPass(Layout layout = Layout::NHWC) : layout_(layout) {}
+
+    using OptimizationPass::apply;
+    void apply(Graph& graph) override;
+
+private:
+    Layout layout_;
+};
+
+// references this translation unit so the static registration is linked in
+void register_layout_passes();
@@ -3,7 +3,9 @@
 
 namespace loss {
 
+// mean over every element, predictions and targets of the same size and any rank
 float mse(const Tensor& predictions, const Tensor& targets);
 Tensor mse_gradient(const Tensor& predictions, const Tensor& targets);
+void mse_gradient(const Tensor& predictions, const Tensor& targets, Tensor& gradient);
 
-}
\ No newline at end of file
+}
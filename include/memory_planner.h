@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// one intermediate buffer, live from the step that produces it to the last step reading it
+struct BufferRequest {
+    size_t bytes;
+    int first_use;
+    int last_use;
+};
+
+struct MemoryPlan {
+    // byte offset of every request inside the shared buffer
+    std::vector<size_t> offsets;
+    // size of the shared buffer
+    size_t planned_bytes = 0;
+    // largest set of buffers live at the same step, the lower bound for planned_bytes
+    size_t peak_live_bytes = 0;
+    // one buffer per intermediate, what allocating every output separately costs
+    size_t naive_bytes = 0;
+};
+
+// Assigns offsets so that buffers with overlapping lifetimes never overlap in memory.
+// Greedy by size: the largest buffers are placed first at the lowest free offset.
+class MemoryPlanner {
+public:
+    static constexpr size_t kAlignment = 64;
+
+    static MemoryPlan plan(const std::vector<BufferRequest>& requests);
+};
@@ -2,19 +2,54 @@
 
 #include "fully_connected_layer.h"
 #include "convolutional_layer.h"
+#include "graph.h"
+#include "memory_planner.h"
 #include "tensor.h"
 #include <vector>
 #include <memory>
 
+class OptimizationPass;
+
 class Network {
 public:
+    Network();
+
+    // layers run in the order they are added, each followed by a ReLU. before the first
+    // forward the ReLUs are fused into the layers by FusionPass
     void add_fully_connected_layer(int input_size, int output_size);
     void add_convolutional_layer(int in_channels, int out_channels, int kernel_size, int stride = 1, int padding = 0);
     Tensor forward(const Tensor& input);
+    // writes the final activation into output. intermediates live in one planned buffer
+    // that is reused between calls, so repeated inputs of the same shape do not allocate
+    void forward(const Tensor& input, Tensor& output);
     void train(const std::vector<Tensor>& inputs, const std::vector<Tensor>& targets, int epochs, float learning_rate);
 
+    std::vector<int> output_shape(const std::vector<int>& input_shape) const;
+
+    // plans the intermediates for an input shape, forward() does this on a shape change.
+    // in inference, buffers whose lifetimes don't overlap share memory; while training every
+    // layer input stays live for backward, so nothing is shared
+    void plan_memory(const std::vector<int>& input_shape);
+    const MemoryPlan& memory_plan() const { return network_graph.memory_plan(); }
+
+    // layers in the order they were added
+    const std::vector<std::shared_ptr<FullyConnectedLayer>>& fully_connected_layers() const { return fc_layers; }
+    const std::vector<std::shared_ptr<ConvolutionalLayer>>& convolutional_layers() const { return conv_layers; }
+
+    Graph& graph() { return network_graph; }
+    const Graph& graph() const { return network_graph; }
+    // rewrites the graph, the next forward re-plans
+    void apply_pass(OptimizationPass& pass);
+
 private:
-    std::vector<std::unique_ptr<FullyConnectedLayer>> fc_layers;
-    std::vector<std::unique_ptr<ConvolutionalLayer>> conv_layers;
-    std::vector<Tensor> activations;
-};
\ No newline at end of file
+    void fuse();
+
+    Graph network_graph;
+    bool fused = false;
+    // tail of the layer chain, and whether it still has spatial dims
+    int last_node;
+    bool spatial_output = false;
+    std::vector<std::shared_ptr<FullyConnectedLayer>> fc_layers;
+    std::vector<std::shared_ptr<ConvolutionalLayer>> conv_layers;
+    bool training = false;
+};
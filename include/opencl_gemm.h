@@ -0,0 +1,92 @@
+#pragma once
+
+#include "gemm.h"
+#include "opencl_runtime.h"
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Tiled SGEMM for OpenCL devices: c[m, n] = act(a[m, k] * b[k, n] (+ bias[n])), all row-major on
+// the device. A work-group computes a tile_m x tile_n block of c and stages tile_k wide slices
+// of a and b in __local memory. Each work-item keeps work_m x work_n outputs in registers,
+// strided by the work-group size so neighbouring work-items touch neighbouring columns.
+// Ragged edges are handled in the kernel, operands need no padding.
+namespace opencl_gemm {
+
+struct TileConfig {
+    int tile_m = 32;
+    int tile_n = 32;
+    int tile_k = 16;
+    int work_m = 4;
+    int work_n = 4;
+
+    // work-group is local_n() x local_m() work-items, dimension 0 runs along n
+    int local_m() const { return tile_m / work_m; }
+    int local_n() const { return tile_n / work_n; }
+    size_t local_bytes() const { return (tile_m * tile_k + tile_k * tile_n) * sizeof(float); }
+    // build options and program name, one program per config
+    std::string options() const;
+    std::string name() const;
+
+    bool operator==(const TileConfig& other) const {
+        return tile_m == other.tile_m && tile_n == other.tile_n && tile_k == other.tile_k &&
+               work_m == other.work_m && work_n == other.work_n;
+    }
+};
+
+// configs that fit a device with these limits, small work-groups and tiles first
+std::vector<TileConfig> candidates(size_t max_work_group_size, size_t local_memory_bytes);
+
+// c = act(a * b (+ bias)) with the given config, bias may be null. enqueued on the runtime's
+// queue after the events in wait_for, done receives the kernel's event when not null. throws
+// std::runtime_error when the launch fails
+void sgemm(const TileConfig& config, int m, int n, int k, cl_mem a, cl_mem b, cl_mem bias, cl_mem c,
+           gemm::Activation activation = gemm::Activation::None, const std::vector<cl_event>& wait_for = {},
+           cl_event* done = nullptr);
+// with the config OpenCLGemmTuner picked for the shape
+void sgemm(int m, int n, int k, cl_mem a, cl_mem b, cl_mem bias, cl_mem c,
+           gemm::Activation activation = gemm::Activation::None, const std::vector<cl_event>& wait_for = {},
+           cl_event* done = nullptr);
+
+}
+
+// Picks the fastest TileConfig per device and shape by timing every candidate once, then
+// remembers it. Shapes are bucketed to the next power of two in each dimension so a new batch
+// size rarely triggers a run. Winners are appended to gemm_tuning.txt in the program binary
+// cache directory and read back on the next start; ANNOF_OPENCL_TUNE=0 skips the timing and
+// uses the first candidate.
+class OpenCLGemmTuner {
+public:
+    // tuner on the shared runtime, throws when there is no OpenCL device
+    static OpenCLGemmTuner& getInstance();
+
+    // path empty keeps the results in memory only
+    explicit OpenCLGemmTuner(std::string path);
+
+    opencl_gemm::TileConfig config(int m, int n, int k);
+    // whether the shape's bucket already has a config, tuned or loaded
+    bool tuned(int m, int n, int k);
+
+    const std::string& path() const { return path_; }
+    // shapes timed by this instance, loaded results don't count
+    size_t tunings() const { return tunings_; }
+
+private:
+    using Bucket = std::tuple<int, int, int>;
+
+    static Bucket bucket(int m, int n, int k);
+    opencl_gemm::TileConfig tune(int m, int n, int k);
+    void load();
+    void store(const Bucket& bucket, const opencl_gemm::TileConfig& config) const;
+
+    std::string path_;
+    // entries in the file belong to the device and driver they were measured on
+    std::string device_key_;
+    std::vector<opencl_gemm::TileConfig> candidates_;
+    std::mutex mutex_;
+    std::map<Bucket, opencl_gemm::TileConfig> configs_;
+    size_t tunings_ = 0;
+};
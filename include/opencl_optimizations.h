@@ -4,9 +4,15 @@
 #include <vector>
 #include <memory>
 
+// Chooses OpenCL GEMM tile and work-group sizes ahead of the first launch through
+// OpenCLGemmTuner. Does nothing without an OpenCL device.
 class OpenCLWorkGroupSizeOptimization : public OptimizationPass {
 public:
+    using OptimizationPass::apply;
+    // every adjacent [m, k], [k, n] pair of tensors is taken as a matmul
     void apply(std::vector<std::shared_ptr<Tensor>>& tensors) override;
+    // fully connected nodes, for the shapes from the last infer_shapes or plan
+    void apply(Graph& graph) override;
 };
 
 // declaring registration function
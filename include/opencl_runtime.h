@@ -0,0 +1,127 @@
+#pragma once
+
+#include "program_cache.h"
+#include "tensor.h"
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+// Process-wide OpenCL state: one device, context and in-order compute queue plus a second
+// in-order queue for async transfers (both with profiling on), compiled programs and
+// kernels, and device copies of tensors that are reused across calls (layer weights).
+// Everything is created on first use and released when the process exits. Program binaries
+// are kept in a ProgramBinaryCache on disk, so only the first start on a machine compiles.
+//
+// A GPU is preferred, otherwise any device is taken, so a CPU implementation like PoCL works
+// too. ANNOF_OPENCL_DEVICE=gpu|cpu|any restricts the choice.
+class OpenCLRuntime {
+public:
+    // throws std::runtime_error when no usable device exists
+    static OpenCLRuntime& getInstance();
+    // whether getInstance() succeeds, the first attempt decides
+    static bool available();
+
+    ~OpenCLRuntime();
+    OpenCLRuntime(const OpenCLRuntime&) = delete;
+    OpenCLRuntime& operator=(const OpenCLRuntime&) = delete;
+
+    cl_device_id device() const { return device_; }
+    cl_context context() const { return context_; }
+    cl_command_queue queue() const { return queue_; }
+    // async uploads and downloads run here so they overlap kernels on queue(), ordering
+    // between the two queues is by events only
+    cl_command_queue transfer_queue() const { return transfer_queue_; }
+    const std::string& device_name() const { return device_name_; }
+    const std::string& driver_version() const { return driver_version_; }
+    bool is_gpu() const { return is_gpu_; }
+
+    // program under name, loaded from the on-disk binary cache or built from source on first
+    // use and kept afterwards. throws with the build log on a compile error
+    cl_program program(const std::string& name, const char* source, const std::string& options = "");
+    // kernel of a cached program. kernels are shared, set their arguments and enqueue from one
+    // thread at a time
+    cl_kernel kernel(const std::string& program_name, const char* source, const std::string& kernel_name,
+                     const std::string& options = "");
+
+    // Device copy of a host tensor that stays on the device between calls, keyed by the
+    // tensor's data. It is uploaded on first use and again after invalidate_resident; the
+    // owner calls release_resident before the host tensor goes away, so only tensors whose
+    // owner does both (layer parameters) may go here. Float32 tensors only
+    cl_mem resident(const Tensor& tensor);
+    // both are no-ops when the runtime was never created, so CPU-only code can call them
+    static void invalidate_resident(const Tensor& tensor);
+    static void release_resident(const Tensor& tensor);
+
+    // grow-only device buffer for per-call data, one per name
+    cl_mem scratch(const std::string& name, size_t bytes);
+
+    // blocking copies between host memory and a device buffer
+    void upload(cl_mem buffer, const float* data, size_t count);
+    void download(cl_mem buffer, float* data, size_t count);
+    // non-blocking copies on the transfer queue after the events in wait_for. the returned
+    // event belongs to the caller, the host memory must stay valid until it completes
+    cl_event upload_async(cl_mem buffer, const float* data, size_t count, const std::vector<cl_event>& wait_for = {});
+    cl_event download_async(cl_mem buffer, float* data, size_t count, const std::vector<cl_event>& wait_for = {});
+    // submits what is enqueued on both queues, needed before waiting on an event whose
+    // dependencies sit on the other queue
+    void flush();
+
+    // startup timing: device and context setup, then every program as it was first loaded
+    struct ProgramLoad {
+        std::string name;
+        bool from_cache;
+        double milliseconds;
+    };
+    double setup_milliseconds() const { return setup_milliseconds_; }
+    std::vector<ProgramLoad> program_loads();
+    const ProgramBinaryCache& binary_cache() const { return binary_cache_; }
+
+    // counters for tests and benchmarks, builds count source compiles only
+    size_t program_builds() const { return program_builds_; }
+    size_t resident_uploads() const { return resident_uploads_; }
+
+private:
+    struct Resident {
+        cl_mem buffer = nullptr;
+        size_t bytes = 0;
+        bool stale = true;
+    };
+    struct Scratch {
+        cl_mem buffer = nullptr;
+        size_t bytes = 0;
+    };
+
+    OpenCLRuntime();
+    static OpenCLRuntime* existing();
+    std::string device_string(cl_device_info info) const;
+    // null when the binary is rejected, e.g. after a driver update the key did not catch
+    cl_program build_from_binary(const std::vector<unsigned char>& binary, const std::string& options);
+    cl_program build_from_source(const std::string& name, const char* source, const std::string& options);
+
+    cl_device_id device_ = nullptr;
+    cl_context context_ = nullptr;
+    cl_command_queue queue_ = nullptr;
+    cl_command_queue transfer_queue_ = nullptr;
+    std::string device_name_;
+    std::string driver_version_;
+    bool is_gpu_ = false;
+    double setup_milliseconds_ = 0.0;
+    ProgramBinaryCache binary_cache_;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, cl_program> programs_;
+    std::unordered_map<std::string, cl_kernel> kernels_;
+    std::unordered_map<const void*, Resident> residents_;
+    std::unordered_map<std::string, Scratch> scratch_;
+    std::vector<ProgramLoad> program_loads_;
+    size_t program_builds_ = 0;
+    size_t resident_uploads_ = 0;
+};
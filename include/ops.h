@@ -1,15 +1,23 @@
 #pragma once
+#include "gpu_future.h"
 #include "tensor.h"
 
 namespace ops {
 
+// operands must be contiguous unless noted, call Tensor::contiguous() on views first.
+// matmul_cpu also accepts 2-D transposed views and passes them to GEMM without copying
 
 void add_cpu_baseline(const Tensor& a, const Tensor& b, Tensor& result);
 void add_cpu(const Tensor& a, const Tensor& b, Tensor& result);
 void add_gpu(const Tensor& a, const Tensor& b, Tensor& result);
+// enqueue and return, result is valid after wait(). a, b and result must stay alive until then
+GpuFuture add_gpu_async(const Tensor& a, const Tensor& b, Tensor& result);
 
 void matmul_cpu_baseline(const Tensor& a, const Tensor& b, Tensor& result);
 void matmul_cpu(const Tensor& a, const Tensor& b, Tensor& result);
 void matmul_gpu(const Tensor& a, const Tensor& b, Tensor& result);
+GpuFuture matmul_gpu_async(const Tensor& a, const Tensor& b, Tensor& result);
+// rows of a split between the CPU threads and the OpenCL device, see SplitGemm
+void matmul_split(const Tensor& a, const Tensor& b, Tensor& result);
 
 }
\ No newline at end of file
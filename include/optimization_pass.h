@@ -3,23 +3,35 @@
 #include <vector>
 #include <memory>
 
+class Graph;
+
+// A pass rewrites either a flat list of tensors or a network's dataflow graph,
+// it overrides whichever form it understands.
 class OptimizationPass {
 public:
     virtual ~OptimizationPass() = default;
-    virtual void apply(std::vector<std::shared_ptr<Tensor>>& tensors) = 0;
+    virtual void apply(std::vector<std::shared_ptr<Tensor>>& /*tensors*/) {}
+    virtual void apply(Graph& /*graph*/) {}
 };
 
 class MemoryReductionPass : public OptimizationPass {
 public:
+    using OptimizationPass::apply;
     void apply(std::vector<std::shared_ptr<Tensor>>& tensors) override;
+    // folds chains of reshapes into one view and drops reshapes that change nothing
+    void apply(Graph& graph) override;
 };
 
 class LatencyReductionPass : public OptimizationPass {
 public:
+    using OptimizationPass::apply;
     void apply(std::vector<std::shared_ptr<Tensor>>& tensors) override;
+    // removes nodes the output does not depend on
+    void apply(Graph& graph) override;
 };
 
 class OpenCLOptimizationPass : public OptimizationPass {
 public:
+    using OptimizationPass::apply;
     void apply(std::vector<std::shared_ptr<Tensor>>& tensors) override;
-};  
\ No newline at end of file
+};  
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// On-disk store of compiled OpenCL program binaries (CL_PROGRAM_BINARIES), so a process start
+// loads kernels instead of compiling them. An entry is found by a key made of everything that
+// changes the binary; a missing, corrupt or foreign file reads as a miss and the caller builds
+// from source. Failures to write are ignored, the cache is only an accelerator.
+class ProgramBinaryCache {
+public:
+    // ANNOF_OPENCL_CACHE_DIR if set (empty disables the cache), else
+    // $XDG_CACHE_HOME/annof/opencl or ~/.cache/annof/opencl
+    static std::string default_directory();
+
+    explicit ProgramBinaryCache(std::string directory = default_directory());
+
+    bool enabled() const { return !directory_.empty(); }
+    const std::string& directory() const { return directory_; }
+
+    // device name, driver version, a hash of the kernel source and the build options
+    static std::string key(const std::string& device, const std::string& driver, const std::string& source,
+                           const std::string& options);
+    std::string path(const std::string& key) const;
+
+    bool load(const std::string& key, std::vector<unsigned char>& binary) const;
+    // written to a temporary file and renamed into place, so concurrent processes never read
+    // half an entry
+    bool store(const std::string& key, const std::vector<unsigned char>& binary) const;
+
+    // 64-bit FNV-1a
+    static uint64_t hash(const std::string& data);
+
+private:
+    std::string directory_;
+};
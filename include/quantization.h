@@ -0,0 +1,113 @@
+#pragma once
+
+#include "cpu_dispatch.h"
+#include "gemm.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// INT8 inference for the fully connected and convolutional layers. Weights are quantized
+// symmetrically per output channel to [-127, 127]. Activations are quantized with a zero point
+// to [0, 127]: 7 bits keep the u8 x s8 pair sums of vpmaddubsw below its 16-bit saturation, at
+// the cost of one bit of activation precision. Their range is each call's own min / max
+// (dynamic) or the one recorded by a calibration run (static, see QuantizationPass). The GEMM
+// accumulates in int32 and dequantizes in the kernel epilogue, the zero point folded in through
+// precomputed column sums of the weights:
+//   c_ij = a_scale_i * w_scale_j * (sum_p qa_ip qw_pj - a_zero_i * sum_p qw_pj) + bias_j
+namespace quant {
+
+constexpr int kMaxActivation = cpu::kInt8MaxActivation;
+constexpr int kMaxWeight = 127;
+
+// x ~= scale * (q - zero), q in [0, kMaxActivation], zero a whole number
+struct ActivationParams {
+    float scale = 1.0f;
+    float zero = 0.0f;
+};
+
+// the range is widened to include 0 so zero padding and ReLU zeros stay exact
+ActivationParams activation_params(float min, float max);
+
+// min / max of the values seen so far
+struct ActivationRange {
+    float min = 0.0f;
+    float max = 0.0f;
+    bool empty = true;
+
+    void observe(const float* x, int count);
+};
+
+// [k, n] weights packed for Kernels::int8_micro_kernel: panels of kInt8Panel columns, in each
+// panel per group of 4 rows the 4 bytes of every column. k is padded to whole groups and n to
+// whole panels with zeros, the per-column arrays are padded the same way
+struct QuantizedWeights {
+    int k = 0;
+    int n = 0;
+    int k_groups = 0;
+    std::vector<int8_t> packed;
+    std::vector<float> scales;
+    std::vector<float> column_sums;
+    std::vector<float> bias;
+
+    int panels() const { return (n + cpu::kInt8Panel - 1) / cpu::kInt8Panel; }
+};
+
+// element (p, j) at w[p * row_stride + j * col_stride], bias may be null
+void quantize_weights(const float* w, int k, int n, std::ptrdiff_t row_stride, std::ptrdiff_t col_stride,
+                      const float* bias, QuantizedWeights& out);
+
+// m rows of activations packed in blocks of the active ISA's int8_mr rows: per group of 4 k,
+// the 4 bytes of each row of the block. scales and zeros hold one entry per row, rows past m
+// included, they read as zero
+struct QuantizedActivations {
+    int m = 0;
+    int k = 0;
+    int k_groups = 0;
+    int mr = 0;
+    std::vector<uint8_t> data;
+    std::vector<float> scales;
+    std::vector<float> zeros;
+
+    // keeps the storage when it is big enough, so repeated calls stop allocating
+    void resize(int m, int k);
+    int padded_rows() const { return (m + mr - 1) / mr * mr; }
+    // k index p of row i is at row(i)[p / 4 * group_stride() + p % 4]
+    uint8_t* row(int i) { return data.data() + (static_cast<size_t>(i / mr) * k_groups * mr + i % mr) * 4; }
+    int group_stride() const { return mr * 4; }
+};
+
+// q = round(x / scale + zero), clamped to [0, kMaxActivation], on the active ISA's kernel
+void quantize(const float* x, int count, ActivationParams params, uint8_t* out);
+
+// rows of x (row stride ld) into out, each with the params of its own range unless fixed is set
+void quantize_rows(const float* x, int m, int k, std::ptrdiff_t ld, const ActivationParams* fixed,
+                   QuantizedActivations& out);
+
+// c = act(dequantized a * w + bias), c is a.m x w.n with row stride ldc. tiles go to the
+// thread pool, a column of tiles at a time so a small batch still splits across the columns
+void gemm(const QuantizedActivations& a, const QuantizedWeights& w, gemm::Activation activation, float* c, int ldc);
+
+// the int8 state a layer keeps next to its float parameters
+struct LayerState {
+    QuantizedWeights weights;
+    // the layer's weight version weights was made from
+    uint64_t weights_version = 0;
+    bool quantized_weights = false;
+
+    // while calibrating the layer runs in float and records its input range
+    bool calibrating = false;
+    ActivationRange range;
+    // set once calibration saw some input, activations then use params instead of their own range
+    bool calibrated = false;
+    ActivationParams params;
+
+    // reused across calls
+    QuantizedActivations activations;
+
+    const ActivationParams* fixed_params() const { return calibrated ? &params : nullptr; }
+    // weights must be requantized when false
+    bool current(uint64_t version) const { return quantized_weights && weights_version == version; }
+    void set_calibrating(bool on);
+};
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "optimization_pass.h"
+#include "tensor.h"
+#include <utility>
+#include <vector>
+
+// Switches every convolution and fully connected layer of the graph to int8 inference (see
+// quantization.h). Without calibration data activations are quantized per call from their own
+// range. Given calibration batches, the pass runs them through the graph in float first and
+// every layer keeps the range its input reached as a fixed activation scale, which saves the
+// min / max pass per call and gives batches the same rounding. Layers are shared with the
+// network that built the graph, they stay quantized until dequantize().
+class QuantizationPass : public OptimizationPass {
+public:
+    QuantizationPass() = default;
+    // inputs for a single-input graph, one execute each
+    explicit QuantizationPass(std::vector<Tensor> calibration_inputs)
+        : calibration_inputs_(std::move(calibration_inputs)) {}
+
+    using OptimizationPass::apply;
+    void apply(Graph& graph) override;
+
+private:
+    std::vector<Tensor> calibration_inputs_;
+};
+
+// references this translation unit so the static registration is linked in
+void register_quantization_passes();
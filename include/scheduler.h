@@ -1,9 +1,96 @@
 #pragma once
 #include "tensor.h"
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
 
 enum class Device { CPU, GPU };
 
+const char* device_name(Device device);
+
+// Measured speeds of this machine. Rates are per millisecond so estimates come out in ms.
+// Everything GPU is zero when there is no OpenCL device.
+struct DeviceProfile {
+    // what the numbers were measured on, a profile for other hardware is recalibrated
+    std::string cpu;
+    std::string gpu;
+    int cpu_threads = 0;
+
+    double cpu_gemm_flops = 0.0;
+    double cpu_elementwise_bytes = 0.0;
+    double gpu_gemm_flops = 0.0;
+    double gpu_elementwise_bytes = 0.0;
+    double upload_bytes = 0.0;
+    double download_bytes = 0.0;
+    // fixed cost of one launch with its synchronisation, ms
+    double gpu_launch = 0.0;
+
+    bool has_gpu() const { return gpu_gemm_flops > 0.0; }
+
+    // key = value lines, false when the file is missing or incomplete
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+};
+
+// What an operator costs: arithmetic, memory traffic, and how much of its data has to cross
+// to the device and back. Bytes already resident on the device (layer weights, outputs of a
+// previous GPU op) don't count as transfers.
+struct OpCost {
+    std::string op;
+    // gemm-like ops are rated by flops, elementwise ops by bytes touched
+    bool compute_bound = true;
+    double flops = 0.0;
+    double bytes = 0.0;
+    double upload_bytes = 0.0;
+    double download_bytes = 0.0;
+
+    static OpCost add(const Tensor& a, const Tensor& b);
+    static OpCost matmul(const Tensor& a, const Tensor& b);
+    // [batch, in] x [in, out] with the parameters resident on the device when weights_on_device
+    static OpCost fully_connected(int batch_size, int input_size, int output_size, bool weights_on_device);
+};
+
+// one select() call, kept for auditing
+struct SchedulingDecision {
+    OpCost cost;
+    Device device;
+    double cpu_ms;
+    double gpu_ms;
+    std::string reason;
+};
+
+// Picks CPU or GPU per operator by estimating both from the cost and the calibrated profile.
+// The profile is measured once per machine and kept in scheduler_profile.txt in the annof
+// cache directory (see ProgramBinaryCache::default_directory). The last decisions are
+// kept and ANNOF_SCHEDULER_LOG=1 prints each one to stderr.
 class Scheduler {
 public:
+    // loads the saved profile or calibrates on first use
+    static Scheduler& getInstance();
+    explicit Scheduler(DeviceProfile profile);
+
+    // elementwise a + b, kept for existing callers
     static Device select_device(const Tensor& a, const Tensor& b);
-};
\ No newline at end of file
+
+    Device select(const OpCost& cost);
+    // time the profile predicts on each device, ms
+    double estimate_cpu(const OpCost& cost) const;
+    double estimate_gpu(const OpCost& cost) const;
+
+    const DeviceProfile& profile() const { return profile_; }
+    // runs the microbenchmarks on this machine, a few hundred ms with a GPU
+    static DeviceProfile calibrate();
+
+    std::vector<SchedulingDecision> decisions();
+    void clear_decisions();
+
+private:
+    static constexpr size_t kMaxDecisions = 256;
+
+    DeviceProfile profile_;
+    bool log_;
+    std::mutex mutex_;
+    std::deque<SchedulingDecision> decisions_;
+};
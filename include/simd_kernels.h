@@ -0,0 +1,679 @@
+#pragma once
+
+#include "cpu_dispatch.h"
+#include "simd_math.h"
+#include <cstddef>
+
+// Bodies of the cpu::Kernels entries, written once over the register ops of simd_math.h and
+// instantiated by kernels_sse.cpp, kernels_avx2.cpp, kernels_avx512.cpp and
+// kernels_avx512_vnni.cpp for their ISA.
+// Include this only from those files, everything here must be compiled for the ISA it runs on.
+// For the same reason nothing here calls std:: helpers: an inline function compiled into two
+// of these files is one symbol to the linker, compiled for whichever ISA it kept.
+namespace simd {
+
+template <class V, int NV>
+void pack_b(const float* b, std::ptrdiff_t row_stride, std::ptrdiff_t col_stride, int kc, int nc, float* buf) {
+    constexpr int NR = NV * V::kLanes;
+    for (int j = 0; j < nc; j += NR) {
+        int nr = nc - j < NR ? nc - j : NR;
+        for (int p = 0; p < kc; ++p) {
+            const float* src = b + p * row_stride + j * col_stride;
+            if (nr == NR && col_stride == 1) {
+                for (int v = 0; v < NV; ++v) V::store(buf + v * V::kLanes, V::loadu(src + v * V::kLanes));
+            } else {
+                for (int jj = 0; jj < NR; ++jj) {
+                    buf[jj] = jj < nr ? src[jj * col_stride] : 0.0f;
+                }
+            }
+            buf += NR;
+        }
+    }
+}
+
+// one register of row i of the tile, offset columns into it. registers are passed by value
+// so the accumulators never have their address taken and stay in registers
+template <class V>
+inline void store(float* c, typename V::Reg x, bool accumulate, const cpu::TileEpilogue* epilogue, int i, int offset) {
+    if (accumulate) x = V::add(V::loadu(c), x);
+    if (epilogue) {
+        if (epilogue->bias && epilogue->bias_per_row) {
+            x = V::add(x, V::set1(epilogue->bias[i]));
+        } else if (epilogue->bias) {
+            x = V::add(x, V::loadu(epilogue->bias + offset));
+        }
+        x = activate<V>(x, epilogue->activation);
+    }
+    V::storeu(c, x);
+}
+
+// MR x (NV * lanes) tile of C kept in registers for the whole k loop. the loops over the tile
+// are unrolled so the accumulators never leave registers
+template <class V, int MR, int NV>
+void micro_kernel(int kc, const float* a, const float* b, float* c, int ldc, bool accumulate,
+                  const cpu::TileEpilogue* epilogue) {
+    using Reg = typename V::Reg;
+    constexpr int NR = NV * V::kLanes;
+    Reg acc[MR][NV];
+#pragma GCC unroll 16
+    for (int i = 0; i < MR; ++i) {
+#pragma GCC unroll 4
+        for (int v = 0; v < NV; ++v) acc[i][v] = V::zero();
+    }
+
+    for (int p = 0; p < kc; ++p) {
+        Reg bv[NV];
+#pragma GCC unroll 4
+        for (int v = 0; v < NV; ++v) bv[v] = V::load(b + v * V::kLanes);
+#pragma GCC unroll 16
+        for (int i = 0; i < MR; ++i) {
+            Reg av = V::broadcast(a + i);
+#pragma GCC unroll 4
+            for (int v = 0; v < NV; ++v) acc[i][v] = V::fmadd(av, bv[v], acc[i][v]);
+        }
+        a += MR;
+        b += NR;
+    }
+
+#pragma GCC unroll 16
+    for (int i = 0; i < MR; ++i) {
+#pragma GCC unroll 4
+        for (int v = 0; v < NV; ++v) {
+            store<V>(c + static_cast<std::ptrdiff_t>(i) * ldc + v * V::kLanes, acc[i][v], accumulate, epilogue, i,
+                     v * V::kLanes);
+        }
+    }
+}
+
+// int8_mr x kInt8Panel tile of the int8 GEMM, the same register blocking as micro_kernel with
+// groups of 4 k values per step. a: per group, 4 bytes of each of the MR rows. b: per group,
+// 4 bytes of each of the 16 columns
+template <class Q, int MR>
+void int8_micro_kernel(int k_groups, const uint8_t* a, const int8_t* b, float* c, int ldc,
+                       const cpu::Int8Epilogue& epilogue) {
+    using V = typename Q::Float;
+    using IReg = typename Q::IReg;
+    constexpr int NV = cpu::kInt8Panel / Q::kLanes;
+    IReg acc[MR][NV];
+#pragma GCC unroll 16
+    for (int i = 0; i < MR; ++i) {
+#pragma GCC unroll 4
+        for (int v = 0; v < NV; ++v) acc[i][v] = Q::zero();
+    }
+
+    for (int g = 0; g < k_groups; ++g) {
+        IReg bv[NV];
+#pragma GCC unroll 4
+        for (int v = 0; v < NV; ++v) bv[v] = Q::load(b + v * Q::kLanes * 4);
+#pragma GCC unroll 16
+        for (int i = 0; i < MR; ++i) {
+            IReg av = Q::broadcast4(a + i * 4);
+#pragma GCC unroll 4
+            for (int v = 0; v < NV; ++v) acc[i][v] = Q::dot4(acc[i][v], av, bv[v]);
+        }
+        a += MR * 4;
+        b += cpu::kInt8Panel * 4;
+    }
+
+#pragma GCC unroll 16
+    for (int i = 0; i < MR; ++i) {
+#pragma GCC unroll 4
+        for (int v = 0; v < NV; ++v) {
+            int offset = v * Q::kLanes;
+            typename V::Reg x = Q::to_float(acc[i][v]);
+            x = V::sub(x, V::mul(V::set1(epilogue.row_zeros[i]), V::loadu(epilogue.column_sums + offset)));
+            x = V::mul(x, V::mul(V::set1(epilogue.row_scales[i]), V::loadu(epilogue.column_scales + offset)));
+            if (epilogue.bias) x = V::add(x, V::loadu(epilogue.bias + offset));
+            V::storeu(c + static_cast<std::ptrdiff_t>(i) * ldc + offset, activate<V>(x, epilogue.activation));
+        }
+    }
+}
+
+template <class Q>
+void quantize(const float* in, int count, float inverse_scale, float zero, uint8_t* out) {
+    using V = typename Q::Float;
+    using Reg = typename V::Reg;
+    constexpr int L = Q::kLanes;
+    Reg scale = V::set1(inverse_scale);
+    Reg offset = V::set1(zero);
+    Reg top = V::set1(static_cast<float>(cpu::kInt8MaxActivation));
+    auto code = [&](Reg x) { return V::min(V::max(V::fmadd(x, scale, offset), V::zero()), top); };
+    int i = 0;
+    for (; i + L <= count; i += L) {
+        Q::store_bytes(out + i, code(V::loadu(in + i)));
+    }
+    if (i < count) {
+        alignas(64) float lanes[L] = {};
+        alignas(64) uint8_t bytes[L];
+        for (int l = 0; l < count - i; ++l) lanes[l] = in[i + l];
+        Q::store_bytes(bytes, code(V::load(lanes)));
+        for (int l = 0; l < count - i; ++l) out[i + l] = bytes[l];
+    }
+}
+
+template <class V>
+void min_max(const float* in, int count, float* min, float* max) {
+    using Reg = typename V::Reg;
+    Reg lo = V::set1(in[0]);
+    Reg hi = lo;
+    int i = 0;
+    for (; i + V::kLanes <= count; i += V::kLanes) {
+        Reg x = V::loadu(in + i);
+        lo = V::min(lo, x);
+        hi = V::max(hi, x);
+    }
+    float smallest = -V::reduce_max(V::sub(V::zero(), lo));
+    float largest = V::reduce_max(hi);
+    for (; i < count; ++i) {
+        smallest = in[i] < smallest ? in[i] : smallest;
+        largest = in[i] > largest ? in[i] : largest;
+    }
+    *min = smallest;
+    *max = largest;
+}
+
+// rows of b ahead of the one stream_rows is on that it prefetches
+constexpr int kStreamPrefetchRows = 12;
+
+// how stream_rows reads a register of b: float weights as they are, 16-bit ones widened
+template <class V>
+struct FloatColumns {
+    using Float = V;
+    using Element = float;
+    static typename V::Reg load(const float* p) { return V::loadu(p); }
+};
+
+template <class H, bool BFloat16>
+struct HalfColumns {
+    using Float = typename H::Float;
+    using Element = uint16_t;
+    static typename H::Float::Reg load(const uint16_t* p) {
+        if (BFloat16) return H::load_bf16(p);
+        return H::load_f16(p);
+    }
+};
+
+// R rows of c over cols columns, NV registers of columns per step. each row of b is loaded
+// once for all R rows, b is read exactly once per call
+template <class B, int R, int NV>
+void stream_rows(int k, int cols, const float* a, int lda, const typename B::Element* b, int ldb, float* c, int ldc,
+                 const cpu::TileEpilogue* epilogue) {
+    using V = typename B::Float;
+    using Reg = typename V::Reg;
+    using Element = typename B::Element;
+    constexpr int L = V::kLanes;
+    constexpr int NB = NV * L;
+    int j = 0;
+    for (; j + NB <= cols; j += NB) {
+        Reg acc[R][NV];
+#pragma GCC unroll 4
+        for (int i = 0; i < R; ++i) {
+#pragma GCC unroll 4
+            for (int v = 0; v < NV; ++v) acc[i][v] = V::zero();
+        }
+        const Element* bp = b + j;
+        for (int p = 0; p < k; ++p) {
+            // successive rows are ldb apart, usually on another page where the hardware
+            // prefetcher does not follow
+#pragma GCC unroll 4
+            for (int line = 0; line < NB * static_cast<int>(sizeof(Element)); line += 64) {
+                _mm_prefetch(reinterpret_cast<const char*>(bp + kStreamPrefetchRows * static_cast<std::ptrdiff_t>(ldb)) + line, _MM_HINT_T0);
+            }
+            Reg bv[NV];
+#pragma GCC unroll 4
+            for (int v = 0; v < NV; ++v) bv[v] = B::load(bp + v * L);
+#pragma GCC unroll 4
+            for (int i = 0; i < R; ++i) {
+                Reg av = V::broadcast(a + static_cast<std::ptrdiff_t>(i) * lda + p);
+#pragma GCC unroll 4
+                for (int v = 0; v < NV; ++v) acc[i][v] = V::fmadd(av, bv[v], acc[i][v]);
+            }
+            bp += ldb;
+        }
+#pragma GCC unroll 4
+        for (int i = 0; i < R; ++i) {
+#pragma GCC unroll 4
+            for (int v = 0; v < NV; ++v) {
+                store<V>(c + static_cast<std::ptrdiff_t>(i) * ldc + j + v * L, acc[i][v], false, epilogue, i, j + v * L);
+            }
+        }
+    }
+
+    // the rest a register at a time, a partial last one through staged lanes so nothing past
+    // b, c or the bias is touched
+    for (; j < cols; j += L) {
+        int n = cols - j < L ? cols - j : L;
+        Reg acc[R];
+#pragma GCC unroll 4
+        for (int i = 0; i < R; ++i) acc[i] = V::zero();
+        alignas(64) Element lanes[L] = {};
+        for (int p = 0; p < k; ++p) {
+            const Element* bp = b + static_cast<std::ptrdiff_t>(p) * ldb + j;
+            Reg bv;
+            if (n == L) {
+                bv = B::load(bp);
+            } else {
+                for (int l = 0; l < n; ++l) lanes[l] = bp[l];
+                bv = B::load(lanes);
+            }
+#pragma GCC unroll 4
+            for (int i = 0; i < R; ++i) {
+                acc[i] = V::fmadd(V::broadcast(a + static_cast<std::ptrdiff_t>(i) * lda + p), bv, acc[i]);
+            }
+        }
+        alignas(64) float bias[L] = {};
+        cpu::TileEpilogue staged_epilogue = epilogue ? *epilogue : cpu::TileEpilogue{nullptr, false, gemm::Activation::None};
+        if (staged_epilogue.bias) {
+            for (int l = 0; l < n; ++l) bias[l] = epilogue->bias[j + l];
+            staged_epilogue.bias = bias;
+        }
+        for (int i = 0; i < R; ++i) {
+            alignas(64) float out[L];
+            store<V>(out, acc[i], false, epilogue ? &staged_epilogue : nullptr, i, 0);
+            for (int l = 0; l < n; ++l) c[static_cast<std::ptrdiff_t>(i) * ldc + j + l] = out[l];
+        }
+    }
+}
+
+// rows <= 4 (kGemvRows and kHalfRows)
+template <class B, int NV>
+void stream_rows_of(int rows, int k, int cols, const float* a, int lda, const typename B::Element* b, int ldb,
+                    float* c, int ldc, const cpu::TileEpilogue* epilogue) {
+    switch (rows) {
+        case 1: stream_rows<B, 1, NV>(k, cols, a, lda, b, ldb, c, ldc, epilogue); break;
+        case 2: stream_rows<B, 2, NV>(k, cols, a, lda, b, ldb, c, ldc, epilogue); break;
+        case 3: stream_rows<B, 3, NV>(k, cols, a, lda, b, ldb, c, ldc, epilogue); break;
+        default: stream_rows<B, 4, NV>(k, cols, a, lda, b, ldb, c, ldc, epilogue); break;
+    }
+}
+
+template <class V, int NV>
+void gemv(int rows, int k, int cols, const float* a, int lda, const float* b, int ldb, float* c, int ldc,
+          const cpu::TileEpilogue* epilogue) {
+    stream_rows_of<FloatColumns<V>, NV>(rows, k, cols, a, lda, b, ldb, c, ldc, epilogue);
+}
+
+template <class H, int NV>
+void half_gemm(int rows, int k, int cols, const float* a, int lda, const uint16_t* b, int ldb,
+               cpu::HalfFormat format, float* c, int ldc, const cpu::TileEpilogue* epilogue) {
+    if (format == cpu::HalfFormat::BFloat16) {
+        stream_rows_of<HalfColumns<H, true>, NV>(rows, k, cols, a, lda, b, ldb, c, ldc, epilogue);
+    } else {
+        stream_rows_of<HalfColumns<H, false>, NV>(rows, k, cols, a, lda, b, ldb, c, ldc, epilogue);
+    }
+}
+
+template <class H>
+void to_half(const float* in, uint16_t* out, int count, cpu::HalfFormat format) {
+    using V = typename H::Float;
+    constexpr int L = H::kLanes;
+    bool bfloat16 = format == cpu::HalfFormat::BFloat16;
+    auto narrow = [bfloat16](uint16_t* p, typename V::Reg x) {
+        if (bfloat16) {
+            H::store_bf16(p, x);
+        } else {
+            H::store_f16(p, x);
+        }
+    };
+    int i = 0;
+    for (; i + L <= count; i += L) narrow(out + i, V::loadu(in + i));
+    if (i < count) {
+        alignas(64) float lanes[L] = {};
+        alignas(64) uint16_t halves[L];
+        for (int l = 0; l < count - i; ++l) lanes[l] = in[i + l];
+        narrow(halves, V::load(lanes));
+        for (int l = 0; l < count - i; ++l) out[i + l] = halves[l];
+    }
+}
+
+template <class H>
+void from_half(const uint16_t* in, float* out, int count, cpu::HalfFormat format) {
+    using V = typename H::Float;
+    constexpr int L = H::kLanes;
+    bool bfloat16 = format == cpu::HalfFormat::BFloat16;
+    auto widen = [bfloat16](const uint16_t* p) { return bfloat16 ? H::load_bf16(p) : H::load_f16(p); };
+    int i = 0;
+    for (; i + L <= count; i += L) V::storeu(out + i, widen(in + i));
+    if (i < count) {
+        alignas(64) uint16_t halves[L] = {};
+        alignas(64) float lanes[L];
+        for (int l = 0; l < count - i; ++l) halves[l] = in[i + l];
+        V::store(lanes, widen(halves));
+        for (int l = 0; l < count - i; ++l) out[i + l] = lanes[l];
+    }
+}
+
+// ROWS rows of one panel of block-sparse weights, NV registers per block row. with a single
+// register per block row, consecutive blocks go to two sets of accumulators so one row still
+// keeps two FMA chains in flight
+template <class V, int ROWS, int R>
+void sparse_rows(int blocks, const int* starts, const float* values, const float* a, int lda, float* c, int ldc,
+                 const cpu::TileEpilogue* epilogue) {
+    using Reg = typename V::Reg;
+    constexpr int L = V::kLanes;
+    constexpr int NV = cpu::kSparseBlockCols / L;
+    constexpr int CHAINS = NV == 1 ? 2 : 1;
+    constexpr int BLOCK = R * cpu::kSparseBlockCols;
+    Reg acc[CHAINS][ROWS][NV];
+#pragma GCC unroll 2
+    for (int h = 0; h < CHAINS; ++h) {
+#pragma GCC unroll 4
+        for (int i = 0; i < ROWS; ++i) {
+#pragma GCC unroll 2
+            for (int v = 0; v < NV; ++v) acc[h][i][v] = V::zero();
+        }
+    }
+
+    int b = 0;
+    for (; b + CHAINS <= blocks; b += CHAINS) {
+#pragma GCC unroll 2
+        for (int h = 0; h < CHAINS; ++h) {
+            const float* w = values + static_cast<std::ptrdiff_t>(b + h) * BLOCK;
+            const float* x = a + starts[b + h];
+#pragma GCC unroll 4
+            for (int r = 0; r < R; ++r) {
+                Reg wv[NV];
+#pragma GCC unroll 2
+                for (int v = 0; v < NV; ++v) wv[v] = V::loadu(w + r * cpu::kSparseBlockCols + v * L);
+#pragma GCC unroll 4
+                for (int i = 0; i < ROWS; ++i) {
+                    Reg xv = V::broadcast(x + static_cast<std::ptrdiff_t>(i) * lda + r);
+#pragma GCC unroll 2
+                    for (int v = 0; v < NV; ++v) acc[h][i][v] = V::fmadd(xv, wv[v], acc[h][i][v]);
+                }
+            }
+        }
+    }
+    if (b < blocks) {
+        const float* w = values + static_cast<std::ptrdiff_t>(b) * BLOCK;
+        const float* x = a + starts[b];
+#pragma GCC unroll 4
+        for (int r = 0; r < R; ++r) {
+#pragma GCC unroll 4
+            for (int i = 0; i < ROWS; ++i) {
+                Reg xv = V::broadcast(x + static_cast<std::ptrdiff_t>(i) * lda + r);
+#pragma GCC unroll 2
+                for (int v = 0; v < NV; ++v) {
+                    acc[0][i][v] = V::fmadd(xv, V::loadu(w + r * cpu::kSparseBlockCols + v * L), acc[0][i][v]);
+                }
+            }
+        }
+    }
+
+#pragma GCC unroll 4
+    for (int i = 0; i < ROWS; ++i) {
+#pragma GCC unroll 2
+        for (int v = 0; v < NV; ++v) {
+            Reg sum = CHAINS == 2 ? V::add(acc[0][i][v], acc[CHAINS - 1][i][v]) : acc[0][i][v];
+            store<V>(c + static_cast<std::ptrdiff_t>(i) * ldc + v * L, sum, false, epilogue, i, v * L);
+        }
+    }
+}
+
+template <class V, int R>
+void sparse_rows_of(int rows, int blocks, const int* starts, const float* values, const float* a, int lda, float* c,
+                    int ldc, const cpu::TileEpilogue* epilogue) {
+    switch (rows) {
+        case 1: sparse_rows<V, 1, R>(blocks, starts, values, a, lda, c, ldc, epilogue); break;
+        case 2: sparse_rows<V, 2, R>(blocks, starts, values, a, lda, c, ldc, epilogue); break;
+        case 3: sparse_rows<V, 3, R>(blocks, starts, values, a, lda, c, ldc, epilogue); break;
+        default: sparse_rows<V, cpu::kSparseRows, R>(blocks, starts, values, a, lda, c, ldc, epilogue); break;
+    }
+}
+
+// a block row is at most one register, wider ISAs take the kernel of one that fits (see
+// kernels_avx512.cpp)
+template <class V>
+void sparse_panel(int rows, int block_rows, int blocks, const int* starts, const float* values, const float* a,
+                  int lda, float* c, int ldc, const cpu::TileEpilogue* epilogue) {
+    static_assert(V::kLanes <= cpu::kSparseBlockCols, "a block row must fill whole registers");
+    if (block_rows == 4) {
+        sparse_rows_of<V, 4>(rows, blocks, starts, values, a, lda, c, ldc, epilogue);
+    } else {
+        sparse_rows_of<V, 1>(rows, blocks, starts, values, a, lda, c, ldc, epilogue);
+    }
+}
+
+template <class V>
+constexpr auto sparse_panel_of() {
+    if constexpr (V::kLanes <= cpu::kSparseBlockCols) {
+        return sparse_panel<V>;
+    } else {
+        return static_cast<decltype(cpu::Kernels::sparse_panel)>(nullptr);
+    }
+}
+
+// out[i] = f(in[i]), the tail goes through a full register so it gets the same rounding as
+// the body
+template <class V, class F>
+inline void map_with(const float* in, float* out, int count, F f) {
+    int i = 0;
+    for (; i + V::kLanes <= count; i += V::kLanes) {
+        V::storeu(out + i, f(V::loadu(in + i)));
+    }
+    if (i < count) {
+        alignas(64) float lanes[V::kLanes] = {};
+        for (int l = 0; l < count - i; ++l) lanes[l] = in[i + l];
+        V::store(lanes, f(V::load(lanes)));
+        for (int l = 0; l < count - i; ++l) out[i + l] = lanes[l];
+    }
+}
+
+template <class V>
+void activate(const float* in, float* out, int count, gemm::Activation activation) {
+    map_with<V>(in, out, count, [activation](typename V::Reg x) { return activate<V>(x, activation); });
+}
+
+// derivatives take the function's input, not its output
+template <class V>
+void map(const float* in, float* out, int count, cpu::MapOp op, float alpha) {
+    using Reg = typename V::Reg;
+    switch (op) {
+        case cpu::MapOp::ReLU:
+            map_with<V>(in, out, count, [](Reg x) { return relu<V>(x); });
+            break;
+        case cpu::MapOp::ReLUDerivative:
+            map_with<V>(in, out, count, [](Reg x) { return V::select(V::less(V::zero(), x), V::set1(1.0f), V::zero()); });
+            break;
+        case cpu::MapOp::Sigmoid:
+            map_with<V>(in, out, count, [](Reg x) { return sigmoid<V>(x); });
+            break;
+        case cpu::MapOp::SigmoidDerivative:
+            map_with<V>(in, out, count, [](Reg x) {
+                Reg s = sigmoid<V>(x);
+                return V::mul(s, V::sub(V::set1(1.0f), s));
+            });
+            break;
+        case cpu::MapOp::Tanh:
+            map_with<V>(in, out, count, [](Reg x) { return tanh<V>(x); });
+            break;
+        case cpu::MapOp::TanhDerivative:
+            map_with<V>(in, out, count, [](Reg x) {
+                Reg t = tanh<V>(x);
+                return V::sub(V::set1(1.0f), V::mul(t, t));
+            });
+            break;
+        case cpu::MapOp::GELU:
+            map_with<V>(in, out, count, [](Reg x) { return gelu<V>(x); });
+            break;
+        case cpu::MapOp::GELUDerivative:
+            // gelu = x s(u) with u = x (c1 + c3 x^2): s + x s (1 - s) (c1 + 3 c3 x^2)
+            map_with<V>(in, out, count, [](Reg x) {
+                Reg x2 = V::mul(x, x);
+                Reg s = sigmoid<V>(V::mul(x, V::fmadd(V::set1(0.0713548163f), x2, V::set1(1.5957691216f))));
+                Reg du = V::fmadd(V::set1(0.2140644488f), x2, V::set1(1.5957691216f));
+                return V::fmadd(V::mul(V::mul(x, s), V::sub(V::set1(1.0f), s)), du, s);
+            });
+            break;
+        case cpu::MapOp::SiLU:
+            map_with<V>(in, out, count, [](Reg x) { return silu<V>(x); });
+            break;
+        case cpu::MapOp::SiLUDerivative:
+            // s (1 + x (1 - s))
+            map_with<V>(in, out, count, [](Reg x) {
+                Reg s = sigmoid<V>(x);
+                return V::fmadd(V::mul(s, x), V::sub(V::set1(1.0f), s), s);
+            });
+            break;
+        case cpu::MapOp::LeakyReLU:
+            map_with<V>(in, out, count, [alpha](Reg x) { return leaky_relu<V>(x, alpha); });
+            break;
+        case cpu::MapOp::LeakyReLUDerivative:
+            map_with<V>(in, out, count, [alpha](Reg x) {
+                return V::select(V::less(V::zero(), x), V::set1(1.0f), V::set1(alpha));
+            });
+            break;
+        case cpu::MapOp::Scale:
+            map_with<V>(in, out, count, [alpha](Reg x) { return V::mul(x, V::set1(alpha)); });
+            break;
+    }
+}
+
+// each row shifted by its max before exp, so no row overflows
+template <class V>
+void softmax(const float* in, float* out, int rows, int cols) {
+    using Reg = typename V::Reg;
+    constexpr int L = V::kLanes;
+    for (int r = 0; r < rows; ++r) {
+        const float* x = in + static_cast<std::ptrdiff_t>(r) * cols;
+        float* y = out + static_cast<std::ptrdiff_t>(r) * cols;
+
+        int j = 0;
+        Reg vmax = V::set1(-3.40282347e38f);
+        for (; j + L <= cols; j += L) vmax = V::max(vmax, V::loadu(x + j));
+        float max = V::reduce_max(vmax);
+        for (; j < cols; ++j) max = x[j] > max ? x[j] : max;
+
+        Reg shift = V::set1(max);
+        Reg vsum = V::zero();
+        for (j = 0; j + L <= cols; j += L) {
+            Reg e = exp<V>(V::sub(V::loadu(x + j), shift));
+            V::storeu(y + j, e);
+            vsum = V::add(vsum, e);
+        }
+        float sum = V::reduce_add(vsum);
+        if (j < cols) {
+            alignas(64) float lanes[L] = {};
+            for (int l = 0; l < cols - j; ++l) lanes[l] = x[j + l];
+            V::store(lanes, exp<V>(V::sub(V::load(lanes), shift)));
+            for (int l = 0; l < cols - j; ++l) {
+                y[j + l] = lanes[l];
+                sum += lanes[l];
+            }
+        }
+
+        Reg scale = V::set1(1.0f / sum);
+        for (j = 0; j + L <= cols; j += L) V::storeu(y + j, V::mul(V::loadu(y + j), scale));
+        for (; j < cols; ++j) y[j] *= 1.0f / sum;
+    }
+}
+
+// out[i] = f(a[i], b[i]), a broadcast operand is loaded into a register once. the tail goes
+// through full registers like map_with
+template <class V, bool BroadcastA, bool BroadcastB, class F>
+inline void zip_with(const float* a, const float* b, float* out, int count, F f) {
+    constexpr int L = V::kLanes;
+    typename V::Reg av = V::set1(a[0]);
+    typename V::Reg bv = V::set1(b[0]);
+    int i = 0;
+    for (; i + L <= count; i += L) {
+        V::storeu(out + i, f(BroadcastA ? av : V::loadu(a + i), BroadcastB ? bv : V::loadu(b + i)));
+    }
+    if (i < count) {
+        alignas(64) float a_lanes[L] = {};
+        alignas(64) float b_lanes[L] = {};
+        for (int l = 0; l < count - i; ++l) {
+            a_lanes[l] = BroadcastA ? a[0] : a[i + l];
+            b_lanes[l] = BroadcastB ? b[0] : b[i + l];
+        }
+        V::store(a_lanes, f(V::load(a_lanes), V::load(b_lanes)));
+        for (int l = 0; l < count - i; ++l) out[i + l] = a_lanes[l];
+    }
+}
+
+template <class V, class F>
+inline void zip_steps(const float* a, int a_step, const float* b, int b_step, float* out, int count, F f) {
+    if (a_step == 0 && b_step == 0) {
+        zip_with<V, true, true>(a, b, out, count, f);
+    } else if (a_step == 0) {
+        zip_with<V, true, false>(a, b, out, count, f);
+    } else if (b_step == 0) {
+        zip_with<V, false, true>(a, b, out, count, f);
+    } else {
+        zip_with<V, false, false>(a, b, out, count, f);
+    }
+}
+
+template <class V>
+void binary(const float* a, int a_step, const float* b, int b_step, float* out, int count, cpu::BinaryOp op) {
+    using Reg = typename V::Reg;
+    if (count <= 0) return;
+    switch (op) {
+        case cpu::BinaryOp::Add:
+            zip_steps<V>(a, a_step, b, b_step, out, count, [](Reg x, Reg y) { return V::add(x, y); });
+            break;
+        case cpu::BinaryOp::Subtract:
+            zip_steps<V>(a, a_step, b, b_step, out, count, [](Reg x, Reg y) { return V::sub(x, y); });
+            break;
+        case cpu::BinaryOp::Multiply:
+            zip_steps<V>(a, a_step, b, b_step, out, count, [](Reg x, Reg y) { return V::mul(x, y); });
+            break;
+        case cpu::BinaryOp::Divide:
+            zip_steps<V>(a, a_step, b, b_step, out, count, [](Reg x, Reg y) { return V::div(x, y); });
+            break;
+    }
+}
+
+// two accumulators hide the add latency
+template <class V>
+float sum_squared_difference(const float* a, const float* b, int count) {
+    using Reg = typename V::Reg;
+    constexpr int L = V::kLanes;
+    Reg sum0 = V::zero();
+    Reg sum1 = V::zero();
+    int i = 0;
+    for (; i + 2 * L <= count; i += 2 * L) {
+        Reg d0 = V::sub(V::loadu(a + i), V::loadu(b + i));
+        Reg d1 = V::sub(V::loadu(a + i + L), V::loadu(b + i + L));
+        sum0 = V::fmadd(d0, d0, sum0);
+        sum1 = V::fmadd(d1, d1, sum1);
+    }
+    float sum = V::reduce_add(V::add(sum0, sum1));
+    for (; i < count; ++i) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+template <class V>
+void subtract_column_sums(const float* rows, int row_count, int cols, float scale, float* out) {
+    int j = 0;
+    for (; j + V::kLanes <= cols; j += V::kLanes) {
+        typename V::Reg sum = V::zero();
+        for (int i = 0; i < row_count; ++i) {
+            sum = V::add(sum, V::loadu(rows + static_cast<std::ptrdiff_t>(i) * cols + j));
+        }
+        V::storeu(out + j, V::sub(V::loadu(out + j), V::mul(V::set1(scale), sum)));
+    }
+    for (; j < cols; ++j) {
+        float sum = 0.0f;
+        for (int i = 0; i < row_count; ++i) {
+            sum += rows[static_cast<std::ptrdiff_t>(i) * cols + j];
+        }
+        out[j] -= scale * sum;
+    }
+}
+
+template <class V, int MR, int NV, class Q, int MR8, class H, int HNV>
+cpu::Kernels make_kernels(cpu::Isa isa) {
+    static_assert(cpu::kGemvRows == 4 && cpu::kHalfRows == 4, "stream_rows_of takes up to 4 rows");
+    return {isa, MR, NV * V::kLanes,
+            pack_b<V, NV>, micro_kernel<V, MR, NV>, gemv<V, HNV>,
+            MR8, int8_micro_kernel<Q, MR8>, quantize<Q>, min_max<V>,
+            half_gemm<H, HNV>, to_half<H>, from_half<H>,
+            sparse_panel_of<V>(),
+            activate<V>, map<V>, softmax<V>, binary<V>, sum_squared_difference<V>, subtract_column_sums<V>};
+}
+
+}
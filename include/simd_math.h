@@ -0,0 +1,455 @@
+#pragma once
+
+#include "gemm.h"
+#include <cstdint>
+#include <immintrin.h>
+
+// Float math on SIMD registers for kernels that post-process values while they are still in
+// registers. Each ISA is a struct of static register ops (Sse, Avx2, Avx512), defined only in
+// translation units compiled for it, and the math is written once on top of them as templates.
+// Polynomials are the Cephes single precision ones.
+namespace simd {
+
+#ifdef __SSE2__
+// plain SSE2, every x86-64 processor has it
+struct Sse {
+    using Reg = __m128;
+    using Mask = __m128;
+    static constexpr int kLanes = 4;
+
+    static Reg zero() { return _mm_setzero_ps(); }
+    static Reg set1(float x) { return _mm_set1_ps(x); }
+    static Reg broadcast(const float* p) { return _mm_load1_ps(p); }
+    static Reg load(const float* p) { return _mm_load_ps(p); }
+    static Reg loadu(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, Reg x) { _mm_store_ps(p, x); }
+    static void storeu(float* p, Reg x) { _mm_storeu_ps(p, x); }
+
+    static Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm_sub_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+    static Reg div(Reg a, Reg b) { return _mm_div_ps(a, b); }
+    static Reg min(Reg a, Reg b) { return _mm_min_ps(a, b); }
+    static Reg max(Reg a, Reg b) { return _mm_max_ps(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static Reg bit_and(Reg a, Reg b) { return _mm_and_ps(a, b); }
+    static Reg bit_or(Reg a, Reg b) { return _mm_or_ps(a, b); }
+    // ~a & b
+    static Reg bit_andnot(Reg a, Reg b) { return _mm_andnot_ps(a, b); }
+
+    // nearest integer under the default rounding mode, |x| < 2^31
+    static Reg round(Reg x) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(x)); }
+    // 2^n for integral n in [-126, 127], built in the exponent field
+    static Reg pow2i(Reg n) {
+        return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23));
+    }
+
+    static Mask less(Reg a, Reg b) { return _mm_cmplt_ps(a, b); }
+    // a where mask is set, b elsewhere
+    static Reg select(Mask mask, Reg a, Reg b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+
+    static float reduce_add(Reg x) {
+        x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+        return _mm_cvtss_f32(_mm_add_ss(x, _mm_shuffle_ps(x, x, 1)));
+    }
+    static float reduce_max(Reg x) {
+        x = _mm_max_ps(x, _mm_movehl_ps(x, x));
+        return _mm_cvtss_f32(_mm_max_ss(x, _mm_shuffle_ps(x, x, 1)));
+    }
+};
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+struct Avx2 {
+    using Reg = __m256;
+    using Mask = __m256;
+    static constexpr int kLanes = 8;
+
+    static Reg zero() { return _mm256_setzero_ps(); }
+    static Reg set1(float x) { return _mm256_set1_ps(x); }
+    static Reg broadcast(const float* p) { return _mm256_broadcast_ss(p); }
+    static Reg load(const float* p) { return _mm256_load_ps(p); }
+    static Reg loadu(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, Reg x) { _mm256_store_ps(p, x); }
+    static void storeu(float* p, Reg x) { _mm256_storeu_ps(p, x); }
+
+    static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+    static Reg div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+    static Reg min(Reg a, Reg b) { return _mm256_min_ps(a, b); }
+    static Reg max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+    static Reg bit_and(Reg a, Reg b) { return _mm256_and_ps(a, b); }
+    static Reg bit_or(Reg a, Reg b) { return _mm256_or_ps(a, b); }
+    static Reg bit_andnot(Reg a, Reg b) { return _mm256_andnot_ps(a, b); }
+
+    static Reg round(Reg x) { return _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Reg pow2i(Reg n) {
+        __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+    }
+
+    static Mask less(Reg a, Reg b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Reg select(Mask mask, Reg a, Reg b) { return _mm256_blendv_ps(b, a, mask); }
+
+    // written out rather than through Sse, an inline function shared by two ISA files would be
+    // one symbol to the linker, compiled for whichever ISA it kept
+    static float reduce_add(Reg x) {
+        __m128 h = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+        h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+        return _mm_cvtss_f32(_mm_add_ss(h, _mm_shuffle_ps(h, h, 1)));
+    }
+    static float reduce_max(Reg x) {
+        __m128 h = _mm_max_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+        h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+        return _mm_cvtss_f32(_mm_max_ss(h, _mm_shuffle_ps(h, h, 1)));
+    }
+};
+#endif
+
+#ifdef __AVX512F__
+// AVX-512 foundation only, float bit ops go through the integer unit since _mm512_and_ps is DQ
+struct Avx512 {
+    using Reg = __m512;
+    using Mask = __mmask16;
+    static constexpr int kLanes = 16;
+
+    static Reg zero() { return _mm512_setzero_ps(); }
+    static Reg set1(float x) { return _mm512_set1_ps(x); }
+    static Reg broadcast(const float* p) { return _mm512_set1_ps(*p); }
+    static Reg load(const float* p) { return _mm512_load_ps(p); }
+    static Reg loadu(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, Reg x) { _mm512_store_ps(p, x); }
+    static void storeu(float* p, Reg x) { _mm512_storeu_ps(p, x); }
+
+    static Reg add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+    static Reg div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+    static Reg min(Reg a, Reg b) { return _mm512_min_ps(a, b); }
+    static Reg max(Reg a, Reg b) { return _mm512_max_ps(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+    static Reg bit_and(Reg a, Reg b) {
+        return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+    }
+    static Reg bit_or(Reg a, Reg b) {
+        return _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+    }
+    static Reg bit_andnot(Reg a, Reg b) {
+        return _mm512_castsi512_ps(_mm512_andnot_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+    }
+
+    static Reg round(Reg x) { return _mm512_roundscale_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Reg pow2i(Reg n) {
+        __m512i e = _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(e, 23));
+    }
+
+    static Mask less(Reg a, Reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static Reg select(Mask mask, Reg a, Reg b) { return _mm512_mask_blend_ps(mask, b, a); }
+
+    static float reduce_add(Reg x) { return _mm512_reduce_add_ps(x); }
+    static float reduce_max(Reg x) { return _mm512_reduce_max_ps(x); }
+};
+#endif
+
+// int8 dot products for the quantized GEMM, one struct per ISA on top of the float one it
+// dequantizes with (Float). dot4 adds to each 32-bit lane j the dot product of the 4 unsigned
+// bytes of a, the same in every lane, with the 4 signed bytes of lane j of b. a stays below 128
+// (see quantization.h) so vpmaddubsw's 16-bit pair sums never saturate. store_bytes narrows
+// quantized floats to those bytes
+#ifdef __SSE2__
+// SSE2 has no byte multiply, bytes are widened to 16 bits for pmaddwd
+struct SseInt8 {
+    using Float = Sse;
+    using IReg = __m128i;
+    static constexpr int kLanes = 4;
+
+    static IReg zero() { return _mm_setzero_si128(); }
+    static IReg broadcast4(const uint8_t* p) { return _mm_shuffle_epi32(_mm_loadu_si32(p), 0); }
+    static IReg load(const int8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    static IReg dot4(IReg acc, IReg a, IReg b) {
+        // a holds one row's 4 bytes repeated, its low half widened pairs with 2 columns of b
+        __m128i a16 = _mm_unpacklo_epi8(a, _mm_setzero_si128());
+        __m128i b_lo = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+        __m128i b_hi = _mm_srai_epi16(_mm_unpackhi_epi8(b, b), 8);
+        // half sums {c0 k01, c0 k23, c1 k01, c1 k23} and the same for c2, c3
+        __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(a16, b_lo));
+        __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(a16, b_hi));
+        __m128i even = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i odd = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+        return _mm_add_epi32(acc, _mm_add_epi32(even, odd));
+    }
+    static Sse::Reg to_float(IReg x) { return _mm_cvtepi32_ps(x); }
+    // lanes already in [0, 255], rounded to nearest
+    static void store_bytes(uint8_t* p, Sse::Reg x) {
+        __m128i words = _mm_packs_epi32(_mm_cvtps_epi32(x), _mm_setzero_si128());
+        _mm_storeu_si32(p, _mm_packus_epi16(words, words));
+    }
+};
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+struct Avx2Int8 {
+    using Float = Avx2;
+    using IReg = __m256i;
+    static constexpr int kLanes = 8;
+
+    static IReg zero() { return _mm256_setzero_si256(); }
+    static IReg broadcast4(const uint8_t* p) { return _mm256_broadcastd_epi32(_mm_loadu_si32(p)); }
+    static IReg load(const int8_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static IReg dot4(IReg acc, IReg a, IReg b) {
+        __m256i pairs = _mm256_maddubs_epi16(a, b);
+        return _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+    }
+    static Avx2::Reg to_float(IReg x) { return _mm256_cvtepi32_ps(x); }
+    static void store_bytes(uint8_t* p, Avx2::Reg x) {
+        __m256i ints = _mm256_cvtps_epi32(x);
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(ints), _mm256_extracti128_si256(ints, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packus_epi16(words, words));
+    }
+};
+#endif
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+struct Avx512Int8 {
+    using Float = Avx512;
+    using IReg = __m512i;
+    static constexpr int kLanes = 16;
+
+    static IReg zero() { return _mm512_setzero_si512(); }
+    static IReg broadcast4(const uint8_t* p) { return _mm512_set1_epi32(_mm_cvtsi128_si32(_mm_loadu_si32(p))); }
+    static IReg load(const int8_t* p) { return _mm512_loadu_si512(p); }
+    static IReg dot4(IReg acc, IReg a, IReg b) {
+        __m512i pairs = _mm512_maddubs_epi16(a, b);
+        return _mm512_add_epi32(acc, _mm512_madd_epi16(pairs, _mm512_set1_epi16(1)));
+    }
+    static Avx512::Reg to_float(IReg x) { return _mm512_cvtepi32_ps(x); }
+    static void store_bytes(uint8_t* p, Avx512::Reg x) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm512_cvtusepi32_epi8(_mm512_cvtps_epi32(x)));
+    }
+};
+#endif
+
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VNNI__)
+// its own float struct so the epilogue templates instantiated for VNNI are different symbols
+// from the ones kernels_avx512.cpp builds without it
+struct Avx512Vnni : Avx512 {};
+
+struct Avx512VnniInt8 {
+    using Float = Avx512Vnni;
+    using IReg = __m512i;
+    static constexpr int kLanes = 16;
+
+    static IReg zero() { return _mm512_setzero_si512(); }
+    static IReg broadcast4(const uint8_t* p) { return _mm512_set1_epi32(_mm_cvtsi128_si32(_mm_loadu_si32(p))); }
+    static IReg load(const int8_t* p) { return _mm512_loadu_si512(p); }
+    static IReg dot4(IReg acc, IReg a, IReg b) { return _mm512_dpbusd_epi32(acc, a, b); }
+    static Avx512::Reg to_float(IReg x) { return _mm512_cvtepi32_ps(x); }
+    static void store_bytes(uint8_t* p, Avx512::Reg x) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm512_cvtusepi32_epi8(_mm512_cvtps_epi32(x)));
+    }
+};
+#endif
+
+// 16-bit float loads and stores for half precision weights, one struct per ISA on top of the
+// float one (Float), kLanes values at a time, unaligned. bf16 widens by a shift and narrows
+// with integer rounding to nearest even on every ISA, fp16 uses F16C where there is one
+#ifdef __SSE2__
+// no F16C on baseline x86-64, fp16 goes through the bits: the exponent and mantissa are
+// shifted into float position and rescaled by 2^112, which also makes fp16 subnormals normal
+struct SseHalf {
+    using Float = Sse;
+    static constexpr int kLanes = 4;
+
+    static __m128i load4(const uint16_t* p) {
+        return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128());
+    }
+    // low 16 bits of each lane, whatever the sign of the 32-bit lane
+    static void store4(uint16_t* p, __m128i x) {
+        x = _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packs_epi32(x, x));
+    }
+
+    static Sse::Reg load_f16(const uint16_t* p) {
+        __m128i h = load4(p);
+        __m128i sign = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+        __m128i bits = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13);
+        __m128 x = _mm_mul_ps(_mm_castsi128_ps(bits), _mm_castsi128_ps(_mm_set1_epi32(0x77800000)));
+        // fp16 exponent 31 is Inf / NaN, the rescale alone would leave it finite
+        __m128i special = _mm_cmpgt_epi32(bits, _mm_set1_epi32(0x0f7fffff));
+        __m128i top = _mm_and_si128(special, _mm_set1_epi32(0x7f800000));
+        return _mm_castsi128_ps(_mm_or_si128(_mm_or_si128(_mm_castps_si128(x), top), sign));
+    }
+    static void store_f16(uint16_t* p, Sse::Reg x) {
+        __m128i bits = _mm_castps_si128(x);
+        __m128i sign = _mm_and_si128(_mm_srli_epi32(bits, 16), _mm_set1_epi32(0x8000));
+        __m128i a = _mm_and_si128(bits, _mm_set1_epi32(0x7fffffff));
+        // below 2^-14 the sum with 0.5 rounds the subnormal mantissa into the low bits
+        __m128 denormal_sum = _mm_add_ps(_mm_castsi128_ps(a), _mm_set1_ps(0.5f));
+        __m128i denormal = _mm_sub_epi32(_mm_castps_si128(denormal_sum), _mm_set1_epi32(0x3f000000));
+        // rebias the exponent, add just under half an ulp plus the lowest kept bit for ties to even
+        __m128i odd = _mm_and_si128(_mm_srli_epi32(a, 13), _mm_set1_epi32(1));
+        __m128i normal = _mm_add_epi32(a, _mm_add_epi32(_mm_set1_epi32(static_cast<int>(0xc8000fffu)), odd));
+        normal = _mm_srli_epi32(normal, 13);
+        __m128i small = _mm_cmplt_epi32(a, _mm_set1_epi32(0x38800000));
+        __m128i h = _mm_or_si128(_mm_and_si128(small, denormal), _mm_andnot_si128(small, normal));
+        // 65520 and up round to Inf, NaN stays a quiet NaN
+        __m128i nan = _mm_cmpgt_epi32(a, _mm_set1_epi32(0x7f800000));
+        __m128i special = _mm_or_si128(_mm_and_si128(nan, _mm_set1_epi32(0x7e00)), _mm_andnot_si128(nan, _mm_set1_epi32(0x7c00)));
+        __m128i big = _mm_cmpgt_epi32(a, _mm_set1_epi32(0x477fefff));
+        h = _mm_or_si128(_mm_and_si128(big, special), _mm_andnot_si128(big, h));
+        store4(p, _mm_or_si128(h, sign));
+    }
+    static Sse::Reg load_bf16(const uint16_t* p) { return _mm_castsi128_ps(_mm_slli_epi32(load4(p), 16)); }
+    static void store_bf16(uint16_t* p, Sse::Reg x) {
+        __m128i bits = _mm_castps_si128(x);
+        __m128i odd = _mm_and_si128(_mm_srli_epi32(bits, 16), _mm_set1_epi32(1));
+        __m128i rounded = _mm_srli_epi32(_mm_add_epi32(bits, _mm_add_epi32(_mm_set1_epi32(0x7fff), odd)), 16);
+        __m128i nan = _mm_castps_si128(_mm_cmpunord_ps(x, x));
+        __m128i quiet = _mm_or_si128(_mm_srli_epi32(bits, 16), _mm_set1_epi32(0x40));
+        store4(p, _mm_or_si128(_mm_and_si128(nan, quiet), _mm_andnot_si128(nan, rounded)));
+    }
+};
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+struct Avx2Half {
+    using Float = Avx2;
+    static constexpr int kLanes = 8;
+
+    static __m128i load8(const uint16_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+
+    static Avx2::Reg load_f16(const uint16_t* p) { return _mm256_cvtph_ps(load8(p)); }
+    static void store_f16(uint16_t* p, Avx2::Reg x) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    }
+    static Avx2::Reg load_bf16(const uint16_t* p) {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(load8(p)), 16));
+    }
+    static void store_bf16(uint16_t* p, Avx2::Reg x) {
+        __m256i bits = _mm256_castps_si256(x);
+        __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+        __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(_mm256_set1_epi32(0x7fff), odd)), 16);
+        __m256i quiet = _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40));
+        __m256i h = _mm256_blendv_epi8(rounded, quiet, _mm256_castps_si256(_mm256_cmp_ps(x, x, _CMP_UNORD_Q)));
+        // lanes are below 2^16, the unsigned pack keeps them. it packs within 128-bit halves
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(h, h), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_castsi256_si128(packed));
+    }
+};
+#endif
+
+#ifdef __AVX512F__
+struct Avx512Half {
+    using Float = Avx512;
+    static constexpr int kLanes = 16;
+
+    static __m256i load16(const uint16_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+
+    static Avx512::Reg load_f16(const uint16_t* p) { return _mm512_cvtph_ps(load16(p)); }
+    static void store_f16(uint16_t* p, Avx512::Reg x) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm512_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    }
+    static Avx512::Reg load_bf16(const uint16_t* p) {
+        return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(load16(p)), 16));
+    }
+    static void store_bf16(uint16_t* p, Avx512::Reg x) {
+        __m512i bits = _mm512_castps_si512(x);
+        __m512i odd = _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+        __m512i rounded = _mm512_srli_epi32(_mm512_add_epi32(bits, _mm512_add_epi32(_mm512_set1_epi32(0x7fff), odd)), 16);
+        __m512i quiet = _mm512_or_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(0x40));
+        __m512i h = _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q), rounded, quiet);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm512_cvtepi32_epi16(h));
+    }
+};
+#endif
+
+template <class V>
+inline typename V::Reg exp(typename V::Reg x) {
+    using Reg = typename V::Reg;
+    // keep 2^n a normal float
+    x = V::min(x, V::set1(88.0f));
+    x = V::max(x, V::set1(-87.0f));
+
+    // x = n * ln2 + r with |r| <= ln2 / 2, ln2 split in two so r stays exact
+    Reg n = V::round(V::mul(x, V::set1(1.44269504088896341f)));
+    Reg r = V::fmadd(n, V::set1(-0.693359375f), x);
+    r = V::fmadd(n, V::set1(2.12194440e-4f), r);
+
+    Reg p = V::set1(1.9875691500e-4f);
+    p = V::fmadd(p, r, V::set1(1.3981999507e-3f));
+    p = V::fmadd(p, r, V::set1(8.3334519073e-3f));
+    p = V::fmadd(p, r, V::set1(4.1665795894e-2f));
+    p = V::fmadd(p, r, V::set1(1.6666665459e-1f));
+    p = V::fmadd(p, r, V::set1(5.0000001201e-1f));
+    p = V::fmadd(p, V::mul(r, r), V::add(r, V::set1(1.0f)));
+
+    return V::mul(p, V::pow2i(n));
+}
+
+template <class V>
+inline typename V::Reg relu(typename V::Reg x) {
+    return V::max(x, V::zero());
+}
+
+template <class V>
+inline typename V::Reg sigmoid(typename V::Reg x) {
+    typename V::Reg one = V::set1(1.0f);
+    return V::div(one, V::add(one, exp<V>(V::sub(V::zero(), x))));
+}
+
+template <class V>
+inline typename V::Reg tanh(typename V::Reg x) {
+    using Reg = typename V::Reg;
+    Reg sign = V::bit_and(x, V::set1(-0.0f));
+    Reg ax = V::bit_andnot(V::set1(-0.0f), x);
+
+    // small |x|: odd polynomial, avoids the cancellation in 1 - 2 / (e + 1)
+    Reg z = V::mul(x, x);
+    Reg p = V::set1(-5.70498872745e-3f);
+    p = V::fmadd(p, z, V::set1(2.06390887954e-2f));
+    p = V::fmadd(p, z, V::set1(-5.37397155531e-2f));
+    p = V::fmadd(p, z, V::set1(1.33314422036e-1f));
+    p = V::fmadd(p, z, V::set1(-3.33332819422e-1f));
+    Reg small = V::fmadd(V::mul(p, z), x, x);
+
+    Reg e = exp<V>(V::add(ax, ax));
+    Reg large = V::sub(V::set1(1.0f), V::div(V::set1(2.0f), V::add(e, V::set1(1.0f))));
+    large = V::bit_or(large, sign);
+
+    return V::select(V::less(ax, V::set1(0.625f)), small, large);
+}
+
+// x * sigmoid(x)
+template <class V>
+inline typename V::Reg silu(typename V::Reg x) {
+    return V::mul(x, sigmoid<V>(x));
+}
+
+// tanh form of GELU, 0.5 x (1 + tanh(sqrt(2 / pi) (x + 0.044715 x^3))), within 5e-4 of the erf
+// definition. evaluated as x * sigmoid(2 u): 1 + tanh(u) cancels for negative x
+template <class V>
+inline typename V::Reg gelu(typename V::Reg x) {
+    typename V::Reg u2 = V::mul(x, V::fmadd(V::set1(0.0713548163f), V::mul(x, x), V::set1(1.5957691216f)));
+    return V::mul(x, sigmoid<V>(u2));
+}
+
+template <class V>
+inline typename V::Reg leaky_relu(typename V::Reg x, float alpha) {
+    return V::select(V::less(V::zero(), x), x, V::mul(V::set1(alpha), x));
+}
+
+template <class V>
+inline typename V::Reg activate(typename V::Reg x, gemm::Activation activation) {
+    switch (activation) {
+        case gemm::Activation::None: return x;
+        case gemm::Activation::ReLU: return relu<V>(x);
+        case gemm::Activation::Sigmoid: return sigmoid<V>(x);
+        case gemm::Activation::Tanh: return tanh<V>(x);
+    }
+    return x;
+}
+
+}
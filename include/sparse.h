@@ -0,0 +1,53 @@
+#pragma once
+
+#include "cpu_dispatch.h"
+#include "gemm.h"
+#include <vector>
+
+// Block-sparse fully connected weights. The [k, n] weight matrix is cut into blocks of
+// block_rows (1 or 4) x kBlockCols values, kBlockCols output columns being one ymm of floats, and
+// only the blocks holding a nonzero are stored: per column panel of kBlockCols outputs, its
+// blocks in order of their first row (the BSR layout of the transposed matrix). The GEMM walks a
+// panel's blocks with the panel's outputs in registers, so both the multiply-adds and the weight
+// bytes read scale with the blocks kept. Pruning whole blocks is what makes that pay: a scattered
+// 90% of zeros still leaves most blocks nonzero.
+namespace sparse {
+
+constexpr int kBlockCols = cpu::kSparseBlockCols;
+
+struct BlockSparseWeights {
+    int k = 0;
+    int n = 0;
+    int block_rows = 0;
+    // the blocks of panel j are [panel_starts[j], panel_starts[j + 1])
+    std::vector<int> panel_starts;
+    // first weight row of each block. the last block row of a k that is not a multiple of
+    // block_rows starts at k - block_rows instead, its rows that belong to the block row
+    // before are zero
+    std::vector<int> block_starts;
+    // block_rows x kBlockCols per block, row-major, columns past n zero
+    std::vector<float> values;
+
+    int panels() const { return (n + kBlockCols - 1) / kBlockCols; }
+    int blocks() const { return static_cast<int>(block_starts.size()); }
+    // blocks kept over all blocks
+    double density() const;
+};
+
+// blocks of the k x n matrix w (row-major) with a nonzero value. block_rows is 1 or 4, anything
+// else throws std::invalid_argument. a k below block_rows is stored with 1-row blocks
+void from_dense(const float* w, int k, int n, int block_rows, BlockSparseWeights& out);
+
+// fraction of the blocks of w that hold a nonzero value, blocks as in from_dense
+double block_density(const float* w, int k, int n, int block_rows);
+
+// zeroes the fraction sparsity of the blocks of w with the smallest sum of squares (magnitude
+// pruning), blocks as in from_dense
+void prune(float* w, int k, int n, int block_rows, float sparsity);
+
+// c = act(a * w + bias), a m x w.k with row stride lda, c m x w.n with row stride ldc, bias per
+// column. column panels go to the thread pool, each read once for all m rows
+void gemm(int m, const float* a, int lda, const BlockSparseWeights& w, float* c, int ldc,
+          const gemm::Epilogue& epilogue);
+
+}
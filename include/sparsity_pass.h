@@ -0,0 +1,42 @@
+#pragma once
+
+#include "optimization_pass.h"
+#include <vector>
+
+// Picks block-sparse or dense weights for every fully connected layer of the graph (see
+// sparse.h). With a prune sparsity each layer is first magnitude pruned to that fraction of zero
+// blocks. A layer whose blocks are at most kMaxDensity nonzero is then timed on a batch of
+// batch_size rows both ways and keeps the faster one; denser layers stay dense untimed. int8
+// layers are left alone. Registered as "sparsify": no pruning, 4 x 8 blocks, batch 1.
+class SparsityPass : public OptimizationPass {
+public:
+    // above this the sparse kernel's indexing costs more than the skipped blocks save
+    static constexpr double kMaxDensity = 0.75;
+
+    struct Decision {
+        int node;
+        double density;
+        // per forward, 0 when not timed
+        double dense_ms;
+        double sparse_ms;
+        bool sparse;
+    };
+
+    explicit SparsityPass(float prune_sparsity = 0.0f, int block_rows = 4, int batch_size = 1)
+        : prune_sparsity_(prune_sparsity), block_rows_(block_rows), batch_size_(batch_size) {}
+
+    using OptimizationPass::apply;
+    void apply(Graph& graph) override;
+
+    // one per layer of the last apply, in topological order
+    const std::vector<Decision>& decisions() const { return decisions_; }
+
+private:
+    float prune_sparsity_;
+    int block_rows_;
+    int batch_size_;
+    std::vector<Decision> decisions_;
+};
+
+// references this translation unit so the static registration is linked in
+void register_sparsity_passes();
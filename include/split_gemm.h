@@ -0,0 +1,55 @@
+#pragma once
+
+#include "gemm.h"
+#include "tensor.h"
+#include <map>
+#include <mutex>
+#include <utility>
+
+// One GEMM on the CPU and the OpenCL device at the same time: the device takes the first rows
+// of A and the CPU threads the rest, each writing its rows of C in place (the device
+// download lands straight in the output tensor, nothing is stitched afterwards). The share
+// of rows is kept per (n, k) and moved after every call towards the ratio of the measured
+// rows per ms, so it follows the load on either side. Without an OpenCL device everything
+// runs on the CPU.
+class SplitGemm {
+public:
+    static SplitGemm& getInstance();
+
+    // c[m, n] = act(a[m, k] * b[k, n] + bias[n]) on contiguous row-major tensors, bias may be
+    // null. resident_b keeps b and bias on the device between calls, for layer parameters.
+    // Callers on several threads take turns enqueueing the device rows, their CPU rows overlap.
+    // The device kernel is shared with opencl_gemm's other users, don't run those at the same time
+    void run(const Tensor& a, const Tensor& b, const Tensor* bias, Tensor& c,
+             gemm::Activation activation = gemm::Activation::None, bool resident_b = false);
+
+    // fraction of the rows the device gets for the next call of this shape
+    double gpu_share(int n, int k);
+    void set_gpu_share(int n, int k, double share);
+
+    struct Split {
+        int gpu_rows = 0;
+        int cpu_rows = 0;
+        // device time from upload start to download end, and CPU wall time
+        double gpu_ms = 0.0;
+        double cpu_ms = 0.0;
+        // share the next call of the shape will use
+        double next_share = 0.0;
+    };
+    Split last_split();
+
+    // never fewer than this share on either side once both run, so both keep being measured
+    static constexpr double kMinShare = 1.0 / 32.0;
+
+private:
+    SplitGemm();
+    double initial_share() const;
+
+    bool has_device_;
+    // guards shares_ and last_
+    std::mutex mutex_;
+    // held while a call enqueues its device rows on the shared buffers and kernel
+    std::mutex enqueue_mutex_;
+    std::map<std::pair<int, int>, double> shares_;
+    Split last_;
+};
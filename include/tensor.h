@@ -1,28 +1,111 @@
 #pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <memory>
 
+class Allocator;
+
+// element type of a tensor's storage. the 16-bit ones are storage only (see half.h): kernels
+// that take them widen to float in registers, everything else works on Float32 tensors
+enum class DType {
+    Float32,
+    Float16,
+    BFloat16
+};
+
+// bytes per element
+size_t dtype_size(DType dtype);
+const char* dtype_name(DType dtype);
+
+// Tensors share their storage: copies, reshape, flatten, slice and transpose are O(1)
+// views described by shape/strides/offset. Use clone() for an independent copy and
+// contiguous() before handing a view to a kernel that assumes dense row-major data.
+// Storage is 64-byte aligned and comes from Allocator::current() unless an allocator is given.
+// Views keep the dtype, shape, strides and offset count elements, not bytes.
 class Tensor {
 public:
-    Tensor(const std::vector<int>& shape, float* data = nullptr);
+    Tensor(const std::vector<int>& shape, float* data = nullptr, Allocator* allocator = nullptr);
+    // zero-filled tensor of dtype
+    Tensor(const std::vector<int>& shape, DType dtype, Allocator* allocator = nullptr);
     Tensor(const Tensor& other);
+    Tensor(Tensor&& other) noexcept;
     Tensor& operator=(const Tensor& other);
+    Tensor& operator=(Tensor&& other) noexcept;
     ~Tensor();
 
     const std::vector<int>& shape() const { return shape_; }
-    float* data() { return data_.get(); }
-    const float* data() const { return data_.get(); }
+    const std::vector<int>& strides() const { return strides_; }
+    int offset() const { return offset_; }
+    int size() const;
+    DType dtype() const { return dtype_; }
+
+    // first element of this view, dense row-major only if is_contiguous(). Float32 only
+    float* data() {
+        assert(dtype_ == DType::Float32);
+        return storage_.get() + offset_;
+    }
+    const float* data() const {
+        assert(dtype_ == DType::Float32);
+        return storage_.get() + offset_;
+    }
+    // the same for Float16 and BFloat16 tensors, raw 16-bit patterns
+    uint16_t* half_data() {
+        assert(dtype_ != DType::Float32);
+        return reinterpret_cast<uint16_t*>(storage_.get()) + offset_;
+    }
+    const uint16_t* half_data() const {
+        assert(dtype_ != DType::Float32);
+        return reinterpret_cast<const uint16_t*>(storage_.get()) + offset_;
+    }
+    // first byte of this view whatever the dtype, e.g. as a key for device copies
+    const void* raw_data() const {
+        return reinterpret_cast<const char*>(storage_.get()) + static_cast<size_t>(offset_) * dtype_size(dtype_);
+    }
+
+    bool is_contiguous() const;
+    bool shares_storage(const Tensor& other) const { return storage_ == other.storage_; }
+
+    // views, no data is copied
+    Tensor reshape(const std::vector<int>& shape) const;
+    Tensor flatten(int start_dim = 1) const;
+    Tensor slice(int begin, int end) const;
+    Tensor transpose(int dim0, int dim1) const;
+
+    // this tensor when already contiguous, otherwise a dense copy
+    Tensor contiguous() const;
+    Tensor clone() const;
+    // dense copy converted to dtype, rounded to nearest even when narrowing. this tensor when it
+    // already has dtype and is contiguous
+    Tensor to(DType dtype, Allocator* allocator = nullptr) const;
 
 private:
+    Tensor(std::shared_ptr<float> storage, const std::vector<int>& shape,
+           const std::vector<int>& strides, int offset, DType dtype);
+
+    static std::vector<int> default_strides(const std::vector<int>& shape);
+
     std::vector<int> shape_;
-    std::unique_ptr<float[]> data_;
+    std::vector<int> strides_;
+    int offset_ = 0;
+    DType dtype_ = DType::Float32;
+    // typed as float whatever the dtype, 16-bit tensors reinterpret it
+    std::shared_ptr<float> storage_;
 };
 
-//arithmetic operations
+//arithmetic operations, shapes broadcast as in NumPy (see elementwise.h)
 Tensor operator+(const Tensor& a, const Tensor& b);
 Tensor operator-(const Tensor& a, const Tensor& b);
 Tensor operator*(const Tensor& a, const Tensor& b);
 Tensor operator/(const Tensor& a, const Tensor& b);
 
 //element-wise operations
-Tensor elementwise_multiply(const Tensor& a, const Tensor& b);
\ No newline at end of file
+Tensor elementwise_multiply(const Tensor& a, const Tensor& b);
+
+// same operations writing into a caller-owned, contiguous result of the broadcast size (may alias a or b)
+void add(const Tensor& a, const Tensor& b, Tensor& result);
+void subtract(const Tensor& a, const Tensor& b, Tensor& result);
+void multiply(const Tensor& a, const Tensor& b, Tensor& result);
+void divide(const Tensor& a, const Tensor& b, Tensor& result);
+void elementwise_multiply(const Tensor& a, const Tensor& b, Tensor& result);
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Process-wide work-stealing pool used by the CPU kernels. A parallel_for range is cut into
+// one contiguous slice per thread. Each thread takes grain-sized chunks off the front of its
+// own slice, and a thread that runs dry steals the back half of another thread's slice.
+// Neighbouring chunks stay on one core and uneven chunks still balance.
+// ANNOF_NUM_THREADS sets the thread count (default: hardware threads), ANNOF_THREAD_AFFINITY=1
+// pins each worker to its own CPU.
+class ThreadPool {
+public:
+    static ThreadPool& getInstance();
+
+    ~ThreadPool();
+
+    // worker threads plus the calling thread
+    int num_threads() const { return num_threads_.load(std::memory_order_relaxed); }
+
+    // restarts the workers so that num_threads() == num_threads (at least 1). waits for running
+    // work, must not be called from inside a task
+    void set_num_threads(int num_threads);
+
+    // pin worker i to the (i + 1)-th CPU of the process affinity mask, the caller keeps its own.
+    // no effect where the OS has no thread affinity
+    void set_affinity(bool pin);
+    bool affinity() const { return pin_threads_; }
+
+    // items per chunk so one chunk outweighs the cost of scheduling it, cost_per_item counted in
+    // simple operations (flops, or floats touched by memory-bound loops)
+    static int grain_for(double cost_per_item);
+
+    // func(chunk_begin, chunk_end) over [begin, end) in chunks of grain items (the last may be
+    // shorter), chunk boundaries at begin + multiples of grain. the caller participates.
+    // calls made from inside a running task execute serially on that thread, so kernels that
+    // use the pool can be nested without oversubscribing the cores.
+    // func is passed by pointer to the workers, nothing is copied or allocated. when a chunk
+    // throws, the chunks not yet started are skipped and the first exception is rethrown on
+    // the caller once every thread is done with the job
+    template <typename Func>
+    void parallel_for(int begin, int end, int grain, Func&& func) {
+        using Callable = std::remove_reference_t<Func>;
+        run_ranges(begin, end, grain, [](const void* context, int chunk_begin, int chunk_end) {
+            (*static_cast<Callable*>(const_cast<void*>(context)))(chunk_begin, chunk_end);
+        }, &func);
+    }
+
+    // runs func(task) for every task in [0, num_tasks), one task per chunk
+    template <typename Func>
+    void run(int num_tasks, Func&& func) {
+        parallel_for(0, num_tasks, 1, [&func](int begin, int end) {
+            for (int task = begin; task < end; ++task) func(task);
+        });
+    }
+
+    // true on a worker thread and on a caller while it runs tasks
+    static bool in_parallel_region();
+
+    // a chunk is worth handing to another thread above this many operations
+    static constexpr double kMinTaskCost = 32768.0;
+
+private:
+    using RangeFunction = void (*)(const void*, int, int);
+
+    // [begin, end) still to run of one thread's slice, packed so thieves and the owner can
+    // claim from it with a single compare-and-swap. own cache line each
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> range{0};
+    };
+
+    explicit ThreadPool(int num_threads);
+    void start_workers(int num_threads);
+    void stop_workers();
+    void run_ranges(int begin, int end, int grain, RangeFunction func, const void* context);
+    void run_slots(int self);
+    bool take_front(int slot, int& chunk_begin, int& chunk_end);
+    bool steal(int self);
+    void worker_loop(int slot, int cpu, uint64_t seen_generation);
+
+    std::vector<std::thread> workers_;
+    std::unique_ptr<Slot[]> slots_;
+    // workers_.size() + 1, readable without run_mutex_ while the workers are restarted
+    std::atomic<int> num_threads_{1};
+    bool pin_threads_ = false;
+
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+
+    RangeFunction job_ = nullptr;
+    const void* job_context_ = nullptr;
+    int job_begin_ = 0;
+    int job_grain_ = 1;
+    int pending_workers_ = 0;
+    // set by the first chunk of the job that throws, its exception under mutex_
+    std::atomic<bool> job_failed_{false};
+    std::exception_ptr job_error_;
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "gemm.h"
+#include <cstddef>
+
+// Winograd F(m x m, 3x3) convolution for 3x3 stride-1 kernels. Each m x m output tile is
+// computed from an (m + 2) x (m + 2) input tile with (m + 2)^2 multiplies per channel pair
+// instead of 9 m^2: 2.25x fewer for m = 2, 4x fewer for m = 4.
+// The transforms use the interpolation points 0, +-1 (and +-2 for m = 4), whose larger
+// coefficients cost accuracy: against the direct path expect errors up to ~1e-6 of the output
+// range for m = 2 and ~1e-5 for m = 4.
+// The transforms are built with AVX2 + FMA, call only when cpu::active_isa() is at least AVX2.
+namespace winograd {
+
+// transformed positions per tile, (m + 2)^2
+int tile_positions(int m);
+
+// filters [out, in, 3, 3] -> [(m + 2)^2, out, in], one GEMM operand per position
+size_t transformed_filter_size(int m, int out_channels, int in_channels);
+void transform_filters(int m, const float* filters, int out_channels, int in_channels, float* transformed);
+
+// output[b, oc] = act(conv3x3(input[b], filters[oc]) + bias[oc]) with zero padding on every
+// side, output is [batch, out_channels, height + 2 * padding - 2, width + 2 * padding - 2].
+// bias may be null
+void conv3x3(int m, const float* input, int batch, int in_channels, int height, int width, int padding,
+             const float* transformed, int out_channels, const float* bias, gemm::Activation activation,
+             float* output);
+
+// The AVX2 halves of conv3x3, in winograd_avx2.cpp. Both work on one tile row, 8 tiles per
+// register, with transformed position p of tile t at p * position_stride + t.
+// strip: the m + 2 zero padded input rows of the tile row, strip_width apart -> v
+void transform_input_row(int m, const float* strip, int strip_width, int tiles_w, float* v, size_t position_stride);
+// mm -> act(y + bias) into the first output_rows (at most m) rows of output
+void transform_output_row(int m, const float* mm, size_t position_stride, int tiles_w, float bias,
+                          gemm::Activation activation, float* output, int output_rows, int output_width);
+
+}
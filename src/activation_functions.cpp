@@ -1,56 +1,237 @@
 #include "activation_functions.h"
+#include "elementwise.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
 #include <cmath>
 
 namespace activation {
 
-Tensor relu(const Tensor& input) {
+static void apply(cpu::MapOp op, const Tensor& input, Tensor& output, float alpha = 0.0f) {
+    elementwise::unary(op, input, output, alpha);
+}
+
+static Tensor apply(cpu::MapOp op, const Tensor& input, float alpha = 0.0f) {
     Tensor output(input.shape());
-    for (int i = 0; i < input.shape()[0] * input.shape()[1]; ++i) {
-        output.data()[i] = std::max(0.0f, input.data()[i]);
-    }
+    apply(op, input, output, alpha);
     return output;
 }
 
-Tensor relu_derivative(const Tensor& input) {
-    Tensor output(input.shape());
-    for (int i = 0; i < input.shape()[0] * input.shape()[1]; ++i) {
-        output.data()[i] = input.data()[i] > 0 ? 1.0f : 0.0f;
+// rows of the last dimension
+static int row_length(const Tensor& x) {
+    return x.shape().empty() ? 1 : x.shape().back();
+}
+
+void relu(const Tensor& input, Tensor& output) {
+    apply(cpu::MapOp::ReLU, input, output);
+}
+
+void relu_derivative(const Tensor& input, Tensor& output) {
+    apply(cpu::MapOp::ReLUDerivative, input, output);
+}
+
+void sigmoid(const Tensor& input, Tensor& output) {
+    apply(cpu::MapOp::Sigmoid, input, output);
+}
+
+void sigmoid_derivative(const Tensor& input, Tensor& output) {
+    apply(cpu::MapOp::SigmoidDerivative, input, output);
+}
+
+void tanh(const Tensor& input, Tensor& output) {
+    apply(cpu::MapOp::Tanh, input, output);
+}
+
+void tanh_derivative(const Tensor& input, Tensor& output) {
+    apply(cpu::MapOp::TanhDerivative, input, output);
+}
+
+void gelu(const Tensor& input, Tensor& output) {
+    apply(cpu::MapOp::GELU, input, output);
+}
+
+void gelu_derivative(const Tensor& input, Tensor& output) {
+    apply(cpu::MapOp::GELUDerivative, input, output);
+}
+
+void silu(const Tensor& input, Tensor& output) {
+    apply(cpu::MapOp::SiLU, input, output);
+}
+
+void silu_derivative(const Tensor& input, Tensor& output) {
+    apply(cpu::MapOp::SiLUDerivative, input, output);
+}
+
+void leaky_relu(const Tensor& input, Tensor& output, float alpha) {
+    apply(cpu::MapOp::LeakyReLU, input, output, alpha);
+}
+
+void leaky_relu_derivative(const Tensor& input, Tensor& output, float alpha) {
+    apply(cpu::MapOp::LeakyReLUDerivative, input, output, alpha);
+}
+
+void softmax(const Tensor& input, Tensor& output) {
+    assert(input.size() == output.size() && output.is_contiguous());
+    if (!input.is_contiguous()) {
+        softmax(input.contiguous(), output);
+        return;
     }
-    return output;
+    // whole rows per thread
+    int cols = row_length(input);
+    const cpu::Kernels& kernels = cpu::kernels();
+    const float* in = input.data();
+    float* out = output.data();
+    int rows = input.size() / cols;
+    ThreadPool::getInstance().parallel_for(0, rows, ThreadPool::grain_for(12.0 * cols), [&](int begin, int end) {
+        kernels.softmax(in + static_cast<size_t>(begin) * cols, out + static_cast<size_t>(begin) * cols, end - begin, cols);
+    });
+}
+
+Tensor relu(const Tensor& input) {
+    return apply(cpu::MapOp::ReLU, input);
+}
+
+Tensor relu_derivative(const Tensor& input) {
+    return apply(cpu::MapOp::ReLUDerivative, input);
 }
 
 Tensor sigmoid(const Tensor& input) {
-    Tensor output(input.shape());
-    for (int i = 0; i < input.shape()[0] * input.shape()[1]; ++i) {
-        output.data()[i] = 1.0f / (1.0f + std::exp(-input.data()[i]));
-    }
-    return output;
+    return apply(cpu::MapOp::Sigmoid, input);
 }
 
 Tensor sigmoid_derivative(const Tensor& input) {
-    Tensor output(input.shape());
-    for (int i = 0; i < input.shape()[0] * input.shape()[1]; ++i) {
-        float s = 1.0f / (1.0f + std::exp(-input.data()[i]));
-        output.data()[i] = s * (1.0f - s);
-    }
-    return output;
+    return apply(cpu::MapOp::SigmoidDerivative, input);
 }
 
 Tensor tanh(const Tensor& input) {
-    Tensor output(input.shape());
-    for (int i = 0; i < input.shape()[0] * input.shape()[1]; ++i) {
-        output.data()[i] = std::tanh(input.data()[i]);
-    }
-    return output;
+    return apply(cpu::MapOp::Tanh, input);
 }
 
 Tensor tanh_derivative(const Tensor& input) {
+    return apply(cpu::MapOp::TanhDerivative, input);
+}
+
+Tensor gelu(const Tensor& input) {
+    return apply(cpu::MapOp::GELU, input);
+}
+
+Tensor gelu_derivative(const Tensor& input) {
+    return apply(cpu::MapOp::GELUDerivative, input);
+}
+
+Tensor silu(const Tensor& input) {
+    return apply(cpu::MapOp::SiLU, input);
+}
+
+Tensor silu_derivative(const Tensor& input) {
+    return apply(cpu::MapOp::SiLUDerivative, input);
+}
+
+Tensor leaky_relu(const Tensor& input, float alpha) {
+    return apply(cpu::MapOp::LeakyReLU, input, alpha);
+}
+
+Tensor leaky_relu_derivative(const Tensor& input, float alpha) {
+    return apply(cpu::MapOp::LeakyReLUDerivative, input, alpha);
+}
+
+Tensor softmax(const Tensor& input) {
     Tensor output(input.shape());
-    for (int i = 0; i < input.shape()[0] * input.shape()[1]; ++i) {
-        float t = std::tanh(input.data()[i]);
-        output.data()[i] = 1.0f - t * t;
-    }
+    softmax(input, output);
     return output;
 }
 
-}
\ No newline at end of file
+void relu_inplace(Tensor& x) {
+    relu(x, x);
+}
+
+void sigmoid_inplace(Tensor& x) {
+    sigmoid(x, x);
+}
+
+void tanh_inplace(Tensor& x) {
+    tanh(x, x);
+}
+
+void gelu_inplace(Tensor& x) {
+    gelu(x, x);
+}
+
+void silu_inplace(Tensor& x) {
+    silu(x, x);
+}
+
+void leaky_relu_inplace(Tensor& x, float alpha) {
+    leaky_relu(x, x, alpha);
+}
+
+void softmax_inplace(Tensor& x) {
+    softmax(x, x);
+}
+
+float reference(cpu::MapOp op, float x, float alpha) {
+    switch (op) {
+        case cpu::MapOp::ReLU: return std::max(0.0f, x);
+        case cpu::MapOp::ReLUDerivative: return x > 0 ? 1.0f : 0.0f;
+        case cpu::MapOp::Sigmoid: return 1.0f / (1.0f + std::exp(-x));
+        case cpu::MapOp::SigmoidDerivative: {
+            float s = 1.0f / (1.0f + std::exp(-x));
+            return s * (1.0f - s);
+        }
+        case cpu::MapOp::Tanh: return std::tanh(x);
+        case cpu::MapOp::TanhDerivative: {
+            float t = std::tanh(x);
+            return 1.0f - t * t;
+        }
+        case cpu::MapOp::GELU: {
+            float u = 0.7978845608f * (x + 0.044715f * x * x * x);
+            return 0.5f * x * (1.0f + std::tanh(u));
+        }
+        case cpu::MapOp::GELUDerivative: {
+            float u = 0.7978845608f * (x + 0.044715f * x * x * x);
+            float t = std::tanh(u);
+            return 0.5f * (1.0f + t) + 0.5f * x * (1.0f - t * t) * 0.7978845608f * (1.0f + 0.134145f * x * x);
+        }
+        case cpu::MapOp::SiLU: return x / (1.0f + std::exp(-x));
+        case cpu::MapOp::SiLUDerivative: {
+            float s = 1.0f / (1.0f + std::exp(-x));
+            return s * (1.0f + x * (1.0f - s));
+        }
+        case cpu::MapOp::LeakyReLU: return x > 0 ? x : alpha * x;
+        case cpu::MapOp::LeakyReLUDerivative: return x > 0 ? 1.0f : alpha;
+        case cpu::MapOp::Scale: return alpha * x;
+    }
+    return x;
+}
+
+void map_baseline(cpu::MapOp op, const Tensor& input, Tensor& output, float alpha) {
+    assert(input.size() == output.size() && output.is_contiguous());
+    if (!input.is_contiguous()) {
+        map_baseline(op, input.contiguous(), output, alpha);
+        return;
+    }
+    const float* in = input.data();
+    float* out = output.data();
+    for (int i = 0; i < input.size(); ++i) {
+        out[i] = reference(op, in[i], alpha);
+    }
+}
+
+void softmax_baseline(const Tensor& input, Tensor& output) {
+    assert(input.size() == output.size() && output.is_contiguous());
+    Tensor x = input.contiguous();
+    int cols = row_length(x);
+    for (int start = 0; start < x.size(); start += cols) {
+        const float* in = x.data() + start;
+        float* out = output.data() + start;
+        float max = *std::max_element(in, in + cols);
+        float sum = 0.0f;
+        for (int j = 0; j < cols; ++j) {
+            out[j] = std::exp(in[j] - max);
+            sum += out[j];
+        }
+        for (int j = 0; j < cols; ++j) out[j] /= sum;
+    }
+}
+
+}
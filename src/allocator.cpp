@@ -0,0 +1,188 @@
+#include "allocator.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+size_t round_up(size_t bytes) {
+    return (bytes + Allocator::kAlignment - 1) / Allocator::kAlignment * Allocator::kAlignment;
+}
+
+void* system_allocate(size_t bytes) {
+    void* ptr = std::aligned_alloc(Allocator::kAlignment, round_up(std::max<size_t>(bytes, 1)));
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+}
+
+thread_local Allocator* Allocator::current_ = nullptr;
+
+Allocator* Allocator::default_allocator() {
+    // never destroyed, tensors with static lifetime may outlive any static pool
+    static PoolAllocator* instance = new PoolAllocator();
+    return instance;
+}
+
+Allocator* Allocator::current() {
+    return current_ ? current_ : default_allocator();
+}
+
+AllocatorStats Allocator::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void Allocator::reset_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t in_use = stats_.bytes_in_use;
+    stats_ = AllocatorStats();
+    stats_.bytes_in_use = in_use;
+    stats_.peak_bytes_in_use = in_use;
+}
+
+void Allocator::record_allocation(size_t bytes, bool from_system, size_t system_bytes) {
+    stats_.allocations++;
+    stats_.bytes_allocated += bytes;
+    stats_.bytes_in_use += bytes;
+    stats_.peak_bytes_in_use = std::max(stats_.peak_bytes_in_use, stats_.bytes_in_use);
+    if (from_system) {
+        stats_.system_allocations++;
+        stats_.system_bytes += system_bytes;
+    }
+}
+
+void Allocator::record_deallocation(size_t bytes) {
+    stats_.deallocations++;
+    stats_.bytes_in_use -= bytes;
+}
+
+PoolAllocator::~PoolAllocator() {
+    release_cached();
+}
+
+int PoolAllocator::size_class(size_t bytes) {
+    int cls = 6;  // 64 bytes, one cache line
+    while ((size_t(1) << cls) < bytes) {
+        ++cls;
+    }
+    return cls;
+}
+
+void* PoolAllocator::allocate(size_t bytes) {
+    int cls = size_class(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (static_cast<int>(free_lists_.size()) <= cls) {
+        free_lists_.resize(cls + 1);
+    }
+
+    std::vector<void*>& free_list = free_lists_[cls];
+    if (!free_list.empty()) {
+        void* ptr = free_list.back();
+        free_list.pop_back();
+        record_allocation(bytes, false, 0);
+        return ptr;
+    }
+
+    void* ptr = system_allocate(size_t(1) << cls);
+    record_allocation(bytes, true, size_t(1) << cls);
+    return ptr;
+}
+
+void PoolAllocator::deallocate(void* ptr, size_t bytes) {
+    if (!ptr) return;
+    int cls = size_class(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_lists_[cls].push_back(ptr);
+    record_deallocation(bytes);
+}
+
+void PoolAllocator::release_cached() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& free_list : free_lists_) {
+        for (void* ptr : free_list) {
+            std::free(ptr);
+        }
+        free_list.clear();
+    }
+}
+
+ArenaAllocator::ArenaAllocator(size_t chunk_bytes)
+    : chunk_bytes_(round_up(chunk_bytes)) {}
+
+ArenaAllocator::~ArenaAllocator() {
+    for (const Chunk& chunk : chunks_) {
+        std::free(chunk.data);
+    }
+}
+
+void* ArenaAllocator::allocate(size_t bytes) {
+    size_t rounded = round_up(std::max<size_t>(bytes, 1));
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    bool from_system = false;
+    size_t system_bytes = 0;
+    if (chunks_.empty() || used_ + rounded > chunks_.back().size) {
+        size_t size = std::max(chunk_bytes_, rounded);
+        chunks_.push_back({static_cast<char*>(system_allocate(size)), size});
+        used_ = 0;
+        from_system = true;
+        system_bytes = size;
+    }
+
+    void* ptr = chunks_.back().data + used_;
+    used_ += rounded;
+    total_used_ += rounded;
+    record_allocation(bytes, from_system, system_bytes);
+    return ptr;
+}
+
+void ArenaAllocator::deallocate(void* ptr, size_t bytes) {
+    if (!ptr) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    record_deallocation(bytes);
+}
+
+void ArenaAllocator::reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // coalesce into a single chunk sized for the last high-water mark
+    if (chunks_.size() > 1) {
+        size_t size = std::max(chunk_bytes_, total_used_);
+        for (const Chunk& chunk : chunks_) {
+            std::free(chunk.data);
+        }
+        chunks_.clear();
+        chunks_.push_back({static_cast<char*>(system_allocate(size)), size});
+        stats_.system_allocations++;
+        stats_.system_bytes += size;
+    }
+
+    used_ = 0;
+    total_used_ = 0;
+}
+
+ScratchBuffer::~ScratchBuffer() {
+    Allocator::default_allocator()->deallocate(data_, capacity_ * sizeof(float));
+}
+
+float* ScratchBuffer::reserve(size_t count) {
+    if (count > capacity_) {
+        Allocator* allocator = Allocator::default_allocator();
+        allocator->deallocate(data_, capacity_ * sizeof(float));
+        data_ = static_cast<float*>(allocator->allocate(count * sizeof(float)));
+        capacity_ = count;
+    }
+    return data_;
+}
+
+AllocatorScope::AllocatorScope(Allocator& allocator)
+    : previous_(Allocator::current_) {
+    Allocator::current_ = &allocator;
+}
+
+AllocatorScope::~AllocatorScope() {
+    Allocator::current_ = previous_;
+}
@@ -1,6 +1,28 @@
 #include "convolutional_layer.h"
+#include "allocator.h"
+#include "cpu_dispatch.h"
+#include "direct_conv.h"
+#include "quantization.h"
+#include "thread_pool.h"
+#include "winograd.h"
+#include <algorithm>
+#include <cassert>
 #include <random>
 #include <cmath>
+#include <cstring>
+
+namespace {
+
+// per-thread im2col matrix, reused across calls
+thread_local ScratchBuffer column_buffer;
+// per-thread quantized image of the int8 path
+thread_local ScratchBuffer image_bytes;
+
+int ceil_div(int a, int b) {
+    return (a + b - 1) / b;
+}
+
+}
 
 ConvolutionalLayer::ConvolutionalLayer(int in_channels, int out_channels, int kernel_size, int stride, int padding)
     : in_channels_(in_channels), out_channels_(out_channels), kernel_size_(kernel_size), stride_(stride), padding_(padding) {
@@ -10,8 +32,9 @@ ConvolutionalLayer::ConvolutionalLayer(int in_channels, int out_channels, int ke
     std::mt19937 gen(rd());
     std::normal_distribution<> d(0, std::sqrt(2.0 / (in_channels * kernel_size * kernel_size)));
 
-    weights_ = std::make_shared<Tensor>(std::vector<int>{out_channels_, in_channels_, kernel_size_, kernel_size_});
-    bias_ = std::make_shared<Tensor>(std::vector<int>{out_channels_});
+    // parameters outlive any per-inference arena, always take them from the pool
+    weights_ = std::make_shared<Tensor>(std::vector<int>{out_channels_, in_channels_, kernel_size_, kernel_size_}, nullptr, Allocator::default_allocator());
+    bias_ = std::make_shared<Tensor>(std::vector<int>{out_channels_}, nullptr, Allocator::default_allocator());
 
     int weight_size = out_channels_ * in_channels_ * kernel_size_ * kernel_size_;
     for (int i = 0; i < weight_size; ++i) {
@@ -23,17 +46,155 @@ ConvolutionalLayer::ConvolutionalLayer(int in_channels, int out_channels, int ke
     }
 }
 
+std::vector<int> ConvolutionalLayer::output_shape(const std::vector<int>& input_shape) const {
+    int output_height = (input_shape[2] + 2 * padding_ - kernel_size_) / stride_ + 1;
+    int output_width = (input_shape[3] + 2 * padding_ - kernel_size_) / stride_ + 1;
+    return {input_shape[0], out_channels_, output_height, output_width};
+}
+
 Tensor ConvolutionalLayer::forward(const Tensor& input) {
-    input_ = std::make_shared<Tensor>(input);
-    Tensor padded_input = pad_input(input);
-    
+    Tensor output(output_shape(input.shape()));
+    forward(input, output);
+    return output;
+}
+
+void ConvolutionalLayer::forward(const Tensor& input, Tensor& output, gemm::Activation activation, Layout layout) {
+    if (!input.is_contiguous()) {
+        forward(input.contiguous(), output, activation, layout);
+        return;
+    }
+
+    if (layout != Layout::NCHW) {
+        const std::vector<int>& shape = input.shape();
+        int height = layout == Layout::NHWC ? shape[1] : shape[2];
+        int width = layout == Layout::NHWC ? shape[2] : shape[3];
+        assert(output.is_contiguous() &&
+               output.shape() == layout::physical_shape(output_shape({shape[0], in_channels_, height, width}), layout));
+        if (cpu::active_isa() < cpu::Isa::AVX2) {
+            // the direct kernels are AVX2 builds, older hosts go through NCHW and the GEMM path
+            Tensor nchw_input({shape[0], in_channels_, height, width});
+            Tensor nchw_output(output_shape(nchw_input.shape()));
+            layout::convert(input, layout, nchw_input, Layout::NCHW);
+            forward(nchw_input, nchw_output, activation, Layout::NCHW);
+            layout::convert(nchw_output, Layout::NCHW, output, layout);
+            return;
+        }
+        direct_conv::conv2d(layout, input.data(), shape[0], in_channels_, height, width, kernel_size_, stride_, padding_,
+                            packed_filters(layout).data(), out_channels_, bias_->data(), activation, output.data());
+        return;
+    }
+
+    // assigning into the existing cache object keeps steady-state calls allocation free
+    if (input_) {
+        *input_ = input;
+    } else {
+        input_ = std::make_shared<Tensor>(input);
+    }
+
+    if (int8_ && !int8_->calibrating) {
+        convolve_int8(input, activation, output);
+        return;
+    }
+    if (int8_) int8_->range.observe(input.data(), input.size());
+
+    ConvAlgorithm algorithm = select_algorithm(input.shape());
+    if (algorithm == ConvAlgorithm::Winograd2x2 || algorithm == ConvAlgorithm::Winograd4x4) {
+        int m = algorithm == ConvAlgorithm::Winograd2x2 ? 2 : 4;
+        assert(output.is_contiguous() && output.size() == input.shape()[0] * out_channels_ *
+               (input.shape()[2] + 2 * padding_ - 2) * (input.shape()[3] + 2 * padding_ - 2));
+        winograd::conv3x3(m, input.data(), input.shape()[0], in_channels_, input.shape()[2], input.shape()[3], padding_,
+                          winograd_filters(m).data(), out_channels_, bias_->data(), activation, output.data());
+        return;
+    }
+
+    convolve(input, *weights_, bias_->data(), activation, output);
+}
+
+ConvAlgorithm ConvolutionalLayer::select_algorithm(const std::vector<int>& input_shape) const {
+    // the tile transforms are AVX2 builds
+    if (cpu::active_isa() < cpu::Isa::AVX2) return ConvAlgorithm::Im2col;
+    bool winograd_shape = kernel_size_ == 3 && stride_ == 1;
+    if (algorithm_ != ConvAlgorithm::Auto) {
+        return winograd_shape ? algorithm_ : ConvAlgorithm::Im2col;
+    }
+
+    // the tile transforms are paid per channel, with few input channels im2col wins
+    if (!winograd_shape || in_channels_ < 16) return ConvAlgorithm::Im2col;
+
+    // 4x4 tiles save the most multiplies but waste work on partial edge tiles of small maps
+    int output_height = input_shape[2] + 2 * padding_ - 2;
+    int output_width = input_shape[3] + 2 * padding_ - 2;
+    return output_height >= 16 && output_width >= 16 ? ConvAlgorithm::Winograd4x4 : ConvAlgorithm::Winograd2x2;
+}
+
+const Tensor& ConvolutionalLayer::winograd_filters(int m) {
+    if (!winograd_filters_ || winograd_tile_ != m || winograd_version_ != weights_version_) {
+        int size = static_cast<int>(winograd::transformed_filter_size(m, out_channels_, in_channels_));
+        if (!winograd_filters_ || winograd_filters_->size() != size) {
+            winograd_filters_ = std::make_shared<Tensor>(std::vector<int>{size}, nullptr, Allocator::default_allocator());
+        }
+        winograd::transform_filters(m, weights_->data(), out_channels_, in_channels_, winograd_filters_->data());
+        winograd_tile_ = m;
+        winograd_version_ = weights_version_;
+    }
+    return *winograd_filters_;
+}
+
+const Tensor& ConvolutionalLayer::packed_filters(Layout layout) {
+    if (!packed_filters_ || packed_layout_ != layout || packed_version_ != weights_version_) {
+        int size = static_cast<int>(direct_conv::packed_filter_size(layout, out_channels_, in_channels_, kernel_size_));
+        if (!packed_filters_ || packed_filters_->size() != size) {
+            packed_filters_ = std::make_shared<Tensor>(std::vector<int>{size}, nullptr, Allocator::default_allocator());
+        }
+        direct_conv::pack_filters(layout, weights_->data(), out_channels_, in_channels_, kernel_size_, packed_filters_->data());
+        packed_layout_ = layout;
+        packed_version_ = weights_version_;
+    }
+    return *packed_filters_;
+}
+
+void ConvolutionalLayer::set_weights(const Tensor& weights) {
+    assert(weights.size() == weights_->size());
+    Tensor dense = weights.contiguous();
+    std::copy(dense.data(), dense.data() + dense.size(), weights_->data());
+    weights_version_++;
+}
+
+void ConvolutionalLayer::quantize_int8() {
+    if (!int8_) int8_ = std::make_shared<quant::LayerState>();
+}
+
+void ConvolutionalLayer::dequantize() {
+    int8_.reset();
+}
+
+void ConvolutionalLayer::set_calibrating(bool calibrating) {
+    quantize_int8();
+    int8_->set_calibrating(calibrating);
+}
+
+void ConvolutionalLayer::forward_baseline(const Tensor& input_view, Tensor& output) {
+    Tensor input = input_view.contiguous();
+
     int batch_size = input.shape()[0];
     int input_height = input.shape()[2];
     int input_width = input.shape()[3];
     int output_height = (input_height + 2 * padding_ - kernel_size_) / stride_ + 1;
     int output_width = (input_width + 2 * padding_ - kernel_size_) / stride_ + 1;
 
-    Tensor output(std::vector<int>{batch_size, out_channels_, output_height, output_width});
+    const Tensor* source = &input;
+    if (padding_ > 0) {
+        int padded_height = input_height + 2 * padding_;
+        int padded_width = input_width + 2 * padding_;
+        if (!padded_ || padded_->shape()[0] != batch_size ||
+            padded_->shape()[2] != padded_height || padded_->shape()[3] != padded_width) {
+            padded_ = std::make_shared<Tensor>(std::vector<int>{batch_size, in_channels_, padded_height, padded_width},
+                                               nullptr, Allocator::default_allocator());
+        }
+        pad_input(input, *padded_);
+        source = padded_.get();
+    }
+    const Tensor& padded_input = *source;
 
     for (int b = 0; b < batch_size; ++b) {
         for (int oc = 0; oc < out_channels_; ++oc) {
@@ -61,23 +222,209 @@ Tensor ConvolutionalLayer::forward(const Tensor& input) {
             }
         }
     }
+}
+
+
+void ConvolutionalLayer::convolve(const Tensor& input, const Tensor& kernel, const float* bias,
+                                  gemm::Activation activation, Tensor& output) const {
+    int batch_size = input.shape()[0];
+    int height = input.shape()[2];
+    int width = input.shape()[3];
+    int output_height = (height + 2 * padding_ - kernel_size_) / stride_ + 1;
+    int output_width = (width + 2 * padding_ - kernel_size_) / stride_ + 1;
+    assert(input.is_contiguous() && kernel.is_contiguous() && output.is_contiguous());
+    assert(output.size() == batch_size * out_channels_ * output_height * output_width);
+
+    // per image: [out_channels x k] * [k x pixels], the weights are already row-major [oc, ic*kh*kw]
+    int m = out_channels_;
+    int k = in_channels_ * kernel_size_ * kernel_size_;
+    int n = output_height * output_width;
+    // a 1x1 stride-1 kernel without padding reads the image itself as the column matrix
+    bool direct = kernel_size_ == 1 && stride_ == 1 && padding_ == 0;
+
+    gemm::Epilogue epilogue;
+    epilogue.bias = bias;
+    epilogue.bias_per_row = true;
+    epilogue.activation = activation;
+
+    auto convolve_image = [&](int b) {
+        const float* image = input.data() + static_cast<size_t>(b) * in_channels_ * height * width;
+        const float* columns = image;
+        if (!direct) {
+            float* buffer = column_buffer.reserve(static_cast<size_t>(k) * n);
+            im2col(image, height, width, output_height, output_width, buffer);
+            columns = buffer;
+        }
+        gemm::sgemm(false, false, m, n, k, 1.0f, kernel.data(), k, columns, n,
+                    0.0f, output.data() + static_cast<size_t>(b) * m * n, n, epilogue);
+    };
+
+    // with an image per thread each task runs a serial GEMM on its own image, otherwise
+    // images go one at a time and the GEMM splits output channels x pixels across the pool
+    ThreadPool& pool = ThreadPool::getInstance();
+    if (batch_size >= pool.num_threads()) {
+        pool.run(batch_size, convolve_image);
+    } else {
+        for (int b = 0; b < batch_size; ++b) {
+            convolve_image(b);
+        }
+    }
+}
+
+void ConvolutionalLayer::convolve_int8(const Tensor& input, gemm::Activation activation, Tensor& output) {
+    int batch_size = input.shape()[0];
+    int height = input.shape()[2];
+    int width = input.shape()[3];
+    int output_height = (height + 2 * padding_ - kernel_size_) / stride_ + 1;
+    int output_width = (width + 2 * padding_ - kernel_size_) / stride_ + 1;
+    int pixels = output_height * output_width;
+    // taps in (kh, kw, channel) order with channels padded to whole groups of 4, so a tap is
+    // whole groups and im2row copies 4 bytes at a time from a channel-minor image
+    int channels = (in_channels_ + 3) / 4 * 4;
+    int taps = kernel_size_ * kernel_size_;
+    int k = taps * channels;
+    assert(output.is_contiguous() && output.size() == batch_size * out_channels_ * pixels);
+
+    quant::LayerState& state = *int8_;
+    if (!state.current(weights_version_)) {
+        // [oc, k] in the tap order above, padding channels get zero weights
+        std::vector<float> filters(static_cast<size_t>(out_channels_) * k, 0.0f);
+        for (int oc = 0; oc < out_channels_; ++oc) {
+            for (int ic = 0; ic < in_channels_; ++ic) {
+                for (int tap = 0; tap < taps; ++tap) {
+                    filters[static_cast<size_t>(oc) * k + tap * channels + ic] =
+                        weights_->data()[(static_cast<size_t>(oc) * in_channels_ + ic) * taps + tap];
+                }
+            }
+        }
+        // read transposed as the [k, oc] GEMM operand
+        quant::quantize_weights(filters.data(), k, out_channels_, 1, k, bias_->data(), state.weights);
+        state.weights_version = weights_version_;
+        state.quantized_weights = true;
+    }
+
+    // per image: [pixels x k] * [k x oc] with a row per output pixel, so the u8 activations are
+    // the left operand the kernel wants, then transposed back to channel planes
+    int plane = height * width;
+    int image_size = in_channels_ * plane;
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(image_bytes.reserve((static_cast<size_t>(image_size) + plane * channels + 3) / 4));
+    uint8_t* interleaved = bytes + image_size;
+    float* staged = column_buffer.reserve(static_cast<size_t>(pixels) * out_channels_);
+    quant::QuantizedActivations& rows = state.activations;
+    rows.resize(pixels, k);
+    ThreadPool& pool = ThreadPool::getInstance();
+
+    for (int b = 0; b < batch_size; ++b) {
+        const float* image = input.data() + static_cast<size_t>(b) * image_size;
+        quant::ActivationParams params;
+        if (const quant::ActivationParams* fixed = state.fixed_params()) {
+            params = *fixed;
+        } else {
+            quant::ActivationRange range;
+            range.observe(image, image_size);
+            params = quant::activation_params(range.min, range.max);
+        }
+        std::fill(rows.scales.begin(), rows.scales.end(), params.scale);
+        std::fill(rows.zeros.begin(), rows.zeros.end(), params.zero);
+
+        uint8_t pad = static_cast<uint8_t>(params.zero);
+        pool.parallel_for(0, height, ThreadPool::grain_for(4.0 * in_channels_ * width), [&](int begin, int end) {
+            for (int ic = 0; ic < in_channels_; ++ic) {
+                size_t offset = static_cast<size_t>(ic) * plane + begin * width;
+                quant::quantize(image + offset, (end - begin) * width, params, bytes + offset);
+            }
+            for (int p = begin * width; p < end * width; ++p) {
+                uint8_t* pixel = interleaved + static_cast<size_t>(p) * channels;
+                for (int ic = 0; ic < in_channels_; ++ic) pixel[ic] = bytes[static_cast<size_t>(ic) * plane + p];
+                for (int ic = in_channels_; ic < channels; ++ic) pixel[ic] = pad;
+            }
+        });
+        pool.parallel_for(0, pixels, ThreadPool::grain_for(k), [&](int begin, int end) {
+            im2row(interleaved, height, width, output_width, pad, begin, end, rows);
+        });
+        quant::gemm(rows, state.weights, activation, staged, out_channels_);
+
+        float* planes = output.data() + static_cast<size_t>(b) * out_channels_ * pixels;
+        pool.parallel_for(0, out_channels_, ThreadPool::grain_for(2.0 * pixels), [&](int begin, int end) {
+            for (int oc = begin; oc < end; ++oc) {
+                float* out = planes + static_cast<size_t>(oc) * pixels;
+                for (int p = 0; p < pixels; ++p) out[p] = staged[static_cast<size_t>(p) * out_channels_ + oc];
+            }
+        });
+    }
+}
+
+void ConvolutionalLayer::im2row(const uint8_t* image, int height, int width, int output_width, uint8_t pad,
+                                int begin, int end, quant::QuantizedActivations& rows) const {
+    int group_stride = rows.group_stride();
+    int groups = rows.k_groups / (kernel_size_ * kernel_size_);
+    for (int i = begin; i < end; ++i) {
+        uint8_t* dst = rows.row(i);
+        int oh = i / output_width;
+        int ow = i % output_width;
+        for (int kh = 0; kh < kernel_size_; ++kh) {
+            int ih = oh * stride_ - padding_ + kh;
+            for (int kw = 0; kw < kernel_size_; ++kw) {
+                int iw = ow * stride_ - padding_ + kw;
+                if (ih < 0 || ih >= height || iw < 0 || iw >= width) {
+                    for (int g = 0; g < groups; ++g) std::memset(dst + g * group_stride, pad, 4);
+                } else {
+                    const uint8_t* src = image + (static_cast<size_t>(ih) * width + iw) * groups * 4;
+                    for (int g = 0; g < groups; ++g) std::memcpy(dst + g * group_stride, src + g * 4, 4);
+                }
+                dst += groups * group_stride;
+            }
+        }
+    }
+}
 
+Tensor ConvolutionalLayer::convolve(const Tensor& input, const Tensor& kernel) const {
+    Tensor output(output_shape(input.shape()));
+    convolve(input.contiguous(), kernel.contiguous(), nullptr, gemm::Activation::None, output);
     return output;
 }
 
+void ConvolutionalLayer::im2col(const float* image, int height, int width, int output_height, int output_width,
+                                float* columns) const {
+    for (int ic = 0; ic < in_channels_; ++ic) {
+        const float* channel = image + static_cast<size_t>(ic) * height * width;
+        for (int kh = 0; kh < kernel_size_; ++kh) {
+            for (int kw = 0; kw < kernel_size_; ++kw) {
+                // output columns whose tap lands inside the row, the rest are padding
+                int ow_begin = std::min(output_width, ceil_div(std::max(0, padding_ - kw), stride_));
+                int ow_end = std::max(ow_begin, std::min(output_width, ceil_div(std::max(0, width + padding_ - kw), stride_)));
+
+                for (int oh = 0; oh < output_height; ++oh) {
+                    float* dst = columns + oh * output_width;
+                    int ih = oh * stride_ - padding_ + kh;
+                    if (ih < 0 || ih >= height) {
+                        std::fill(dst, dst + output_width, 0.0f);
+                        continue;
+                    }
 
-Tensor ConvolutionalLayer::pad_input(const Tensor& input) const {
-    if (padding_ == 0) {
-        return input;
+                    const float* row = channel + static_cast<size_t>(ih) * width;
+                    std::fill(dst, dst + ow_begin, 0.0f);
+                    if (stride_ == 1) {
+                        std::copy(row + ow_begin - padding_ + kw, row + ow_end - padding_ + kw, dst + ow_begin);
+                    } else {
+                        for (int ow = ow_begin; ow < ow_end; ++ow) {
+                            dst[ow] = row[ow * stride_ - padding_ + kw];
+                        }
+                    }
+                    std::fill(dst + ow_end, dst + output_width, 0.0f);
+                }
+                columns += static_cast<size_t>(output_height) * output_width;
+            }
+        }
     }
+}
 
+void ConvolutionalLayer::pad_input(const Tensor& input, Tensor& padded) const {
     int batch_size = input.shape()[0];
     int channels = input.shape()[1];
     int height = input.shape()[2];
     int width = input.shape()[3];
 
-    Tensor padded(std::vector<int>{batch_size, channels, height + 2 * padding_, width + 2 * padding_});
-
     for (int b = 0; b < batch_size; ++b) {
         for (int c = 0; c < channels; ++c) {
             for (int h = 0; h < height; ++h) {
@@ -92,6 +439,4 @@ Tensor ConvolutionalLayer::pad_input(const Tensor& input) const {
             }
         }
     }
-
-    return padded;
 }
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include "cpu_dispatch.h"
+#include <atomic>
+#include <cpuid.h>
+#include <cstdlib>
+#include <iostream>
+
+namespace cpu {
+
+namespace {
+
+// XCR0, the register state the OS saves on a context switch
+unsigned long long xgetbv() {
+    unsigned int lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<unsigned long long>(hi) << 32) | lo;
+}
+
+Isa probe() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return Isa::SSE;
+    bool fma = ecx & bit_FMA;
+    bool f16c = ecx & bit_F16C;
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) return Isa::SSE;
+
+    // xmm and ymm state, without it the OS would corrupt the upper halves
+    unsigned long long xcr0 = xgetbv();
+    if ((xcr0 & 0x6) != 0x6) return Isa::SSE;
+    if (__get_cpuid_max(0, nullptr) < 7) return Isa::SSE;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (!(ebx & bit_AVX2) || !fma || !f16c) return Isa::SSE;
+
+    // opmask registers, upper zmm halves and zmm16-31. BW for the byte multiply of the int8
+    // kernel, every AVX-512 server core since Skylake has it
+    if (!(ebx & bit_AVX512F) || !(ebx & bit_AVX512BW) || (xcr0 & 0xe0) != 0xe0) return Isa::AVX2;
+    if (ecx & bit_AVX512VNNI) return Isa::AVX512VNNI;
+    return Isa::AVX512;
+}
+
+Isa lower(Isa isa) {
+    return static_cast<Isa>(static_cast<int>(isa) - 1);
+}
+
+const Kernels* initial() {
+    Isa isa = detect();
+    const char* forced = std::getenv("ANNOF_CPU_ISA");
+    if (forced) {
+        Isa requested;
+        if (!parse_isa(forced, requested)) {
+            std::cerr << "ANNOF_CPU_ISA=" << forced << " is not sse, avx2, avx512 or avx512vnni, using " << isa_name(isa) << std::endl;
+        } else if (requested > isa) {
+            std::cerr << "ANNOF_CPU_ISA=" << forced << " but this host only runs up to " << isa_name(isa) << std::endl;
+        } else {
+            isa = requested;
+        }
+    }
+    // SSE is always built, the others only when the compiler knows their flags
+    while (!kernels_for(isa)) isa = lower(isa);
+    return kernels_for(isa);
+}
+
+std::atomic<const Kernels*>& active() {
+    static std::atomic<const Kernels*> table{initial()};
+    return table;
+}
+
+}
+
+const char* isa_name(Isa isa) {
+    switch (isa) {
+        case Isa::SSE: return "sse";
+        case Isa::AVX2: return "avx2";
+        case Isa::AVX512: return "avx512";
+        case Isa::AVX512VNNI: return "avx512vnni";
+    }
+    return "unknown";
+}
+
+bool parse_isa(const std::string& name, Isa& isa) {
+    for (Isa candidate : {Isa::SSE, Isa::AVX2, Isa::AVX512, Isa::AVX512VNNI}) {
+        if (name == isa_name(candidate)) {
+            isa = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+Isa detect() {
+    static const Isa isa = probe();
+    return isa;
+}
+
+const Kernels& kernels() {
+    return *active().load(std::memory_order_acquire);
+}
+
+Isa active_isa() {
+    return kernels().isa;
+}
+
+bool set_isa(Isa isa) {
+    const Kernels* table = kernels_for(isa);
+    if (isa > detect() || !table) return false;
+    active().store(table, std::memory_order_release);
+    return true;
+}
+
+const Kernels* kernels_for(Isa isa) {
+    switch (isa) {
+        case Isa::SSE: return sse_kernels();
+        case Isa::AVX2: return avx2_kernels();
+        case Isa::AVX512: return avx512_kernels();
+        case Isa::AVX512VNNI: return avx512_vnni_kernels();
+    }
+    return nullptr;
+}
+
+}
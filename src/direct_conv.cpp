@@ -0,0 +1,61 @@
+#include "direct_conv.h"
+#include "thread_pool.h"
+#include <algorithm>
+
+namespace direct_conv {
+
+namespace {
+
+constexpr int kBlock = layout::kChannelBlock;
+
+int ceil_div(int a, int b) {
+    return (a + b - 1) / b;
+}
+
+}
+
+size_t packed_filter_size(Layout layout, int out_channels, int in_channels, int kernel_size) {
+    size_t in = layout == Layout::NCHW8c ? ceil_div(in_channels, kBlock) * kBlock : in_channels;
+    return static_cast<size_t>(ceil_div(out_channels, kBlock)) * kBlock * in * kernel_size * kernel_size;
+}
+
+void pack_filters(Layout layout, const float* filters, int out_channels, int in_channels, int kernel_size,
+                  float* packed) {
+    int taps = kernel_size * kernel_size;
+    int in_blocks = ceil_div(in_channels, kBlock);
+    std::fill(packed, packed + packed_filter_size(layout, out_channels, in_channels, kernel_size), 0.0f);
+
+    for (int oc = 0; oc < out_channels; ++oc) {
+        int block = oc / kBlock;
+        int o = oc % kBlock;
+        for (int ic = 0; ic < in_channels; ++ic) {
+            for (int t = 0; t < taps; ++t) {
+                float value = filters[(static_cast<size_t>(oc) * in_channels + ic) * taps + t];
+                size_t index;
+                if (layout == Layout::NHWC) {
+                    index = ((static_cast<size_t>(block) * taps + t) * in_channels + ic) * kBlock + o;
+                } else {
+                    size_t group = static_cast<size_t>(block) * in_blocks + ic / kBlock;
+                    index = ((group * taps + t) * kBlock + ic % kBlock) * kBlock + o;
+                }
+                packed[index] = value;
+            }
+        }
+    }
+}
+
+void conv2d(Layout layout, const float* input, int batch, int in_channels, int height, int width,
+            int kernel_size, int stride, int padding, const float* packed, int out_channels,
+            const float* bias, gemm::Activation activation, float* output) {
+    Conv conv{layout, input, in_channels, height, width, kernel_size, stride, padding, packed, out_channels,
+              bias, activation, output};
+    int output_height = (height + 2 * padding - kernel_size) / stride + 1;
+    // a task is one output row of one image for a pair of output channel blocks
+    int pairs = ceil_div(ceil_div(out_channels, kBlock), 2);
+    int tasks = batch * pairs * output_height;
+    ThreadPool::getInstance().parallel_for(0, tasks, 1, [&](int begin, int end) {
+        conv2d_tasks(conv, begin, end);
+    });
+}
+
+}
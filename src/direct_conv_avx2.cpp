@@ -0,0 +1,263 @@
+#include "direct_conv.h"
+#include "simd_math.h"
+#include <immintrin.h>
+
+// The only direct convolution file built with -mavx2 -mfma. As in simd_kernels.h nothing here
+// calls std:: helpers or other inline code the baseline files also instantiate: the linker keeps
+// one copy of such a function, and it may be the AVX2 one.
+namespace direct_conv {
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+namespace {
+
+constexpr int kBlock = layout::kChannelBlock;
+// output pixels per register strip, 6 x 2 accumulators leave room for the operands
+constexpr int kStrip = 6;
+// input channels reduced per sweep over an output row, their filters for two output blocks
+// (32 x 9 taps x 16 floats for 3x3) stay in L1 while every strip of the row reuses them
+constexpr int kChunkChannels = 32;
+
+// Both layouts are a sequence of channel groups, each contiguous per pixel: one group of all
+// the channels for NHWC, ceil(in / 8) groups of 8 for NCHW8c. Everything below is in floats.
+struct Geometry {
+    int height, width, kernel_size, stride, padding;
+    int groups;
+    int group_channels;
+    size_t input_group_stride;
+    size_t pixel_stride;
+    size_t filter_group_stride;
+    size_t filter_tap_stride;
+    // between the packed filters of two output channel blocks
+    size_t filter_block_stride;
+};
+
+// a slice of the reduction, groups [group_begin, group_end) x channels [channel_begin, channel_end)
+struct Chunk {
+    int group_begin, group_end;
+    int channel_begin, channel_end;
+    bool first, last;
+};
+
+int ceil_div(int a, int b) {
+    return (a + b - 1) / b;
+}
+
+int min(int a, int b) {
+    return a < b ? a : b;
+}
+
+int max(int a, int b) {
+    return a > b ? a : b;
+}
+
+// acc[p][j] += input(pixel p) * filters(block j) over the taps and channels of chunk, for P
+// pixels of output row oh starting at ow. Border strips are single pixels whose taps may fall
+// into the padding. C is the channel count of a group when known at compile time (NCHW8c), so
+// the channel loop unrolls, and 0 otherwise
+template <int P, int NB, bool Border, int C>
+void accumulate_strip(const Geometry& g, const Chunk& chunk, const float* image, const float* filters,
+                      int oh, int ow, __m256 (&result)[P][NB]) {
+    static_assert(!Border || P == 1, "border pixels go one at a time");
+    // a local copy the compiler keeps in registers across the whole reduction
+    __m256 acc[P][NB];
+    for (int p = 0; p < P; ++p) {
+        for (int j = 0; j < NB; ++j) acc[p][j] = result[p][j];
+    }
+    size_t step = static_cast<size_t>(g.stride) * g.pixel_stride;
+    for (int group = chunk.group_begin; group < chunk.group_end; ++group) {
+        const float* plane = image + group * g.input_group_stride;
+        const float* group_filters = filters + group * g.filter_group_stride;
+        for (int kh = 0; kh < g.kernel_size; ++kh) {
+            int ih = oh * g.stride - g.padding + kh;
+            if (ih < 0 || ih >= g.height) continue;
+            const float* row = plane + static_cast<size_t>(ih) * g.width * g.pixel_stride;
+            for (int kw = 0; kw < g.kernel_size; ++kw) {
+                int iw = ow * g.stride - g.padding + kw;
+                if (Border && (iw < 0 || iw >= g.width)) continue;
+
+                const float* src = row + static_cast<size_t>(iw) * g.pixel_stride;
+                const float* w = group_filters + (kh * g.kernel_size + kw) * g.filter_tap_stride;
+                int channel_end = C ? C : chunk.channel_end;
+                for (int c = C ? 0 : chunk.channel_begin; c < channel_end; ++c) {
+                    __m256 weights[NB];
+                    for (int j = 0; j < NB; ++j) {
+                        weights[j] = _mm256_loadu_ps(w + j * g.filter_block_stride + c * kBlock);
+                    }
+                    for (int p = 0; p < P; ++p) {
+                        __m256 x = _mm256_broadcast_ss(src + p * step + c);
+                        for (int j = 0; j < NB; ++j) {
+                            acc[p][j] = simd::Avx2::fmadd(x, weights[j], acc[p][j]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    for (int p = 0; p < P; ++p) {
+        for (int j = 0; j < NB; ++j) result[p][j] = acc[p][j];
+    }
+}
+
+// where and how many channels of an output block are written
+struct OutputBlock {
+    float* pixel;
+    size_t pixel_stride;
+    int lanes;
+};
+
+// the first chunk starts from the bias, later ones from the partial sums in the output,
+// the last one applies the activation
+template <int P, int NB, bool Border, int C>
+void conv_strip(const Geometry& g, const Chunk& chunk, const float* image, const float* filters,
+                const __m256 (&bias)[2], gemm::Activation activation, int oh, int ow, const OutputBlock (&out)[2]) {
+    alignas(32) static const int mask_table[2 * kBlock] = {-1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    __m256i mask[NB];
+    __m256 acc[P][NB];
+    for (int j = 0; j < NB; ++j) {
+        mask[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask_table + kBlock - out[j].lanes));
+        for (int p = 0; p < P; ++p) {
+            acc[p][j] = chunk.first ? bias[j] : _mm256_maskload_ps(out[j].pixel + (ow + p) * out[j].pixel_stride, mask[j]);
+        }
+    }
+    accumulate_strip<P, NB, Border, C>(g, chunk, image, filters, oh, ow, acc);
+
+    for (int j = 0; j < NB; ++j) {
+        for (int p = 0; p < P; ++p) {
+            __m256 y = chunk.last ? simd::activate<simd::Avx2>(acc[p][j], activation) : acc[p][j];
+            float* dst = out[j].pixel + (ow + p) * out[j].pixel_stride;
+            if (out[j].lanes == kBlock) {
+                _mm256_storeu_ps(dst, y);
+            } else {
+                _mm256_maskstore_ps(dst, mask[j], y);
+            }
+        }
+    }
+}
+
+// one output row for NB output channel blocks, one sweep per chunk of the reduction:
+// border pixels singly, the interior in strips
+template <int NB, int C>
+void conv_row(const Geometry& g, int output_width, const float* image, const float* filters,
+              const __m256 (&bias)[2], gemm::Activation activation, int oh, const OutputBlock (&out)[2]) {
+    // outputs whose taps all land inside the row
+    int interior_begin = min(output_width, ceil_div(g.padding, g.stride));
+    int last_start = g.width - g.kernel_size + g.padding;
+    int interior_end = last_start < 0 ? 0 : min(output_width, last_start / g.stride + 1);
+    interior_end = max(interior_end, interior_begin);
+
+    // NHWC splits its single group by channels, NCHW8c takes several groups at once
+    int chunk_groups = max(1, kChunkChannels / g.group_channels);
+    int chunk_channels = min(g.group_channels, kChunkChannels);
+    for (int group = 0; group < g.groups; group += chunk_groups) {
+        for (int channel = 0; channel < g.group_channels; channel += chunk_channels) {
+            Chunk chunk;
+            chunk.group_begin = group;
+            chunk.group_end = min(g.groups, group + chunk_groups);
+            chunk.channel_begin = channel;
+            chunk.channel_end = min(g.group_channels, channel + chunk_channels);
+            chunk.first = group == 0 && channel == 0;
+            chunk.last = chunk.group_end == g.groups && chunk.channel_end == g.group_channels;
+
+            int ow = 0;
+            for (; ow < interior_begin; ++ow) {
+                conv_strip<1, NB, true, C>(g, chunk, image, filters, bias, activation, oh, ow, out);
+            }
+            for (; ow + kStrip <= interior_end; ow += kStrip) {
+                conv_strip<kStrip, NB, false, C>(g, chunk, image, filters, bias, activation, oh, ow, out);
+            }
+            for (; ow < interior_end; ++ow) {
+                conv_strip<1, NB, false, C>(g, chunk, image, filters, bias, activation, oh, ow, out);
+            }
+            for (; ow < output_width; ++ow) {
+                conv_strip<1, NB, true, C>(g, chunk, image, filters, bias, activation, oh, ow, out);
+            }
+        }
+    }
+}
+
+}
+
+void conv2d_tasks(const Conv& conv, int begin, int end) {
+    int output_height = (conv.height + 2 * conv.padding - conv.kernel_size) / conv.stride + 1;
+    int output_width = (conv.width + 2 * conv.padding - conv.kernel_size) / conv.stride + 1;
+    int taps = conv.kernel_size * conv.kernel_size;
+    int in_blocks = ceil_div(conv.in_channels, kBlock);
+    int out_blocks = ceil_div(conv.out_channels, kBlock);
+    int pairs = ceil_div(out_blocks, 2);
+
+    Geometry g;
+    g.height = conv.height;
+    g.width = conv.width;
+    g.kernel_size = conv.kernel_size;
+    g.stride = conv.stride;
+    g.padding = conv.padding;
+    size_t image_size;
+    if (conv.layout == Layout::NHWC) {
+        g.groups = 1;
+        g.group_channels = conv.in_channels;
+        g.input_group_stride = 0;
+        g.pixel_stride = conv.in_channels;
+        g.filter_group_stride = 0;
+        g.filter_tap_stride = static_cast<size_t>(conv.in_channels) * kBlock;
+        image_size = static_cast<size_t>(conv.height) * conv.width * conv.in_channels;
+    } else {
+        g.groups = in_blocks;
+        g.group_channels = kBlock;
+        g.input_group_stride = static_cast<size_t>(conv.height) * conv.width * kBlock;
+        g.pixel_stride = kBlock;
+        g.filter_group_stride = static_cast<size_t>(taps) * kBlock * kBlock;
+        g.filter_tap_stride = kBlock * kBlock;
+        image_size = static_cast<size_t>(in_blocks) * conv.height * conv.width * kBlock;
+    }
+    g.filter_block_stride = g.groups * taps * g.group_channels * kBlock;
+
+    for (int task = begin; task < end; ++task) {
+        int oh = task % output_height;
+        int pair = (task / output_height) % pairs;
+        int b = task / (output_height * pairs);
+        int first_block = 2 * pair;
+        int blocks = min(2, out_blocks - first_block);
+
+        __m256 block_bias[2];
+        OutputBlock out[2];
+        for (int j = 0; j < blocks; ++j) {
+            int oc = (first_block + j) * kBlock;
+            int lanes = min(kBlock, conv.out_channels - oc);
+            alignas(32) float lane_bias[kBlock] = {};
+            for (int l = 0; conv.bias && l < lanes; ++l) lane_bias[l] = conv.bias[oc + l];
+            block_bias[j] = _mm256_load_ps(lane_bias);
+
+            if (conv.layout == Layout::NHWC) {
+                size_t row = (static_cast<size_t>(b) * output_height + oh) * output_width;
+                out[j] = {conv.output + row * conv.out_channels + oc, static_cast<size_t>(conv.out_channels), lanes};
+            } else {
+                // padding channels of the last block are written too, as act(0)
+                size_t row = (static_cast<size_t>(b) * out_blocks + first_block + j) * output_height + oh;
+                out[j] = {conv.output + row * output_width * kBlock, kBlock, kBlock};
+            }
+        }
+
+        const float* image = conv.input + b * image_size;
+        const float* filters = conv.packed + first_block * g.filter_block_stride;
+        gemm::Activation activation = conv.activation;
+        bool blocked = conv.layout == Layout::NCHW8c;
+        if (blocks == 2) {
+            blocked ? conv_row<2, kBlock>(g, output_width, image, filters, block_bias, activation, oh, out)
+                    : conv_row<2, 0>(g, output_width, image, filters, block_bias, activation, oh, out);
+        } else {
+            blocked ? conv_row<1, kBlock>(g, output_width, image, filters, block_bias, activation, oh, out)
+                    : conv_row<1, 0>(g, output_width, image, filters, block_bias, activation, oh, out);
+        }
+    }
+}
+
+#else
+
+// without AVX2 support in the compiler the layer never picks the direct path
+void conv2d_tasks(const Conv&, int, int) {}
+
+#endif
+
+}
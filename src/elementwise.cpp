@@ -0,0 +1,219 @@
+#include "elementwise.h"
+#include "thread_pool.h"
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include <stdexcept>
+
+namespace elementwise {
+
+namespace {
+
+// output dims with the stride each operand is read with, 0 where it is broadcast
+struct Walk {
+    int dims = 0;
+    int shape[kMaxDims];
+    int a_strides[kMaxDims];
+    int b_strides[kMaxDims];
+};
+
+// stride of x for dim d of a rank-rank output, 0 for missing and size-1 dims
+int broadcast_stride(const Tensor& x, int d, int rank) {
+    int xd = d - (rank - static_cast<int>(x.shape().size()));
+    if (xd < 0 || x.shape()[xd] == 1) return 0;
+    return x.strides()[xd];
+}
+
+// size-1 dims are dropped and a dim is merged into the one before it when both operands step
+// through the pair as one contiguous run, so dense operands become a single dim
+Walk plan(const std::vector<int>& shape, const Tensor& a, const Tensor& b) {
+    Walk walk;
+    int rank = static_cast<int>(shape.size());
+    for (int d = 0; d < rank; ++d) {
+        if (shape[d] == 1) continue;
+        int as = broadcast_stride(a, d, rank);
+        int bs = broadcast_stride(b, d, rank);
+        int last = walk.dims - 1;
+        if (last >= 0 && walk.a_strides[last] == as * shape[d] && walk.b_strides[last] == bs * shape[d]) {
+            walk.shape[last] *= shape[d];
+            walk.a_strides[last] = as;
+            walk.b_strides[last] = bs;
+            continue;
+        }
+        assert(walk.dims < kMaxDims);
+        walk.shape[walk.dims] = shape[d];
+        walk.a_strides[walk.dims] = as;
+        walk.b_strides[walk.dims] = bs;
+        ++walk.dims;
+    }
+    if (walk.dims == 0) {
+        walk.shape[0] = 1;
+        walk.a_strides[0] = 0;
+        walk.b_strides[0] = 0;
+        walk.dims = 1;
+    }
+    return walk;
+}
+
+// grain in whole cache lines of output, so two threads never write the same line
+int grain_of(double cost_per_element) {
+    int grain = ThreadPool::grain_for(cost_per_element);
+    return grain < 16 ? 16 : grain / 16 * 16;
+}
+
+// relative cost for the grain, exp and its divide weigh about ten plain operations
+double map_cost(cpu::MapOp op) {
+    switch (op) {
+        case cpu::MapOp::ReLU:
+        case cpu::MapOp::ReLUDerivative:
+        case cpu::MapOp::LeakyReLU:
+        case cpu::MapOp::LeakyReLUDerivative:
+        case cpu::MapOp::Scale:
+            return 1.0;
+        default:
+            return 12.0;
+    }
+}
+
+int shape_size(const std::vector<int>& shape) {
+    int size = 1;
+    for (int s : shape) size *= s;
+    return size;
+}
+
+}
+
+std::vector<int> broadcast_shape(const std::vector<int>& a, const std::vector<int>& b) {
+    const std::vector<int>& longer = a.size() >= b.size() ? a : b;
+    const std::vector<int>& shorter = a.size() >= b.size() ? b : a;
+    std::vector<int> shape = longer;
+    size_t lead = longer.size() - shorter.size();
+    for (size_t d = 0; d < shorter.size(); ++d) {
+        int x = longer[lead + d];
+        int y = shorter[d];
+        if (x != y && x != 1 && y != 1) {
+            throw std::invalid_argument("tensor shapes don't broadcast");
+        }
+        shape[lead + d] = x == 1 ? y : x;
+    }
+    return shape;
+}
+
+void binary(cpu::BinaryOp op, const Tensor& a, const Tensor& b, Tensor& out) {
+    // equal shapes, the common case, don't build a new shape vector
+    std::vector<int> broadcast;
+    const std::vector<int>& shape = a.shape() == b.shape() ? a.shape() : (broadcast = broadcast_shape(a.shape(), b.shape()));
+    if (out.size() != shape_size(shape) || !out.is_contiguous()) {
+        throw std::invalid_argument("binary output must be contiguous and hold the broadcast shape");
+    }
+
+    // a strided view of out's own storage would be overwritten before it is read
+    if (!a.is_contiguous() && a.shares_storage(out)) {
+        binary(op, a.clone(), b, out);
+        return;
+    }
+    if (!b.is_contiguous() && b.shares_storage(out)) {
+        binary(op, a, b.clone(), out);
+        return;
+    }
+
+    Walk walk = plan(shape, a, b);
+    int inner = walk.dims - 1;
+    int n = walk.shape[inner];
+    int a_step = walk.a_strides[inner];
+    int b_step = walk.b_strides[inner];
+    // the kernels take unit or broadcast runs, densify views like a transpose first
+    if (a_step != 0 && a_step != 1) {
+        binary(op, a.contiguous(), b, out);
+        return;
+    }
+    if (b_step != 0 && b_step != 1) {
+        binary(op, a, b.contiguous(), out);
+        return;
+    }
+
+    const cpu::Kernels& kernels = cpu::kernels();
+    const float* a_data = a.data();
+    const float* b_data = b.data();
+    float* out_data = out.data();
+    ThreadPool::getInstance().parallel_for(0, out.size(), grain_of(1.0), [&](int begin, int end) {
+        // index of begin over the outer dims, and where that row starts in each operand
+        int index[kMaxDims];
+        std::ptrdiff_t a_row = 0;
+        std::ptrdiff_t b_row = 0;
+        int row = begin / n;
+        for (int d = inner - 1; d >= 0; --d) {
+            index[d] = row % walk.shape[d];
+            row /= walk.shape[d];
+            a_row += static_cast<std::ptrdiff_t>(index[d]) * walk.a_strides[d];
+            b_row += static_cast<std::ptrdiff_t>(index[d]) * walk.b_strides[d];
+        }
+
+        int col = begin % n;
+        for (int pos = begin; pos < end; col = 0) {
+            int count = n - col < end - pos ? n - col : end - pos;
+            kernels.binary(a_data + a_row + col * a_step, a_step, b_data + b_row + col * b_step, b_step,
+                           out_data + pos, count, op);
+            pos += count;
+
+            for (int d = inner - 1; d >= 0; --d) {
+                a_row += walk.a_strides[d];
+                b_row += walk.b_strides[d];
+                if (++index[d] < walk.shape[d]) break;
+                a_row -= static_cast<std::ptrdiff_t>(walk.shape[d]) * walk.a_strides[d];
+                b_row -= static_cast<std::ptrdiff_t>(walk.shape[d]) * walk.b_strides[d];
+                index[d] = 0;
+            }
+        }
+    });
+}
+
+Tensor binary(cpu::BinaryOp op, const Tensor& a, const Tensor& b) {
+    Tensor out(a.shape() == b.shape() ? a.shape() : broadcast_shape(a.shape(), b.shape()));
+    binary(op, a, b, out);
+    return out;
+}
+
+void unary(cpu::MapOp op, const Tensor& in, Tensor& out, float alpha) {
+    assert(in.size() == out.size() && out.is_contiguous());
+    if (!in.is_contiguous()) {
+        unary(op, in.clone(), out, alpha);
+        return;
+    }
+
+    const cpu::Kernels& kernels = cpu::kernels();
+    const float* in_data = in.data();
+    float* out_data = out.data();
+    ThreadPool::getInstance().parallel_for(0, in.size(), grain_of(map_cost(op)), [&](int begin, int end) {
+        kernels.map(in_data + begin, out_data + begin, end - begin, op, alpha);
+    });
+}
+
+double sum_squared_difference(const Tensor& a, const Tensor& b) {
+    assert(a.size() == b.size());
+    if (!a.is_contiguous() || !b.is_contiguous()) {
+        return sum_squared_difference(a.contiguous(), b.contiguous());
+    }
+
+    // the kernel sums in float, blocks of 4096 keep its rounding error small
+    const int block = 4096;
+    int grain = (ThreadPool::grain_for(2.0) + block - 1) / block * block;
+    const cpu::Kernels& kernels = cpu::kernels();
+    const float* a_data = a.data();
+    const float* b_data = b.data();
+    // one partial per chunk, added in chunk order so the result doesn't depend on scheduling
+    std::vector<double> partials((a.size() + grain - 1) / grain, 0.0);
+    ThreadPool::getInstance().parallel_for(0, a.size(), grain, [&](int begin, int end) {
+        double sum = 0.0;
+        for (int i = begin; i < end; i += block) {
+            int count = end - i < block ? end - i : block;
+            sum += kernels.sum_squared_difference(a_data + i, b_data + i, count);
+        }
+        partials[begin / grain] = sum;
+    });
+    double total = 0.0;
+    for (double partial : partials) total += partial;
+    return total;
+}
+
+}
@@ -1,8 +1,18 @@
 #include "fully_connected_layer.h"
+#include "allocator.h"
+#include "cpu_dispatch.h"
 #include "ops.h"
+#include "gemm.h"
 #include "gpu_operations.h"
+#include "split_gemm.h"
+#include "opencl_runtime.h"
+#include "half.h"
+#include "quantization.h"
+#include "sparse.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <iostream>
-#include <immintrin.h>
 #include <random>
 #include <stdexcept>
 
@@ -12,8 +22,9 @@ FullyConnectedLayer::FullyConnectedLayer(int input_size, int output_size) {
     std::mt19937 gen(rd());
     std::normal_distribution<> d(0, 1);
 
-    weights = std::make_shared<Tensor>(std::vector<int>{input_size, output_size});
-    bias = std::make_shared<Tensor>(std::vector<int>{1, output_size});
+    // parameters outlive any per-inference arena, always take them from the pool
+    weights = std::make_shared<Tensor>(std::vector<int>{input_size, output_size}, nullptr, Allocator::default_allocator());
+    bias = std::make_shared<Tensor>(std::vector<int>{1, output_size}, nullptr, Allocator::default_allocator());
 
     for (int i = 0; i < input_size * output_size; ++i) {
         weights->data()[i] = d(gen) / std::sqrt(input_size);
@@ -24,54 +35,172 @@ FullyConnectedLayer::FullyConnectedLayer(int input_size, int output_size) {
     }
 }
 
-Tensor FullyConnectedLayer::forward_cpu(const Tensor& input) {
-    this->input = std::make_shared<Tensor>(input);
-    Tensor output(std::vector<int>{input.shape()[0], weights->shape()[1]});
+FullyConnectedLayer::~FullyConnectedLayer() {
+    OpenCLRuntime::release_resident(*weights);
+    OpenCLRuntime::release_resident(*bias);
+}
+
+std::vector<int> FullyConnectedLayer::output_shape(const std::vector<int>& input_shape) const {
+    int features = 1;
+    for (size_t d = 1; d < input_shape.size(); ++d) {
+        features *= input_shape[d];
+    }
+    int batch_size = features * input_shape[0] / weights->shape()[0];
+    return {batch_size, weights->shape()[1]};
+}
+
+void FullyConnectedLayer::cache_input(const Tensor& input) {
+    // assigning into the existing cache object keeps steady-state calls allocation free
+    if (!this->input) {
+        this->input = std::make_shared<Tensor>(input.contiguous());
+    } else if (input.is_contiguous()) {
+        *this->input = input;
+    } else {
+        *this->input = input.contiguous();
+    }
+}
+
+void FullyConnectedLayer::forward_cpu(const Tensor& input, Tensor& output, gemm::Activation activation) {
+    cache_input(input);
     
-    int m = input.shape()[0];
     int n = weights->shape()[1];
     int k = weights->shape()[0];
-    
-    for (int i = 0; i < m; ++i) {
-        for (int j = 0; j < n; j += 8) {
-            __m256 sum = _mm256_setzero_ps();
-            for (int l = 0; l < k; ++l) {
-                __m256 a = _mm256_set1_ps(input.data()[i * k + l]);
-                __m256 b = _mm256_loadu_ps(&weights->data()[l * n + j]);
-                sum = _mm256_add_ps(sum, _mm256_mul_ps(a, b));
-            }
-            _mm256_storeu_ps(&output.data()[i * n + j], sum);
-        }
-        
-        // remaining elems
-        for (int j = n - n % 8; j < n; ++j) {
-            float sum = 0;
-            for (int l = 0; l < k; ++l) {
-                sum += input.data()[i * k + l] * weights->data()[l * n + j];
-            }
-            output.data()[i * n + j] = sum;
-        }
+    int m = input.size() / k;
+    assert(output.size() == m * n && output.is_contiguous());
+
+    if (int8_ && !int8_->calibrating) {
+        forward_int8(m, output, activation);
+        return;
     }
+    if (int8_) int8_->range.observe(this->input->data(), this->input->size());
     
-    // bias
-    for (int i = 0; i < m; ++i) {
-        for (int j = 0; j < n; j += 8) {
-            __m256 out = _mm256_loadu_ps(&output.data()[i * n + j]);
-            __m256 b = _mm256_loadu_ps(&bias->data()[j]);
-            _mm256_storeu_ps(&output.data()[i * n + j], _mm256_add_ps(out, b));
-        }
-        
-        for (int j = n - n % 8; j < n; ++j) {
-            output.data()[i * n + j] += bias->data()[j];
-        }
+    gemm::Epilogue epilogue;
+    epilogue.bias = bias->data();
+    epilogue.activation = activation;
+    if (sparse_) {
+        if (sparse_version_ != weights_version_) build_sparse(sparse_->block_rows);
+        sparse::gemm(m, this->input->data(), k, *sparse_, output.data(), n, epilogue);
+        return;
     }
-    
+    if (weights->dtype() != DType::Float32) {
+        half::gemm(m, n, k, this->input->data(), k, weights->half_data(), n, half::format_of(weights->dtype()),
+                   output.data(), n, epilogue);
+        return;
+    }
+    // a batch that fits one gemv call reads the weights once and unpacked, past that each extra
+    // pass over them costs more than packing
+    if (m <= cpu::kGemvRows) {
+        gemm::gemv(m, n, k, this->input->data(), k, weights->data(), n, output.data(), n, epilogue);
+        return;
+    }
+    if (packed_) {
+        if (packed_version_ != weights_version_ || packed_->nr != cpu::kernels().nr) pack_weights();
+        gemm::sgemm_packed(false, m, 1.0f, this->input->data(), k, *packed_, 0.0f, output.data(), n, epilogue);
+        return;
+    }
+    gemm::sgemm(false, false, m, n, k, 1.0f, this->input->data(), k, weights->data(), n, 0.0f, output.data(), n, epilogue);
+}
+
+void FullyConnectedLayer::forward_int8(int batch_size, Tensor& output, gemm::Activation activation) {
+    int n = weights->shape()[1];
+    int k = weights->shape()[0];
+    quant::LayerState& state = *int8_;
+    if (!state.current(weights_version_)) {
+        Tensor float_weights = weights->to(DType::Float32);
+        quant::quantize_weights(float_weights.data(), k, n, n, 1, bias->data(), state.weights);
+        state.weights_version = weights_version_;
+        state.quantized_weights = true;
+    }
+    quant::quantize_rows(input->data(), batch_size, k, k, state.fixed_params(), state.activations);
+    quant::gemm(state.activations, state.weights, activation, output.data(), n);
+}
+
+void FullyConnectedLayer::quantize_int8() {
+    if (!int8_) int8_ = std::make_shared<quant::LayerState>();
+}
+
+void FullyConnectedLayer::dequantize() {
+    int8_.reset();
+}
+
+void FullyConnectedLayer::set_calibrating(bool calibrating) {
+    quantize_int8();
+    int8_->set_calibrating(calibrating);
+}
+
+void FullyConnectedLayer::set_weight_dtype(DType dtype) {
+    if (dtype == weights->dtype()) return;
+    OpenCLRuntime::release_resident(*weights);
+    weights = std::make_shared<Tensor>(weights->to(dtype, Allocator::default_allocator()));
+    weights_version_++;
+}
+
+void FullyConnectedLayer::build_sparse(int block_rows) {
+    if (!sparse_) sparse_ = std::make_shared<sparse::BlockSparseWeights>();
+    Tensor float_weights = weights->to(DType::Float32);
+    sparse::from_dense(float_weights.data(), input_size(), output_size(), block_rows, *sparse_);
+    sparse_version_ = weights_version_;
+}
+
+void FullyConnectedLayer::set_sparse(int block_rows) {
+    if (block_rows == 0) {
+        sparse_.reset();
+        return;
+    }
+    build_sparse(block_rows);
+}
+
+void FullyConnectedLayer::prune(float sparsity, int block_rows) {
+    Tensor float_weights = weights->to(DType::Float32);
+    sparse::prune(float_weights.data(), input_size(), output_size(), block_rows, sparsity);
+    if (weights->dtype() != DType::Float32) {
+        half::narrow(float_weights.data(), weights->half_data(), float_weights.size(), half::format_of(weights->dtype()));
+    }
+    OpenCLRuntime::invalidate_resident(*weights);
+    weights_version_++;
+}
+
+double FullyConnectedLayer::weight_density(int block_rows) const {
+    Tensor float_weights = weights->to(DType::Float32);
+    return sparse::block_density(float_weights.data(), input_size(), output_size(), block_rows);
+}
+
+void FullyConnectedLayer::pack_weights() {
+    gemm::pack_b(false, input_size(), output_size(), weights->data(), output_size(), *packed_);
+    packed_version_ = weights_version_;
+}
+
+void FullyConnectedLayer::set_prepacked(bool prepacked) {
+    if (!prepacked) {
+        packed_.reset();
+        return;
+    }
+    if (packed_) return;
+    packed_ = std::make_shared<gemm::PackedB>();
+    if (weights->dtype() == DType::Float32) pack_weights();
+}
+
+void FullyConnectedLayer::forward_split(const Tensor& input, Tensor& output, gemm::Activation activation) {
+    if (weights->dtype() != DType::Float32) {
+        forward_cpu(input, output, activation);
+        return;
+    }
+    cache_input(input);
+    SplitGemm::getInstance().run(*this->input, *weights, bias.get(), output, activation, true);
+}
+
+Tensor FullyConnectedLayer::forward_cpu(const Tensor& input) {
+    Tensor output(output_shape(input.shape()));
+    forward_cpu(input, output);
     return output;
 }
 
 Tensor FullyConnectedLayer::forward_gpu(const Tensor& input) {
+    // the device kernels take float weights only
+    if (weights->dtype() != DType::Float32) return forward_cpu(input);
     try {
-        return gpu_operations::fully_connected_forward(input, *weights, *bias);
+        // the layer owns its parameters, they stay resident until backward or the destructor
+        return gpu_operations::fully_connected_forward(input.reshape({-1, weights->shape()[0]}), *weights, *bias, true);
     } catch (const std::exception& e) {
         std::cerr << "GPU forward pass failed: " << e.what() << std::endl;
         std::cerr << "Falling back to CPU implementation." << std::endl;
@@ -79,6 +208,22 @@ Tensor FullyConnectedLayer::forward_gpu(const Tensor& input) {
     }
 }
 
+void FullyConnectedLayer::forward_gpu(const Tensor& input, Tensor& output) {
+    if (weights->dtype() != DType::Float32) {
+        forward_cpu(input, output);
+        return;
+    }
+    try {
+        // downloads straight into output, no result tensor in between
+        Tensor rows = input.contiguous().reshape({-1, weights->shape()[0]});
+        gpu_operations::fully_connected_forward_async(rows, *weights, *bias, output, gemm::Activation::None, true).wait();
+    } catch (const std::exception& e) {
+        std::cerr << "GPU forward pass failed: " << e.what() << std::endl;
+        std::cerr << "Falling back to CPU implementation." << std::endl;
+        forward_cpu(input, output);
+    }
+}
+
 Tensor FullyConnectedLayer::forward(const Tensor& input, bool use_gpu) {
     if (use_gpu) {
         return forward_gpu(input);
@@ -87,73 +232,45 @@ Tensor FullyConnectedLayer::forward(const Tensor& input, bool use_gpu) {
     }
 }
 
-Tensor FullyConnectedLayer::backward(const Tensor& output_gradient, float learning_rate) {
+void FullyConnectedLayer::forward(const Tensor& input, Tensor& output, bool use_gpu) {
+    if (use_gpu) {
+        forward_gpu(input, output);
+    } else {
+        forward_cpu(input, output);
+    }
+}
+
+Tensor FullyConnectedLayer::backward(const Tensor& output_gradient_view, float learning_rate) {
+    Tensor output_gradient = output_gradient_view.contiguous();
     int batch_size = output_gradient.shape()[0];
     int input_size = weights->shape()[0];
     int output_size = weights->shape()[1];
 
     Tensor input_gradient({batch_size, input_size});
+    // the weights themselves when they are float, a widened copy of 16-bit ones
+    Tensor float_weights = weights->to(DType::Float32);
     
-    for (int i = 0; i < batch_size; ++i) {
-        for (int j = 0; j < input_size; j += 8) {
-            __m256 sum = _mm256_setzero_ps();
-            for (int k = 0; k < output_size; ++k) {
-                __m256 grad = _mm256_set1_ps(output_gradient.data()[i * output_size + k]);
-                __m256 w = _mm256_loadu_ps(&weights->data()[j * output_size + k]);
-                sum = _mm256_add_ps(sum, _mm256_mul_ps(grad, w));
-            }
-            _mm256_storeu_ps(&input_gradient.data()[i * input_size + j], sum);
-        }
-        
-        for (int j = input_size - input_size % 8; j < input_size; ++j) {
-            float sum = 0;
-            for (int k = 0; k < output_size; ++k) {
-                sum += output_gradient.data()[i * output_size + k] * weights->data()[j * output_size + k];
-            }
-            input_gradient.data()[i * input_size + j] = sum;
-        }
-    }
-
-    for (int i = 0; i < input_size; ++i) {
-        for (int j = 0; j < output_size; j += 8) {
-            __m256 w_update = _mm256_setzero_ps();
-            for (int k = 0; k < batch_size; ++k) {
-                __m256 grad = _mm256_loadu_ps(&output_gradient.data()[k * output_size + j]);
-                __m256 in = _mm256_set1_ps(input->data()[k * input_size + i]);
-                w_update = _mm256_add_ps(w_update, _mm256_mul_ps(grad, in));
-            }
-            __m256 w = _mm256_loadu_ps(&weights->data()[i * output_size + j]);
-            w = _mm256_sub_ps(w, _mm256_mul_ps(_mm256_set1_ps(learning_rate), w_update));
-            _mm256_storeu_ps(&weights->data()[i * output_size + j], w);
-        }
-        
-        for (int j = output_size - output_size % 8; j < output_size; ++j) {
-            float w_update = 0;
-            for (int k = 0; k < batch_size; ++k) {
-                w_update += output_gradient.data()[k * output_size + j] * input->data()[k * input_size + i];
-            }
-            weights->data()[i * output_size + j] -= learning_rate * w_update;
-        }
-    }
-
-    for (int j = 0; j < output_size; j += 8) {
-        __m256 b_update = _mm256_setzero_ps();
-        for (int i = 0; i < batch_size; ++i) {
-            __m256 grad = _mm256_loadu_ps(&output_gradient.data()[i * output_size + j]);
-            b_update = _mm256_add_ps(b_update, grad);
-        }
-        __m256 b = _mm256_loadu_ps(&bias->data()[j]);
-        b = _mm256_sub_ps(b, _mm256_mul_ps(_mm256_set1_ps(learning_rate), b_update));
-        _mm256_storeu_ps(&bias->data()[j], b);
-    }
-    
-    for (int j = output_size - output_size % 8; j < output_size; ++j) {
-        float b_update = 0;
-        for (int i = 0; i < batch_size; ++i) {
-            b_update += output_gradient.data()[i * output_size + j];
-        }
-        bias->data()[j] -= learning_rate * b_update;
+    // dX = dY * W^T, uses the weights before this step's update
+    gemm::sgemm(false, true, batch_size, input_size, output_size,
+                1.0f, output_gradient.data(), output_size, float_weights.data(), output_size,
+                0.0f, input_gradient.data(), input_size);
+
+    // W -= lr * X^T * dY, accumulated straight into the weights
+    gemm::sgemm(true, false, input_size, output_size, batch_size,
+                -learning_rate, input->data(), input_size, output_gradient.data(), output_size,
+                1.0f, float_weights.data(), output_size);
+    if (weights->dtype() != DType::Float32) {
+        half::narrow(float_weights.data(), weights->half_data(), float_weights.size(), half::format_of(weights->dtype()));
     }
 
+    // b -= lr * column sums of dY
+    cpu::kernels().subtract_column_sums(output_gradient.data(), batch_size, output_size, learning_rate, bias->data());
+
+    // the device copies are uploaded again on the next GPU forward, the int8, sparse and packed
+    // ones on the next forward that uses them
+    OpenCLRuntime::invalidate_resident(*weights);
+    OpenCLRuntime::invalidate_resident(*bias);
+    weights_version_++;
+
     return input_gradient;
 }
\ No newline at end of file
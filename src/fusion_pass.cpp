@@ -0,0 +1,42 @@
+#include "fusion_pass.h"
+#include "graph.h"
+#include "optimization_pass_registrar.h"
+
+namespace {
+
+bool fusable(OpType op, gemm::Activation& activation) {
+    switch (op) {
+        case OpType::ReLU: activation = gemm::Activation::ReLU; return true;
+        case OpType::Sigmoid: activation = gemm::Activation::Sigmoid; return true;
+        case OpType::Tanh: activation = gemm::Activation::Tanh; return true;
+        default: return false;
+    }
+}
+
+}
+
+void FusionPass::apply(Graph& graph) {
+    for (int id : graph.topological_order()) {
+        GraphNode& node = graph.node(id);
+        if (node.op != OpType::Convolution && node.op != OpType::FullyConnected) continue;
+        if (node.activation != gemm::Activation::None) continue;
+
+        // the pre-activation value must not be needed by anyone else
+        std::vector<int> readers = graph.consumers(id);
+        if (readers.size() != 1 || graph.output() == id) continue;
+
+        gemm::Activation activation;
+        if (!fusable(graph.node(readers[0]).op, activation)) continue;
+
+        node.activation = activation;
+        graph.replace_uses(readers[0], id);
+        graph.remove_node(readers[0]);
+    }
+    graph.invalidate_plan();
+}
+
+REGISTER_OPTIMIZATION_PASS("fuse_activations", FusionPass);
+
+void register_fusion_passes() {
+    // empty bc registration is handled by REGISTER_OPTIMIZATION_PASS macro
+}
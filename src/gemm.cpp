@@ -0,0 +1,314 @@
+#include "gemm.h"
+#include "allocator.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <stdexcept>
+
+namespace gemm {
+
+namespace {
+
+// The register block (mr x nr) and the micro-kernel come from the ISA table of cpu_dispatch.h,
+// everything here is ISA independent.
+
+// cache blocking: a packed A block (MC x KC) lives in L2, a B panel (KC x NC) in L3.
+// MC is a multiple of every table's mr and NC of every nr
+constexpr int MC = 72;
+constexpr int KC = 256;
+constexpr int NC = 3072;
+
+// below this many multiply-adds a single thread wins
+constexpr double kParallelThreshold = 128.0 * 128.0 * 128.0;
+
+// columns of B per gemv task, a whole number of registers on every ISA
+constexpr int kGemvStrip = 64;
+
+// per-thread packing buffers, allocated on first use and reused across calls
+struct PackBuffers {
+    float* a;
+    float* b;
+
+    PackBuffers()
+        : a(static_cast<float*>(Allocator::default_allocator()->allocate(MC * KC * sizeof(float)))),
+          b(static_cast<float*>(Allocator::default_allocator()->allocate(KC * NC * sizeof(float)))) {}
+
+    ~PackBuffers() {
+        Allocator::default_allocator()->deallocate(a, MC * KC * sizeof(float));
+        Allocator::default_allocator()->deallocate(b, KC * NC * sizeof(float));
+    }
+};
+
+// row-major matrix with arbitrary strides, lets one packing routine handle transposes
+struct MatrixView {
+    const float* data;
+    std::ptrdiff_t row_stride;
+    std::ptrdiff_t col_stride;
+
+    float at(int i, int j) const { return data[i * row_stride + j * col_stride]; }
+};
+
+// A block -> mr-row slivers, each stored k-major so the kernel reads mr contiguous values per step.
+// alpha is folded in here so the kernel never has to scale
+void pack_a(const MatrixView& a, int i0, int p0, int mc, int kc, float alpha, int mr, float* buf) {
+    for (int i = 0; i < mc; i += mr) {
+        int rows = std::min(mr, mc - i);
+        for (int p = 0; p < kc; ++p) {
+            for (int ii = 0; ii < mr; ++ii) {
+                *buf++ = ii < rows ? alpha * a.at(i0 + i + ii, p0 + p) : 0.0f;
+            }
+        }
+    }
+}
+
+// epilogue may be null, otherwise its bias is indexed from the block origin (row0, col0)
+void macro_kernel(const cpu::Kernels& kernels, int mc, int nc, int kc, const float* packed_a, const float* packed_b,
+                  float* c, int ldc, bool accumulate, const Epilogue* epilogue, int row0, int col0) {
+    const int MR = kernels.mr;
+    const int NR = kernels.nr;
+    float tile[cpu::kMaxTile];
+
+    for (int j = 0; j < nc; j += NR) {
+        int nr = std::min(NR, nc - j);
+        const float* bp = packed_b + j * kc;
+        for (int i = 0; i < mc; i += MR) {
+            int mr = std::min(MR, mc - i);
+            const float* ap = packed_a + i * kc;
+            float* cp = c + static_cast<std::ptrdiff_t>(i) * ldc + j;
+
+            cpu::TileEpilogue tile_epilogue{nullptr, false, Activation::None};
+            if (epilogue) {
+                const float* bias = epilogue->bias;
+                if (bias) bias += epilogue->bias_per_row ? row0 + i : col0 + j;
+                tile_epilogue = {bias, epilogue->bias_per_row, epilogue->activation};
+            }
+
+            if (mr == MR && nr == NR) {
+                kernels.micro_kernel(kc, ap, bp, cp, ldc, accumulate, epilogue ? &tile_epilogue : nullptr);
+                continue;
+            }
+
+            // edge tile, compute the full block and copy back the valid part
+            kernels.micro_kernel(kc, ap, bp, tile, NR, false, nullptr);
+            for (int ii = 0; ii < mr; ++ii) {
+                float* row = tile + ii * NR;
+                for (int jj = 0; jj < nr; ++jj) {
+                    float value = row[jj];
+                    if (accumulate) value += cp[ii * ldc + jj];
+                    if (epilogue && tile_epilogue.bias) {
+                        value += tile_epilogue.bias[tile_epilogue.bias_per_row ? ii : jj];
+                    }
+                    row[jj] = value;
+                }
+                if (epilogue && epilogue->activation != Activation::None) {
+                    kernels.activate(row, row, nr, epilogue->activation);
+                }
+                std::copy(row, row + nr, cp + ii * ldc);
+            }
+        }
+    }
+}
+
+void scale_rows(float* c, int ldc, int m0, int m1, int n0, int n1, float beta) {
+    for (int i = m0; i < m1; ++i) {
+        float* row = c + static_cast<std::ptrdiff_t>(i) * ldc;
+        for (int j = n0; j < n1; ++j) {
+            row[j] = beta == 0.0f ? 0.0f : beta * row[j];
+        }
+    }
+}
+
+// bias and activation over C[m0:m1, n0:n1], for calls that never reach the micro-kernel
+void apply_epilogue(const cpu::Kernels& kernels, float* c, int ldc, int m0, int m1, int n0, int n1,
+                    const Epilogue& epilogue) {
+    for (int i = m0; i < m1; ++i) {
+        float* row = c + static_cast<std::ptrdiff_t>(i) * ldc;
+        if (epilogue.bias) {
+            for (int j = n0; j < n1; ++j) row[j] += epilogue.bias[epilogue.bias_per_row ? i : j];
+        }
+        kernels.activate(row + n0, row + n0, n1 - n0, epilogue.activation);
+    }
+}
+
+// k block p0 of width kc in a packed B with n columns rounded up to nr, column j0 into it
+const float* packed_panel(const PackedB& b, int p0, int kc, int j0) {
+    int padded_n = (b.n + b.nr - 1) / b.nr * b.nr;
+    return b.data + static_cast<std::ptrdiff_t>(p0) * padded_n + static_cast<std::ptrdiff_t>(j0) * kc;
+}
+
+// C[m0:m1, n0:n1], run by a single thread with its own packing buffers. B comes from packed
+// when it is set, otherwise b is packed a panel at a time
+void gemm_tile(const cpu::Kernels& kernels, const MatrixView& a, const MatrixView& b, const PackedB* packed,
+               int m0, int m1, int n0, int n1, int k, float alpha, float beta, float* c, int ldc,
+               const Epilogue* epilogue) {
+    thread_local PackBuffers buffers;
+
+    if (beta != 0.0f && beta != 1.0f) {
+        scale_rows(c, ldc, m0, m1, n0, n1, beta);
+    }
+
+    for (int jc = n0; jc < n1; jc += NC) {
+        int nc = std::min(NC, n1 - jc);
+        for (int pc = 0; pc < k; pc += KC) {
+            int kc = std::min(KC, k - pc);
+            const float* panel = buffers.b;
+            if (packed) {
+                panel = packed_panel(*packed, pc, kc, jc);
+            } else {
+                kernels.pack_b(b.data + pc * b.row_stride + jc * b.col_stride, b.row_stride, b.col_stride, kc, nc,
+                               buffers.b);
+            }
+
+            // first k block overwrites C when beta is zero, the last one runs the epilogue
+            bool accumulate = pc > 0 || beta != 0.0f;
+            const Epilogue* block_epilogue = pc + kc == k ? epilogue : nullptr;
+            for (int ic = m0; ic < m1; ic += MC) {
+                int mc = std::min(MC, m1 - ic);
+                pack_a(a, ic, pc, mc, kc, alpha, kernels.mr, buffers.a);
+                macro_kernel(kernels, mc, nc, kc, buffers.a, panel,
+                             c + static_cast<std::ptrdiff_t>(ic) * ldc + jc, ldc, accumulate,
+                             block_epilogue, ic, jc);
+            }
+        }
+    }
+}
+
+// picks a tm x tn grid of C tiles for the thread pool.
+// cost is the largest tile's compute plus the panels each thread has to pack
+void choose_grid(int m, int n, int MR, int NR, int threads, int& tm, int& tn) {
+    int m_blocks = (m + MR - 1) / MR;
+    int n_blocks = (n + NR - 1) / NR;
+
+    tm = 1;
+    tn = 1;
+    long best_cost = -1;
+    for (int cand_m = 1; cand_m <= threads; ++cand_m) {
+        int cand_n = std::min(threads / cand_m, n_blocks);
+        int used_m = std::min(cand_m, m_blocks);
+        long rows = static_cast<long>((m_blocks + used_m - 1) / used_m) * MR;
+        long cols = static_cast<long>((n_blocks + cand_n - 1) / cand_n) * NR;
+        long cost = rows * cols + 8 * (rows + cols);
+        if (best_cost < 0 || cost < best_cost) {
+            best_cost = cost;
+            tm = used_m;
+            tn = cand_n;
+        }
+    }
+}
+
+// the whole call on the pool, b or packed as for gemm_tile
+void run(const cpu::Kernels& kernels, const MatrixView& a, const MatrixView& b, const PackedB* packed,
+         int m, int n, int k, float alpha, float beta, float* c, int ldc, const Epilogue& epilogue) {
+    if (m <= 0 || n <= 0) return;
+
+    bool has_epilogue = epilogue.bias || epilogue.activation != Activation::None;
+    const Epilogue* tile_epilogue = has_epilogue ? &epilogue : nullptr;
+
+    if (k <= 0 || alpha == 0.0f) {
+        if (beta != 1.0f) scale_rows(c, ldc, 0, m, 0, n, beta);
+        if (has_epilogue) apply_epilogue(kernels, c, ldc, 0, m, 0, n, epilogue);
+        return;
+    }
+
+    ThreadPool& pool = ThreadPool::getInstance();
+    double work = static_cast<double>(m) * n * k;
+    int threads = work < kParallelThreshold ? 1 : pool.num_threads();
+
+    const int MR = kernels.mr;
+    const int NR = kernels.nr;
+    int tm, tn;
+    choose_grid(m, n, MR, NR, threads, tm, tn);
+    int m_blocks = (m + MR - 1) / MR;
+    int n_blocks = (n + NR - 1) / NR;
+
+    pool.run(tm * tn, [&](int task) {
+        int ti = task / tn;
+        int tj = task % tn;
+        int m0 = std::min(m, (m_blocks * ti / tm) * MR);
+        int m1 = std::min(m, (m_blocks * (ti + 1) / tm) * MR);
+        int n0 = std::min(n, (n_blocks * tj / tn) * NR);
+        int n1 = std::min(n, (n_blocks * (tj + 1) / tn) * NR);
+        if (m0 < m1 && n0 < n1) {
+            gemm_tile(kernels, a, b, packed, m0, m1, n0, n1, k, alpha, beta, c, ldc, tile_epilogue);
+        }
+    });
+}
+
+}
+
+void sgemm(bool trans_a, bool trans_b, int m, int n, int k,
+           float alpha, const float* a, int lda,
+           const float* b, int ldb,
+           float beta, float* c, int ldc) {
+    sgemm(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, Epilogue());
+}
+
+void sgemm(bool trans_a, bool trans_b, int m, int n, int k,
+           float alpha, const float* a, int lda,
+           const float* b, int ldb,
+           float beta, float* c, int ldc,
+           const Epilogue& epilogue) {
+    // one table for the whole call, even if the ISA is switched meanwhile
+    const cpu::Kernels& kernels = cpu::kernels();
+    MatrixView av{a, trans_a ? 1 : lda, trans_a ? lda : 1};
+    MatrixView bv{b, trans_b ? 1 : ldb, trans_b ? ldb : 1};
+    run(kernels, av, bv, nullptr, m, n, k, alpha, beta, c, ldc, epilogue);
+}
+
+void gemv(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc,
+          const Epilogue& epilogue) {
+    assert(!epilogue.bias_per_row);
+    if (m <= 0 || n <= 0) return;
+
+    const cpu::Kernels& kernels = cpu::kernels();
+    int strips = (n + kGemvStrip - 1) / kGemvStrip;
+    int grain = ThreadPool::grain_for(2.0 * m * k * kGemvStrip);
+    ThreadPool::getInstance().parallel_for(0, strips, grain, [&](int begin, int end) {
+        for (int s = begin; s < end; ++s) {
+            int col0 = s * kGemvStrip;
+            int cols = std::min(kGemvStrip, n - col0);
+            cpu::TileEpilogue tile{epilogue.bias ? epilogue.bias + col0 : nullptr, false, epilogue.activation};
+            // the strip stays in cache while the row blocks go by
+            for (int row0 = 0; row0 < m; row0 += cpu::kGemvRows) {
+                int rows = std::min(cpu::kGemvRows, m - row0);
+                kernels.gemv(rows, k, cols, a + static_cast<std::ptrdiff_t>(row0) * lda, lda, b + col0, ldb,
+                             c + static_cast<std::ptrdiff_t>(row0) * ldc + col0, ldc, &tile);
+            }
+        }
+    });
+}
+
+void pack_b(bool trans_b, int k, int n, const float* b, int ldb, PackedB& out) {
+    const cpu::Kernels& kernels = cpu::kernels();
+    out.k = k;
+    out.n = n;
+    out.nr = kernels.nr;
+    int padded_n = (n + kernels.nr - 1) / kernels.nr * kernels.nr;
+    float* data = out.storage.reserve(static_cast<size_t>(std::max(k, 0)) * std::max(padded_n, 0));
+    out.data = data;
+
+    std::ptrdiff_t row_stride = trans_b ? 1 : ldb;
+    std::ptrdiff_t col_stride = trans_b ? ldb : 1;
+    int blocks = (k + KC - 1) / KC;
+    ThreadPool::getInstance().parallel_for(0, blocks, 1, [&](int begin, int end) {
+        for (int block = begin; block < end; ++block) {
+            int pc = block * KC;
+            kernels.pack_b(b + pc * row_stride, row_stride, col_stride, std::min(KC, k - pc), n,
+                           data + static_cast<std::ptrdiff_t>(pc) * padded_n);
+        }
+    });
+}
+
+void sgemm_packed(bool trans_a, int m, float alpha, const float* a, int lda, const PackedB& b,
+                  float beta, float* c, int ldc, const Epilogue& epilogue) {
+    const cpu::Kernels& kernels = cpu::kernels();
+    if (b.nr != kernels.nr) {
+        throw std::invalid_argument("B was packed for another ISA's register block");
+    }
+    MatrixView av{a, trans_a ? 1 : lda, trans_a ? lda : 1};
+    run(kernels, av, MatrixView{nullptr, 0, 0}, &b, m, b.n, b.k, alpha, beta, c, ldc, epilogue);
+}
+
+}
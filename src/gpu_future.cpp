@@ -0,0 +1,43 @@
+#include "gpu_future.h"
+#include <stdexcept>
+#include <string>
+
+GpuFuture::~GpuFuture() {
+    release();
+}
+
+GpuFuture& GpuFuture::operator=(GpuFuture&& other) noexcept {
+    if (this != &other) {
+        release();
+        event_ = other.event_;
+        other.event_ = nullptr;
+    }
+    return *this;
+}
+
+void GpuFuture::wait() {
+    if (!event_) return;
+    cl_int err = clWaitForEvents(1, &event_);
+    cl_int status = CL_COMPLETE;
+    clGetEventInfo(event_, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+    clReleaseEvent(event_);
+    event_ = nullptr;
+    // a failed command reports a negative status, the wait itself then fails too
+    if (err != CL_SUCCESS || status < 0) {
+        throw std::runtime_error("GPU work failed (OpenCL error " + std::to_string(status < 0 ? status : err) + ")");
+    }
+}
+
+bool GpuFuture::ready() const {
+    if (!event_) return true;
+    cl_int status = CL_COMPLETE;
+    clGetEventInfo(event_, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+    return status <= CL_COMPLETE;
+}
+
+void GpuFuture::release() noexcept {
+    if (!event_) return;
+    clWaitForEvents(1, &event_);
+    clReleaseEvent(event_);
+    event_ = nullptr;
+}
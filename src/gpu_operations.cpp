@@ -1,36 +1,14 @@
 #include "gpu_operations.h"
+#include "opencl_gemm.h"
+#include "opencl_runtime.h"
+#include <algorithm>
+#include <string>
 #include <stdexcept>
 #include <vector>
-#include <iostream>
 
 namespace gpu_operations {
 
-cl_context context;
-cl_command_queue queue;
-cl_program program;
-cl_kernel fc_forward_kernel;
-cl_kernel fc_backward_kernel;
-
 const char* kernel_source = R"(
-__kernel void fully_connected_forward(
-    __global const float* input,
-    __global const float* weights,
-    __global const float* bias,
-    __global float* output,
-    const int input_size,
-    const int output_size
-) {
-    int gid = get_global_id(0);
-    int batch_id = gid / output_size;
-    int output_id = gid % output_size;
-
-    float sum = bias[output_id];
-    for (int i = 0; i < input_size; ++i) {
-        sum += input[batch_id * input_size + i] * weights[i * output_size + output_id];
-    }
-    output[gid] = sum;
-}
-
 __kernel void fully_connected_backward(
     __global const float* output_gradient,
     __global const float* input,
@@ -74,101 +52,93 @@ __kernel void fully_connected_backward(
 }
 )";
 
-void initialize() {
-    cl_int err;
-
-    // Get platform
-    cl_platform_id platform;
-    err = clGetPlatformIDs(1, &platform, NULL);
-    if (err != CL_SUCCESS) throw std::runtime_error("Failed to get platform ID");
-
-    // Get device
-    cl_device_id device;
-    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
-    if (err != CL_SUCCESS) throw std::runtime_error("Failed to get device ID");
-
-    // Create context
-    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
-    if (err != CL_SUCCESS) throw std::runtime_error("Failed to create context");
-
-    // Create command queue
-    queue = clCreateCommandQueue(context, device, 0, &err);
-    if (err != CL_SUCCESS) throw std::runtime_error("Failed to create command queue");
-
-    // Create program
-    program = clCreateProgramWithSource(context, 1, &kernel_source, NULL, &err);
-    if (err != CL_SUCCESS) throw std::runtime_error("Failed to create program");
-
-    // Build program
-    err = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        size_t log_size;
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-        std::vector<char> log(log_size);
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, log.data(), NULL);
-        std::cerr << "OpenCL program build log: " << log.data() << std::endl;
-        throw std::runtime_error("Failed to build program");
-    }
+namespace {
+
+const char* program_name = "fully_connected";
+
+cl_kernel backward_kernel() {
+    return OpenCLRuntime::getInstance().kernel(program_name, kernel_source, "fully_connected_backward");
+}
 
-    // Create kernels
-    fc_forward_kernel = clCreateKernel(program, "fully_connected_forward", &err);
-    if (err != CL_SUCCESS) throw std::runtime_error("Failed to create forward kernel");
+// device copy of a layer parameter: the resident one when the caller owns the tensor, otherwise
+// a scratch buffer filled for this call. the blocking write is on the in-order compute queue, so
+// it waits for the kernels still reading the previous contents
+cl_mem parameter_buffer(OpenCLRuntime& runtime, const std::string& name, const Tensor& tensor, bool resident) {
+    if (resident) return runtime.resident(tensor);
+    if (tensor.dtype() != DType::Float32) throw std::invalid_argument("GPU parameters must be float32");
+    Tensor data = tensor.contiguous();
+    cl_mem buffer = runtime.scratch(name, data.size() * sizeof(float));
+    runtime.upload(buffer, data.data(), data.size());
+    return buffer;
+}
+
+}
 
-    fc_backward_kernel = clCreateKernel(program, "fully_connected_backward", &err);
-    if (err != CL_SUCCESS) throw std::runtime_error("Failed to create backward kernel");
+void initialize() {
+    // compiles the kernels up front so the first pass doesn't pay for it. the forward GEMM is
+    // built per tile config as the tuner picks one, loading its earlier results is enough here
+    backward_kernel();
+    OpenCLGemmTuner::getInstance();
 }
 
 void cleanup() {
-    clReleaseKernel(fc_forward_kernel);
-    clReleaseKernel(fc_backward_kernel);
-    clReleaseProgram(program);
-    clReleaseCommandQueue(queue);
-    clReleaseContext(context);
+    // the runtime owns every OpenCL object and releases them at exit
 }
 
-Tensor fully_connected_forward(const Tensor& input, const Tensor& weights, const Tensor& bias) {
-    cl_int err;
+Tensor fully_connected_forward(const Tensor& input_view, const Tensor& weights, const Tensor& bias,
+                               bool resident_parameters) {
+    Tensor input = input_view.contiguous();
+    Tensor output({input.shape()[0], weights.shape()[1]});
+    fully_connected_forward_async(input, weights, bias, output, gemm::Activation::None, resident_parameters).wait();
+    return output;
+}
+
+GpuFuture fully_connected_forward_async(const Tensor& input, const Tensor& weights, const Tensor& bias,
+                                        Tensor& output, gemm::Activation activation, bool resident_parameters) {
+    // a contiguous copy made here would be gone before the upload reads it
+    if (!input.is_contiguous()) throw std::invalid_argument("async GPU inputs must be contiguous");
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
 
     int batch_size = input.shape()[0];
-    int input_size = input.shape()[1];
     int output_size = weights.shape()[1];
 
-    Tensor output({batch_size, output_size});
-
-    cl_mem input_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                                         batch_size * input_size * sizeof(float), (void*)input.data(), &err);
-    cl_mem weights_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                                           input_size * output_size * sizeof(float), (void*)weights.data(), &err);
-    cl_mem bias_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                                        output_size * sizeof(float), (void*)bias.data(), &err);
-    cl_mem output_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, 
-                                          batch_size * output_size * sizeof(float), NULL, &err);
-
-    clSetKernelArg(fc_forward_kernel, 0, sizeof(cl_mem), &input_buffer);
-    clSetKernelArg(fc_forward_kernel, 1, sizeof(cl_mem), &weights_buffer);
-    clSetKernelArg(fc_forward_kernel, 2, sizeof(cl_mem), &bias_buffer);
-    clSetKernelArg(fc_forward_kernel, 3, sizeof(cl_mem), &output_buffer);
-    clSetKernelArg(fc_forward_kernel, 4, sizeof(int), &input_size);
-    clSetKernelArg(fc_forward_kernel, 5, sizeof(int), &output_size);
-
-    size_t global_work_size = batch_size * output_size;
-    err = clEnqueueNDRangeKernel(queue, fc_forward_kernel, 1, NULL, &global_work_size, NULL, 0, NULL, NULL);
-    if (err != CL_SUCCESS) throw std::runtime_error("Failed to enqueue kernel");
-
-    err = clEnqueueReadBuffer(queue, output_buffer, CL_TRUE, 0, 
-                              batch_size * output_size * sizeof(float), output.data(), 0, NULL, NULL);
-    if (err != CL_SUCCESS) throw std::runtime_error("Failed to read output buffer");
-
-    clReleaseMemObject(input_buffer);
-    clReleaseMemObject(weights_buffer);
-    clReleaseMemObject(bias_buffer);
-    clReleaseMemObject(output_buffer);
+    // the transfer queue is in order, so the next call's upload waits for this call's download
+    cl_mem input_buffer = runtime.scratch("fc.input", input.size() * sizeof(float));
+    cl_mem output_buffer = runtime.scratch("fc.output", static_cast<size_t>(batch_size) * output_size * sizeof(float));
+    cl_event uploaded = runtime.upload_async(input_buffer, input.data(), input.size());
+
+    cl_event computed = nullptr;
+    try {
+        fully_connected_forward(input_buffer, batch_size, weights, bias, output_buffer, activation, {uploaded}, &computed,
+                                resident_parameters);
+    } catch (...) {
+        clReleaseEvent(uploaded);
+        throw;
+    }
+    cl_event downloaded = runtime.download_async(output_buffer, output.data(), output.size(), {computed});
+    runtime.flush();
+    clReleaseEvent(uploaded);
+    clReleaseEvent(computed);
+    return GpuFuture(downloaded);
+}
 
-    return output;
+void fully_connected_forward(cl_mem input, int batch_size, const Tensor& weights, const Tensor& bias, cl_mem output,
+                             gemm::Activation activation, const std::vector<cl_event>& wait_for, cl_event* done,
+                             bool resident_parameters) {
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+    int input_size = weights.shape()[0];
+    int output_size = weights.shape()[1];
+    cl_mem weights_buffer = parameter_buffer(runtime, "fc.weights", weights, resident_parameters);
+    cl_mem bias_buffer = parameter_buffer(runtime, "fc.bias", bias, resident_parameters);
+    opencl_gemm::sgemm(batch_size, output_size, input_size, input, weights_buffer, bias_buffer, output, activation,
+                       wait_for, done);
 }
 
-std::tuple<Tensor, Tensor, Tensor> fully_connected_backward(const Tensor& output_gradient, const Tensor& input, const Tensor& weights) {
-    cl_int err;
+std::tuple<Tensor, Tensor, Tensor> fully_connected_backward(const Tensor& output_gradient_view, const Tensor& input_view, const Tensor& weights) {
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+    cl_kernel kernel = backward_kernel();
+    Tensor output_gradient = output_gradient_view.contiguous();
+    Tensor input = input_view.contiguous();
 
     int batch_size = input.shape()[0];
     int input_size = input.shape()[1];
@@ -178,47 +148,33 @@ std::tuple<Tensor, Tensor, Tensor> fully_connected_backward(const Tensor& output
     Tensor weight_gradient({input_size, output_size});
     Tensor bias_gradient({1, output_size});
 
-    cl_mem output_gradient_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                                                   batch_size * output_size * sizeof(float), (void*)output_gradient.data(), &err);
-    cl_mem input_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                                         batch_size * input_size * sizeof(float), (void*)input.data(), &err);
-    cl_mem weights_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                                           input_size * output_size * sizeof(float), (void*)weights.data(), &err);
-    cl_mem input_gradient_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, 
-                                                  batch_size * input_size * sizeof(float), NULL, &err);
-    cl_mem weight_gradient_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, 
-                                                   input_size * output_size * sizeof(float), NULL, &err);
-    cl_mem bias_gradient_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, 
-                                                 output_size * sizeof(float), NULL, &err);
-
-    clSetKernelArg(fc_backward_kernel, 0, sizeof(cl_mem), &output_gradient_buffer);
-    clSetKernelArg(fc_backward_kernel, 1, sizeof(cl_mem), &input_buffer);
-    clSetKernelArg(fc_backward_kernel, 2, sizeof(cl_mem), &weights_buffer);
-    clSetKernelArg(fc_backward_kernel, 3, sizeof(cl_mem), &input_gradient_buffer);
-    clSetKernelArg(fc_backward_kernel, 4, sizeof(cl_mem), &weight_gradient_buffer);
-    clSetKernelArg(fc_backward_kernel, 5, sizeof(cl_mem), &bias_gradient_buffer);
-    clSetKernelArg(fc_backward_kernel, 6, sizeof(int), &input_size);
-    clSetKernelArg(fc_backward_kernel, 7, sizeof(int), &output_size);
-    clSetKernelArg(fc_backward_kernel, 8, sizeof(int), &batch_size);
+    cl_mem weights_buffer = parameter_buffer(runtime, "fc.backward_weights", weights, false);
+    cl_mem output_gradient_buffer = runtime.scratch("fc.output_gradient", output_gradient.size() * sizeof(float));
+    // not fc.input, an async forward may still be reading that one on the transfer queue
+    cl_mem input_buffer = runtime.scratch("fc.backward_input", input.size() * sizeof(float));
+    cl_mem input_gradient_buffer = runtime.scratch("fc.input_gradient", input_gradient.size() * sizeof(float));
+    cl_mem weight_gradient_buffer = runtime.scratch("fc.weight_gradient", weight_gradient.size() * sizeof(float));
+    cl_mem bias_gradient_buffer = runtime.scratch("fc.bias_gradient", bias_gradient.size() * sizeof(float));
+    runtime.upload(output_gradient_buffer, output_gradient.data(), output_gradient.size());
+    runtime.upload(input_buffer, input.data(), input.size());
+
+    clSetKernelArg(kernel, 0, sizeof(cl_mem), &output_gradient_buffer);
+    clSetKernelArg(kernel, 1, sizeof(cl_mem), &input_buffer);
+    clSetKernelArg(kernel, 2, sizeof(cl_mem), &weights_buffer);
+    clSetKernelArg(kernel, 3, sizeof(cl_mem), &input_gradient_buffer);
+    clSetKernelArg(kernel, 4, sizeof(cl_mem), &weight_gradient_buffer);
+    clSetKernelArg(kernel, 5, sizeof(cl_mem), &bias_gradient_buffer);
+    clSetKernelArg(kernel, 6, sizeof(int), &input_size);
+    clSetKernelArg(kernel, 7, sizeof(int), &output_size);
+    clSetKernelArg(kernel, 8, sizeof(int), &batch_size);
 
     size_t global_work_size = std::max(input_size * output_size, batch_size * input_size);
-    err = clEnqueueNDRangeKernel(queue, fc_backward_kernel, 1, NULL, &global_work_size, NULL, 0, NULL, NULL);
+    cl_int err = clEnqueueNDRangeKernel(runtime.queue(), kernel, 1, NULL, &global_work_size, NULL, 0, NULL, NULL);
     if (err != CL_SUCCESS) throw std::runtime_error("Failed to enqueue kernel");
 
-    err = clEnqueueReadBuffer(queue, input_gradient_buffer, CL_TRUE, 0, 
-                              batch_size * input_size * sizeof(float), input_gradient.data(), 0, NULL, NULL);
-    err |= clEnqueueReadBuffer(queue, weight_gradient_buffer, CL_TRUE, 0, 
-                               input_size * output_size * sizeof(float), weight_gradient.data(), 0, NULL, NULL);
-    err |= clEnqueueReadBuffer(queue, bias_gradient_buffer, CL_TRUE, 0, 
-                               output_size * sizeof(float), bias_gradient.data(), 0, NULL, NULL);
-    if (err != CL_SUCCESS) throw std::runtime_error("Failed to read output buffers");
-
-    clReleaseMemObject(output_gradient_buffer);
-    clReleaseMemObject(input_buffer);
-    clReleaseMemObject(weights_buffer);
-    clReleaseMemObject(input_gradient_buffer);
-    clReleaseMemObject(weight_gradient_buffer);
-    clReleaseMemObject(bias_gradient_buffer);
+    runtime.download(input_gradient_buffer, input_gradient.data(), input_gradient.size());
+    runtime.download(weight_gradient_buffer, weight_gradient.data(), weight_gradient.size());
+    runtime.download(bias_gradient_buffer, bias_gradient.data(), bias_gradient.size());
 
     return std::make_tuple(input_gradient, weight_gradient, bias_gradient);
 }
@@ -0,0 +1,148 @@
+#include "gpu_pipeline.h"
+#include "gpu_operations.h"
+#include "network.h"
+#include "opencl_runtime.h"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+GpuPipeline::GpuPipeline() {
+    static std::atomic<int> next_id{0};
+    name_ = "pipeline" + std::to_string(next_id++);
+}
+
+GpuPipeline::GpuPipeline(const Network& network) : GpuPipeline() {
+    if (!network.convolutional_layers().empty()) {
+        throw std::invalid_argument("GpuPipeline runs fully connected layers only");
+    }
+    for (const auto& layer : network.fully_connected_layers()) add(layer, gemm::Activation::ReLU);
+}
+
+void GpuPipeline::add(std::shared_ptr<FullyConnectedLayer> layer, gemm::Activation activation) {
+    if (!stages_.empty() && stages_.back().layer->output_size() != layer->input_size()) {
+        throw std::invalid_argument("GpuPipeline layer sizes don't chain");
+    }
+    stages_.push_back({std::move(layer), activation});
+}
+
+std::vector<int> GpuPipeline::output_shape(const std::vector<int>& input_shape) const {
+    return {input_shape[0], stages_.back().layer->output_size()};
+}
+
+void GpuPipeline::check_input(const Tensor& input, const Tensor& output) const {
+    if (stages_.empty()) throw std::invalid_argument("GpuPipeline has no layers");
+    if (!input.is_contiguous()) throw std::invalid_argument("async GPU inputs must be contiguous");
+    int batch_size = input.shape()[0];
+    if (input.size() != batch_size * stages_.front().layer->input_size() ||
+        output.size() != batch_size * stages_.back().layer->output_size()) {
+        throw std::invalid_argument("GpuPipeline input or output has the wrong size");
+    }
+}
+
+void GpuPipeline::reserve(int batch_size) {
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+    int width = 0;
+    for (size_t i = 0; i + 1 < stages_.size(); ++i) width = std::max(width, stages_[i].layer->output_size());
+    size_t bytes = static_cast<size_t>(std::max(width, 1)) * batch_size * sizeof(float);
+    hidden_[0] = runtime.scratch(name_ + ".hidden0", bytes);
+    hidden_[1] = runtime.scratch(name_ + ".hidden1", bytes);
+}
+
+cl_event GpuPipeline::enqueue(cl_mem input, int batch_size, cl_mem output, const std::vector<cl_event>& wait_for) {
+    // kernels share the in-order compute queue, so only the first one needs the wait list and
+    // two hidden buffers can take turns
+    cl_mem current = input;
+    cl_event done = nullptr;
+    for (size_t i = 0; i < stages_.size(); ++i) {
+        bool last = i + 1 == stages_.size();
+        cl_mem next = last ? output : hidden_[i % 2];
+        const Stage& stage = stages_[i];
+        gpu_operations::fully_connected_forward(current, batch_size, stage.layer->get_weights(), stage.layer->get_bias(),
+                                                next, stage.activation,
+                                                i == 0 ? wait_for : std::vector<cl_event>(), last ? &done : nullptr,
+                                                true);
+        current = next;
+    }
+    return done;
+}
+
+GpuFuture GpuPipeline::forward_async(const Tensor& input, Tensor& output) {
+    check_input(input, output);
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+    int batch_size = input.shape()[0];
+    reserve(batch_size);
+
+    cl_mem input_buffer = runtime.scratch(name_ + ".input0", input.size() * sizeof(float));
+    cl_mem output_buffer = runtime.scratch(name_ + ".output0", output.size() * sizeof(float));
+    // events in between are released as soon as the next command holds on to them, releasing
+    // does not wait
+    cl_event uploaded = runtime.upload_async(input_buffer, input.data(), input.size());
+    cl_event computed = nullptr;
+    try {
+        computed = enqueue(input_buffer, batch_size, output_buffer, {uploaded});
+    } catch (...) {
+        clReleaseEvent(uploaded);
+        throw;
+    }
+    clReleaseEvent(uploaded);
+    cl_event downloaded = runtime.download_async(output_buffer, output.data(), output.size(), {computed});
+    runtime.flush();
+    clReleaseEvent(computed);
+    return GpuFuture(downloaded);
+}
+
+void GpuPipeline::forward(const Tensor& input, Tensor& output) {
+    forward_async(input, output).wait();
+}
+
+void GpuPipeline::forward_stream(const std::vector<Tensor>& inputs, std::vector<Tensor>& outputs) {
+    if (inputs.size() != outputs.size()) throw std::invalid_argument("GpuPipeline needs one output per input");
+    if (inputs.empty()) return;
+    for (size_t i = 0; i < inputs.size(); ++i) check_input(inputs[i], outputs[i]);
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+
+    // buffers are sized for the largest batch up front, so none is replaced mid-stream
+    size_t input_bytes = 0;
+    size_t output_bytes = 0;
+    int max_batch = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        input_bytes = std::max(input_bytes, inputs[i].size() * sizeof(float));
+        output_bytes = std::max(output_bytes, outputs[i].size() * sizeof(float));
+        max_batch = std::max(max_batch, inputs[i].shape()[0]);
+    }
+    reserve(max_batch);
+    cl_mem input_buffers[2] = {runtime.scratch(name_ + ".input0", input_bytes),
+                               runtime.scratch(name_ + ".input1", input_bytes)};
+    cl_mem output_buffers[2] = {runtime.scratch(name_ + ".output0", output_bytes),
+                                runtime.scratch(name_ + ".output1", output_bytes)};
+
+    // Batch i uses slot i % 2. Its upload waits until batch i - 2 is computed, and its kernels
+    // until the upload has landed and batch i - 2 has downloaded. Uploads are enqueued one
+    // batch ahead, so batch i + 1 moves in while batch i computes.
+    size_t count = inputs.size();
+    std::vector<GpuFuture> uploaded(count);
+    std::vector<GpuFuture> computed(count);
+    std::vector<GpuFuture> downloaded(count);
+    auto upload = [&](size_t i) {
+        std::vector<cl_event> wait_for;
+        if (i >= 2) wait_for.push_back(computed[i - 2].event());
+        uploaded[i] = GpuFuture(runtime.upload_async(input_buffers[i % 2], inputs[i].data(), inputs[i].size(), wait_for));
+    };
+    try {
+        upload(0);
+        for (size_t i = 0; i < count; ++i) {
+            if (i + 1 < count) upload(i + 1);
+            std::vector<cl_event> wait_for = {uploaded[i].event()};
+            if (i >= 2) wait_for.push_back(downloaded[i - 2].event());
+            computed[i] = GpuFuture(enqueue(input_buffers[i % 2], inputs[i].shape()[0], output_buffers[i % 2], wait_for));
+            downloaded[i] = GpuFuture(runtime.download_async(output_buffers[i % 2], outputs[i].data(), outputs[i].size(),
+                                                             {computed[i].event()}));
+            runtime.flush();
+        }
+    } catch (...) {
+        // the futures wait for what was enqueued before they release it
+        runtime.flush();
+        throw;
+    }
+    for (GpuFuture& download : downloaded) download.wait();
+}
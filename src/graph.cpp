@@ -0,0 +1,409 @@
+#include "graph.h"
+#include "activation_functions.h"
+#include "allocator.h"
+#include "convolutional_layer.h"
+#include "fully_connected_layer.h"
+#include "loss_functions.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+
+bool is_activation(OpType op) {
+    return op == OpType::ReLU || op == OpType::Sigmoid || op == OpType::Tanh;
+}
+
+std::vector<int> resolve_reshape(const std::vector<int>& input, const std::vector<int>& target) {
+    int total = 1;
+    for (int dim : input) total *= dim;
+
+    std::vector<int> shape(target.size());
+    int known = 1;
+    int infer = -1;
+    for (size_t i = 0; i < target.size(); ++i) {
+        if (target[i] == 0) {
+            if (i >= input.size()) throw std::invalid_argument("reshape copies a missing dim");
+            shape[i] = input[i];
+        } else if (target[i] == -1) {
+            if (infer >= 0) throw std::invalid_argument("reshape can infer only one dim");
+            infer = static_cast<int>(i);
+            continue;
+        } else {
+            shape[i] = target[i];
+        }
+        known *= shape[i];
+    }
+    if (infer >= 0) {
+        if (known == 0 || total % known != 0) throw std::invalid_argument("reshape size mismatch");
+        shape[infer] = total / known;
+    } else if (known != total) {
+        throw std::invalid_argument("reshape size mismatch");
+    }
+    return shape;
+}
+
+}
+
+const char* op_name(OpType op) {
+    switch (op) {
+        case OpType::Input: return "Input";
+        case OpType::Convolution: return "Convolution";
+        case OpType::FullyConnected: return "FullyConnected";
+        case OpType::ReLU: return "ReLU";
+        case OpType::Sigmoid: return "Sigmoid";
+        case OpType::Tanh: return "Tanh";
+        case OpType::Reshape: return "Reshape";
+        case OpType::LayoutConvert: return "LayoutConvert";
+        case OpType::MSELoss: return "MSELoss";
+    }
+    return "Unknown";
+}
+
+int Graph::add_node(OpType op, const std::vector<int>& inputs) {
+    for (int input : inputs) {
+        if (input < 0 || input >= static_cast<int>(nodes_.size())) {
+            throw std::invalid_argument("graph edge to an unknown node");
+        }
+    }
+    GraphNode node;
+    node.id = static_cast<int>(nodes_.size());
+    node.op = op;
+    node.inputs = inputs;
+    nodes_.push_back(node);
+    planned_ = false;
+    return node.id;
+}
+
+int Graph::add_input() {
+    int id = add_node(OpType::Input, {});
+    inputs_.push_back(id);
+    return id;
+}
+
+int Graph::add_convolution(int input, std::shared_ptr<ConvolutionalLayer> layer) {
+    int id = add_node(OpType::Convolution, {input});
+    nodes_[id].conv = std::move(layer);
+    return id;
+}
+
+int Graph::add_fully_connected(int input, std::shared_ptr<FullyConnectedLayer> layer) {
+    int id = add_node(OpType::FullyConnected, {input});
+    nodes_[id].fc = std::move(layer);
+    return id;
+}
+
+int Graph::add_activation(OpType op, int input) {
+    if (!is_activation(op)) throw std::invalid_argument("not an activation");
+    int id = add_node(op, {input});
+    nodes_[id].layout = nodes_[input].layout;
+    return id;
+}
+
+int Graph::add_reshape(int input, const std::vector<int>& target_shape) {
+    int id = add_node(OpType::Reshape, {input});
+    nodes_[id].target_shape = target_shape;
+    return id;
+}
+
+int Graph::add_layout_convert(int input, Layout layout) {
+    int id = add_node(OpType::LayoutConvert, {input});
+    nodes_[id].layout = layout;
+    return id;
+}
+
+int Graph::add_mse_loss(int predictions, int targets) {
+    return add_node(OpType::MSELoss, {predictions, targets});
+}
+
+void Graph::set_output(int id) {
+    output_ = id;
+    planned_ = false;
+}
+
+std::vector<int> Graph::consumers(int id) const {
+    std::vector<int> result;
+    for (const GraphNode& node : nodes_) {
+        if (node.removed) continue;
+        if (std::find(node.inputs.begin(), node.inputs.end(), id) != node.inputs.end()) {
+            result.push_back(node.id);
+        }
+    }
+    return result;
+}
+
+void Graph::replace_uses(int from, int to) {
+    for (GraphNode& node : nodes_) {
+        if (node.removed || node.id == to) continue;
+        std::replace(node.inputs.begin(), node.inputs.end(), from, to);
+    }
+    if (output_ == from) output_ = to;
+    planned_ = false;
+}
+
+void Graph::remove_node(int id) {
+    nodes_[id].removed = true;
+    planned_ = false;
+}
+
+// post-order walk from the output, so only nodes the output depends on are scheduled
+std::vector<int> Graph::topological_order() const {
+    std::vector<int> order;
+    if (output_ < 0) return order;
+
+    // 0 unvisited, 1 on the stack, 2 done
+    std::vector<char> state(nodes_.size(), 0);
+    std::vector<std::pair<int, size_t>> stack = {{output_, 0}};
+    state[output_] = 1;
+    while (!stack.empty()) {
+        auto& [id, next] = stack.back();
+        const GraphNode& node = nodes_[id];
+        if (next < node.inputs.size()) {
+            int input = node.inputs[next++];
+            if (state[input] == 1) throw std::runtime_error("graph has a cycle");
+            if (state[input] == 0) {
+                if (nodes_[input].removed) throw std::runtime_error("graph reads a removed node");
+                state[input] = 1;
+                stack.push_back({input, 0});
+            }
+            continue;
+        }
+        state[id] = 2;
+        order.push_back(id);
+        stack.pop_back();
+    }
+    return order;
+}
+
+std::vector<std::vector<int>> Graph::compute_shapes(const std::vector<std::vector<int>>& input_shapes) const {
+    if (input_shapes.size() != inputs_.size()) {
+        throw std::invalid_argument("expected one shape per graph input");
+    }
+
+    std::vector<std::vector<int>> shapes(nodes_.size());
+    for (size_t i = 0; i < inputs_.size(); ++i) {
+        shapes[inputs_[i]] = input_shapes[i];
+    }
+
+    for (int id : topological_order()) {
+        const GraphNode& node = nodes_[id];
+        const std::vector<int>& in = node.inputs.empty() ? shapes[id] : shapes[node.inputs[0]];
+        switch (node.op) {
+            case OpType::Input: break;
+            case OpType::Convolution: shapes[id] = node.conv->output_shape(in); break;
+            case OpType::FullyConnected: shapes[id] = node.fc->output_shape(in); break;
+            case OpType::ReLU:
+            case OpType::Sigmoid:
+            case OpType::Tanh:
+            case OpType::LayoutConvert: shapes[id] = in; break;
+            case OpType::Reshape: shapes[id] = resolve_reshape(in, node.target_shape); break;
+            case OpType::MSELoss: shapes[id] = {1}; break;
+        }
+    }
+    return shapes;
+}
+
+void Graph::infer_shapes(const std::vector<std::vector<int>>& input_shapes) {
+    std::vector<std::vector<int>> shapes = compute_shapes(input_shapes);
+    for (size_t id = 0; id < nodes_.size(); ++id) {
+        nodes_[id].shape = std::move(shapes[id]);
+    }
+}
+
+std::vector<int> Graph::output_shape(const std::vector<std::vector<int>>& input_shapes) const {
+    if (output_ < 0) throw std::runtime_error("graph has no output");
+    return compute_shapes(input_shapes)[output_];
+}
+
+void Graph::set_keep_alive(bool keep_alive) {
+    if (keep_alive != keep_alive_) planned_ = false;
+    keep_alive_ = keep_alive;
+}
+
+// every node reads its inputs in the layout it expects, conversions are explicit nodes
+void Graph::check_layouts() const {
+    if (nodes_[output_].layout != Layout::NCHW) throw std::runtime_error("graph output must be NCHW");
+    for (int id : topological_order()) {
+        const GraphNode& node = nodes_[id];
+        if (node.op == OpType::LayoutConvert) continue;
+        Layout expected = node.op == OpType::Convolution || is_activation(node.op) ? node.layout : Layout::NCHW;
+        for (int input : node.inputs) {
+            if (nodes_[input].layout != expected) {
+                throw std::runtime_error(std::string(op_name(node.op)) + " reads " + layout_name(nodes_[input].layout) +
+                                         " but expects " + layout_name(expected));
+            }
+        }
+    }
+}
+
+void Graph::plan(const std::vector<std::vector<int>>& input_shapes) {
+    if (output_ < 0) throw std::runtime_error("graph has no output");
+    check_layouts();
+    infer_shapes(input_shapes);
+    order_ = topological_order();
+    buffer_shapes_.assign(nodes_.size(), {});
+    for (int id : order_) {
+        buffer_shapes_[id] = layout::physical_shape(nodes_[id].shape, nodes_[id].layout);
+    }
+
+    int steps = static_cast<int>(order_.size());
+    std::vector<int> position(nodes_.size(), -1);
+    std::vector<int> readers(nodes_.size(), 0);
+    for (int s = 0; s < steps; ++s) {
+        position[order_[s]] = s;
+        for (int input : nodes_[order_[s]].inputs) readers[input]++;
+    }
+
+    // Reshapes are views of their input. An activation overwrites its input when it is the
+    // only reader along the whole chain of views, and never touches a caller-owned input.
+    root_.assign(nodes_.size(), -1);
+    std::vector<char> exclusive(nodes_.size(), 0);
+    for (int id : order_) {
+        const GraphNode& node = nodes_[id];
+        root_[id] = id;
+        exclusive[id] = 1;
+        if (node.op == OpType::Reshape) {
+            int in = node.inputs[0];
+            root_[id] = root_[in];
+            exclusive[id] = exclusive[in] && readers[in] == 1;
+        } else if (is_activation(node.op)) {
+            int in = node.inputs[0];
+            if (exclusive[in] && readers[in] == 1 && nodes_[root_[in]].op != OpType::Input) {
+                root_[id] = root_[in];
+            }
+        }
+    }
+
+    // the output writes straight into the caller's tensor, inputs are the caller's too
+    int output_root = root_[output_];
+    std::vector<int> request_of(nodes_.size(), -1);
+    std::vector<int> planned_roots;
+    std::vector<BufferRequest> requests;
+    for (int id : order_) {
+        if (root_[id] != id || id == output_root || nodes_[id].op == OpType::Input) continue;
+        size_t elements = 1;
+        for (int dim : buffer_shapes_[id]) elements *= dim;
+        request_of[id] = static_cast<int>(requests.size());
+        planned_roots.push_back(id);
+        requests.push_back({elements * sizeof(float), position[id], position[id]});
+    }
+
+    // a buffer lives until the last reader of any node aliasing it
+    for (int id : order_) {
+        int request = request_of[root_[id]];
+        if (request < 0) continue;
+        int last_use = position[id];
+        for (int consumer : consumers(id)) {
+            if (position[consumer] >= 0) last_use = std::max(last_use, position[consumer]);
+        }
+        if (keep_alive_) last_use = steps;
+        requests[request].last_use = std::max(requests[request].last_use, last_use);
+    }
+    memory_plan_ = MemoryPlanner::plan(requests);
+
+    // kept across calls, so never from a per-inference arena
+    int storage_elements = static_cast<int>(memory_plan_.planned_bytes / sizeof(float));
+    storage_ = std::make_shared<Tensor>(std::vector<int>{storage_elements}, nullptr, Allocator::default_allocator());
+
+    values_.assign(nodes_.size(), Tensor(std::vector<int>{0}));
+    for (size_t r = 0; r < planned_roots.size(); ++r) {
+        int id = planned_roots[r];
+        int begin = static_cast<int>(memory_plan_.offsets[r] / sizeof(float));
+        int elements = static_cast<int>(requests[r].bytes / sizeof(float));
+        values_[id] = storage_->slice(begin, begin + elements).reshape(buffer_shapes_[id]);
+    }
+    for (int id : order_) {
+        if (root_[id] == id || request_of[root_[id]] < 0) continue;
+        bind(id, values_[nodes_[id].inputs[0]]);
+    }
+
+    planned_shapes_ = input_shapes;
+    planned_ = true;
+}
+
+void Graph::bind(int id, const Tensor& source) {
+    const std::vector<int>& shape = buffer_shapes_[id];
+    if (source.shape() == shape) {
+        values_[id] = source;
+    } else {
+        values_[id] = source.reshape(shape);
+    }
+}
+
+void Graph::execute(const Tensor& input, Tensor& output) {
+    if (!planned_ || planned_shapes_.size() != 1 || planned_shapes_[0] != input.shape()) {
+        plan({input.shape()});
+    }
+    const Tensor* inputs[] = {&input};
+    run(inputs, output);
+}
+
+void Graph::execute(const std::vector<Tensor>& inputs, Tensor& output) {
+    bool same_shapes = planned_ && planned_shapes_.size() == inputs.size();
+    for (size_t i = 0; same_shapes && i < inputs.size(); ++i) {
+        same_shapes = planned_shapes_[i] == inputs[i].shape();
+    }
+    if (!same_shapes) {
+        std::vector<std::vector<int>> shapes;
+        for (const Tensor& input : inputs) shapes.push_back(input.shape());
+        plan(shapes);
+    }
+
+    std::vector<const Tensor*> pointers;
+    for (const Tensor& input : inputs) pointers.push_back(&input);
+    run(pointers.data(), output);
+}
+
+void Graph::run(const Tensor* const* inputs, Tensor& output) {
+    // caller-owned tensors change between calls, rebind them and everything aliasing them
+    for (size_t i = 0; i < inputs_.size(); ++i) {
+        bind(inputs_[i], *inputs[i]);
+    }
+    int output_root = root_[output_];
+    bool output_is_input = nodes_[output_root].op == OpType::Input;
+    if (!output_is_input) {
+        bind(output_root, output);
+    }
+
+    for (int id : order_) {
+        const GraphNode& node = nodes_[id];
+        if (root_[id] != id && (root_[id] == output_root || nodes_[root_[id]].op == OpType::Input)) {
+            bind(id, values_[node.inputs[0]]);
+        }
+
+        Tensor& out = values_[id];
+        switch (node.op) {
+            case OpType::Input:
+            case OpType::Reshape:
+                break;
+            case OpType::Convolution:
+                node.conv->forward(values_[node.inputs[0]], out, node.activation, node.layout);
+                break;
+            case OpType::FullyConnected:
+                node.fc->forward_cpu(values_[node.inputs[0]], out, node.activation);
+                break;
+            case OpType::ReLU:
+                activation::relu(values_[node.inputs[0]], out);
+                break;
+            case OpType::Sigmoid:
+                activation::sigmoid(values_[node.inputs[0]], out);
+                break;
+            case OpType::Tanh:
+                activation::tanh(values_[node.inputs[0]], out);
+                break;
+            case OpType::LayoutConvert:
+                layout::convert(values_[node.inputs[0]], nodes_[node.inputs[0]].layout, out, node.layout);
+                break;
+            case OpType::MSELoss:
+                out.data()[0] = loss::mse(values_[node.inputs[0]], values_[node.inputs[1]]);
+                break;
+        }
+    }
+
+    // nothing was computed, the output is the input itself or a view of it
+    if (output_is_input) {
+        Tensor result = values_[output_].contiguous();
+        std::copy(result.data(), result.data() + result.size(), output.data());
+    }
+}
@@ -0,0 +1,90 @@
+#include "half.h"
+#include "allocator.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace half {
+
+namespace {
+
+// columns of b per task, a whole number of registers on every ISA
+constexpr int kStrip = 64;
+
+// b widened for the sgemm of larger batches, reused across calls
+thread_local ScratchBuffer widened;
+
+}
+
+cpu::HalfFormat format_of(DType dtype) {
+    switch (dtype) {
+        case DType::Float16: return cpu::HalfFormat::Float16;
+        case DType::BFloat16: return cpu::HalfFormat::BFloat16;
+        case DType::Float32: break;
+    }
+    throw std::invalid_argument("float32 is not a half precision dtype");
+}
+
+uint16_t from_float(float x, cpu::HalfFormat format) {
+    uint16_t h;
+    cpu::kernels().to_half(&x, &h, 1, format);
+    return h;
+}
+
+float to_float(uint16_t h, cpu::HalfFormat format) {
+    float x;
+    cpu::kernels().from_half(&h, &x, 1, format);
+    return x;
+}
+
+void narrow(const float* in, uint16_t* out, int count, cpu::HalfFormat format) {
+    const cpu::Kernels& kernels = cpu::kernels();
+    ThreadPool::getInstance().parallel_for(0, count, ThreadPool::grain_for(2.0), [&](int begin, int end) {
+        kernels.to_half(in + begin, out + begin, end - begin, format);
+    });
+}
+
+void widen(const uint16_t* in, float* out, int count, cpu::HalfFormat format) {
+    const cpu::Kernels& kernels = cpu::kernels();
+    ThreadPool::getInstance().parallel_for(0, count, ThreadPool::grain_for(2.0), [&](int begin, int end) {
+        kernels.from_half(in + begin, out + begin, end - begin, format);
+    });
+}
+
+void gemm(int m, int n, int k, const float* a, int lda, const uint16_t* b, int ldb, cpu::HalfFormat format,
+          float* c, int ldc, const gemm::Epilogue& epilogue) {
+    assert(!epilogue.bias_per_row);
+    if (m <= 0 || n <= 0) return;
+
+    if (m > kStreamRows) {
+        float* wide = widened.reserve(static_cast<size_t>(k) * n);
+        const cpu::Kernels& kernels = cpu::kernels();
+        ThreadPool::getInstance().parallel_for(0, k, ThreadPool::grain_for(2.0 * n), [&](int begin, int end) {
+            for (int p = begin; p < end; ++p) {
+                kernels.from_half(b + static_cast<std::ptrdiff_t>(p) * ldb, wide + static_cast<std::ptrdiff_t>(p) * n, n, format);
+            }
+        });
+        gemm::sgemm(false, false, m, n, k, 1.0f, a, lda, wide, n, 0.0f, c, ldc, epilogue);
+        return;
+    }
+
+    const cpu::Kernels& kernels = cpu::kernels();
+    int strips = (n + kStrip - 1) / kStrip;
+    int grain = ThreadPool::grain_for(2.0 * m * k * kStrip);
+    ThreadPool::getInstance().parallel_for(0, strips, grain, [&](int begin, int end) {
+        for (int s = begin; s < end; ++s) {
+            int col0 = s * kStrip;
+            int cols = std::min(kStrip, n - col0);
+            cpu::TileEpilogue tile{epilogue.bias ? epilogue.bias + col0 : nullptr, false, epilogue.activation};
+            // the strip stays in cache while the row blocks go by
+            for (int row0 = 0; row0 < m; row0 += cpu::kHalfRows) {
+                int rows = std::min(cpu::kHalfRows, m - row0);
+                kernels.half_gemm(rows, k, cols, a + static_cast<std::ptrdiff_t>(row0) * lda, lda, b + col0, ldb, format,
+                                  c + static_cast<std::ptrdiff_t>(row0) * ldc + col0, ldc, &tile);
+            }
+        }
+    });
+}
+
+}
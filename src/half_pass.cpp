@@ -0,0 +1,19 @@
+#include "half_pass.h"
+#include "fully_connected_layer.h"
+#include "graph.h"
+#include "optimization_pass_registrar.h"
+
+void HalfPrecisionPass::apply(Graph& graph) {
+    for (int id : graph.topological_order()) {
+        GraphNode& node = graph.node(id);
+        if (node.op == OpType::FullyConnected && node.fc) node.fc->set_weight_dtype(dtype_);
+    }
+    graph.invalidate_plan();
+}
+
+REGISTER_OPTIMIZATION_PASS("convert_fp16", HalfPrecisionPass);
+REGISTER_OPTIMIZATION_PASS("convert_bf16", BFloat16Pass);
+
+void register_half_passes() {
+    // empty bc registration is handled by REGISTER_OPTIMIZATION_PASS macro
+}
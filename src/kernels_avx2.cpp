@@ -0,0 +1,17 @@
+#include "simd_kernels.h"
+
+namespace cpu {
+
+// built with -mavx2 -mfma -mf16c. 6 x 16 tile: 12 of the 16 ymm registers hold C, the same
+// for int8. half: 4 x 16
+const Kernels* avx2_kernels() {
+#if defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+    static const Kernels kernels =
+        simd::make_kernels<simd::Avx2, 6, 2, simd::Avx2Int8, 6, simd::Avx2Half, 2>(Isa::AVX2);
+    return &kernels;
+#else
+    return nullptr;
+#endif
+}
+
+}
@@ -0,0 +1,21 @@
+#include "simd_kernels.h"
+
+namespace cpu {
+
+// built with -mavx512f -mavx512bw -mf16c. 12 x 32 tile: 24 of the 32 zmm registers hold C.
+// int8: 12 x 16, one register per row. half: 4 x 64, 16 accumulators
+const Kernels* avx512_kernels() {
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    static const Kernels kernels = [] {
+        Kernels table = simd::make_kernels<simd::Avx512, 12, 2, simd::Avx512Int8, 12, simd::Avx512Half, 4>(Isa::AVX512);
+        // a block-sparse block row fills a ymm, the AVX2 kernel is already the right width
+        table.sparse_panel = avx2_kernels()->sparse_panel;
+        return table;
+    }();
+    return &kernels;
+#else
+    return nullptr;
+#endif
+}
+
+}
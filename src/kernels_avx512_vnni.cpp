@@ -0,0 +1,22 @@
+#include "simd_kernels.h"
+
+namespace cpu {
+
+// built with -mavx512f -mavx512bw -mavx512vnni -mf16c. the float kernels are the AVX-512 ones, only
+// int8 changes: vpdpbusd does the multiply and both adds in one instruction
+const Kernels* avx512_vnni_kernels() {
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VNNI__)
+    static const Kernels kernels = [] {
+        Kernels table = *avx512_kernels();
+        table.isa = Isa::AVX512VNNI;
+        table.int8_mr = 12;
+        table.int8_micro_kernel = simd::int8_micro_kernel<simd::Avx512VnniInt8, 12>;
+        return table;
+    }();
+    return &kernels;
+#else
+    return nullptr;
+#endif
+}
+
+}
@@ -0,0 +1,13 @@
+#include "simd_kernels.h"
+
+namespace cpu {
+
+// baseline x86-64, built without extra flags. 6 x 8 tile: 12 of the 16 xmm registers hold C.
+// int8: 2 x 16, 8 accumulators, the pmaddwd emulation needs the rest. half: 4 x 8
+const Kernels* sse_kernels() {
+    static const Kernels kernels =
+        simd::make_kernels<simd::Sse, 6, 2, simd::SseInt8, 2, simd::SseHalf, 2>(Isa::SSE);
+    return &kernels;
+}
+
+}
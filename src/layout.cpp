@@ -0,0 +1,113 @@
+#include "layout.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace {
+
+// strides of the logical [n, c, h, w] index for a layout, so any pair converts by one loop
+struct Strides {
+    size_t n, c, h, w;
+};
+
+size_t channel_offset(Layout layout, const Strides& s, int c) {
+    if (layout == Layout::NCHW8c) {
+        return (c / layout::kChannelBlock) * s.c + c % layout::kChannelBlock;
+    }
+    return c * s.c;
+}
+
+Strides strides_of(Layout layout, int channels, int height, int width) {
+    int blocks = (channels + layout::kChannelBlock - 1) / layout::kChannelBlock;
+    switch (layout) {
+        case Layout::NCHW:
+            return {static_cast<size_t>(channels) * height * width, static_cast<size_t>(height) * width,
+                    static_cast<size_t>(width), 1};
+        case Layout::NHWC:
+            return {static_cast<size_t>(height) * width * channels, 1,
+                    static_cast<size_t>(width) * channels, static_cast<size_t>(channels)};
+        case Layout::NCHW8c:
+            // s.c is the stride of a channel block, the lane is added on top
+            return {static_cast<size_t>(blocks) * height * width * layout::kChannelBlock,
+                    static_cast<size_t>(height) * width * layout::kChannelBlock,
+                    static_cast<size_t>(width) * layout::kChannelBlock, layout::kChannelBlock};
+    }
+    return {0, 0, 0, 0};
+}
+
+}
+
+const char* layout_name(Layout layout) {
+    switch (layout) {
+        case Layout::NCHW: return "NCHW";
+        case Layout::NHWC: return "NHWC";
+        case Layout::NCHW8c: return "NCHW8c";
+    }
+    return "Unknown";
+}
+
+namespace layout {
+
+std::vector<int> physical_shape(const std::vector<int>& shape, Layout layout) {
+    if (layout == Layout::NCHW) return shape;
+    if (shape.size() != 4) throw std::invalid_argument("only 4-D tensors have a channel layout");
+    switch (layout) {
+        case Layout::NHWC:
+            return {shape[0], shape[2], shape[3], shape[1]};
+        case Layout::NCHW8c:
+            return {shape[0], (shape[1] + kChannelBlock - 1) / kChannelBlock, shape[2], shape[3], kChannelBlock};
+        default:
+            return shape;
+    }
+}
+
+void convert(const Tensor& source_view, Layout from, Tensor& destination, Layout to) {
+    Tensor source = source_view.contiguous();
+    assert(destination.is_contiguous());
+
+    // logical n, c, h, w, the channel count from the side that stores it exactly
+    const std::vector<int>& exact = from != Layout::NCHW8c ? source.shape() : destination.shape();
+    Layout exact_layout = from != Layout::NCHW8c ? from : to;
+    int batch, channels, height, width;
+    if (exact_layout == Layout::NHWC) {
+        batch = exact[0]; height = exact[1]; width = exact[2]; channels = exact[3];
+    } else if (exact_layout == Layout::NCHW) {
+        batch = exact[0]; channels = exact[1]; height = exact[2]; width = exact[3];
+    } else {
+        // blocked on both sides, the padding comes along
+        batch = exact[0]; channels = exact[1] * kChannelBlock; height = exact[2]; width = exact[3];
+    }
+
+    if (from == to) {
+        std::copy(source.data(), source.data() + source.size(), destination.data());
+        return;
+    }
+
+    Strides in = strides_of(from, channels, height, width);
+    Strides out = strides_of(to, channels, height, width);
+    if (to == Layout::NCHW8c) {
+        std::fill(destination.data(), destination.data() + destination.size(), 0.0f);
+    }
+
+    const float* src = source.data();
+    float* dst = destination.data();
+    // tasks are (image, channel) planes, small planes are grouped so a chunk is worth a thread.
+    // the innermost loop walks the destination row
+    int grain = ThreadPool::grain_for(2.0 * height * width);
+    ThreadPool::getInstance().parallel_for(0, batch * channels, grain, [&](int begin, int end) {
+        for (int task = begin; task < end; ++task) {
+            int b = task / channels;
+            int c = task % channels;
+            const float* s = src + b * in.n + channel_offset(from, in, c);
+            float* d = dst + b * out.n + channel_offset(to, out, c);
+            for (int h = 0; h < height; ++h) {
+                for (int w = 0; w < width; ++w) {
+                    d[h * out.h + w * out.w] = s[h * in.h + w * in.w];
+                }
+            }
+        }
+    });
+}
+
+}
@@ -0,0 +1,62 @@
+#include "layout_pass.h"
+#include "graph.h"
+#include "optimization_pass_registrar.h"
+#include <map>
+#include <utility>
+
+namespace {
+
+bool follows_input(OpType op) {
+    return op == OpType::ReLU || op == OpType::Sigmoid || op == OpType::Tanh;
+}
+
+}
+
+void LayoutPropagationPass::apply(Graph& graph) {
+    std::vector<int> order = graph.topological_order();
+
+    // choose layouts front to back, producers are decided before their readers
+    for (int id : order) {
+        GraphNode& node = graph.node(id);
+        if (node.op == OpType::Convolution) {
+            node.layout = layout_;
+        } else if (follows_input(node.op)) {
+            node.layout = graph.node(node.inputs[0]).layout;
+        } else if (node.op != OpType::LayoutConvert) {
+            node.layout = Layout::NCHW;
+        }
+    }
+
+    // one conversion per (producer, layout), shared by every reader that needs it
+    std::map<std::pair<int, Layout>, int> conversions;
+    auto converted = [&](int producer, Layout layout) {
+        if (graph.node(producer).layout == layout) return producer;
+        auto key = std::make_pair(producer, layout);
+        auto it = conversions.find(key);
+        if (it != conversions.end()) return it->second;
+        int id = graph.add_layout_convert(producer, layout);
+        conversions[key] = id;
+        return id;
+    };
+
+    for (int id : order) {
+        OpType op = graph.node(id).op;
+        if (op == OpType::LayoutConvert || follows_input(op)) continue;
+        Layout expected = op == OpType::Convolution ? layout_ : Layout::NCHW;
+        // add_layout_convert grows the node list, index it afresh every time
+        for (size_t i = 0; i < graph.node(id).inputs.size(); ++i) {
+            int input = converted(graph.node(id).inputs[i], expected);
+            graph.node(id).inputs[i] = input;
+        }
+    }
+
+    int output = graph.output();
+    graph.set_output(converted(output, Layout::NCHW));
+    graph.invalidate_plan();
+}
+
+REGISTER_OPTIMIZATION_PASS("propagate_layout", LayoutPropagationPass);
+
+void register_layout_passes() {
+    // empty bc registration is handled by REGISTER_OPTIMIZATION_PASS macro
+}
@@ -1,25 +1,26 @@
 #include "loss_functions.h"
-#include <cmath>
+#include "elementwise.h"
+#include <cassert>
 
 namespace loss {
 
 float mse(const Tensor& predictions, const Tensor& targets) {
-    float sum = 0.0f;
-    int size = predictions.shape()[0] * predictions.shape()[1];
-    for (int i = 0; i < size; ++i) {
-        float diff = predictions.data()[i] - targets.data()[i];
-        sum += diff * diff;
-    }
-    return sum / size;
+    assert(predictions.size() == targets.size());
+    int size = predictions.size();
+    return static_cast<float>(elementwise::sum_squared_difference(predictions, targets) / size);
+}
+
+void mse_gradient(const Tensor& predictions, const Tensor& targets, Tensor& gradient) {
+    assert(predictions.size() == targets.size());
+    int size = predictions.size();
+    elementwise::binary(cpu::BinaryOp::Subtract, predictions, targets, gradient);
+    elementwise::unary(cpu::MapOp::Scale, gradient, gradient, 2.0f / size);
 }
 
 Tensor mse_gradient(const Tensor& predictions, const Tensor& targets) {
     Tensor gradient(predictions.shape());
-    int size = predictions.shape()[0] * predictions.shape()[1];
-    for (int i = 0; i < size; ++i) {
-        gradient.data()[i] = 2 * (predictions.data()[i] - targets.data()[i]) / size;
-    }
+    mse_gradient(predictions, targets, gradient);
     return gradient;
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,70 @@
+#include "memory_planner.h"
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+namespace {
+
+size_t aligned_size(size_t bytes) {
+    return (bytes + MemoryPlanner::kAlignment - 1) / MemoryPlanner::kAlignment * MemoryPlanner::kAlignment;
+}
+
+bool lifetimes_overlap(const BufferRequest& a, const BufferRequest& b) {
+    return a.first_use <= b.last_use && b.first_use <= a.last_use;
+}
+
+}
+
+MemoryPlan MemoryPlanner::plan(const std::vector<BufferRequest>& requests) {
+    MemoryPlan plan;
+    plan.offsets.assign(requests.size(), 0);
+
+    std::vector<size_t> order(requests.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return requests[a].bytes > requests[b].bytes;
+    });
+
+    std::vector<size_t> placed;
+    std::vector<std::pair<size_t, size_t>> busy;
+    for (size_t index : order) {
+        const BufferRequest& request = requests[index];
+        size_t size = aligned_size(request.bytes);
+
+        // address ranges already taken by buffers alive at the same time
+        busy.clear();
+        for (size_t other : placed) {
+            if (lifetimes_overlap(request, requests[other])) {
+                busy.emplace_back(plan.offsets[other], plan.offsets[other] + aligned_size(requests[other].bytes));
+            }
+        }
+        std::sort(busy.begin(), busy.end());
+
+        size_t offset = 0;
+        for (const auto& range : busy) {
+            if (offset + size <= range.first) break;
+            offset = std::max(offset, range.second);
+        }
+
+        plan.offsets[index] = offset;
+        plan.planned_bytes = std::max(plan.planned_bytes, offset + size);
+        placed.push_back(index);
+    }
+
+    int last_step = 0;
+    for (const BufferRequest& request : requests) {
+        plan.naive_bytes += aligned_size(request.bytes);
+        last_step = std::max(last_step, request.last_use);
+    }
+    for (int step = 0; step <= last_step; ++step) {
+        size_t live = 0;
+        for (const BufferRequest& request : requests) {
+            if (request.first_use <= step && step <= request.last_use) {
+                live += aligned_size(request.bytes);
+            }
+        }
+        plan.peak_live_bytes = std::max(plan.peak_live_bytes, live);
+    }
+
+    return plan;
+}
@@ -1,39 +1,75 @@
 #include "network.h"
-#include "activation_functions.h"
+#include "fusion_pass.h"
 #include "loss_functions.h"
 #include <iostream>
 
+Network::Network() {
+    last_node = network_graph.add_input();
+    network_graph.set_output(last_node);
+}
+
 void Network::add_fully_connected_layer(int input_size, int output_size) {
-    fc_layers.push_back(std::make_unique<FullyConnectedLayer>(input_size, output_size));
+    fc_layers.push_back(std::make_shared<FullyConnectedLayer>(input_size, output_size));
+
+    // conv outputs are flattened to [batch, features] by a view, no copy
+    if (spatial_output) {
+        last_node = network_graph.add_reshape(last_node, {0, -1});
+        spatial_output = false;
+    }
+    int layer = network_graph.add_fully_connected(last_node, fc_layers.back());
+    last_node = network_graph.add_activation(OpType::ReLU, layer);
+    network_graph.set_output(last_node);
+    fused = false;
 }
 
 void Network::add_convolutional_layer(int in_channels, int out_channels, int kernel_size, int stride, int padding) {
-    conv_layers.push_back(std::make_unique<ConvolutionalLayer>(in_channels, out_channels, kernel_size, stride, padding));
+    conv_layers.push_back(std::make_shared<ConvolutionalLayer>(in_channels, out_channels, kernel_size, stride, padding));
+
+    int layer = network_graph.add_convolution(last_node, conv_layers.back());
+    last_node = network_graph.add_activation(OpType::ReLU, layer);
+    network_graph.set_output(last_node);
+    spatial_output = true;
+    fused = false;
+}
+
+std::vector<int> Network::output_shape(const std::vector<int>& input_shape) const {
+    return network_graph.output_shape({input_shape});
+}
+
+void Network::fuse() {
+    if (fused) return;
+    FusionPass fusion;
+    fusion.apply(network_graph);
+    // the trailing ReLU is gone, new layers attach to the layer that absorbed it
+    last_node = network_graph.output();
+    fused = true;
+}
+
+void Network::plan_memory(const std::vector<int>& input_shape) {
+    fuse();
+    network_graph.set_keep_alive(training);
+    network_graph.plan({input_shape});
+}
+
+void Network::apply_pass(OptimizationPass& pass) {
+    pass.apply(network_graph);
+    network_graph.invalidate_plan();
 }
 
 Tensor Network::forward(const Tensor& input) {
-    Tensor current = input;
-    
-    for (const auto& layer : conv_layers) {
-        current = layer->forward(current);
-        current = activation::relu(current);
-    }
-    
-    // Flatten the output of convolutional layers for fully connected layers
-    if (!fc_layers.empty() && current.shape().size() > 2) {
-        int flat_size = current.shape()[1] * current.shape()[2] * current.shape()[3];
-        current = Tensor({current.shape()[0], flat_size}, current.data());
-    }
-    
-    for (const auto& layer : fc_layers) {
-        current = layer->forward(current);
-        current = activation::relu(current);
-    }
-    
-    return current;
+    Tensor output(output_shape(input.shape()));
+    forward(input, output);
+    return output;
+}
+
+void Network::forward(const Tensor& input, Tensor& output) {
+    fuse();
+    network_graph.set_keep_alive(training);
+    network_graph.execute(input, output);
 }
 
 void Network::train(const std::vector<Tensor>& inputs, const std::vector<Tensor>& targets, int epochs, float learning_rate) {
+    training = true;
     for (int epoch = 0; epoch < epochs; ++epoch) {
         float total_loss = 0.0f;
         
@@ -55,4 +91,6 @@ void Network::train(const std::vector<Tensor>& inputs, const std::vector<Tensor>
         std::cout << "Epoch " << epoch + 1 << "/" << epochs 
                   << ", Average Loss: " << avg_loss << std::endl;
     }
+    
+    training = false;
 }
\ No newline at end of file
@@ -0,0 +1,300 @@
+#include "opencl_gemm.h"
+#include "program_cache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+namespace opencl_gemm {
+
+// TM x TN tile per work-group, TK deep slices staged in local memory, WM x WN outputs per
+// work-item. a_tile is stored transposed so the inner loop reads both tiles along k rows
+const char* kernel_source = R"(
+#define LM (TM / WM)
+#define LN (TN / WN)
+
+__kernel __attribute__((reqd_work_group_size(LN, LM, 1)))
+void gemm_tiled(__global const float* a, __global const float* b, __global const float* bias,
+                __global float* c, const int m, const int n, const int k, const int has_bias,
+                const int activation) {
+    __local float a_tile[TK][TM];
+    __local float b_tile[TK][TN];
+
+    const int tx = get_local_id(0);
+    const int ty = get_local_id(1);
+    const int lid = ty * LN + tx;
+    const int row0 = get_group_id(1) * TM;
+    const int col0 = get_group_id(0) * TN;
+
+    float acc[WM][WN];
+    #pragma unroll
+    for (int i = 0; i < WM; ++i) {
+        #pragma unroll
+        for (int j = 0; j < WN; ++j) acc[i][j] = 0.0f;
+    }
+
+    for (int k0 = 0; k0 < k; k0 += TK) {
+        // consecutive work-items load consecutive elements of a row, out of range reads as 0
+        for (int i = lid; i < TM * TK; i += LM * LN) {
+            int r = i / TK;
+            int kk = i % TK;
+            int row = row0 + r;
+            int col = k0 + kk;
+            a_tile[kk][r] = (row < m && col < k) ? a[row * k + col] : 0.0f;
+        }
+        for (int i = lid; i < TK * TN; i += LM * LN) {
+            int kk = i / TN;
+            int cc = i % TN;
+            int row = k0 + kk;
+            int col = col0 + cc;
+            b_tile[kk][cc] = (row < k && col < n) ? b[row * n + col] : 0.0f;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        #pragma unroll
+        for (int kk = 0; kk < TK; ++kk) {
+            float a_reg[WM];
+            float b_reg[WN];
+            #pragma unroll
+            for (int i = 0; i < WM; ++i) a_reg[i] = a_tile[kk][ty + i * LM];
+            #pragma unroll
+            for (int j = 0; j < WN; ++j) b_reg[j] = b_tile[kk][tx + j * LN];
+            #pragma unroll
+            for (int i = 0; i < WM; ++i) {
+                #pragma unroll
+                for (int j = 0; j < WN; ++j) acc[i][j] = mad(a_reg[i], b_reg[j], acc[i][j]);
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    #pragma unroll
+    for (int i = 0; i < WM; ++i) {
+        int row = row0 + ty + i * LM;
+        if (row >= m) break;
+        #pragma unroll
+        for (int j = 0; j < WN; ++j) {
+            int col = col0 + tx + j * LN;
+            if (col >= n) break;
+            // activation as gemm::Activation: 1 ReLU, 2 sigmoid, 3 tanh
+            float value = acc[i][j] + (has_bias ? bias[col] : 0.0f);
+            if (activation == 1) value = fmax(value, 0.0f);
+            else if (activation == 2) value = 1.0f / (1.0f + exp(-value));
+            else if (activation == 3) value = tanh(value);
+            c[row * n + col] = value;
+        }
+    }
+}
+)";
+
+std::string TileConfig::options() const {
+    std::ostringstream options;
+    options << "-DTM=" << tile_m << " -DTN=" << tile_n << " -DTK=" << tile_k << " -DWM=" << work_m
+            << " -DWN=" << work_n;
+    return options.str();
+}
+
+std::string TileConfig::name() const {
+    std::ostringstream name;
+    name << tile_m << "x" << tile_n << "x" << tile_k << "/" << work_m << "x" << work_n;
+    return name.str();
+}
+
+std::vector<TileConfig> candidates(size_t max_work_group_size, size_t local_memory_bytes) {
+    // {tile_m, tile_n, tile_k, work_m, work_n}. the narrow tiles are for small batches
+    static const TileConfig all[] = {
+        {32, 32, 16, 4, 4},
+        {16, 16, 16, 2, 2},
+        {32, 32, 16, 2, 2},
+        {8, 64, 16, 1, 4},
+        {16, 64, 16, 2, 4},
+        {32, 64, 16, 4, 4},
+        {64, 64, 16, 8, 8},
+        {64, 64, 16, 4, 4},
+        {64, 128, 16, 8, 8},
+    };
+    std::vector<TileConfig> fitting;
+    for (const TileConfig& config : all) {
+        size_t work_group = static_cast<size_t>(config.local_m()) * config.local_n();
+        if (work_group <= max_work_group_size && config.local_bytes() <= local_memory_bytes) {
+            fitting.push_back(config);
+        }
+    }
+    return fitting;
+}
+
+void sgemm(const TileConfig& config, int m, int n, int k, cl_mem a, cl_mem b, cl_mem bias, cl_mem c,
+           gemm::Activation activation, const std::vector<cl_event>& wait_for, cl_event* done) {
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+    cl_kernel kernel = runtime.kernel("gemm_" + config.name(), kernel_source, "gemm_tiled", config.options());
+
+    // the kernel never reads bias without has_bias, any valid buffer stands in
+    int has_bias = bias ? 1 : 0;
+    cl_mem bias_buffer = bias ? bias : a;
+    clSetKernelArg(kernel, 0, sizeof(cl_mem), &a);
+    clSetKernelArg(kernel, 1, sizeof(cl_mem), &b);
+    clSetKernelArg(kernel, 2, sizeof(cl_mem), &bias_buffer);
+    clSetKernelArg(kernel, 3, sizeof(cl_mem), &c);
+    clSetKernelArg(kernel, 4, sizeof(int), &m);
+    clSetKernelArg(kernel, 5, sizeof(int), &n);
+    clSetKernelArg(kernel, 6, sizeof(int), &k);
+    clSetKernelArg(kernel, 7, sizeof(int), &has_bias);
+    int activation_id = static_cast<int>(activation);
+    clSetKernelArg(kernel, 8, sizeof(int), &activation_id);
+
+    size_t local_work_size[2] = {static_cast<size_t>(config.local_n()), static_cast<size_t>(config.local_m())};
+    size_t global_work_size[2] = {
+        static_cast<size_t>((n + config.tile_n - 1) / config.tile_n) * local_work_size[0],
+        static_cast<size_t>((m + config.tile_m - 1) / config.tile_m) * local_work_size[1]};
+    cl_int err = clEnqueueNDRangeKernel(runtime.queue(), kernel, 2, NULL, global_work_size, local_work_size,
+                                        static_cast<cl_uint>(wait_for.size()), wait_for.empty() ? NULL : wait_for.data(),
+                                        done);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("Failed to enqueue gemm " + config.name() + " (OpenCL error " +
+                                 std::to_string(err) + ")");
+    }
+}
+
+void sgemm(int m, int n, int k, cl_mem a, cl_mem b, cl_mem bias, cl_mem c, gemm::Activation activation,
+           const std::vector<cl_event>& wait_for, cl_event* done) {
+    sgemm(OpenCLGemmTuner::getInstance().config(m, n, k), m, n, k, a, b, bias, c, activation, wait_for, done);
+}
+
+}
+
+namespace {
+
+int next_power_of_two(int value) {
+    int power = 1;
+    while (power < value) power *= 2;
+    return power;
+}
+
+bool tuning_enabled() {
+    const char* env = std::getenv("ANNOF_OPENCL_TUNE");
+    return !env || std::string(env) != "0";
+}
+
+}
+
+OpenCLGemmTuner& OpenCLGemmTuner::getInstance() {
+    static OpenCLGemmTuner instance([] {
+        std::string directory = ProgramBinaryCache::default_directory();
+        return directory.empty() ? std::string() : directory + "/gemm_tuning.txt";
+    }());
+    return instance;
+}
+
+OpenCLGemmTuner::OpenCLGemmTuner(std::string path) : path_(std::move(path)) {
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(
+        ProgramBinaryCache::hash(runtime.device_name() + "\n" + runtime.driver_version())));
+    device_key_ = key;
+
+    size_t max_work_group_size = 0;
+    cl_ulong local_memory = 0;
+    clGetDeviceInfo(runtime.device(), CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_work_group_size),
+                    &max_work_group_size, nullptr);
+    clGetDeviceInfo(runtime.device(), CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_memory), &local_memory, nullptr);
+    candidates_ = opencl_gemm::candidates(max_work_group_size, static_cast<size_t>(local_memory));
+    if (candidates_.empty()) throw std::runtime_error("No GEMM tile configuration fits the OpenCL device");
+
+    load();
+}
+
+OpenCLGemmTuner::Bucket OpenCLGemmTuner::bucket(int m, int n, int k) {
+    return Bucket(next_power_of_two(m), next_power_of_two(n), next_power_of_two(k));
+}
+
+opencl_gemm::TileConfig OpenCLGemmTuner::config(int m, int n, int k) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Bucket key = bucket(m, n, k);
+    auto it = configs_.find(key);
+    if (it != configs_.end()) return it->second;
+
+    if (!tuning_enabled()) return candidates_.front();
+    opencl_gemm::TileConfig best = tune(m, n, k);
+    configs_[key] = best;
+    store(key, best);
+    tunings_++;
+    return best;
+}
+
+bool OpenCLGemmTuner::tuned(int m, int n, int k) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return configs_.count(bucket(m, n, k)) != 0;
+}
+
+opencl_gemm::TileConfig OpenCLGemmTuner::tune(int m, int n, int k) {
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+    // the contents don't change the timing, the buffers are left as they come
+    cl_mem a = runtime.scratch("gemm_tune.a", static_cast<size_t>(m) * k * sizeof(float));
+    cl_mem b = runtime.scratch("gemm_tune.b", static_cast<size_t>(k) * n * sizeof(float));
+    cl_mem bias = runtime.scratch("gemm_tune.bias", static_cast<size_t>(n) * sizeof(float));
+    cl_mem c = runtime.scratch("gemm_tune.c", static_cast<size_t>(m) * n * sizeof(float));
+
+    opencl_gemm::TileConfig best = candidates_.front();
+    double best_time = std::numeric_limits<double>::max();
+    for (const opencl_gemm::TileConfig& config : candidates_) {
+        try {
+            // the first run builds the program, then the best of three counts
+            opencl_gemm::sgemm(config, m, n, k, a, b, bias, c);
+            clFinish(runtime.queue());
+            double time = std::numeric_limits<double>::max();
+            for (int run = 0; run < 3; ++run) {
+                auto start = std::chrono::high_resolution_clock::now();
+                opencl_gemm::sgemm(config, m, n, k, a, b, bias, c);
+                clFinish(runtime.queue());
+                time = std::min(time, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+            }
+            if (time < best_time) {
+                best_time = time;
+                best = config;
+            }
+        } catch (const std::exception&) {
+            // a config the compiler or the device rejects is skipped
+        }
+    }
+    return best;
+}
+
+// one entry per line: device key, bucket m n k, then tile_m tile_n tile_k work_m work_n.
+// entries are only appended, a later line for the same bucket wins
+void OpenCLGemmTuner::load() {
+    if (path_.empty()) return;
+    std::ifstream file(path_);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string device;
+        int m, n, k;
+        opencl_gemm::TileConfig config;
+        if (!(fields >> device >> m >> n >> k >> config.tile_m >> config.tile_n >> config.tile_k >>
+              config.work_m >> config.work_n)) {
+            continue;
+        }
+        if (device != device_key_) continue;
+        // only configs this build still offers and the device still fits
+        for (const opencl_gemm::TileConfig& candidate : candidates_) {
+            if (candidate == config) configs_[Bucket(m, n, k)] = config;
+        }
+    }
+}
+
+void OpenCLGemmTuner::store(const Bucket& bucket, const opencl_gemm::TileConfig& config) const {
+    if (path_.empty()) return;
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path_).parent_path(), error);
+    std::ofstream file(path_, std::ios::app);
+    file << device_key_ << " " << std::get<0>(bucket) << " " << std::get<1>(bucket) << " " << std::get<2>(bucket)
+         << " " << config.tile_m << " " << config.tile_n << " " << config.tile_k << " " << config.work_m << " "
+         << config.work_n << "\n";
+}
@@ -1,21 +1,39 @@
 #include "optimization_pass.h"
 #include "opencl_optimizations.h"
-#include <OpenCL/opencl.h>
+#include "graph.h"
+#include "opencl_gemm.h"
+#include "opencl_runtime.h"
 #include "optimization_pass_registrar.h" 
 
 void OpenCLWorkGroupSizeOptimization::apply(std::vector<std::shared_ptr<Tensor>>& tensors) {
-    for (auto& tensor : tensors) {
-        // make tensor shape be multiple of 64
-        auto shape = tensor->shape();
-        if (shape[0] % 64 != 0) {
-            int new_size = ((shape[0] / 64) + 1) * 64;
-            auto new_tensor = std::make_shared<Tensor>(std::vector<int>{new_size});
-            std::copy(tensor->data(), tensor->data() + shape[0], new_tensor->data());
-            tensor = new_tensor;
+    if (!OpenCLRuntime::available()) return;
+    // kernels guard their own edges, so tensors keep their shapes. each a [m, k], b [k, n]
+    // pair is a matmul whose tile config is chosen now instead of on the first call
+    for (size_t i = 0; i + 1 < tensors.size(); ++i) {
+        const std::vector<int>& a = tensors[i]->shape();
+        const std::vector<int>& b = tensors[i + 1]->shape();
+        if (a.size() == 2 && b.size() == 2 && a[1] == b[0]) {
+            OpenCLGemmTuner::getInstance().config(a[0], b[1], a[1]);
+            ++i;
         }
     }
 }
 
+void OpenCLWorkGroupSizeOptimization::apply(Graph& graph) {
+    if (!OpenCLRuntime::available()) return;
+    // fully connected layers of the last inferred shapes, a GPU forward of them is a
+    // [batch, in] x [in, out] GEMM with the input's trailing dims flattened
+    for (int id : graph.topological_order()) {
+        const GraphNode& node = graph.node(id);
+        if (node.op != OpType::FullyConnected || node.shape.empty()) continue;
+        const std::vector<int>& input_shape = graph.node(node.inputs[0]).shape;
+        if (input_shape.empty()) continue;
+        int input_size = 1;
+        for (size_t d = 1; d < input_shape.size(); ++d) input_size *= input_shape[d];
+        OpenCLGemmTuner::getInstance().config(node.shape[0], node.shape[1], input_size);
+    }
+}
+
 REGISTER_OPTIMIZATION_PASS("opencl_workgroup_size", OpenCLWorkGroupSizeOptimization);
 
 void register_opencl_optimizations() {
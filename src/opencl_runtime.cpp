@@ -0,0 +1,292 @@
+#include "opencl_runtime.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// set once the singleton is fully constructed, cleared when it is destroyed
+std::atomic<OpenCLRuntime*> created_instance{nullptr};
+
+void check(cl_int err, const char* what) {
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error(std::string(what) + " (OpenCL error " + std::to_string(err) + ")");
+    }
+}
+
+// device types to try in order, ANNOF_OPENCL_DEVICE narrows it down
+std::vector<cl_device_type> wanted_device_types() {
+    const char* env = std::getenv("ANNOF_OPENCL_DEVICE");
+    std::string choice = env ? env : "";
+    if (choice == "gpu") return {CL_DEVICE_TYPE_GPU};
+    if (choice == "cpu") return {CL_DEVICE_TYPE_CPU};
+    if (choice == "any") return {CL_DEVICE_TYPE_ALL};
+    return {CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL};
+}
+
+}
+
+OpenCLRuntime& OpenCLRuntime::getInstance() {
+    static OpenCLRuntime instance;
+    created_instance = &instance;
+    return instance;
+}
+
+bool OpenCLRuntime::available() {
+    static const bool usable = [] {
+        try {
+            getInstance();
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }();
+    return usable;
+}
+
+OpenCLRuntime* OpenCLRuntime::existing() {
+    return created_instance;
+}
+
+OpenCLRuntime::OpenCLRuntime() {
+    auto start = std::chrono::high_resolution_clock::now();
+    cl_uint num_platforms = 0;
+    if (clGetPlatformIDs(0, nullptr, &num_platforms) != CL_SUCCESS || num_platforms == 0) {
+        throw std::runtime_error("No OpenCL platform found");
+    }
+    std::vector<cl_platform_id> platforms(num_platforms);
+    check(clGetPlatformIDs(num_platforms, platforms.data(), nullptr), "Failed to get platform IDs");
+
+    for (cl_device_type type : wanted_device_types()) {
+        for (cl_platform_id platform : platforms) {
+            if (clGetDeviceIDs(platform, type, 1, &device_, nullptr) == CL_SUCCESS) break;
+            device_ = nullptr;
+        }
+        if (device_) break;
+    }
+    if (!device_) throw std::runtime_error("No OpenCL device found");
+
+    device_name_ = device_string(CL_DEVICE_NAME);
+    driver_version_ = device_string(CL_DRIVER_VERSION);
+    cl_device_type type = 0;
+    clGetDeviceInfo(device_, CL_DEVICE_TYPE, sizeof(type), &type, nullptr);
+    is_gpu_ = (type & CL_DEVICE_TYPE_GPU) != 0;
+
+    cl_int err;
+    context_ = clCreateContext(nullptr, 1, &device_, nullptr, nullptr, &err);
+    check(err, "Failed to create context");
+    // profiling timestamps let callers measure device time without blocking (SplitGemm)
+    queue_ = clCreateCommandQueue(context_, device_, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (err != CL_SUCCESS) {
+        clReleaseContext(context_);
+        check(err, "Failed to create command queue");
+    }
+    transfer_queue_ = clCreateCommandQueue(context_, device_, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (err != CL_SUCCESS) {
+        clReleaseCommandQueue(queue_);
+        clReleaseContext(context_);
+        check(err, "Failed to create transfer queue");
+    }
+    setup_milliseconds_ = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+std::string OpenCLRuntime::device_string(cl_device_info info) const {
+    size_t size = 0;
+    clGetDeviceInfo(device_, info, 0, nullptr, &size);
+    std::vector<char> value(size + 1, '\0');
+    clGetDeviceInfo(device_, info, size, value.data(), nullptr);
+    return value.data();
+}
+
+OpenCLRuntime::~OpenCLRuntime() {
+    created_instance = nullptr;
+    for (auto& entry : residents_) clReleaseMemObject(entry.second.buffer);
+    for (auto& entry : scratch_) clReleaseMemObject(entry.second.buffer);
+    for (auto& entry : kernels_) clReleaseKernel(entry.second);
+    for (auto& entry : programs_) clReleaseProgram(entry.second);
+    clReleaseCommandQueue(transfer_queue_);
+    clReleaseCommandQueue(queue_);
+    clReleaseContext(context_);
+}
+
+cl_program OpenCLRuntime::program(const std::string& name, const char* source, const std::string& options) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = programs_.find(name);
+    if (it != programs_.end()) return it->second;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::string key = ProgramBinaryCache::key(device_name_, driver_version_, source, options);
+    std::vector<unsigned char> binary;
+    cl_program program = nullptr;
+    bool from_cache = binary_cache_.load(key, binary) && (program = build_from_binary(binary, options)) != nullptr;
+    if (!from_cache) {
+        program = build_from_source(name, source, options);
+    }
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    // stored after the timing, the write is not part of what a warm start would pay
+    if (!from_cache && binary_cache_.enabled()) {
+        size_t size = 0;
+        if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, nullptr) == CL_SUCCESS && size > 0) {
+            binary.resize(size);
+            unsigned char* data = binary.data();
+            if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, nullptr) == CL_SUCCESS) {
+                binary_cache_.store(key, binary);
+            }
+        }
+    }
+
+    program_loads_.push_back({name, from_cache, milliseconds});
+    programs_[name] = program;
+    return program;
+}
+
+cl_program OpenCLRuntime::build_from_binary(const std::vector<unsigned char>& binary, const std::string& options) {
+    const unsigned char* data = binary.data();
+    size_t size = binary.size();
+    cl_int status;
+    cl_int err;
+    cl_program program = clCreateProgramWithBinary(context_, 1, &device_, &size, &data, &status, &err);
+    if (err != CL_SUCCESS || status != CL_SUCCESS) {
+        if (program) clReleaseProgram(program);
+        return nullptr;
+    }
+    // binaries still need a build call before kernels can be created
+    if (clBuildProgram(program, 1, &device_, options.c_str(), nullptr, nullptr) != CL_SUCCESS) {
+        clReleaseProgram(program);
+        return nullptr;
+    }
+    return program;
+}
+
+cl_program OpenCLRuntime::build_from_source(const std::string& name, const char* source, const std::string& options) {
+    cl_int err;
+    cl_program program = clCreateProgramWithSource(context_, 1, &source, nullptr, &err);
+    check(err, "Failed to create program");
+    err = clBuildProgram(program, 1, &device_, options.c_str(), nullptr, nullptr);
+    if (err != CL_SUCCESS) {
+        size_t log_size = 0;
+        clGetProgramBuildInfo(program, device_, CL_PROGRAM_BUILD_LOG, 0, nullptr, &log_size);
+        std::vector<char> log(log_size + 1, '\0');
+        clGetProgramBuildInfo(program, device_, CL_PROGRAM_BUILD_LOG, log_size, log.data(), nullptr);
+        clReleaseProgram(program);
+        throw std::runtime_error("Failed to build program " + name + ":\n" + log.data());
+    }
+    program_builds_++;
+    return program;
+}
+
+std::vector<OpenCLRuntime::ProgramLoad> OpenCLRuntime::program_loads() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return program_loads_;
+}
+
+cl_kernel OpenCLRuntime::kernel(const std::string& program_name, const char* source, const std::string& kernel_name,
+                                const std::string& options) {
+    cl_program built = program(program_name, source, options);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key = program_name + "/" + kernel_name;
+    auto it = kernels_.find(key);
+    if (it != kernels_.end()) return it->second;
+
+    cl_int err;
+    cl_kernel kernel = clCreateKernel(built, kernel_name.c_str(), &err);
+    check(err, "Failed to create kernel");
+    kernels_[key] = kernel;
+    return kernel;
+}
+
+cl_mem OpenCLRuntime::resident(const Tensor& tensor) {
+    if (!tensor.is_contiguous()) throw std::invalid_argument("resident tensors must be contiguous");
+    if (tensor.dtype() != DType::Float32) throw std::invalid_argument("resident tensors must be float32");
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Resident& entry = residents_[tensor.data()];
+    size_t bytes = static_cast<size_t>(tensor.size()) * sizeof(float);
+    if (entry.bytes != bytes) {
+        if (entry.buffer) clReleaseMemObject(entry.buffer);
+        cl_int err;
+        entry.buffer = clCreateBuffer(context_, CL_MEM_READ_ONLY, bytes, nullptr, &err);
+        if (err != CL_SUCCESS) {
+            residents_.erase(tensor.data());
+            check(err, "Failed to create resident buffer");
+        }
+        entry.bytes = bytes;
+        entry.stale = true;
+    }
+    if (entry.stale) {
+        check(clEnqueueWriteBuffer(queue_, entry.buffer, CL_TRUE, 0, bytes, tensor.data(), 0, nullptr, nullptr),
+              "Failed to upload resident buffer");
+        entry.stale = false;
+        resident_uploads_++;
+    }
+    return entry.buffer;
+}
+
+void OpenCLRuntime::invalidate_resident(const Tensor& tensor) {
+    OpenCLRuntime* runtime = existing();
+    if (!runtime) return;
+    std::lock_guard<std::mutex> lock(runtime->mutex_);
+    auto it = runtime->residents_.find(tensor.raw_data());
+    if (it != runtime->residents_.end()) it->second.stale = true;
+}
+
+void OpenCLRuntime::release_resident(const Tensor& tensor) {
+    OpenCLRuntime* runtime = existing();
+    if (!runtime) return;
+    std::lock_guard<std::mutex> lock(runtime->mutex_);
+    auto it = runtime->residents_.find(tensor.raw_data());
+    if (it == runtime->residents_.end()) return;
+    clReleaseMemObject(it->second.buffer);
+    runtime->residents_.erase(it);
+}
+
+cl_mem OpenCLRuntime::scratch(const std::string& name, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Scratch& entry = scratch_[name];
+    if (entry.bytes < bytes) {
+        if (entry.buffer) clReleaseMemObject(entry.buffer);
+        cl_int err;
+        entry.buffer = clCreateBuffer(context_, CL_MEM_READ_WRITE, bytes, nullptr, &err);
+        if (err != CL_SUCCESS) {
+            scratch_.erase(name);
+            check(err, "Failed to create scratch buffer");
+        }
+        entry.bytes = bytes;
+    }
+    return entry.buffer;
+}
+
+void OpenCLRuntime::upload(cl_mem buffer, const float* data, size_t count) {
+    check(clEnqueueWriteBuffer(queue_, buffer, CL_TRUE, 0, count * sizeof(float), data, 0, nullptr, nullptr),
+          "Failed to write buffer");
+}
+
+void OpenCLRuntime::download(cl_mem buffer, float* data, size_t count) {
+    check(clEnqueueReadBuffer(queue_, buffer, CL_TRUE, 0, count * sizeof(float), data, 0, nullptr, nullptr),
+          "Failed to read buffer");
+}
+
+cl_event OpenCLRuntime::upload_async(cl_mem buffer, const float* data, size_t count, const std::vector<cl_event>& wait_for) {
+    cl_event event;
+    check(clEnqueueWriteBuffer(transfer_queue_, buffer, CL_FALSE, 0, count * sizeof(float), data,
+                               static_cast<cl_uint>(wait_for.size()), wait_for.empty() ? nullptr : wait_for.data(), &event),
+          "Failed to enqueue write");
+    return event;
+}
+
+cl_event OpenCLRuntime::download_async(cl_mem buffer, float* data, size_t count, const std::vector<cl_event>& wait_for) {
+    cl_event event;
+    check(clEnqueueReadBuffer(transfer_queue_, buffer, CL_FALSE, 0, count * sizeof(float), data,
+                              static_cast<cl_uint>(wait_for.size()), wait_for.empty() ? nullptr : wait_for.data(), &event),
+          "Failed to enqueue read");
+    return event;
+}
+
+void OpenCLRuntime::flush() {
+    clFlush(queue_);
+    clFlush(transfer_queue_);
+}
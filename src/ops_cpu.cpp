@@ -1,5 +1,9 @@
 #include "ops.h"
-#include <immintrin.h>
+#include "cpu_dispatch.h"
+#include "elementwise.h"
+#include "gemm.h"
+#include <algorithm>
+#include <cassert>
 
 namespace ops {
 
@@ -7,7 +11,7 @@ void add_cpu_baseline(const Tensor& a, const Tensor& b, Tensor& result) {
     const float* a_data = a.data();
     const float* b_data = b.data();
     float* result_data = result.data();
-    int size = a.shape()[0] * a.shape()[1];
+    int size = a.size();
 
     for (int i = 0; i < size; ++i) {
         result_data[i] = a_data[i] + b_data[i];
@@ -16,22 +20,8 @@ void add_cpu_baseline(const Tensor& a, const Tensor& b, Tensor& result) {
 
 
 void add_cpu(const Tensor& a, const Tensor& b, Tensor& result) {
-    const float* a_data = a.data();
-    const float* b_data = b.data();
-    float* result_data = result.data();
-    int size = a.shape()[0] * a.shape()[1];
-
-    int i = 0;
-    for (; i <= size - 8; i += 8) {
-        __m256 va = _mm256_loadu_ps(a_data + i);
-        __m256 vb = _mm256_loadu_ps(b_data + i);
-        __m256 vr = _mm256_add_ps(va, vb);
-        _mm256_storeu_ps(result_data + i, vr);
-    }
-
-    for (; i < size; ++i) {
-        result_data[i] = a_data[i] + b_data[i];
-    }
+    assert(a.is_contiguous() && b.is_contiguous() && result.is_contiguous());
+    elementwise::binary(cpu::BinaryOp::Add, a, b, result);
 }
 
 void matmul_cpu_baseline(const Tensor& a, const Tensor& b, Tensor& result) {
@@ -53,48 +43,40 @@ void matmul_cpu_baseline(const Tensor& a, const Tensor& b, Tensor& result) {
     }
 }
 
+// GEMM can consume a 2-D view directly as long as one of its dims is dense
+static bool gemm_operand(const Tensor& t, bool& trans, int& ld) {
+    const std::vector<int>& strides = t.strides();
+    if (strides[1] == 1 || t.shape()[1] == 1) {
+        trans = false;
+        ld = t.shape()[1] == 1 ? std::max(strides[0], 1) : strides[0];
+        return true;
+    }
+    if (strides[0] == 1 || t.shape()[0] == 1) {
+        trans = true;
+        ld = strides[1];
+        return true;
+    }
+    return false;
+}
+
 void matmul_cpu(const Tensor& a, const Tensor& b, Tensor& result) {
-    const float* a_data = a.data();
-    const float* b_data = b.data();
-    float* result_data = result.data();
+    assert(result.is_contiguous());
     int m = a.shape()[0];
     int n = b.shape()[1];
     int k = a.shape()[1];
 
-    // Initialize result to zero
-    std::fill(result_data, result_data + m * n, 0.0f);
-
-    const int block_size = 64;
-
-    for (int i = 0; i < m; i += block_size) {
-        for (int j = 0; j < n; j += block_size) {
-            for (int l = 0; l < k; l += block_size) {
-                int max_i = std::min(i + block_size, m);
-                int max_j = std::min(j + block_size, n);
-                int max_l = std::min(l + block_size, k);
-
-                for (int ii = i; ii < max_i; ++ii) {
-                    for (int jj = j; jj < max_j; jj += 8) {
-                        __m256 sum = _mm256_loadu_ps(&result_data[ii * n + jj]);
-                        for (int ll = l; ll < max_l; ++ll) {
-                            __m256 a_val = _mm256_set1_ps(a_data[ii * k + ll]);
-                            __m256 b_val = _mm256_loadu_ps(&b_data[ll * n + jj]);
-                            sum = _mm256_add_ps(sum, _mm256_mul_ps(a_val, b_val));
-                        }
-                        _mm256_storeu_ps(&result_data[ii * n + jj], sum);
-                    }
-                    
-                    for (int jj = (max_j / 8) * 8; jj < max_j; ++jj) {
-                        float sum = result_data[ii * n + jj];
-                        for (int ll = l; ll < max_l; ++ll) {
-                            sum += a_data[ii * k + ll] * b_data[ll * n + jj];
-                        }
-                        result_data[ii * n + jj] = sum;
-                    }
-                }
-            }
-        }
+    bool trans_a, trans_b;
+    int lda, ldb;
+    if (!gemm_operand(a, trans_a, lda)) {
+        matmul_cpu(a.contiguous(), b, result);
+        return;
     }
+    if (!gemm_operand(b, trans_b, ldb)) {
+        matmul_cpu(a, b.contiguous(), result);
+        return;
+    }
+
+    gemm::sgemm(trans_a, trans_b, m, n, k, 1.0f, a.data(), lda, b.data(), ldb, 0.0f, result.data(), n);
 }
 
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #include "ops.h"
-#include <OpenCL/opencl.h>
+#include "opencl_gemm.h"
+#include "opencl_runtime.h"
+#include "split_gemm.h"
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 namespace ops {
@@ -14,66 +18,30 @@ __kernel void add_kernel(__global const float* a, __global const float* b, __glo
 }
 )";
 
+// context, queue and compiled kernels come from the shared runtime, so a call only moves
+// data and launches. the device buffers are reused between calls too
 void add_gpu(const Tensor& a, const Tensor& b, Tensor& result) {
-    cl_int err;
-    
-    // Get platform
-    cl_platform_id platform;
-    err = clGetPlatformIDs(1, &platform, NULL);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error getting platform ID: " << err << std::endl;
-        return;
-    }
-
-    // Get device
-    cl_device_id device;
-    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error getting device ID: " << err << std::endl;
-        return;
-    }
-
-    // Create context
-    cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error creating context: " << err << std::endl;
-        return;
-    }
-
-    // Create command queue
-    cl_command_queue queue = clCreateCommandQueue(context, device, 0, &err);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error creating command queue: " << err << std::endl;
-        return;
-    }
-
-    // Create program
-    cl_program program = clCreateProgramWithSource(context, 1, &kernelSource, NULL, &err);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error creating program: " << err << std::endl;
-        return;
-    }
-
-    // Build program
-    err = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error building program: " << err << std::endl;
-        return;
+    try {
+        add_gpu_async(a, b, result).wait();
+    } catch (const std::exception& e) {
+        std::cerr << "Error running add on OpenCL: " << e.what() << std::endl;
     }
+}
 
-    // Create kernel
-    cl_kernel kernel = clCreateKernel(program, "add_kernel", &err);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error creating kernel: " << err << std::endl;
-        return;
-    }
+// uploads on the transfer queue, the kernel on the compute queue once they land, then the
+// download. the transfer queue is in order, so the next call's uploads into the same scratch
+// buffers start only after this call's download
+GpuFuture add_gpu_async(const Tensor& a, const Tensor& b, Tensor& result) {
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+    cl_kernel kernel = runtime.kernel("add", kernelSource, "add_kernel");
 
-    int size = a.shape()[0];
+    int size = a.size();
 
-    // Create buffers
-    cl_mem a_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size * sizeof(float), (void*)a.data(), &err);
-    cl_mem b_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size * sizeof(float), (void*)b.data(), &err);
-    cl_mem result_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, size * sizeof(float), NULL, &err);
+    cl_mem a_buffer = runtime.scratch("add.a", size * sizeof(float));
+    cl_mem b_buffer = runtime.scratch("add.b", size * sizeof(float));
+    cl_mem result_buffer = runtime.scratch("add.result", size * sizeof(float));
+    std::vector<cl_event> uploaded = {runtime.upload_async(a_buffer, a.data(), size),
+                                      runtime.upload_async(b_buffer, b.data(), size)};
 
     // Set kernel arguments
     clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_buffer);
@@ -83,145 +51,58 @@ void add_gpu(const Tensor& a, const Tensor& b, Tensor& result) {
 
     // Execute kernel
     size_t global_work_size = size;
-    err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_work_size, NULL, 0, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error enqueuing kernel: " << err << std::endl;
-        return;
-    }
-
-    // Read result
-    err = clEnqueueReadBuffer(queue, result_buffer, CL_TRUE, 0, size * sizeof(float), result.data(), 0, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error reading result buffer: " << err << std::endl;
-        return;
-    }
-
-    clReleaseMemObject(a_buffer);
-    clReleaseMemObject(b_buffer);
-    clReleaseMemObject(result_buffer);
-    clReleaseKernel(kernel);
-    clReleaseProgram(program);
-    clReleaseCommandQueue(queue);
-    clReleaseContext(context);
+    cl_event computed;
+    cl_int err = clEnqueueNDRangeKernel(runtime.queue(), kernel, 1, NULL, &global_work_size, NULL,
+                                        static_cast<cl_uint>(uploaded.size()), uploaded.data(), &computed);
+    for (cl_event event : uploaded) clReleaseEvent(event);
+    if (err != CL_SUCCESS) throw std::runtime_error("Error enqueuing kernel: " + std::to_string(err));
+
+    cl_event downloaded = runtime.download_async(result_buffer, result.data(), size, {computed});
+    runtime.flush();
+    clReleaseEvent(computed);
+    return GpuFuture(downloaded);
 }
 
-const char* matmul_kernel_source = R"(
-__kernel void matmul_kernel(__global const float* a, __global const float* b, __global float* result,
-                            const int m, const int n, const int k) {
-    const int row = get_global_id(0);
-    const int col = get_global_id(1);
-    
-    if (row < m && col < n) {
-        float sum = 0.0f;
-        for (int i = 0; i < k; ++i) {
-            sum += a[row * k + i] * b[i * n + col];
-        }
-        result[row * n + col] = sum;
-    }
-}
-)";
-
-
+// tiled kernel with the tile shape the tuner picked for this device and shape, see opencl_gemm.h
 void matmul_gpu(const Tensor& a, const Tensor& b, Tensor& result) {
-    cl_int err;
-    
-    // Get platform
-    cl_platform_id platform;
-    err = clGetPlatformIDs(1, &platform, NULL);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error getting platform ID: " << err << std::endl;
-        return;
-    }
-
-    // Get device
-    cl_device_id device;
-    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error getting device ID: " << err << std::endl;
-        return;
-    }
-
-    // Create context
-    cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error creating context: " << err << std::endl;
-        return;
-    }
-
-    // Create command queue
-    cl_command_queue queue = clCreateCommandQueue(context, device, 0, &err);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error creating command queue: " << err << std::endl;
-        return;
-    }
-
-    // Create program
-    cl_program program = clCreateProgramWithSource(context, 1, &matmul_kernel_source, NULL, &err);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error creating program: " << err << std::endl;
-        return;
+    try {
+        matmul_gpu_async(a, b, result).wait();
+    } catch (const std::exception& e) {
+        std::cerr << "Error running matmul on OpenCL: " << e.what() << std::endl;
     }
+}
 
-    // Build program
-    err = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error building program: " << err << std::endl;
-        // Print build log
-        size_t log_size;
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-        std::vector<char> log(log_size);
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, log.data(), NULL);
-        std::cerr << "Build log:\n" << log.data() << std::endl;
-        return;
-    }
-
-    // Create kernel
-    cl_kernel kernel = clCreateKernel(program, "matmul_kernel", &err);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error creating kernel: " << err << std::endl;
-        return;
-    }
+GpuFuture matmul_gpu_async(const Tensor& a, const Tensor& b, Tensor& result) {
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
 
     int m = a.shape()[0];
     int n = b.shape()[1];
     int k = a.shape()[1];
 
-    // Create buffers
-    cl_mem a_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, m * k * sizeof(float), (void*)a.data(), &err);
-    cl_mem b_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, k * n * sizeof(float), (void*)b.data(), &err);
-    cl_mem result_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, m * n * sizeof(float), NULL, &err);
-
-    // Set kernel arguments
-    clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_buffer);
-    clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_buffer);
-    clSetKernelArg(kernel, 2, sizeof(cl_mem), &result_buffer);
-    clSetKernelArg(kernel, 3, sizeof(int), &m);
-    clSetKernelArg(kernel, 4, sizeof(int), &n);
-    clSetKernelArg(kernel, 5, sizeof(int), &k);
-
-    // Execute kernel
-    size_t global_work_size[2] = {static_cast<size_t>(m), static_cast<size_t>(n)};
-    err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_work_size, NULL, 0, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error enqueuing kernel: " << err << std::endl;
-        return;
-    }
-
-    // Read result
-    err = clEnqueueReadBuffer(queue, result_buffer, CL_TRUE, 0, m * n * sizeof(float), result.data(), 0, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        std::cerr << "Error reading result buffer: " << err << std::endl;
-        return;
-    }
+    cl_mem a_buffer = runtime.scratch("matmul.a", m * k * sizeof(float));
+    cl_mem b_buffer = runtime.scratch("matmul.b", k * n * sizeof(float));
+    cl_mem result_buffer = runtime.scratch("matmul.result", m * n * sizeof(float));
+    std::vector<cl_event> uploaded = {runtime.upload_async(a_buffer, a.data(), m * k),
+                                      runtime.upload_async(b_buffer, b.data(), k * n)};
+
+    cl_event computed = nullptr;
+    try {
+        opencl_gemm::sgemm(m, n, k, a_buffer, b_buffer, nullptr, result_buffer, gemm::Activation::None, uploaded,
+                           &computed);
+    } catch (...) {
+        for (cl_event event : uploaded) clReleaseEvent(event);
+        throw;
+    }
+    for (cl_event event : uploaded) clReleaseEvent(event);
+
+    cl_event downloaded = runtime.download_async(result_buffer, result.data(), m * n, {computed});
+    runtime.flush();
+    clReleaseEvent(computed);
+    return GpuFuture(downloaded);
+}
 
-    // Clean up
-    clReleaseMemObject(a_buffer);
-    clReleaseMemObject(b_buffer);
-    clReleaseMemObject(result_buffer);
-    clReleaseKernel(kernel);
-    clReleaseProgram(program);
-    clReleaseCommandQueue(queue);
-    clReleaseContext(context);
+void matmul_split(const Tensor& a, const Tensor& b, Tensor& result) {
+    SplitGemm::getInstance().run(a, b, nullptr, result);
 }
 
-}
\ No newline at end of file
+}
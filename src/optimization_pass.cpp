@@ -1,4 +1,5 @@
 #include "optimization_pass.h"
+#include "graph.h"
 #include <algorithm>
 
 void MemoryReductionPass::apply(std::vector<std::shared_ptr<Tensor>>& tensors) {
@@ -20,6 +21,32 @@ void MemoryReductionPass::apply(std::vector<std::shared_ptr<Tensor>>& tensors) {
     }
 }
 
+void MemoryReductionPass::apply(Graph& graph) {
+    for (int id : graph.topological_order()) {
+        GraphNode& node = graph.node(id);
+        if (node.op != OpType::Reshape) continue;
+
+        // reshape(reshape(x)) -> reshape(x), a 0 dim copies from the direct input so only
+        // fold when this target copies none
+        GraphNode& input = graph.node(node.inputs[0]);
+        if (input.op == OpType::Reshape &&
+            std::find(node.target_shape.begin(), node.target_shape.end(), 0) == node.target_shape.end()) {
+            node.inputs[0] = input.inputs[0];
+            if (graph.consumers(input.id).empty() && graph.output() != input.id) {
+                graph.remove_node(input.id);
+            }
+        }
+
+        // a reshape to the shape it already has, once shapes are known
+        const GraphNode& source = graph.node(node.inputs[0]);
+        if (!node.shape.empty() && node.shape == source.shape && id != graph.output()) {
+            graph.replace_uses(id, source.id);
+            graph.remove_node(id);
+        }
+    }
+    graph.invalidate_plan();
+}
+
 void LatencyReductionPass::apply(std::vector<std::shared_ptr<Tensor>>& tensors) {
     // latency reduction techniques
     // simple operation reorderingg
@@ -29,6 +56,20 @@ void LatencyReductionPass::apply(std::vector<std::shared_ptr<Tensor>>& tensors)
         });
 }
 
+void LatencyReductionPass::apply(Graph& graph) {
+    std::vector<char> live(graph.nodes().size(), 0);
+    for (int id : graph.topological_order()) {
+        live[id] = 1;
+    }
+    for (GraphNode& node : graph.nodes()) {
+        // inputs stay, callers bind them by position
+        if (!live[node.id] && !node.removed && node.op != OpType::Input) {
+            graph.remove_node(node.id);
+        }
+    }
+    graph.invalidate_plan();
+}
+
 
 #include "optimization_pass.h"
 #include <OpenCL/opencl.h>
@@ -47,4 +88,4 @@ void OpenCLOptimizationPass::apply(std::vector<std::shared_ptr<Tensor>>& tensors
             tensor = new_tensor;
         }
     }
-}
\ No newline at end of file
+}
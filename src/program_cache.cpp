@@ -0,0 +1,112 @@
+#include "program_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+
+// file layout: magic, key length, key, binary length, binary
+const char kMagic[8] = {'A', 'N', 'N', 'O', 'F', 'C', 'L', '1'};
+
+std::string hex(uint64_t value) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(value));
+    return text;
+}
+
+}
+
+std::string ProgramBinaryCache::default_directory() {
+    if (const char* dir = std::getenv("ANNOF_OPENCL_CACHE_DIR")) return dir;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+        if (*xdg) return std::string(xdg) + "/annof/opencl";
+    }
+    if (const char* home = std::getenv("HOME")) {
+        if (*home) return std::string(home) + "/.cache/annof/opencl";
+    }
+    return "";
+}
+
+ProgramBinaryCache::ProgramBinaryCache(std::string directory) : directory_(std::move(directory)) {}
+
+uint64_t ProgramBinaryCache::hash(const std::string& data) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+std::string ProgramBinaryCache::key(const std::string& device, const std::string& driver, const std::string& source,
+                                    const std::string& options) {
+    std::ostringstream key;
+    key << "device=" << device << "\ndriver=" << driver << "\nsource=" << hex(hash(source))
+        << ":" << source.size() << "\noptions=" << options;
+    return key.str();
+}
+
+std::string ProgramBinaryCache::path(const std::string& key) const {
+    return directory_ + "/" + hex(hash(key)) + ".clbin";
+}
+
+bool ProgramBinaryCache::load(const std::string& key, std::vector<unsigned char>& binary) const {
+    if (!enabled()) return false;
+    std::ifstream file(path(key), std::ios::binary);
+    if (!file) return false;
+
+    char magic[sizeof(kMagic)];
+    uint64_t key_size = 0;
+    if (!file.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), kMagic)) return false;
+    if (!file.read(reinterpret_cast<char*>(&key_size), sizeof(key_size)) || key_size != key.size()) return false;
+    // a different key hashing to the same file name is a miss
+    std::string stored(key_size, '\0');
+    if (!file.read(&stored[0], key_size) || stored != key) return false;
+
+    uint64_t binary_size = 0;
+    if (!file.read(reinterpret_cast<char*>(&binary_size), sizeof(binary_size)) || binary_size == 0) return false;
+    // the binary is the rest of the file. a length that runs past the end or leaves trailing bytes
+    // means the entry is not what we wrote, and must not size the buffer
+    std::streampos start = file.tellg();
+    if (!file.seekg(0, std::ios::end)) return false;
+    std::streamoff left = file.tellg() - start;
+    if (left < 0 || binary_size != static_cast<uint64_t>(left) || !file.seekg(start)) return false;
+    binary.resize(binary_size);
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(binary.data()), binary_size));
+}
+
+bool ProgramBinaryCache::store(const std::string& key, const std::vector<unsigned char>& binary) const {
+    if (!enabled() || binary.empty()) return false;
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    if (error) return false;
+
+    std::string target = path(key);
+    std::string temporary = target + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        uint64_t key_size = key.size();
+        uint64_t binary_size = binary.size();
+        file.write(kMagic, sizeof(kMagic));
+        file.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+        file.write(key.data(), key.size());
+        file.write(reinterpret_cast<const char*>(&binary_size), sizeof(binary_size));
+        file.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+        if (!file) {
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, target, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
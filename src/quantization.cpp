@@ -0,0 +1,168 @@
+#include "quantization.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace quant {
+
+ActivationParams activation_params(float min, float max) {
+    min = std::min(min, 0.0f);
+    max = std::max(max, 0.0f);
+    ActivationParams params;
+    if (max - min <= 0.0f || !std::isfinite(max - min)) return params;
+    params.scale = (max - min) / kMaxActivation;
+    params.zero = std::min(static_cast<float>(kMaxActivation), std::round(-min / params.scale));
+    return params;
+}
+
+void ActivationRange::observe(const float* x, int count) {
+    if (count == 0) return;
+    float lo, hi;
+    cpu::kernels().min_max(x, count, &lo, &hi);
+    min = empty ? lo : std::min(min, lo);
+    max = empty ? hi : std::max(max, hi);
+    empty = false;
+}
+
+void quantize_weights(const float* w, int k, int n, std::ptrdiff_t row_stride, std::ptrdiff_t col_stride,
+                      const float* bias, QuantizedWeights& out) {
+    const int panel = cpu::kInt8Panel;
+    out.k = k;
+    out.n = n;
+    out.k_groups = (k + 3) / 4;
+    int padded_n = out.panels() * panel;
+    out.packed.assign(static_cast<size_t>(out.panels()) * out.k_groups * panel * 4, 0);
+    out.scales.assign(padded_n, 0.0f);
+    out.column_sums.assign(padded_n, 0.0f);
+    out.bias.assign(padded_n, 0.0f);
+
+    ThreadPool::getInstance().parallel_for(0, n, ThreadPool::grain_for(3.0 * k), [&](int begin, int end) {
+        for (int j = begin; j < end; ++j) {
+            const float* column = w + j * col_stride;
+            float max = 0.0f;
+            for (int p = 0; p < k; ++p) max = std::max(max, std::fabs(column[p * row_stride]));
+            float scale = max > 0.0f ? max / kMaxWeight : 1.0f;
+            float inverse = 1.0f / scale;
+
+            int8_t* dst = out.packed.data() + static_cast<size_t>(j / panel) * out.k_groups * panel * 4 + (j % panel) * 4;
+            int sum = 0;
+            for (int p = 0; p < k; ++p) {
+                int q = static_cast<int>(std::lround(column[p * row_stride] * inverse));
+                q = std::max(-kMaxWeight, std::min(kMaxWeight, q));
+                dst[(p / 4) * panel * 4 + p % 4] = static_cast<int8_t>(q);
+                sum += q;
+            }
+            out.scales[j] = scale;
+            out.column_sums[j] = static_cast<float>(sum);
+            out.bias[j] = bias ? bias[j] : 0.0f;
+        }
+    });
+}
+
+void QuantizedActivations::resize(int rows, int depth) {
+    m = rows;
+    k = depth;
+    k_groups = (depth + 3) / 4;
+    mr = cpu::kernels().int8_mr;
+    int padded = padded_rows();
+    data.resize(static_cast<size_t>(padded) * k_groups * 4);
+    scales.resize(padded);
+    zeros.resize(padded);
+}
+
+void quantize(const float* x, int count, ActivationParams params, uint8_t* out) {
+    cpu::kernels().quantize(x, count, 1.0f / params.scale, params.zero, out);
+}
+
+void quantize_rows(const float* x, int m, int k, std::ptrdiff_t ld, const ActivationParams* fixed,
+                   QuantizedActivations& out) {
+    out.resize(m, k);
+    const cpu::Kernels& kernels = cpu::kernels();
+    int stride = out.group_stride();
+    ThreadPool::getInstance().parallel_for(0, out.padded_rows(), ThreadPool::grain_for(4.0 * k), [&](int begin, int end) {
+        // a row at a time through a small buffer, then its groups of 4 into the block
+        uint8_t bytes[256];
+        for (int i = begin; i < end; ++i) {
+            uint8_t* dst = out.row(i);
+            if (i >= m) {
+                for (int g = 0; g < out.k_groups; ++g) std::memset(dst + g * stride, 0, 4);
+                out.scales[i] = 0.0f;
+                out.zeros[i] = 0.0f;
+                continue;
+            }
+            const float* src = x + i * ld;
+            ActivationParams params;
+            if (fixed) {
+                params = *fixed;
+            } else {
+                float lo, hi;
+                kernels.min_max(src, k, &lo, &hi);
+                params = activation_params(lo, hi);
+            }
+            for (int p0 = 0; p0 < k; p0 += 256) {
+                int count = std::min(256, k - p0);
+                kernels.quantize(src + p0, count, 1.0f / params.scale, params.zero, bytes);
+                // the tail of the last group meets zero weights, any value works, keep it defined
+                std::memset(bytes + count, 0, (4 - count % 4) % 4);
+                for (int g = 0; g < (count + 3) / 4; ++g) std::memcpy(dst + (p0 / 4 + g) * stride, bytes + g * 4, 4);
+            }
+            out.scales[i] = params.scale;
+            out.zeros[i] = params.zero;
+        }
+    });
+}
+
+void gemm(const QuantizedActivations& a, const QuantizedWeights& w, gemm::Activation activation, float* c, int ldc) {
+    const cpu::Kernels& kernels = cpu::kernels();
+    assert(a.mr == kernels.int8_mr && a.k == w.k);
+    const int mr = a.mr;
+    const int panel = cpu::kInt8Panel;
+    int row_blocks = (a.m + mr - 1) / mr;
+    int tiles = row_blocks * w.panels();
+    // one dot4 lane per 4 multiply-adds
+    int grain = ThreadPool::grain_for(static_cast<double>(mr) * panel * w.k_groups);
+
+    ThreadPool::getInstance().parallel_for(0, tiles, grain, [&](int begin, int end) {
+        for (int t = begin; t < end; ++t) {
+            // consecutive tiles share a weight panel, it stays in cache while the rows go by
+            int block = t % row_blocks;
+            int column_panel = t / row_blocks;
+            int row0 = block * mr;
+            int col0 = column_panel * panel;
+            int rows = std::min(mr, a.m - row0);
+            int cols = std::min(panel, w.n - col0);
+
+            cpu::Int8Epilogue epilogue{a.scales.data() + row0, a.zeros.data() + row0,
+                                       w.column_sums.data() + col0, w.scales.data() + col0,
+                                       w.bias.data() + col0, activation};
+            const uint8_t* a_block = a.data.data() + static_cast<size_t>(block) * a.k_groups * mr * 4;
+            const int8_t* b_panel = w.packed.data() + static_cast<size_t>(column_panel) * w.k_groups * panel * 4;
+            float* c_tile = c + static_cast<std::ptrdiff_t>(row0) * ldc + col0;
+            if (rows == mr && cols == panel) {
+                kernels.int8_micro_kernel(w.k_groups, a_block, b_panel, c_tile, ldc, epilogue);
+                continue;
+            }
+            // edge tile, staged so the kernel never writes past c
+            alignas(64) float staged[cpu::kMaxInt8Rows * cpu::kInt8Panel];
+            kernels.int8_micro_kernel(w.k_groups, a_block, b_panel, staged, panel, epilogue);
+            for (int i = 0; i < rows; ++i) {
+                std::copy(staged + i * panel, staged + i * panel + cols, c_tile + static_cast<std::ptrdiff_t>(i) * ldc);
+            }
+        }
+    });
+}
+
+void LayerState::set_calibrating(bool on) {
+    if (on) {
+        range = ActivationRange();
+        calibrated = false;
+    } else if (calibrating && !range.empty) {
+        params = activation_params(range.min, range.max);
+        calibrated = true;
+    }
+    calibrating = on;
+}
+
+}
@@ -0,0 +1,42 @@
+#include "quantization_pass.h"
+#include "convolutional_layer.h"
+#include "fully_connected_layer.h"
+#include "graph.h"
+#include "optimization_pass_registrar.h"
+
+void QuantizationPass::apply(Graph& graph) {
+    std::vector<int> layers;
+    for (int id : graph.topological_order()) {
+        OpType op = graph.node(id).op;
+        if (op == OpType::Convolution || op == OpType::FullyConnected) layers.push_back(id);
+    }
+    auto set_calibrating = [&](bool calibrating) {
+        for (int id : layers) {
+            GraphNode& node = graph.node(id);
+            if (node.conv) node.conv->set_calibrating(calibrating);
+            if (node.fc) node.fc->set_calibrating(calibrating);
+        }
+    };
+
+    for (int id : layers) {
+        GraphNode& node = graph.node(id);
+        if (node.conv) node.conv->quantize_int8();
+        if (node.fc) node.fc->quantize_int8();
+    }
+
+    if (!calibration_inputs_.empty()) {
+        set_calibrating(true);
+        for (const Tensor& input : calibration_inputs_) {
+            Tensor output(graph.output_shape({input.shape()}));
+            graph.execute(input, output);
+        }
+        set_calibrating(false);
+    }
+    graph.invalidate_plan();
+}
+
+REGISTER_OPTIMIZATION_PASS("quantize_int8", QuantizationPass);
+
+void register_quantization_passes() {
+    // empty bc registration is handled by REGISTER_OPTIMIZATION_PASS macro
+}
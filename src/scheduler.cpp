@@ -1,20 +1,276 @@
 #include "scheduler.h"
-#include <OpenCL/opencl.h>
+#include "opencl_gemm.h"
+#include "opencl_runtime.h"
+#include "ops.h"
+#include "program_cache.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <system_error>
+
+namespace {
+
+std::string cpu_model() {
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            size_t colon = line.find(':');
+            if (colon != std::string::npos) return line.substr(line.find_first_not_of(' ', colon + 1));
+        }
+    }
+    return "unknown";
+}
+
+std::string profile_path() {
+    std::string directory = ProgramBinaryCache::default_directory();
+    return directory.empty() ? std::string() : directory + "/scheduler_profile.txt";
+}
+
+// best of a few runs after a warm-up, ms
+double best_time(const std::function<void()>& run, int repeats = 3) {
+    run();
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::high_resolution_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    }
+    return best;
+}
+
+void fill(Tensor& tensor) {
+    for (int i = 0; i < tensor.size(); ++i) tensor.data()[i] = static_cast<float>(i % 17) * 0.125f;
+}
+
+}
+
+const char* device_name(Device device) {
+    return device == Device::CPU ? "CPU" : "GPU";
+}
+
+bool DeviceProfile::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::map<std::string, std::string> values;
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t equals = line.find(" = ");
+        if (equals != std::string::npos) values[line.substr(0, equals)] = line.substr(equals + 3);
+    }
+    const char* numbers[] = {"cpu_threads", "cpu_gemm_flops", "cpu_elementwise_bytes", "gpu_gemm_flops",
+                             "gpu_elementwise_bytes", "upload_bytes", "download_bytes", "gpu_launch"};
+    if (!values.count("cpu") || !values.count("gpu")) return false;
+    for (const char* key : numbers) {
+        if (!values.count(key)) return false;
+    }
+    try {
+        cpu = values["cpu"];
+        gpu = values["gpu"];
+        cpu_threads = std::stoi(values["cpu_threads"]);
+        cpu_gemm_flops = std::stod(values["cpu_gemm_flops"]);
+        cpu_elementwise_bytes = std::stod(values["cpu_elementwise_bytes"]);
+        gpu_gemm_flops = std::stod(values["gpu_gemm_flops"]);
+        gpu_elementwise_bytes = std::stod(values["gpu_elementwise_bytes"]);
+        upload_bytes = std::stod(values["upload_bytes"]);
+        download_bytes = std::stod(values["download_bytes"]);
+        gpu_launch = std::stod(values["gpu_launch"]);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+bool DeviceProfile::save(const std::string& path) const {
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    std::ofstream file(path);
+    file << "cpu = " << cpu << "\n"
+         << "gpu = " << gpu << "\n"
+         << "cpu_threads = " << cpu_threads << "\n"
+         << "cpu_gemm_flops = " << cpu_gemm_flops << "\n"
+         << "cpu_elementwise_bytes = " << cpu_elementwise_bytes << "\n"
+         << "gpu_gemm_flops = " << gpu_gemm_flops << "\n"
+         << "gpu_elementwise_bytes = " << gpu_elementwise_bytes << "\n"
+         << "upload_bytes = " << upload_bytes << "\n"
+         << "download_bytes = " << download_bytes << "\n"
+         << "gpu_launch = " << gpu_launch << "\n";
+    return static_cast<bool>(file);
+}
+
+OpCost OpCost::add(const Tensor& a, const Tensor& b) {
+    OpCost cost;
+    cost.op = "add";
+    cost.compute_bound = false;
+    cost.flops = a.size();
+    cost.upload_bytes = static_cast<double>(a.size() + b.size()) * sizeof(float);
+    cost.download_bytes = static_cast<double>(a.size()) * sizeof(float);
+    cost.bytes = cost.upload_bytes + cost.download_bytes;
+    return cost;
+}
+
+OpCost OpCost::matmul(const Tensor& a, const Tensor& b) {
+    double m = a.shape()[0];
+    double k = a.shape()[1];
+    double n = b.shape()[1];
+    OpCost cost;
+    cost.op = "matmul";
+    cost.flops = 2.0 * m * n * k;
+    cost.upload_bytes = (m * k + k * n) * sizeof(float);
+    cost.download_bytes = m * n * sizeof(float);
+    cost.bytes = cost.upload_bytes + cost.download_bytes;
+    return cost;
+}
+
+OpCost OpCost::fully_connected(int batch_size, int input_size, int output_size, bool weights_on_device) {
+    double parameters = (static_cast<double>(input_size) * output_size + output_size) * sizeof(float);
+    OpCost cost;
+    cost.op = "fully_connected";
+    cost.flops = 2.0 * batch_size * input_size * output_size;
+    cost.upload_bytes = static_cast<double>(batch_size) * input_size * sizeof(float) +
+                        (weights_on_device ? 0.0 : parameters);
+    cost.download_bytes = static_cast<double>(batch_size) * output_size * sizeof(float);
+    cost.bytes = static_cast<double>(batch_size) * (input_size + output_size) * sizeof(float) + parameters;
+    return cost;
+}
+
+Scheduler& Scheduler::getInstance() {
+    static Scheduler instance([] {
+        DeviceProfile current;
+        current.cpu = cpu_model();
+        current.gpu = OpenCLRuntime::available() ? OpenCLRuntime::getInstance().device_name() : "";
+        current.cpu_threads = ThreadPool::getInstance().num_threads();
+
+        // a profile from other hardware, or a forced run, means measuring again
+        std::string path = profile_path();
+        const char* force = std::getenv("ANNOF_SCHEDULER_CALIBRATE");
+        DeviceProfile saved;
+        if (!path.empty() && !(force && std::string(force) == "1") && saved.load(path) &&
+            saved.cpu == current.cpu && saved.gpu == current.gpu && saved.cpu_threads == current.cpu_threads) {
+            return saved;
+        }
+        DeviceProfile measured = calibrate();
+        if (!path.empty()) measured.save(path);
+        return measured;
+    }());
+    return instance;
+}
+
+Scheduler::Scheduler(DeviceProfile profile) : profile_(std::move(profile)) {
+    const char* log = std::getenv("ANNOF_SCHEDULER_LOG");
+    log_ = log && std::string(log) == "1";
+}
 
 Device Scheduler::select_device(const Tensor& a, const Tensor& b) {
-    int size = a.shape()[0];
-    
-    // check if OpenCL GPU is available
-    cl_platform_id platform;
-    cl_device_id device;
-    cl_int err;
-    
-    err = clGetPlatformIDs(1, &platform, NULL);
-    if (err != CL_SUCCESS) return Device::CPU;
-    
-    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
-    if (err != CL_SUCCESS) return Device::CPU;
-    
-    // I guess metric is use GPU for larger tensors
-    return (size > 1000000) ? Device::GPU : Device::CPU;
-}
\ No newline at end of file
+    return getInstance().select(OpCost::add(a, b));
+}
+
+double Scheduler::estimate_cpu(const OpCost& cost) const {
+    return cost.compute_bound ? cost.flops / profile_.cpu_gemm_flops : cost.bytes / profile_.cpu_elementwise_bytes;
+}
+
+double Scheduler::estimate_gpu(const OpCost& cost) const {
+    if (!profile_.has_gpu()) return std::numeric_limits<double>::infinity();
+    double compute = cost.compute_bound ? cost.flops / profile_.gpu_gemm_flops : cost.bytes / profile_.gpu_elementwise_bytes;
+    return profile_.gpu_launch + cost.upload_bytes / profile_.upload_bytes +
+           cost.download_bytes / profile_.download_bytes + compute;
+}
+
+Device Scheduler::select(const OpCost& cost) {
+    SchedulingDecision decision{cost, Device::CPU, estimate_cpu(cost), estimate_gpu(cost), ""};
+    std::ostringstream reason;
+    if (!profile_.has_gpu()) {
+        reason << "no OpenCL device";
+    } else {
+        decision.device = decision.gpu_ms < decision.cpu_ms ? Device::GPU : Device::CPU;
+        double transfer = cost.upload_bytes / profile_.upload_bytes + cost.download_bytes / profile_.download_bytes;
+        reason << "cpu " << decision.cpu_ms << " ms vs gpu " << decision.gpu_ms << " ms (" << transfer
+               << " ms transfer, " << profile_.gpu_launch << " ms launch)";
+    }
+    decision.reason = reason.str();
+
+    if (log_) {
+        std::cerr << "scheduler: " << cost.op << " " << cost.flops << " flops " << cost.bytes << " bytes -> "
+                  << device_name(decision.device) << ", " << decision.reason << std::endl;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    decisions_.push_back(std::move(decision));
+    if (decisions_.size() > kMaxDecisions) decisions_.pop_front();
+    return decisions_.back().device;
+}
+
+std::vector<SchedulingDecision> Scheduler::decisions() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::vector<SchedulingDecision>(decisions_.begin(), decisions_.end());
+}
+
+void Scheduler::clear_decisions() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    decisions_.clear();
+}
+
+DeviceProfile Scheduler::calibrate() {
+    DeviceProfile profile;
+    profile.cpu = cpu_model();
+    profile.cpu_threads = ThreadPool::getInstance().num_threads();
+
+    // big enough to reach the steady-state rate, small enough to stay in the tens of ms
+    const int n = 256;
+    Tensor a({n, n});
+    Tensor b({n, n});
+    Tensor c({n, n});
+    fill(a);
+    fill(b);
+    profile.cpu_gemm_flops = 2.0 * n * n * n / best_time([&] { ops::matmul_cpu(a, b, c); });
+
+    const int count = 1 << 20;
+    Tensor x({count});
+    Tensor y({count});
+    Tensor z({count});
+    fill(x);
+    fill(y);
+    profile.cpu_elementwise_bytes = 3.0 * count * sizeof(float) / best_time([&] { ops::add_cpu(x, y, z); });
+
+    if (!OpenCLRuntime::available()) return profile;
+    try {
+        OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+        profile.gpu = runtime.device_name();
+
+        cl_mem buffer = runtime.scratch("calibrate.transfer", count * sizeof(float));
+        profile.upload_bytes = count * sizeof(float) / best_time([&] { runtime.upload(buffer, x.data(), count); });
+        profile.download_bytes = count * sizeof(float) / best_time([&] { runtime.download(buffer, z.data(), count); });
+
+        // a one-element add is all overhead: launch, synchronisation and three tiny copies
+        Tensor one({1});
+        Tensor one_result({1});
+        profile.gpu_launch = best_time([&] { ops::add_gpu_async(one, one, one_result).wait(); }, 5);
+
+        const int m = 512;
+        cl_mem ga = runtime.scratch("calibrate.a", m * m * sizeof(float));
+        cl_mem gb = runtime.scratch("calibrate.b", m * m * sizeof(float));
+        cl_mem gc = runtime.scratch("calibrate.c", m * m * sizeof(float));
+        double gemm_ms = best_time([&] {
+            opencl_gemm::sgemm(m, m, m, ga, gb, nullptr, gc);
+            clFinish(runtime.queue());
+        });
+        profile.gpu_gemm_flops = 2.0 * m * m * m / gemm_ms;
+
+        // the add kernel only runs behind its transfers, take them out again
+        double add_ms = best_time([&] { ops::add_gpu_async(x, y, z).wait(); });
+        double transfer_ms = 2.0 * count * sizeof(float) / profile.upload_bytes +
+                             count * sizeof(float) / profile.download_bytes + profile.gpu_launch;
+        profile.gpu_elementwise_bytes = 3.0 * count * sizeof(float) / std::max(add_ms - transfer_ms, 1e-3);
+    } catch (const std::exception& e) {
+        std::cerr << "Scheduler calibration on OpenCL failed, scheduling on the CPU: " << e.what() << std::endl;
+        profile.gpu_gemm_flops = 0.0;
+    }
+    return profile;
+}
@@ -0,0 +1,165 @@
+#include "sparse.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace sparse {
+
+namespace {
+
+// block rows of k rows, the last one possibly partial
+int block_row_count(int k, int block_rows) {
+    return (k + block_rows - 1) / block_rows;
+}
+
+int effective_block_rows(int k, int block_rows) {
+    if (block_rows != 1 && block_rows != 4) throw std::invalid_argument("sparse blocks are 1 or 4 rows high");
+    return k < block_rows ? 1 : block_rows;
+}
+
+// calls f(first row, rows) for the rows of block row g that are its own
+template <typename F>
+void block_rows_of(int g, int k, int block_rows, F f) {
+    int begin = g * block_rows;
+    f(begin, std::min(block_rows, k - begin));
+}
+
+// sum of squares of block (g, panel), 0 exactly when every value in it is zero
+double block_energy(const float* w, int k, int n, int block_rows, int g, int panel) {
+    double energy = 0.0;
+    int col0 = panel * kBlockCols;
+    int cols = std::min(kBlockCols, n - col0);
+    block_rows_of(g, k, block_rows, [&](int begin, int rows) {
+        for (int r = 0; r < rows; ++r) {
+            const float* row = w + static_cast<std::ptrdiff_t>(begin + r) * n + col0;
+            for (int j = 0; j < cols; ++j) energy += static_cast<double>(row[j]) * row[j];
+        }
+    });
+    return energy;
+}
+
+}
+
+double BlockSparseWeights::density() const {
+    double total = static_cast<double>(panels()) * block_row_count(k, block_rows);
+    return total > 0.0 ? blocks() / total : 0.0;
+}
+
+void from_dense(const float* w, int k, int n, int block_rows, BlockSparseWeights& out) {
+    block_rows = effective_block_rows(k, block_rows);
+    out.k = k;
+    out.n = n;
+    out.block_rows = block_rows;
+    out.panel_starts.assign(1, 0);
+    out.block_starts.clear();
+    out.values.clear();
+    int groups = block_row_count(k, block_rows);
+    const int block_size = block_rows * kBlockCols;
+    for (int panel = 0; panel < out.panels(); ++panel) {
+        int col0 = panel * kBlockCols;
+        int cols = std::min(kBlockCols, n - col0);
+        for (int g = 0; g < groups; ++g) {
+            if (block_energy(w, k, n, block_rows, g, panel) == 0.0) continue;
+            // a partial last block row is moved up to end at k, the rows it overlaps stay zero
+            int start = std::min(g * block_rows, k - block_rows);
+            size_t offset = out.values.size();
+            out.values.resize(offset + block_size, 0.0f);
+            block_rows_of(g, k, block_rows, [&](int begin, int rows) {
+                for (int r = 0; r < rows; ++r) {
+                    const float* row = w + static_cast<std::ptrdiff_t>(begin + r) * n + col0;
+                    float* dst = out.values.data() + offset + (begin + r - start) * kBlockCols;
+                    std::copy(row, row + cols, dst);
+                }
+            });
+            out.block_starts.push_back(start);
+        }
+        out.panel_starts.push_back(out.blocks());
+    }
+}
+
+double block_density(const float* w, int k, int n, int block_rows) {
+    block_rows = effective_block_rows(k, block_rows);
+    int groups = block_row_count(k, block_rows);
+    int panels = (n + kBlockCols - 1) / kBlockCols;
+    long long kept = 0;
+    for (int panel = 0; panel < panels; ++panel) {
+        for (int g = 0; g < groups; ++g) kept += block_energy(w, k, n, block_rows, g, panel) != 0.0;
+    }
+    long long total = static_cast<long long>(panels) * groups;
+    return total > 0 ? static_cast<double>(kept) / total : 0.0;
+}
+
+void prune(float* w, int k, int n, int block_rows, float sparsity) {
+    block_rows = effective_block_rows(k, block_rows);
+    int groups = block_row_count(k, block_rows);
+    int panels = (n + kBlockCols - 1) / kBlockCols;
+    std::vector<std::pair<double, int>> energies;
+    energies.reserve(static_cast<size_t>(panels) * groups);
+    for (int panel = 0; panel < panels; ++panel) {
+        for (int g = 0; g < groups; ++g) {
+            energies.emplace_back(block_energy(w, k, n, block_rows, g, panel), panel * groups + g);
+        }
+    }
+    size_t count = static_cast<size_t>(std::max(0.0f, std::min(1.0f, sparsity)) * energies.size() + 0.5f);
+    std::nth_element(energies.begin(), energies.begin() + count, energies.end());
+    for (size_t i = 0; i < count; ++i) {
+        int panel = energies[i].second / groups;
+        int g = energies[i].second % groups;
+        int col0 = panel * kBlockCols;
+        int cols = std::min(kBlockCols, n - col0);
+        block_rows_of(g, k, block_rows, [&](int begin, int rows) {
+            for (int r = 0; r < rows; ++r) {
+                float* row = w + static_cast<std::ptrdiff_t>(begin + r) * n + col0;
+                std::fill(row, row + cols, 0.0f);
+            }
+        });
+    }
+}
+
+void gemm(int m, const float* a, int lda, const BlockSparseWeights& w, float* c, int ldc,
+          const gemm::Epilogue& epilogue) {
+    assert(!epilogue.bias_per_row);
+    if (m <= 0 || w.n <= 0) return;
+    const cpu::Kernels& kernels = cpu::kernels();
+    const int block_size = w.block_rows * kBlockCols;
+    double blocks_per_panel = static_cast<double>(w.blocks()) / w.panels();
+    int grain = ThreadPool::grain_for(2.0 * m * block_size * std::max(1.0, blocks_per_panel));
+
+    ThreadPool::getInstance().parallel_for(0, w.panels(), grain, [&](int begin, int end) {
+        for (int panel = begin; panel < end; ++panel) {
+            int col0 = panel * kBlockCols;
+            int cols = std::min(kBlockCols, w.n - col0);
+            int first = w.panel_starts[panel];
+            int blocks = w.panel_starts[panel + 1] - first;
+            const int* starts = w.block_starts.data() + first;
+            const float* values = w.values.data() + static_cast<size_t>(first) * block_size;
+
+            // the last panel of an n that is not a multiple of kBlockCols goes through staged
+            // columns and bias, the kernel always writes a whole panel
+            alignas(64) float bias[kBlockCols] = {};
+            alignas(64) float staged[cpu::kSparseRows * kBlockCols];
+            bool edge = cols < kBlockCols;
+            cpu::TileEpilogue tile{epilogue.bias ? epilogue.bias + col0 : nullptr, false, epilogue.activation};
+            if (edge && epilogue.bias) {
+                std::copy(epilogue.bias + col0, epilogue.bias + col0 + cols, bias);
+                tile.bias = bias;
+            }
+            for (int row0 = 0; row0 < m; row0 += cpu::kSparseRows) {
+                int rows = std::min(cpu::kSparseRows, m - row0);
+                const float* a_rows = a + static_cast<std::ptrdiff_t>(row0) * lda;
+                float* c_tile = c + static_cast<std::ptrdiff_t>(row0) * ldc + col0;
+                if (!edge) {
+                    kernels.sparse_panel(rows, w.block_rows, blocks, starts, values, a_rows, lda, c_tile, ldc, &tile);
+                    continue;
+                }
+                kernels.sparse_panel(rows, w.block_rows, blocks, starts, values, a_rows, lda, staged, kBlockCols, &tile);
+                for (int i = 0; i < rows; ++i) {
+                    std::copy(staged + i * kBlockCols, staged + i * kBlockCols + cols, c_tile + static_cast<std::ptrdiff_t>(i) * ldc);
+                }
+            }
+        }
+    });
+}
+
+}
@@ -0,0 +1,57 @@
+#include "sparsity_pass.h"
+#include "fully_connected_layer.h"
+#include "graph.h"
+#include "optimization_pass_registrar.h"
+#include <chrono>
+#include <random>
+
+namespace {
+
+// ms per forward, the first call warms caches and builds what the layer caches
+double time_forward(FullyConnectedLayer& layer, const Tensor& input, Tensor& output) {
+    layer.forward_cpu(input, output);
+    int iterations = 0;
+    double elapsed = 0.0;
+    auto start = std::chrono::high_resolution_clock::now();
+    while (iterations < 3 || (elapsed < 5.0 && iterations < 100)) {
+        layer.forward_cpu(input, output);
+        ++iterations;
+        elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+    return elapsed / iterations;
+}
+
+}
+
+void SparsityPass::apply(Graph& graph) {
+    decisions_.clear();
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+    for (int id : graph.topological_order()) {
+        GraphNode& node = graph.node(id);
+        if (node.op != OpType::FullyConnected || !node.fc || node.fc->is_quantized()) continue;
+        FullyConnectedLayer& layer = *node.fc;
+        if (prune_sparsity_ > 0.0f) layer.prune(prune_sparsity_, block_rows_);
+
+        Decision decision{id, layer.weight_density(block_rows_), 0.0, 0.0, false};
+        if (decision.density <= kMaxDensity) {
+            Tensor input({batch_size_, layer.input_size()});
+            for (int i = 0; i < input.size(); ++i) input.data()[i] = dis(gen);
+            Tensor output({batch_size_, layer.output_size()});
+            layer.set_sparse(0);
+            decision.dense_ms = time_forward(layer, input, output);
+            layer.set_sparse(block_rows_);
+            decision.sparse_ms = time_forward(layer, input, output);
+            decision.sparse = decision.sparse_ms < decision.dense_ms;
+        }
+        layer.set_sparse(decision.sparse ? block_rows_ : 0);
+        decisions_.push_back(decision);
+    }
+    graph.invalidate_plan();
+}
+
+REGISTER_OPTIMIZATION_PASS("sparsify", SparsityPass);
+
+void register_sparsity_passes() {
+    // empty bc registration is handled by REGISTER_OPTIMIZATION_PASS macro
+}
@@ -0,0 +1,160 @@
+#include "split_gemm.h"
+#include "gpu_future.h"
+#include "opencl_gemm.h"
+#include "opencl_runtime.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+SplitGemm& SplitGemm::getInstance() {
+    static SplitGemm instance;
+    return instance;
+}
+
+SplitGemm::SplitGemm() : has_device_(OpenCLRuntime::available()) {}
+
+double SplitGemm::initial_share() const {
+    // the calibrated GEMM rates are the best guess before a call of the shape has been timed
+    const DeviceProfile& profile = Scheduler::getInstance().profile();
+    if (!profile.has_gpu() || profile.cpu_gemm_flops <= 0.0) return 0.5;
+    double share = profile.gpu_gemm_flops / (profile.gpu_gemm_flops + profile.cpu_gemm_flops);
+    return std::min(std::max(share, kMinShare), 1.0 - kMinShare);
+}
+
+double SplitGemm::gpu_share(int n, int k) {
+    if (!has_device_) return 0.0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = shares_.find({n, k});
+    if (it != shares_.end()) return it->second;
+    double share = initial_share();
+    shares_[{n, k}] = share;
+    return share;
+}
+
+void SplitGemm::set_gpu_share(int n, int k, double share) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shares_[{n, k}] = std::min(std::max(share, 0.0), 1.0);
+}
+
+SplitGemm::Split SplitGemm::last_split() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_;
+}
+
+void SplitGemm::run(const Tensor& a, const Tensor& b, const Tensor* bias, Tensor& c, gemm::Activation activation,
+                    bool resident_b) {
+    if (!a.is_contiguous() || !b.is_contiguous() || !c.is_contiguous()) {
+        throw std::invalid_argument("SplitGemm operands must be contiguous");
+    }
+    int k = b.shape()[0];
+    int n = b.shape()[1];
+    int m = a.size() / k;
+    if (a.size() != m * k || c.size() != m * n) throw std::invalid_argument("SplitGemm shapes don't match");
+
+    double share = gpu_share(n, k);
+    int gpu_rows = static_cast<int>(std::lround(m * share));
+    // a shape that is being split keeps both sides busy, even when m rounds one of them away
+    if (share > 0.0 && share < 1.0 && m >= 2) gpu_rows = std::min(std::max(gpu_rows, 1), m - 1);
+    int cpu_rows = m - gpu_rows;
+
+    // device rows: upload the first rows of a, compute, download into the first rows of c
+    cl_event uploaded = nullptr;
+    GpuFuture downloaded;
+    auto start = std::chrono::high_resolution_clock::now();
+    if (gpu_rows > 0) {
+        // one caller at a time fills the shared scratch buffers and sets the shared kernel's
+        // arguments. the enqueues need no more than that: both transfers run on the in-order
+        // transfer queue, so the next call's uploads wait for this call's download
+        std::lock_guard<std::mutex> enqueue(enqueue_mutex_);
+        std::vector<cl_event> events;
+        try {
+            OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+            cl_mem a_buffer = runtime.scratch("split.a", static_cast<size_t>(gpu_rows) * k * sizeof(float));
+            cl_mem c_buffer = runtime.scratch("split.c", static_cast<size_t>(gpu_rows) * n * sizeof(float));
+            uploaded = runtime.upload_async(a_buffer, a.data(), static_cast<size_t>(gpu_rows) * k);
+            events.push_back(uploaded);
+            clRetainEvent(uploaded);
+
+            cl_mem b_buffer;
+            cl_mem bias_buffer = nullptr;
+            if (resident_b) {
+                b_buffer = runtime.resident(b);
+                if (bias) bias_buffer = runtime.resident(*bias);
+            } else {
+                b_buffer = runtime.scratch("split.b", b.size() * sizeof(float));
+                events.push_back(runtime.upload_async(b_buffer, b.data(), b.size()));
+                if (bias) {
+                    bias_buffer = runtime.scratch("split.bias", bias->size() * sizeof(float));
+                    events.push_back(runtime.upload_async(bias_buffer, bias->data(), bias->size()));
+                }
+            }
+
+            cl_event computed = nullptr;
+            opencl_gemm::sgemm(gpu_rows, n, k, a_buffer, b_buffer, bias_buffer, c_buffer, activation, events, &computed);
+            events.push_back(computed);
+            downloaded = GpuFuture(runtime.download_async(c_buffer, c.data(), static_cast<size_t>(gpu_rows) * n, {computed}));
+            runtime.flush();
+        } catch (const std::exception& e) {
+            std::cerr << "Split GEMM on OpenCL failed, running it on the CPU: " << e.what() << std::endl;
+            // uploads already enqueued read a, b and bias, let them finish before the caller
+            // gets its tensors back
+            clFinish(OpenCLRuntime::getInstance().transfer_queue());
+            downloaded = GpuFuture();
+            if (uploaded) clReleaseEvent(uploaded);
+            uploaded = nullptr;
+            gpu_rows = 0;
+            cpu_rows = m;
+        }
+        for (cl_event event : events) clReleaseEvent(event);
+    }
+
+    gemm::Epilogue epilogue;
+    epilogue.bias = bias ? bias->data() : nullptr;
+    epilogue.activation = activation;
+    if (cpu_rows > 0) {
+        gemm::sgemm(false, false, cpu_rows, n, k, 1.0f, a.data() + static_cast<size_t>(gpu_rows) * k, k, b.data(), n,
+                    0.0f, c.data() + static_cast<size_t>(gpu_rows) * n, n, epilogue);
+    }
+    double cpu_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    double gpu_ms = 0.0;
+    if (gpu_rows > 0) {
+        cl_event last = downloaded.event();
+        clRetainEvent(last);
+        try {
+            downloaded.wait();
+            // device time from the first upload starting to the download ending
+            cl_ulong begin = 0;
+            cl_ulong end = 0;
+            if (clGetEventProfilingInfo(uploaded, CL_PROFILING_COMMAND_START, sizeof(begin), &begin, nullptr) == CL_SUCCESS &&
+                clGetEventProfilingInfo(last, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr) == CL_SUCCESS &&
+                end > begin) {
+                gpu_ms = (end - begin) / 1e6;
+            } else {
+                gpu_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Split GEMM on OpenCL failed, running it on the CPU: " << e.what() << std::endl;
+            gemm::sgemm(false, false, gpu_rows, n, k, 1.0f, a.data(), k, b.data(), n, 0.0f, c.data(), n, epilogue);
+            gpu_rows = 0;
+            cpu_rows = m;
+        }
+        clReleaseEvent(last);
+        clReleaseEvent(uploaded);
+    }
+
+    // move halfway towards the split that would have made both sides finish together
+    std::lock_guard<std::mutex> lock(mutex_);
+    double& next = shares_[{n, k}];
+    if (gpu_rows > 0 && cpu_rows > 0 && gpu_ms > 0.0 && cpu_ms > 0.0) {
+        double gpu_rate = gpu_rows / gpu_ms;
+        double cpu_rate = cpu_rows / cpu_ms;
+        double balanced = gpu_rate / (gpu_rate + cpu_rate);
+        next = std::min(std::max(0.5 * next + 0.5 * balanced, kMinShare), 1.0 - kMinShare);
+    }
+    last_ = {gpu_rows, cpu_rows, gpu_ms, cpu_ms, next};
+}
@@ -1,85 +1,265 @@
 #include "tensor.h"
+#include "allocator.h"
+#include "elementwise.h"
+#include "half.h"
 #include <numeric>
 #include <algorithm>
 #include <cassert>
 #include <cstring>
 
-Tensor::Tensor(const std::vector<int>& shape, float* data)
-    : shape_(shape) {
+namespace {
+
+struct StorageDeleter {
+    Allocator* allocator;
+    size_t bytes;
+
+    void operator()(float* ptr) const { allocator->deallocate(ptr, bytes); }
+};
+
+// shared_ptr control block comes from the same allocator as the data, so creating a
+// tensor from a warm pool or an arena never reaches malloc
+template <typename T>
+struct ControlBlockAllocator {
+    using value_type = T;
+
+    Allocator* allocator;
+
+    explicit ControlBlockAllocator(Allocator* allocator) : allocator(allocator) {}
+    template <typename U>
+    ControlBlockAllocator(const ControlBlockAllocator<U>& other) : allocator(other.allocator) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(allocator->allocate(n * sizeof(T))); }
+    void deallocate(T* ptr, size_t n) { allocator->deallocate(ptr, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const ControlBlockAllocator<U>& other) const { return allocator == other.allocator; }
+    template <typename U>
+    bool operator!=(const ControlBlockAllocator<U>& other) const { return allocator != other.allocator; }
+};
+
+// uninitialized storage for size elements of dtype
+std::shared_ptr<float> allocate(int size, DType dtype, Allocator* allocator) {
+    if (!allocator) {
+        allocator = Allocator::current();
+    }
+    size_t bytes = size * dtype_size(dtype);
+    float* ptr = static_cast<float*>(allocator->allocate(bytes));
+    return std::shared_ptr<float>(ptr, StorageDeleter{allocator, bytes}, ControlBlockAllocator<float>(allocator));
+}
+
+// dense row-major copy of a strided view, walked with an N-d index counter
+template <typename T>
+void gather(const T* src, const std::vector<int>& shape, const std::vector<int>& strides, int offset, int total,
+            T* dst) {
+    int dims = static_cast<int>(shape.size());
+    std::vector<int> index(dims, 0);
+    for (int i = 0; i < total; ++i) {
+        int pos = offset;
+        for (int d = 0; d < dims; ++d) {
+            pos += index[d] * strides[d];
+        }
+        dst[i] = src[pos];
+
+        for (int d = dims - 1; d >= 0; --d) {
+            if (++index[d] < shape[d]) break;
+            index[d] = 0;
+        }
+    }
+}
+
+}
+
+size_t dtype_size(DType dtype) {
+    return dtype == DType::Float32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+const char* dtype_name(DType dtype) {
+    switch (dtype) {
+        case DType::Float32: return "float32";
+        case DType::Float16: return "float16";
+        case DType::BFloat16: return "bfloat16";
+    }
+    return "unknown";
+}
+
+Tensor::Tensor(const std::vector<int>& shape, float* data, Allocator* allocator)
+    : shape_(shape), strides_(default_strides(shape)) {
     int size = std::accumulate(shape.begin(), shape.end(), 1, std::multiplies<int>());
-    data_ = std::make_unique<float[]>(size);
+    storage_ = allocate(size, DType::Float32, allocator);
     if (data) {
-        std::memcpy(data_.get(), data, size * sizeof(float));
+        std::memcpy(storage_.get(), data, size * sizeof(float));
     } else {
-        std::fill(data_.get(), data_.get() + size, 0.0f);
+        std::fill(storage_.get(), storage_.get() + size, 0.0f);
     }
 }
 
-Tensor::Tensor(const Tensor& other)
-    : shape_(other.shape_) {
-    int size = std::accumulate(shape_.begin(), shape_.end(), 1, std::multiplies<int>());
-    data_ = std::make_unique<float[]>(size);
-    std::memcpy(data_.get(), other.data_.get(), size * sizeof(float));
+Tensor::Tensor(const std::vector<int>& shape, DType dtype, Allocator* allocator)
+    : shape_(shape), strides_(default_strides(shape)), dtype_(dtype) {
+    int size = std::accumulate(shape.begin(), shape.end(), 1, std::multiplies<int>());
+    storage_ = allocate(size, dtype, allocator);
+    std::memset(storage_.get(), 0, size * dtype_size(dtype));
 }
 
-Tensor& Tensor::operator=(const Tensor& other) {
-    if (this != &other) {
-        shape_ = other.shape_;
-        int size = std::accumulate(shape_.begin(), shape_.end(), 1, std::multiplies<int>());
-        data_ = std::make_unique<float[]>(size);
-        std::memcpy(data_.get(), other.data_.get(), size * sizeof(float));
+Tensor::Tensor(std::shared_ptr<float> storage, const std::vector<int>& shape,
+               const std::vector<int>& strides, int offset, DType dtype)
+    : shape_(shape), strides_(strides), offset_(offset), dtype_(dtype), storage_(std::move(storage)) {}
+
+Tensor::Tensor(const Tensor& other) = default;
+
+Tensor::Tensor(Tensor&& other) noexcept = default;
+
+Tensor& Tensor::operator=(const Tensor& other) = default;
+
+Tensor& Tensor::operator=(Tensor&& other) noexcept = default;
+
+Tensor::~Tensor() = default;
+
+std::vector<int> Tensor::default_strides(const std::vector<int>& shape) {
+    std::vector<int> strides(shape.size());
+    int stride = 1;
+    for (int d = static_cast<int>(shape.size()) - 1; d >= 0; --d) {
+        strides[d] = stride;
+        stride *= shape[d];
     }
-    return *this;
+    return strides;
 }
 
-Tensor::~Tensor() = default;
+int Tensor::size() const {
+    return std::accumulate(shape_.begin(), shape_.end(), 1, std::multiplies<int>());
+}
 
-Tensor operator+(const Tensor& a, const Tensor& b) {
-    assert(a.shape() == b.shape());
-    Tensor result(a.shape());
-    int size = std::accumulate(a.shape().begin(), a.shape().end(), 1, std::multiplies<int>());
-    for (int i = 0; i < size; ++i) {
-        result.data()[i] = a.data()[i] + b.data()[i];
+bool Tensor::is_contiguous() const {
+    int expected = 1;
+    for (int d = static_cast<int>(shape_.size()) - 1; d >= 0; --d) {
+        // size-1 dims can carry any stride
+        if (shape_[d] != 1 && strides_[d] != expected) return false;
+        expected *= shape_[d];
     }
-    return result;
+    return true;
 }
 
-Tensor operator-(const Tensor& a, const Tensor& b) {
-    assert(a.shape() == b.shape());
-    Tensor result(a.shape());
-    int size = std::accumulate(a.shape().begin(), a.shape().end(), 1, std::multiplies<int>());
-    for (int i = 0; i < size; ++i) {
-        result.data()[i] = a.data()[i] - b.data()[i];
+Tensor Tensor::reshape(const std::vector<int>& shape) const {
+    if (!is_contiguous()) {
+        return contiguous().reshape(shape);
     }
-    return result;
+
+    // a single -1 is inferred from the remaining dims
+    std::vector<int> new_shape = shape;
+    int known = 1;
+    int inferred = -1;
+    for (size_t d = 0; d < new_shape.size(); ++d) {
+        if (new_shape[d] == -1) {
+            assert(inferred == -1);
+            inferred = static_cast<int>(d);
+        } else {
+            known *= new_shape[d];
+        }
+    }
+    if (inferred >= 0) {
+        new_shape[inferred] = size() / known;
+    }
+    assert(std::accumulate(new_shape.begin(), new_shape.end(), 1, std::multiplies<int>()) == size());
+
+    return Tensor(storage_, new_shape, default_strides(new_shape), offset_, dtype_);
 }
 
-Tensor operator*(const Tensor& a, const Tensor& b) {
-    assert(a.shape() == b.shape());
-    Tensor result(a.shape());
-    int size = std::accumulate(a.shape().begin(), a.shape().end(), 1, std::multiplies<int>());
-    for (int i = 0; i < size; ++i) {
-        result.data()[i] = a.data()[i] * b.data()[i];
+Tensor Tensor::flatten(int start_dim) const {
+    std::vector<int> new_shape(shape_.begin(), shape_.begin() + start_dim);
+    new_shape.push_back(std::accumulate(shape_.begin() + start_dim, shape_.end(), 1, std::multiplies<int>()));
+    return reshape(new_shape);
+}
+
+Tensor Tensor::slice(int begin, int end) const {
+    assert(!shape_.empty() && 0 <= begin && begin <= end && end <= shape_[0]);
+    std::vector<int> new_shape = shape_;
+    new_shape[0] = end - begin;
+    return Tensor(storage_, new_shape, strides_, offset_ + begin * strides_[0], dtype_);
+}
+
+Tensor Tensor::transpose(int dim0, int dim1) const {
+    std::vector<int> new_shape = shape_;
+    std::vector<int> new_strides = strides_;
+    std::swap(new_shape[dim0], new_shape[dim1]);
+    std::swap(new_strides[dim0], new_strides[dim1]);
+    return Tensor(storage_, new_shape, new_strides, offset_, dtype_);
+}
+
+Tensor Tensor::contiguous() const {
+    if (is_contiguous()) {
+        return *this;
     }
-    return result;
+    return clone();
 }
 
-Tensor operator/(const Tensor& a, const Tensor& b) {
-    assert(a.shape() == b.shape());
-    Tensor result(a.shape());
-    int size = std::accumulate(a.shape().begin(), a.shape().end(), 1, std::multiplies<int>());
-    for (int i = 0; i < size; ++i) {
-        result.data()[i] = a.data()[i] / b.data()[i];
+Tensor Tensor::clone() const {
+    Tensor result(shape_, dtype_);
+    int total = size();
+    if (total == 0) return result;
+
+    if (is_contiguous()) {
+        std::memcpy(result.storage_.get(), raw_data(), total * dtype_size(dtype_));
+    } else if (dtype_ == DType::Float32) {
+        gather(storage_.get(), shape_, strides_, offset_, total, result.data());
+    } else {
+        gather(reinterpret_cast<const uint16_t*>(storage_.get()), shape_, strides_, offset_, total, result.half_data());
     }
     return result;
 }
 
-Tensor elementwise_multiply(const Tensor& a, const Tensor& b) {
-    assert(a.shape() == b.shape());
-    Tensor result(a.shape());
-    int size = std::accumulate(a.shape().begin(), a.shape().end(), 1, std::multiplies<int>());
-    for (int i = 0; i < size; ++i) {
-        result.data()[i] = a.data()[i] * b.data()[i];
+Tensor Tensor::to(DType dtype, Allocator* allocator) const {
+    if (dtype == dtype_) {
+        return contiguous();
+    }
+    if (dtype_ != DType::Float32 && dtype != DType::Float32) {
+        // between the two 16-bit formats through float, fp16 -> float is exact
+        return to(DType::Float32).to(dtype, allocator);
+    }
+    Tensor source = contiguous();
+    Tensor result(shape_, dtype, allocator);
+    if (dtype == DType::Float32) {
+        half::widen(source.half_data(), result.data(), size(), half::format_of(dtype_));
+    } else {
+        half::narrow(source.data(), result.half_data(), size(), half::format_of(dtype));
     }
     return result;
-}
\ No newline at end of file
+}
+
+void add(const Tensor& a, const Tensor& b, Tensor& result) {
+    elementwise::binary(cpu::BinaryOp::Add, a, b, result);
+}
+
+void subtract(const Tensor& a, const Tensor& b, Tensor& result) {
+    elementwise::binary(cpu::BinaryOp::Subtract, a, b, result);
+}
+
+void multiply(const Tensor& a, const Tensor& b, Tensor& result) {
+    elementwise::binary(cpu::BinaryOp::Multiply, a, b, result);
+}
+
+void divide(const Tensor& a, const Tensor& b, Tensor& result) {
+    elementwise::binary(cpu::BinaryOp::Divide, a, b, result);
+}
+
+void elementwise_multiply(const Tensor& a, const Tensor& b, Tensor& result) {
+    multiply(a, b, result);
+}
+
+Tensor operator+(const Tensor& a, const Tensor& b) {
+    return elementwise::binary(cpu::BinaryOp::Add, a, b);
+}
+
+Tensor operator-(const Tensor& a, const Tensor& b) {
+    return elementwise::binary(cpu::BinaryOp::Subtract, a, b);
+}
+
+Tensor operator*(const Tensor& a, const Tensor& b) {
+    return elementwise::binary(cpu::BinaryOp::Multiply, a, b);
+}
+
+Tensor operator/(const Tensor& a, const Tensor& b) {
+    return elementwise::binary(cpu::BinaryOp::Divide, a, b);
+}
+
+Tensor elementwise_multiply(const Tensor& a, const Tensor& b) {
+    return elementwise::binary(cpu::BinaryOp::Multiply, a, b);
+}
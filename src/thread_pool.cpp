@@ -0,0 +1,272 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// set on workers and on a caller while it runs tasks
+thread_local bool in_task = false;
+
+// in_task for the caller's part of a job, cleared however that part ends
+struct TaskScope {
+    TaskScope() { in_task = true; }
+    ~TaskScope() { in_task = false; }
+    TaskScope(const TaskScope&) = delete;
+    TaskScope& operator=(const TaskScope&) = delete;
+};
+
+uint64_t pack(int begin, int end) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(begin)) << 32) | static_cast<uint32_t>(end);
+}
+
+int range_begin(uint64_t range) {
+    return static_cast<int>(range >> 32);
+}
+
+int range_end(uint64_t range) {
+    return static_cast<int>(range & 0xffffffffu);
+}
+
+// CPUs this process may run on, in order. empty where the OS doesn't say
+std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &mask)) cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
+void pin_current_thread(int cpu) {
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+#else
+    (void)cpu;
+#endif
+}
+
+}
+
+ThreadPool& ThreadPool::getInstance() {
+    // one thread per CPU the process may use, a cgroup or taskset limit included
+    static ThreadPool instance([] {
+        if (const char* env = std::getenv("ANNOF_NUM_THREADS")) {
+            int threads = std::atoi(env);
+            if (threads > 0) return threads;
+        }
+        int cpus = static_cast<int>(allowed_cpus().size());
+        if (cpus > 0) return cpus;
+        return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }());
+    return instance;
+}
+
+ThreadPool::ThreadPool(int num_threads) {
+    const char* affinity = std::getenv("ANNOF_THREAD_AFFINITY");
+    pin_threads_ = affinity && std::string(affinity) == "1";
+    start_workers(num_threads);
+}
+
+ThreadPool::~ThreadPool() {
+    stop_workers();
+}
+
+void ThreadPool::set_num_threads(int num_threads) {
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    stop_workers();
+    start_workers(std::max(1, num_threads));
+}
+
+void ThreadPool::set_affinity(bool pin) {
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    int threads = num_threads();
+    stop_workers();
+    pin_threads_ = pin;
+    start_workers(threads);
+}
+
+int ThreadPool::grain_for(double cost_per_item) {
+    if (cost_per_item <= 0.0) return INT_MAX;
+    return static_cast<int>(std::min(static_cast<double>(INT_MAX), std::max(1.0, std::ceil(kMinTaskCost / cost_per_item))));
+}
+
+bool ThreadPool::in_parallel_region() {
+    return in_task;
+}
+
+void ThreadPool::start_workers(int num_threads) {
+    slots_.reset(new Slot[num_threads]);
+    // workers start at the current generation, so they only pick up jobs posted after this
+    std::vector<int> cpus = pin_threads_ ? allowed_cpus() : std::vector<int>();
+    for (int slot = 1; slot < num_threads; ++slot) {
+        int cpu = cpus.empty() ? -1 : cpus[slot % cpus.size()];
+        workers_.emplace_back(&ThreadPool::worker_loop, this, slot, cpu, generation_);
+    }
+    num_threads_.store(num_threads, std::memory_order_relaxed);
+}
+
+void ThreadPool::stop_workers() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+    num_threads_.store(1, std::memory_order_relaxed);
+    stop_ = false;
+}
+
+void ThreadPool::run_ranges(int begin, int end, int grain, RangeFunction func, const void* context) {
+    if (end <= begin) return;
+    grain = std::max(1, grain);
+    int count = end - begin;
+
+    // workers_ is only read under run_mutex_. should a restart drop the workers after this
+    // check, slot 0 below is the only slot and the caller runs the whole range
+    if (count <= grain || num_threads() == 1 || in_task) {
+        for (int chunk = begin; chunk < end; chunk += std::min(grain, end - chunk)) {
+            func(context, chunk, chunk + std::min(grain, end - chunk));
+        }
+        return;
+    }
+
+    // one job at a time, concurrent callers queue up here
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    // contiguous slices of whole chunks, offsets relative to begin
+    int threads = num_threads();
+    int chunks = count / grain + (count % grain != 0);
+    int active = std::min(threads, chunks);
+    for (int slot = 0; slot < threads; ++slot) {
+        int first = slot < active ? static_cast<int>(static_cast<int64_t>(chunks) * slot / active) * grain : 0;
+        int last = slot < active ? std::min(count, static_cast<int>(static_cast<int64_t>(chunks) * (slot + 1) / active) * grain) : 0;
+        slots_[slot].range.store(pack(first, last), std::memory_order_relaxed);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = func;
+        job_context_ = context;
+        job_begin_ = begin;
+        job_grain_ = grain;
+        pending_workers_ = static_cast<int>(workers_.size());
+        job_failed_.store(false, std::memory_order_relaxed);
+        job_error_ = nullptr;
+        ++generation_;
+    }
+    work_cv_.notify_all();
+
+    {
+        TaskScope scope;
+        run_slots(0);
+    }
+
+    // workers still hold the job until they check in, func and context live on the caller's
+    // stack, so this wait comes before anything is thrown
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this] { return pending_workers_ == 0; });
+        job_ = nullptr;
+        job_context_ = nullptr;
+        error = job_error_;
+        job_error_ = nullptr;
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+void ThreadPool::run_slots(int self) {
+    int chunk_begin;
+    int chunk_end;
+    do {
+        while (take_front(self, chunk_begin, chunk_end)) {
+            // after a failure the rest of the job is drained without running it
+            if (job_failed_.load(std::memory_order_relaxed)) continue;
+            try {
+                job_(job_context_, job_begin_ + chunk_begin, job_begin_ + chunk_end);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!job_error_) job_error_ = std::current_exception();
+                job_failed_.store(true, std::memory_order_relaxed);
+            }
+        }
+    } while (steal(self));
+}
+
+bool ThreadPool::take_front(int slot, int& chunk_begin, int& chunk_end) {
+    std::atomic<uint64_t>& range = slots_[slot].range;
+    uint64_t current = range.load(std::memory_order_acquire);
+    while (true) {
+        int begin = range_begin(current);
+        int end = range_end(current);
+        if (begin >= end) return false;
+        int next = std::min(end, begin + job_grain_);
+        if (range.compare_exchange_weak(current, pack(next, end), std::memory_order_acq_rel)) {
+            chunk_begin = begin;
+            chunk_end = next;
+            return true;
+        }
+    }
+}
+
+// the back half of the first non-empty slice after self's, in whole chunks. self's slot is
+// empty here and only the owner refills its own slot, so a plain store publishes the loot
+bool ThreadPool::steal(int self) {
+    int threads = num_threads();
+    for (int i = 1; i < threads; ++i) {
+        std::atomic<uint64_t>& range = slots_[(self + i) % threads].range;
+        uint64_t current = range.load(std::memory_order_acquire);
+        while (true) {
+            int begin = range_begin(current);
+            int end = range_end(current);
+            if (begin >= end) break;
+            int chunks = (end - begin + job_grain_ - 1) / job_grain_;
+            int middle = chunks == 1 ? begin : begin + (chunks + 1) / 2 * job_grain_;
+            if (range.compare_exchange_weak(current, pack(begin, middle), std::memory_order_acq_rel)) {
+                slots_[self].range.store(pack(middle, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::worker_loop(int slot, int cpu, uint64_t seen_generation) {
+    in_task = true;
+    if (cpu >= 0) pin_current_thread(cpu);
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cv_.wait(lock, [&] { return stop_ || generation_ != seen_generation; });
+            if (stop_) return;
+            seen_generation = generation_;
+        }
+
+        run_slots(slot);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_workers_ == 0) {
+                done_cv_.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,161 @@
+#include "winograd.h"
+#include "allocator.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
+
+namespace winograd {
+
+namespace {
+
+// filter transforms G (alpha x 3), applied once per weight update
+constexpr float G2[4 * 3] = {
+    1.0f,  0.0f, 0.0f,
+    0.5f,  0.5f, 0.5f,
+    0.5f, -0.5f, 0.5f,
+    0.0f,  0.0f, 1.0f,
+};
+constexpr float G4[6 * 3] = {
+     1.0f / 4,  0.0f,       0.0f,
+    -1.0f / 6, -1.0f / 6,  -1.0f / 6,
+    -1.0f / 6,  1.0f / 6,  -1.0f / 6,
+     1.0f / 24, 1.0f / 12,  1.0f / 6,
+     1.0f / 24, -1.0f / 12, 1.0f / 6,
+     0.0f,      0.0f,       1.0f,
+};
+
+// tiles per pass, keeps the transformed input and the GEMM output around 4 MB
+constexpr size_t kBlockFloats = size_t(1) << 20;
+
+thread_local ScratchBuffer transform_buffer;
+// zero padded input rows of one tile row, per worker
+thread_local ScratchBuffer strip_buffer;
+
+template <int M>
+void conv3x3_tiles(const float* input, int batch, int in_channels, int height, int width, int padding,
+                   const float* transformed, int out_channels, const float* bias, gemm::Activation activation,
+                   float* output) {
+    constexpr int alpha = M + 2;
+    constexpr int positions = alpha * alpha;
+
+    int output_height = height + 2 * padding - 2;
+    int output_width = width + 2 * padding - 2;
+    int tiles_h = (output_height + M - 1) / M;
+    int tiles_w = (output_width + M - 1) / M;
+    int groups_w = (tiles_w + 7) / 8;
+    int tile_rows = batch * tiles_h;
+
+    // a block is a run of whole tile rows, so every group of 8 tiles lies in one block
+    size_t per_row = static_cast<size_t>(positions) * (in_channels + out_channels) * tiles_w;
+    int block_rows = std::max(1, std::min(tile_rows, static_cast<int>(kBlockFloats / per_row)));
+    int block_tiles = block_rows * tiles_w;
+
+    // V: [position, in_channel, tile] and M: [position, out_channel, tile] for one block
+    size_t v_size = static_cast<size_t>(positions) * in_channels * block_tiles;
+    size_t m_size = static_cast<size_t>(positions) * out_channels * block_tiles;
+    float* v = transform_buffer.reserve(v_size + m_size);
+    float* mm = v + v_size;
+
+    // the loads of the last group run past the last tile by up to alpha floats, and the
+    // strip must hold a padded input row
+    int strip_width = std::max(groups_w * 8 * M + 8, width + 2 * padding);
+
+    ThreadPool& pool = ThreadPool::getInstance();
+    for (int row0 = 0; row0 < tile_rows; row0 += block_rows) {
+        int rows = std::min(block_rows, tile_rows - row0);
+        int tiles = rows * tiles_w;
+
+        // input transform V = B^T d B, one task per input channel
+        pool.run(in_channels, [&](int ic) {
+            float* strip = strip_buffer.reserve(static_cast<size_t>(alpha) * strip_width);
+            for (int r = 0; r < rows; ++r) {
+                int b = (row0 + r) / tiles_h;
+                int th = (row0 + r) % tiles_h;
+                const float* channel = input + (static_cast<size_t>(b) * in_channels + ic) * height * width;
+
+                for (int i = 0; i < alpha; ++i) {
+                    float* dst = strip + i * strip_width;
+                    std::fill(dst, dst + strip_width, 0.0f);
+                    int row = th * M - padding + i;
+                    if (row < 0 || row >= height) continue;
+                    const float* src = channel + static_cast<size_t>(row) * width;
+                    std::copy(src, src + width, dst + padding);
+                }
+
+                transform_input_row(M, strip, strip_width, tiles_w, v + static_cast<size_t>(ic) * tiles + r * tiles_w,
+                                    static_cast<size_t>(in_channels) * tiles);
+            }
+        });
+
+        // M_p = U_p * V_p, each position is an independent [out x in] * [in x tiles] GEMM
+        size_t u_plane = static_cast<size_t>(out_channels) * in_channels;
+        pool.run(positions, [&](int p) {
+            gemm::sgemm(false, false, out_channels, tiles, in_channels,
+                        1.0f, transformed + p * u_plane, in_channels,
+                        v + static_cast<size_t>(p) * in_channels * tiles, tiles,
+                        0.0f, mm + static_cast<size_t>(p) * out_channels * tiles, tiles);
+        });
+
+        // output transform Y = A^T M A with bias and activation, one task per output channel
+        pool.run(out_channels, [&](int oc) {
+            for (int r = 0; r < rows; ++r) {
+                int b = (row0 + r) / tiles_h;
+                int th = (row0 + r) % tiles_h;
+                float* plane = output + (static_cast<size_t>(b) * out_channels + oc) * output_height * output_width;
+                transform_output_row(M, mm + static_cast<size_t>(oc) * tiles + r * tiles_w,
+                                     static_cast<size_t>(out_channels) * tiles, tiles_w, bias ? bias[oc] : 0.0f,
+                                     activation, plane + static_cast<size_t>(th) * M * output_width,
+                                     std::min(M, output_height - th * M), output_width);
+            }
+        });
+    }
+}
+
+}
+
+int tile_positions(int m) {
+    return (m + 2) * (m + 2);
+}
+
+size_t transformed_filter_size(int m, int out_channels, int in_channels) {
+    return static_cast<size_t>(tile_positions(m)) * out_channels * in_channels;
+}
+
+void transform_filters(int m, const float* filters, int out_channels, int in_channels, float* transformed) {
+    assert(m == 2 || m == 4);
+    const float* g_matrix = m == 2 ? G2 : G4;
+    int alpha = m + 2;
+    size_t plane = static_cast<size_t>(out_channels) * in_channels;
+
+    // U = G g G^T
+    for (int oc = 0; oc < out_channels; ++oc) {
+        for (int ic = 0; ic < in_channels; ++ic) {
+            const float* g = filters + (static_cast<size_t>(oc) * in_channels + ic) * 9;
+            float gg[6 * 3];
+            for (int i = 0; i < alpha; ++i) {
+                for (int j = 0; j < 3; ++j) {
+                    gg[i * 3 + j] = g_matrix[i * 3] * g[j] + g_matrix[i * 3 + 1] * g[3 + j] + g_matrix[i * 3 + 2] * g[6 + j];
+                }
+            }
+            for (int i = 0; i < alpha; ++i) {
+                for (int j = 0; j < alpha; ++j) {
+                    float u = gg[i * 3] * g_matrix[j * 3] + gg[i * 3 + 1] * g_matrix[j * 3 + 1] + gg[i * 3 + 2] * g_matrix[j * 3 + 2];
+                    transformed[(i * alpha + j) * plane + static_cast<size_t>(oc) * in_channels + ic] = u;
+                }
+            }
+        }
+    }
+}
+
+void conv3x3(int m, const float* input, int batch, int in_channels, int height, int width, int padding,
+             const float* transformed, int out_channels, const float* bias, gemm::Activation activation,
+             float* output) {
+    assert(m == 2 || m == 4);
+    if (m == 2) {
+        conv3x3_tiles<2>(input, batch, in_channels, height, width, padding, transformed, out_channels, bias, activation, output);
+    } else {
+        conv3x3_tiles<4>(input, batch, in_channels, height, width, padding, transformed, out_channels, bias, activation, output);
+    }
+}
+
+}
@@ -0,0 +1,248 @@
+#include "winograd.h"
+#include "simd_math.h"
+#include <immintrin.h>
+
+// The only Winograd file built with -mavx2 -mfma. As in simd_kernels.h nothing here calls
+// std:: helpers or other inline code the baseline files also instantiate: the linker keeps one
+// copy of such a function, and it may be the AVX2 one.
+namespace winograd {
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+namespace {
+
+// Data and output transforms, written out from B^T and A^T. Every lane holds a different
+// tile, so one call transforms 8 horizontally adjacent tiles.
+template <int M>
+struct Tile;
+
+template <>
+struct Tile<2> {
+    static constexpr int alpha = 4;
+
+    // B^T = [1 0 -1 0; 0 1 1 0; 0 -1 1 0; 0 1 0 -1]
+    static void input(const __m256* d, __m256* v) {
+        v[0] = _mm256_sub_ps(d[0], d[2]);
+        v[1] = _mm256_add_ps(d[1], d[2]);
+        v[2] = _mm256_sub_ps(d[2], d[1]);
+        v[3] = _mm256_sub_ps(d[1], d[3]);
+    }
+
+    // A^T = [1 1 1 0; 0 1 -1 -1]
+    static void output(const __m256* m, __m256* y) {
+        y[0] = _mm256_add_ps(_mm256_add_ps(m[0], m[1]), m[2]);
+        y[1] = _mm256_sub_ps(_mm256_sub_ps(m[1], m[2]), m[3]);
+    }
+
+    // tiles start 2 apart: d[k] lane t = row[2t + k]
+    static void load(const float* row, __m256* d) {
+        for (int shift = 0; shift < 2; ++shift) {
+            __m256 r0 = _mm256_loadu_ps(row + 2 * shift);
+            __m256 r1 = _mm256_loadu_ps(row + 2 * shift + 8);
+            __m256 lo = _mm256_permute2f128_ps(r0, r1, 0x20);
+            __m256 hi = _mm256_permute2f128_ps(r0, r1, 0x31);
+            d[2 * shift] = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+            d[2 * shift + 1] = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        }
+    }
+
+    // inverse of load for the M outputs of each tile: row[2t + j] = y[j] lane t
+    static void store(const __m256* y, float* row) {
+        __m256 lo = _mm256_unpacklo_ps(y[0], y[1]);
+        __m256 hi = _mm256_unpackhi_ps(y[0], y[1]);
+        _mm256_storeu_ps(row, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(row + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+};
+
+template <>
+struct Tile<4> {
+    static constexpr int alpha = 6;
+
+    static void input(const __m256* d, __m256* v) {
+        __m256 two = _mm256_set1_ps(2.0f);
+        __m256 four = _mm256_set1_ps(4.0f);
+        __m256 five = _mm256_set1_ps(5.0f);
+        // v0 = 4 d0 - 5 d2 + d4, v5 = 4 d1 - 5 d3 + d5
+        v[0] = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(four, d[0]), _mm256_mul_ps(five, d[2])), d[4]);
+        v[5] = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(four, d[1]), _mm256_mul_ps(five, d[3])), d[5]);
+        // v1, v2 = (d4 - 4 d2) -+ (4 d1 - d3)
+        __m256 a = _mm256_sub_ps(d[4], _mm256_mul_ps(four, d[2]));
+        __m256 b = _mm256_sub_ps(_mm256_mul_ps(four, d[1]), d[3]);
+        v[1] = _mm256_sub_ps(a, b);
+        v[2] = _mm256_add_ps(a, b);
+        // v3, v4 = (d4 - d2) -+ 2 (d1 - d3)
+        __m256 c = _mm256_sub_ps(d[4], d[2]);
+        __m256 e = _mm256_mul_ps(two, _mm256_sub_ps(d[1], d[3]));
+        v[3] = _mm256_sub_ps(c, e);
+        v[4] = _mm256_add_ps(c, e);
+    }
+
+    static void output(const __m256* m, __m256* y) {
+        __m256 s12 = _mm256_add_ps(m[1], m[2]);
+        __m256 d12 = _mm256_sub_ps(m[1], m[2]);
+        __m256 s34 = _mm256_add_ps(m[3], m[4]);
+        __m256 d34 = _mm256_sub_ps(m[3], m[4]);
+        y[0] = _mm256_add_ps(_mm256_add_ps(m[0], s12), s34);
+        y[1] = simd::Avx2::fmadd(_mm256_set1_ps(2.0f), d34, d12);
+        y[2] = simd::Avx2::fmadd(_mm256_set1_ps(4.0f), s34, s12);
+        y[3] = _mm256_add_ps(simd::Avx2::fmadd(_mm256_set1_ps(8.0f), d34, d12), m[5]);
+    }
+
+    // tiles start 4 apart: an 8x4 transpose of row[0..32) gives d0..d3, the same on
+    // row[4..36) gives d4, d5
+    static void load(const float* row, __m256* d) {
+        for (int shift = 0; shift < 2; ++shift) {
+            const float* r = row + 4 * shift;
+            __m256 r01 = _mm256_loadu_ps(r);
+            __m256 r23 = _mm256_loadu_ps(r + 8);
+            __m256 r45 = _mm256_loadu_ps(r + 16);
+            __m256 r67 = _mm256_loadu_ps(r + 24);
+            __m256 a = _mm256_permute2f128_ps(r01, r45, 0x20);
+            __m256 b = _mm256_permute2f128_ps(r01, r45, 0x31);
+            __m256 c = _mm256_permute2f128_ps(r23, r67, 0x20);
+            __m256 e = _mm256_permute2f128_ps(r23, r67, 0x31);
+            __m256 t0 = _mm256_unpacklo_ps(a, b);
+            __m256 t1 = _mm256_unpacklo_ps(c, e);
+            __m256 t2 = _mm256_unpackhi_ps(a, b);
+            __m256 t3 = _mm256_unpackhi_ps(c, e);
+            d[4 * shift] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+            d[4 * shift + 1] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+            if (shift == 1) break;
+            d[2] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+            d[3] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        }
+    }
+
+    static void store(const __m256* y, float* row) {
+        __m256 t0 = _mm256_unpacklo_ps(y[0], y[1]);
+        __m256 t1 = _mm256_unpackhi_ps(y[0], y[1]);
+        __m256 t2 = _mm256_unpacklo_ps(y[2], y[3]);
+        __m256 t3 = _mm256_unpackhi_ps(y[2], y[3]);
+        __m256 a = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 b = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 c = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 e = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        _mm256_storeu_ps(row, _mm256_permute2f128_ps(a, b, 0x20));
+        _mm256_storeu_ps(row + 8, _mm256_permute2f128_ps(c, e, 0x20));
+        _mm256_storeu_ps(row + 16, _mm256_permute2f128_ps(a, b, 0x31));
+        _mm256_storeu_ps(row + 24, _mm256_permute2f128_ps(c, e, 0x31));
+    }
+};
+
+// partial groups at the end of a tile row go through a temporary
+void store_lanes(float* dst, __m256 v, int count) {
+    if (count == 8) {
+        _mm256_storeu_ps(dst, v);
+        return;
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, v);
+    for (int i = 0; i < count; ++i) dst[i] = lanes[i];
+}
+
+__m256 load_lanes(const float* src, int count) {
+    if (count == 8) return _mm256_loadu_ps(src);
+    alignas(32) float lanes[8] = {};
+    for (int i = 0; i < count; ++i) lanes[i] = src[i];
+    return _mm256_load_ps(lanes);
+}
+
+int min(int a, int b) {
+    return a < b ? a : b;
+}
+
+template <int M>
+void input_row(const float* strip, int strip_width, int tiles_w, float* v, size_t position_stride) {
+    constexpr int alpha = Tile<M>::alpha;
+    int groups_w = (tiles_w + 7) / 8;
+    for (int g = 0; g < groups_w; ++g) {
+        __m256 h[alpha][alpha];
+        __m256 d[alpha];
+        for (int i = 0; i < alpha; ++i) {
+            Tile<M>::load(strip + i * strip_width + g * 8 * M, d);
+            Tile<M>::input(d, h[i]);
+        }
+
+        int count = min(8, tiles_w - g * 8);
+        __m256 column[alpha];
+        __m256 result[alpha];
+        for (int j = 0; j < alpha; ++j) {
+            for (int i = 0; i < alpha; ++i) column[i] = h[i][j];
+            Tile<M>::input(column, result);
+            for (int i = 0; i < alpha; ++i) {
+                int p = i * alpha + j;
+                store_lanes(v + p * position_stride + g * 8, result[i], count);
+            }
+        }
+    }
+}
+
+template <int M>
+void output_row(const float* mm, size_t position_stride, int tiles_w, float bias, gemm::Activation activation,
+                float* output, int output_rows, int output_width) {
+    constexpr int alpha = Tile<M>::alpha;
+    int groups_w = (tiles_w + 7) / 8;
+    __m256 channel_bias = _mm256_set1_ps(bias);
+    alignas(32) float row_out[8 * M];
+    for (int g = 0; g < groups_w; ++g) {
+        int count = min(8, tiles_w - g * 8);
+
+        // columns first: t[i][j] = (A^T M)[i][j]
+        __m256 t[M][alpha];
+        __m256 column[alpha];
+        __m256 y[M];
+        for (int j = 0; j < alpha; ++j) {
+            for (int i = 0; i < alpha; ++i) {
+                int p = i * alpha + j;
+                column[i] = load_lanes(mm + p * position_stride + g * 8, count);
+            }
+            Tile<M>::output(column, y);
+            for (int i = 0; i < M; ++i) t[i][j] = y[i];
+        }
+
+        int columns = min(8 * M, output_width - g * 8 * M);
+        for (int i = 0; i < M && i < output_rows; ++i) {
+            Tile<M>::output(t[i], y);
+            for (int j = 0; j < M; ++j) {
+                y[j] = simd::activate<simd::Avx2>(_mm256_add_ps(y[j], channel_bias), activation);
+            }
+            float* dst = output + static_cast<size_t>(i) * output_width + g * 8 * M;
+            if (columns == 8 * M) {
+                Tile<M>::store(y, dst);
+            } else {
+                Tile<M>::store(y, row_out);
+                for (int c = 0; c < columns; ++c) dst[c] = row_out[c];
+            }
+        }
+    }
+}
+
+}
+
+void transform_input_row(int m, const float* strip, int strip_width, int tiles_w, float* v, size_t position_stride) {
+    if (m == 2) {
+        input_row<2>(strip, strip_width, tiles_w, v, position_stride);
+    } else {
+        input_row<4>(strip, strip_width, tiles_w, v, position_stride);
+    }
+}
+
+void transform_output_row(int m, const float* mm, size_t position_stride, int tiles_w, float bias,
+                          gemm::Activation activation, float* output, int output_rows, int output_width) {
+    if (m == 2) {
+        output_row<2>(mm, position_stride, tiles_w, bias, activation, output, output_rows, output_width);
+    } else {
+        output_row<4>(mm, position_stride, tiles_w, bias, activation, output, output_rows, output_width);
+    }
+}
+
+#else
+
+// without AVX2 support in the compiler the layer never picks Winograd
+void transform_input_row(int, const float*, int, int, float*, size_t) {}
+void transform_output_row(int, const float*, size_t, int, float, gemm::Activation, float*, int, int) {}
+
+#endif
+
+}
@@ -0,0 +1,93 @@
+#include "activation_functions.h"
+#include "cpu_dispatch.h"
+#include "tensor.h"
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+struct ActivationCase {
+    std::string name;
+    cpu::MapOp op;
+};
+
+double time_operation(const std::function<void()>& func, int iterations) {
+    func();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        func();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+// vector kernel of every ISA the host runs against the scalar std:: version
+void benchmark_activation(const ActivationCase& c, const Tensor& input, Tensor& output) {
+    const int timing_iterations = 20;
+    double baseline_time = time_operation([&] { activation::map_baseline(c.op, input, output); }, timing_iterations);
+    double elements = input.size();
+
+    std::cout << c.name << ":" << std::endl;
+    std::cout << "  Scalar: " << baseline_time << " ms (" << elements / (baseline_time * 1e3) << " M/s)" << std::endl;
+    for (cpu::Isa isa : {cpu::Isa::SSE, cpu::Isa::AVX2, cpu::Isa::AVX512}) {
+        if (!cpu::set_isa(isa)) continue;
+        double time = time_operation([&] { cpu::kernels().map(input.data(), output.data(), input.size(), c.op, 0.01f); },
+                                     timing_iterations);
+        std::cout << "  " << cpu::isa_name(isa) << ": " << time << " ms (" << elements / (time * 1e3) << " M/s, "
+                  << baseline_time / time << " x)" << std::endl;
+    }
+}
+
+void benchmark_softmax(int rows, int cols) {
+    Tensor logits({rows, cols});
+    Tensor probabilities({rows, cols});
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-8.0f, 8.0f);
+    for (int i = 0; i < logits.size(); ++i) logits.data()[i] = dis(gen);
+
+    const int timing_iterations = 20;
+    double baseline_time = time_operation([&] { activation::softmax_baseline(logits, probabilities); }, timing_iterations);
+    std::cout << "Softmax " << rows << "x" << cols << ":" << std::endl;
+    std::cout << "  Scalar: " << baseline_time << " ms" << std::endl;
+    for (cpu::Isa isa : {cpu::Isa::SSE, cpu::Isa::AVX2, cpu::Isa::AVX512}) {
+        if (!cpu::set_isa(isa)) continue;
+        double time = time_operation([&] { activation::softmax(logits, probabilities); }, timing_iterations);
+        std::cout << "  " << cpu::isa_name(isa) << ": " << time << " ms (" << baseline_time / time << " x)" << std::endl;
+    }
+}
+
+int main() {
+    // a few MB, past L2 so both sides stream from memory the same way
+    const int size = 1 << 20;
+    Tensor input({size});
+    Tensor output({size});
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-8.0f, 8.0f);
+    for (int i = 0; i < size; ++i) input.data()[i] = dis(gen);
+
+    std::vector<ActivationCase> cases = {
+        {"ReLU", cpu::MapOp::ReLU},
+        {"LeakyReLU", cpu::MapOp::LeakyReLU},
+        {"Sigmoid", cpu::MapOp::Sigmoid},
+        {"Sigmoid derivative", cpu::MapOp::SigmoidDerivative},
+        {"Tanh", cpu::MapOp::Tanh},
+        {"Tanh derivative", cpu::MapOp::TanhDerivative},
+        {"GELU", cpu::MapOp::GELU},
+        {"GELU derivative", cpu::MapOp::GELUDerivative},
+        {"SiLU", cpu::MapOp::SiLU},
+        {"SiLU derivative", cpu::MapOp::SiLUDerivative},
+    };
+
+    cpu::Isa original = cpu::active_isa();
+    std::cout << "Benchmarking Activations (" << size << " elements):" << std::endl;
+    for (const ActivationCase& c : cases) {
+        benchmark_activation(c, input, output);
+    }
+    benchmark_softmax(1024, 1000);
+    benchmark_softmax(64, 32000);
+    cpu::set_isa(original);
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include "convolutional_layer.h"
+#include "layout.h"
+#include "tensor.h"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+struct ConvCase {
+    std::string name;
+    int batch_size;
+    int in_channels;
+    int out_channels;
+    int kernel_size;
+    int stride;
+    int padding;
+    int size;
+};
+
+bool verify_conv_results(ConvolutionalLayer& layer, const Tensor& input) {
+    Tensor expected(layer.output_shape(input.shape()));
+    Tensor output(layer.output_shape(input.shape()));
+    layer.forward_baseline(input, expected);
+    layer.forward(input, output);
+
+    for (int i = 0; i < output.size(); ++i) {
+        // sums over thousands of taps, compare relative to the magnitude of the output
+        float error = std::abs(output.data()[i] - expected.data()[i]);
+        if (error > 1e-4f * (1.0f + std::abs(expected.data()[i]))) {
+            std::cout << "Conv results don't match at index " << i << std::endl;
+            std::cout << "Baseline result: " << expected.data()[i] << std::endl;
+            std::cout << "Optimized result: " << output.data()[i] << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void benchmark_conv(const ConvCase& c) {
+    ConvolutionalLayer layer(c.in_channels, c.out_channels, c.kernel_size, c.stride, c.padding);
+
+    Tensor input({c.batch_size, c.in_channels, c.size, c.size});
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> dis(-1.0, 1.0);
+    for (int i = 0; i < input.size(); ++i) {
+        input.data()[i] = dis(gen);
+    }
+
+    layer.set_algorithm(ConvAlgorithm::Im2col);
+    if (!verify_conv_results(layer, input)) {
+        std::cout << "Error: Conv results don't match for " << c.name << std::endl;
+        return;
+    }
+
+    Tensor output(layer.output_shape(input.shape()));
+    const int warmup_iterations = 3;
+    const int timing_iterations = 20;
+
+    auto time_operation = [&](auto func, int iterations) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            func();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+    };
+
+    auto gemm_forward = [&]() { layer.forward(input, output); };
+    auto baseline_forward = [&]() { layer.forward_baseline(input, output); };
+
+    for (int i = 0; i < warmup_iterations; ++i) {
+        gemm_forward();
+    }
+    double gemm_time = time_operation(gemm_forward, timing_iterations);
+
+    // Winograd only applies to 3x3 stride-1 layers
+    bool winograd = c.kernel_size == 3 && c.stride == 1;
+    double winograd_times[2] = {0.0, 0.0};
+    ConvAlgorithm winograd_algorithms[2] = {ConvAlgorithm::Winograd2x2, ConvAlgorithm::Winograd4x4};
+    for (int w = 0; winograd && w < 2; ++w) {
+        layer.set_algorithm(winograd_algorithms[w]);
+        for (int i = 0; i < warmup_iterations; ++i) {
+            gemm_forward();
+        }
+        winograd_times[w] = time_operation(gemm_forward, timing_iterations);
+    }
+    layer.set_algorithm(ConvAlgorithm::Auto);
+
+    // direct kernels on channel-minor layouts, conversions excluded as a graph pays them only
+    // at its boundaries
+    Layout layouts[2] = {Layout::NHWC, Layout::NCHW8c};
+    double layout_times[2];
+    for (int l = 0; l < 2; ++l) {
+        Tensor converted(layout::physical_shape(input.shape(), layouts[l]));
+        layout::convert(input, Layout::NCHW, converted, layouts[l]);
+        Tensor layout_output(layout::physical_shape(output.shape(), layouts[l]));
+        auto layout_forward = [&]() { layer.forward(converted, layout_output, gemm::Activation::None, layouts[l]); };
+        for (int i = 0; i < warmup_iterations; ++i) {
+            layout_forward();
+        }
+        layout_times[l] = time_operation(layout_forward, timing_iterations);
+    }
+
+    // the direct loop is slow, one run is enough to compare against
+    double baseline_time = time_operation(baseline_forward, 1);
+
+    int output_pixels = output.shape()[2] * output.shape()[3];
+    double flops = 2.0 * c.batch_size * c.out_channels * output_pixels * c.in_channels * c.kernel_size * c.kernel_size;
+
+    std::cout << "Convolution " << c.name << " (batch " << c.batch_size << ", " << c.in_channels << "->" << c.out_channels
+              << ", " << c.kernel_size << "x" << c.kernel_size << " stride " << c.stride << ", " << c.size << "x" << c.size << "):" << std::endl;
+    std::cout << "  Baseline Latency: " << baseline_time << " ms" << std::endl;
+    std::cout << "  im2col + GEMM Latency: " << gemm_time << " ms" << std::endl;
+    std::cout << "  im2col + GEMM Throughput: " << flops / (gemm_time * 1e6) << " GFLOP/s" << std::endl;
+    std::cout << "  Speedup: " << baseline_time / gemm_time << " x" << std::endl;
+    if (winograd) {
+        std::cout << "  Winograd F(2x2,3x3) Latency: " << winograd_times[0] << " ms ("
+                  << gemm_time / winograd_times[0] << " x vs im2col)" << std::endl;
+        std::cout << "  Winograd F(4x4,3x3) Latency: " << winograd_times[1] << " ms ("
+                  << gemm_time / winograd_times[1] << " x vs im2col)" << std::endl;
+    }
+    for (int l = 0; l < 2; ++l) {
+        std::cout << "  " << layout_name(layouts[l]) << " direct Latency: " << layout_times[l] << " ms ("
+                  << gemm_time / layout_times[l] << " x vs im2col)" << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+int main() {
+    // shapes of typical ResNet-style stages
+    std::vector<ConvCase> cases = {
+        {"3x3 stem", 8, 3, 32, 3, 1, 1, 64},
+        {"3x3", 8, 64, 64, 3, 1, 1, 56},
+        {"3x3", 8, 128, 128, 3, 1, 1, 28},
+        {"3x3 strided", 8, 128, 256, 3, 2, 1, 28},
+        {"3x3", 1, 256, 256, 3, 1, 1, 14},
+        {"1x1", 8, 64, 256, 1, 1, 0, 56},
+        {"1x1", 8, 256, 64, 1, 1, 0, 56},
+        {"1x1", 1, 512, 128, 1, 1, 0, 28},
+    };
+
+    std::cout << "Benchmarking Convolution:" << std::endl;
+    for (const ConvCase& c : cases) {
+        benchmark_conv(c);
+    }
+
+    return 0;
+}
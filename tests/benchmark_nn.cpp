@@ -1,6 +1,20 @@
+#include "activation_functions.h"
 #include "benchmark.h"
+#include "convolutional_layer.h"
+#include "cpu_dispatch.h"
 #include "fully_connected_layer.h"
 #include "gpu_operations.h"
+#include "gpu_pipeline.h"
+#include "half.h"
+#include "network.h"
+#include "opencl_runtime.h"
+#include "quantization_pass.h"
+#include "ops.h"
+#include "split_gemm.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <iostream>
 #include <vector>
 #include <random>
@@ -30,17 +44,422 @@ void benchmark_fully_connected_layer(int input_size, int output_size, int batch_
     };
     auto gpu_result = Benchmark::run("GPU Forward", gpu_forward, tensors);
 
+    // bias + ReLU as separate passes over the output vs. in the GEMM epilogue
+    Tensor output({batch_size, output_size});
+    auto separate_forward = [&](const std::vector<std::shared_ptr<Tensor>>& t) {
+        layer.forward_cpu(*t[0], output);
+        activation::relu(output, output);
+    };
+    auto separate_result = Benchmark::run("CPU Forward + ReLU", separate_forward, tensors);
+
+    auto fused_forward = [&](const std::vector<std::shared_ptr<Tensor>>& t) {
+        layer.forward_cpu(*t[0], output, gemm::Activation::ReLU);
+    };
+    auto fused_result = Benchmark::run("CPU Fused Forward + ReLU", fused_forward, tensors);
+
 
     std::cout << "Fully Connected Layer Benchmark:" << std::endl;
     std::cout << "Input size: " << input_size << ", Output size: " << output_size << ", Batch size: " << batch_size << std::endl;
     Benchmark::printResults("CPU Forward Pass", cpu_result);
     Benchmark::printResults("GPU Forward Pass", gpu_result);
     std::cout << "GPU Speedup: " << cpu_result.latency / gpu_result.latency << " x" << std::endl;
+    Benchmark::printResults("CPU Forward + ReLU (separate passes)", separate_result);
+    Benchmark::printResults("CPU Forward + ReLU (fused epilogue)", fused_result);
+    std::cout << "Fusion Speedup: " << fused_result.throughput / separate_result.throughput << " x" << std::endl;
     std::cout << std::endl;
 }
 
-int main() {
+void report_memory_plan() {
+    Network network;
+    network.add_convolutional_layer(3, 32, 3, 1, 1);
+    network.add_convolutional_layer(32, 32, 3, 1, 1);
+    network.add_convolutional_layer(32, 64, 3, 2, 1);
+    network.add_convolutional_layer(64, 64, 3, 1, 1);
+    network.add_fully_connected_layer(64 * 16 * 16, 256);
+    network.add_fully_connected_layer(256, 10);
+
+    network.plan_memory({32, 3, 32, 32});
+    const MemoryPlan& plan = network.memory_plan();
+
+    std::cout << "Inference Memory Plan (batch 32, 3x32x32 input):" << std::endl;
+    std::cout << "  Naive (one buffer per intermediate): " << plan.naive_bytes << " bytes" << std::endl;
+    std::cout << "  Planned: " << plan.planned_bytes << " bytes" << std::endl;
+    std::cout << "  Peak live set: " << plan.peak_live_bytes << " bytes" << std::endl;
+    std::cout << "  Saved: " << (1.0 - static_cast<double>(plan.planned_bytes) / plan.naive_bytes) * 100.0 << " %" << std::endl;
+    std::cout << std::endl;
+}
+
+// time from first OpenCL call until every kernel is ready. run twice: the first run on a
+// machine compiles and fills the binary cache, later runs load from it
+void report_opencl_startup() {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (!OpenCLRuntime::available()) {
+        std::cout << "OpenCL Startup: no OpenCL device" << std::endl << std::endl;
+        return;
+    }
     gpu_operations::initialize();
+    double total = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+    std::vector<OpenCLRuntime::ProgramLoad> loads = runtime.program_loads();
+    size_t hits = 0;
+    for (const auto& load : loads) hits += load.from_cache ? 1 : 0;
+
+    std::cout << "OpenCL Startup (" << runtime.device_name() << "):" << std::endl;
+    std::cout << "  Start: " << (hits == loads.size() ? "warm" : hits == 0 ? "cold" : "partial")
+              << ", cache " << (runtime.binary_cache().enabled() ? runtime.binary_cache().directory() : "disabled")
+              << std::endl;
+    std::cout << "  Device and context setup: " << runtime.setup_milliseconds() << " ms" << std::endl;
+    for (const auto& load : loads) {
+        std::cout << "  Program " << load.name << ": " << load.milliseconds << " ms"
+                  << (load.from_cache ? " (cached binary)" : " (compiled)") << std::endl;
+    }
+    std::cout << "  Total: " << total << " ms" << std::endl;
+    std::cout << std::endl;
+}
+
+// a 3-layer MLP over a stream of batches: one blocking forward per batch against
+// forward_stream, which uploads the next batch and downloads the last while one computes
+void benchmark_gpu_stream(int batch_size, int batches) {
+    if (!OpenCLRuntime::available()) return;
+    Network network;
+    network.add_fully_connected_layer(1024, 512);
+    network.add_fully_connected_layer(512, 512);
+    network.add_fully_connected_layer(512, 10);
+    GpuPipeline pipeline(network);
+
+    std::vector<Tensor> inputs;
+    std::vector<Tensor> outputs;
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+    for (int i = 0; i < batches; ++i) {
+        inputs.emplace_back(std::vector<int>{batch_size, 1024});
+        for (int j = 0; j < inputs.back().size(); ++j) inputs.back().data()[j] = dis(gen);
+        outputs.emplace_back(std::vector<int>{batch_size, 10});
+    }
+
+    auto time = [](const std::function<void()>& run) {
+        run();
+        double best = 1e30;
+        for (int repeat = 0; repeat < 5; ++repeat) {
+            auto start = std::chrono::high_resolution_clock::now();
+            run();
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+        }
+        return best;
+    };
+    double per_layer = time([&] {
+        for (int i = 0; i < batches; ++i) {
+            Tensor hidden = network.fully_connected_layers()[0]->forward_gpu(inputs[i]);
+            hidden = network.fully_connected_layers()[1]->forward_gpu(hidden);
+            network.fully_connected_layers()[2]->forward_gpu(hidden);
+        }
+    });
+    double blocking = time([&] {
+        for (int i = 0; i < batches; ++i) pipeline.forward(inputs[i], outputs[i]);
+    });
+    double streamed = time([&] { pipeline.forward_stream(inputs, outputs); });
+
+    std::cout << "GPU MLP Stream (1024-512-512-10, " << batches << " batches of " << batch_size << "):" << std::endl;
+    std::cout << "  Layer by layer, host round trips: " << per_layer << " ms" << std::endl;
+    std::cout << "  Chained on device, blocking: " << blocking << " ms" << std::endl;
+    std::cout << "  Chained on device, double-buffered: " << streamed << " ms" << std::endl;
+    std::cout << "  Overlap Speedup: " << blocking / streamed << " x" << std::endl;
+    std::cout << std::endl;
+}
+
+// one large matmul on the CPU, on the device, and split between them. the split starts from
+// the calibrated rates and is shown converging over the calls
+void benchmark_split_matmul(int size, int calls) {
+    if (!OpenCLRuntime::available()) return;
+    Tensor a({size, size});
+    Tensor b({size, size});
+    Tensor c({size, size});
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+    for (int i = 0; i < a.size(); ++i) a.data()[i] = dis(gen);
+    for (int i = 0; i < b.size(); ++i) b.data()[i] = dis(gen);
+
+    auto time = [](const std::function<void()>& run) {
+        auto start = std::chrono::high_resolution_clock::now();
+        run();
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+    ops::matmul_gpu(a, b, c);
+    double cpu = time([&] { ops::matmul_cpu(a, b, c); });
+    double gpu = time([&] { ops::matmul_gpu(a, b, c); });
+
+    std::cout << "Split Matmul (" << size << "x" << size << "x" << size << "):" << std::endl;
+    std::cout << "  CPU only: " << cpu << " ms, GPU only: " << gpu << " ms" << std::endl;
+    for (int call = 0; call < calls; ++call) {
+        double split = time([&] { ops::matmul_split(a, b, c); });
+        SplitGemm::Split last = SplitGemm::getInstance().last_split();
+        std::cout << "  Split call " << call << ": " << split << " ms, " << last.gpu_rows << " GPU rows ("
+                  << last.gpu_ms << " ms) / " << last.cpu_rows << " CPU rows (" << last.cpu_ms << " ms), next share "
+                  << last.next_share << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+// int8 against float: how far a quantized MLP drifts (largest error relative to the output range,
+// and how often the top class still matches) and what each layer kind gains per ISA
+void benchmark_int8() {
+    auto time = [](int iterations, const std::function<void()>& run) {
+        run();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; ++i) run();
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+    };
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+    auto fill = [&](Tensor& t) {
+        for (int i = 0; i < t.size(); ++i) t.data()[i] = dis(gen);
+    };
+
+    const int batch = 64, batches = 16, classes = 10;
+    std::vector<Tensor> inputs;
+    for (int b = 0; b < batches; ++b) {
+        inputs.emplace_back(std::vector<int>{batch, 784});
+        fill(inputs.back());
+    }
+    Network network;
+    network.add_fully_connected_layer(784, 512);
+    network.add_fully_connected_layer(512, 256);
+    network.add_fully_connected_layer(256, classes);
+    std::vector<Tensor> reference;
+    for (const Tensor& input : inputs) reference.push_back(network.forward(input));
+    double fp32_ms = time(20, [&] { network.forward(inputs[0]); });
+
+    auto report = [&](const char* name, double ms) {
+        double max_error = 0.0, range = 0.0;
+        int agree = 0;
+        for (int b = 0; b < batches; ++b) {
+            Tensor output = network.forward(inputs[b]);
+            const float* x = output.data();
+            const float* r = reference[b].data();
+            for (int i = 0; i < output.size(); ++i) {
+                max_error = std::max(max_error, static_cast<double>(std::abs(x[i] - r[i])));
+                range = std::max(range, static_cast<double>(std::abs(r[i])));
+            }
+            for (int row = 0; row < batch; ++row) {
+                agree += std::max_element(x + row * classes, x + (row + 1) * classes) - (x + row * classes) ==
+                         std::max_element(r + row * classes, r + (row + 1) * classes) - (r + row * classes);
+            }
+        }
+        std::cout << "  " << name << ": " << batch / ms * 1000.0 << " samples/s (" << fp32_ms / ms << " x), max error "
+                  << max_error / range * 100.0 << " % of range, top-1 agreement "
+                  << 100.0 * agree / (batch * batches) << " %" << std::endl;
+    };
+
+    std::cout << "INT8 MLP (784-512-256-10, batch " << batch << ", " << cpu::isa_name(cpu::active_isa()) << "):" << std::endl;
+    std::cout << "  fp32: " << batch / fp32_ms * 1000.0 << " samples/s" << std::endl;
+    QuantizationPass dynamic;
+    network.apply_pass(dynamic);
+    report("int8 dynamic", time(20, [&] { network.forward(inputs[0]); }));
+    QuantizationPass calibrated(std::vector<Tensor>(inputs.begin(), inputs.begin() + 4));
+    network.apply_pass(calibrated);
+    report("int8 calibrated", time(20, [&] { network.forward(inputs[0]); }));
+
+    // single layers on every ISA the host runs, GOPS counts a multiply-add as two
+    FullyConnectedLayer fc(1024, 1024);
+    ConvolutionalLayer conv(64, 64, 3, 1, 1);
+    Tensor image({1, 64, 56, 56});
+    Tensor conv_output(conv.output_shape(image.shape()));
+    fill(image);
+    double conv_ops = 2.0 * 64 * 64 * 9 * 56 * 56;
+    cpu::Isa original = cpu::active_isa();
+    for (cpu::Isa isa : {cpu::Isa::SSE, cpu::Isa::AVX2, cpu::Isa::AVX512, cpu::Isa::AVX512VNNI}) {
+        if (!cpu::set_isa(isa)) continue;
+        std::cout << "  " << cpu::isa_name(isa) << ":" << std::endl;
+        for (int rows : {1, 64}) {
+            Tensor input({rows, 1024});
+            Tensor output({rows, 1024});
+            fill(input);
+            double ops = 2.0 * rows * 1024 * 1024;
+            fc.dequantize();
+            double fp32 = time(50, [&] { fc.forward_cpu(input, output); });
+            fc.quantize_int8();
+            double int8 = time(50, [&] { fc.forward_cpu(input, output); });
+            std::cout << "    FC 1024x1024 batch " << rows << ": fp32 " << ops / fp32 / 1e6 << " GOPS, int8 "
+                      << ops / int8 / 1e6 << " GOPS (" << fp32 / int8 << " x)" << std::endl;
+        }
+        conv.dequantize();
+        double fp32 = time(10, [&] { conv.forward(image, conv_output); });
+        conv.quantize_int8();
+        double int8 = time(10, [&] { conv.forward(image, conv_output); });
+        std::cout << "    Conv 64->64 3x3 56x56: fp32 " << conv_ops / fp32 / 1e6 << " GOPS, int8 "
+                  << conv_ops / int8 / 1e6 << " GOPS (" << fp32 / int8 << " x)" << std::endl;
+    }
+    cpu::set_isa(original);
+    std::cout << std::endl;
+}
+
+// fp32 against 16-bit weight storage where the weights dominate: small batches through layers
+// too big for the caches, the time is the weights coming in from memory
+void benchmark_half_storage() {
+    auto time = [](int iterations, const std::function<void()>& run) {
+        run();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; ++i) run();
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+    };
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+
+    std::cout << "Half precision FC weights (" << cpu::isa_name(cpu::active_isa())
+              << "), ms per forward and weight bytes streamed per second:" << std::endl;
+    int shapes[][2] = {{1024, 1024}, {4096, 4096}, {8192, 2048}};
+    for (auto& shape : shapes) {
+        FullyConnectedLayer fc(shape[0], shape[1]);
+        for (int rows : {1, 4}) {
+            Tensor input({rows, shape[0]});
+            Tensor output({rows, shape[1]});
+            for (int i = 0; i < input.size(); ++i) input.data()[i] = dis(gen);
+            double weights = static_cast<double>(shape[0]) * shape[1];
+            std::cout << "  FC " << shape[0] << "x" << shape[1] << " batch " << rows << ":";
+            double fp32 = 0.0;
+            for (DType dtype : {DType::Float32, DType::Float16, DType::BFloat16}) {
+                fc.set_weight_dtype(dtype);
+                double ms = time(20, [&] { fc.forward_cpu(input, output); });
+                if (dtype == DType::Float32) fp32 = ms;
+                std::cout << " " << dtype_name(dtype) << " " << ms << " ms (" << weights * dtype_size(dtype) / ms / 1e6
+                          << " GB/s, " << fp32 / ms << " x)";
+            }
+            fc.set_weight_dtype(DType::Float32);
+            std::cout << std::endl;
+        }
+    }
+    std::cout << std::endl;
+}
+
+// block-sparse against dense weights on pruned layers, "effective" GFLOPS count the dense
+// multiply-adds so the columns compare directly
+void benchmark_block_sparse() {
+    auto time = [](int iterations, const std::function<void()>& run) {
+        run();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; ++i) run();
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+    };
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+
+    std::cout << "Block-sparse FC 2048x2048 (" << cpu::isa_name(cpu::active_isa()) << "), effective GFLOPS:" << std::endl;
+    for (int rows : {1, 64}) {
+        Tensor input({rows, 2048});
+        Tensor output({rows, 2048});
+        for (int i = 0; i < input.size(); ++i) input.data()[i] = dis(gen);
+        double flops = 2.0 * rows * 2048 * 2048;
+        for (int block_rows : {1, 4}) {
+            for (float sparsity : {0.5f, 0.75f, 0.9f}) {
+                FullyConnectedLayer fc(2048, 2048);
+                fc.prune(sparsity, block_rows);
+                double dense = time(20, [&] { fc.forward_cpu(input, output); });
+                fc.set_sparse(block_rows);
+                double sparse = time(20, [&] { fc.forward_cpu(input, output); });
+                std::cout << "  batch " << rows << ", " << block_rows << "x8 blocks, " << sparsity * 100.0
+                          << " % sparse: dense " << flops / dense / 1e6 << ", sparse " << flops / sparse / 1e6 << " ("
+                          << dense / sparse << " x)" << std::endl;
+            }
+        }
+    }
+    std::cout << std::endl;
+}
+
+// weights packed on every call against packed once, over batch sizes. the packing is a pass over
+// the weights, it matters most where the multiply itself is short. gemm is called directly: the
+// layer sends batches up to cpu::kGemvRows to gemv, which packs nothing
+void benchmark_prepacked_weights() {
+    auto time = [](int iterations, const std::function<void()>& run) {
+        run();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; ++i) run();
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+    };
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+
+    std::cout << "Prepacked FC weights (" << cpu::isa_name(cpu::active_isa()) << "), ms per forward:" << std::endl;
+    for (int size : {512, 2048}) {
+        FullyConnectedLayer fc(size, size);
+        const float* weights = fc.get_weights().data();
+        gemm::PackedB packed_weights;
+        gemm::pack_b(false, size, size, weights, size, packed_weights);
+        gemm::Epilogue epilogue;
+        epilogue.bias = fc.get_bias().data();
+        for (int rows : {1, 2, 4, 8, 16, 32, 64, 128, 256}) {
+            Tensor input({rows, size});
+            Tensor output({rows, size});
+            for (int i = 0; i < input.size(); ++i) input.data()[i] = dis(gen);
+            int iterations = std::max(5, static_cast<int>(2e9 / (2.0 * rows * size * size)));
+            double unpacked = time(iterations, [&] {
+                gemm::sgemm(false, false, rows, size, size, 1.0f, input.data(), size, weights, size, 0.0f,
+                            output.data(), size, epilogue);
+            });
+            double packed = time(iterations, [&] {
+                gemm::sgemm_packed(false, rows, 1.0f, input.data(), size, packed_weights, 0.0f, output.data(), size,
+                                   epilogue);
+            });
+            std::cout << "  " << size << "x" << size << " batch " << rows << ": unpacked " << unpacked << ", prepacked "
+                      << packed << " (" << unpacked / packed << " x)" << std::endl;
+        }
+    }
+    std::cout << std::endl;
+}
+
+// online inference latency: one forward per request at small batches, p50 and p99 over many
+// requests. batches up to cpu::kGemvRows take the column-split gemv, plain gemm::sgemm of the
+// same shape is shown next to it
+void benchmark_small_batch_latency() {
+    auto percentiles = [](int requests, const std::function<void()>& run, double& p50, double& p99) {
+        std::vector<double> latencies(requests);
+        run();
+        for (double& latency : latencies) {
+            auto start = std::chrono::high_resolution_clock::now();
+            run();
+            latency = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+        std::sort(latencies.begin(), latencies.end());
+        p50 = latencies[requests / 2];
+        p99 = latencies[requests * 99 / 100];
+    };
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+
+    std::cout << "Small batch FC latency (" << cpu::isa_name(cpu::active_isa()) << ", "
+              << ThreadPool::getInstance().num_threads() << " threads), ms:" << std::endl;
+    for (int size : {512, 2048}) {
+        FullyConnectedLayer fc(size, size);
+        for (int rows : {1, 2, 4, 8}) {
+            Tensor input({rows, size});
+            Tensor output({rows, size});
+            for (int i = 0; i < input.size(); ++i) input.data()[i] = dis(gen);
+            gemm::Epilogue epilogue;
+            epilogue.bias = fc.get_bias().data();
+            double p50, p99, sgemm_p50, sgemm_p99;
+            percentiles(500, [&] { fc.forward_cpu(input, output); }, p50, p99);
+            percentiles(500, [&] {
+                gemm::sgemm(false, false, rows, size, size, 1.0f, input.data(), size, fc.get_weights().data(), size,
+                            0.0f, output.data(), size, epilogue);
+            }, sgemm_p50, sgemm_p99);
+            std::cout << "  " << size << "x" << size << " batch " << rows << ": p50 " << p50 << ", p99 " << p99
+                      << " (sgemm p50 " << sgemm_p50 << ", p99 " << sgemm_p99 << ")" << std::endl;
+        }
+    }
+    std::cout << std::endl;
+}
+
+int main() {
+    report_opencl_startup();
+    benchmark_split_matmul(1024, 6);
+    benchmark_gpu_stream(64, 16);
+
+    report_memory_plan();
+    benchmark_int8();
+    benchmark_half_storage();
+    benchmark_block_sparse();
+    benchmark_prepacked_weights();
+    benchmark_small_batch_latency();
 
     std::vector<int> input_sizes = {128, 256, 512, 1024};
     std::vector<int> output_sizes = {64, 128, 256, 512};
@@ -1,6 +1,11 @@
 #include "ops.h"
 #include "tensor.h"
 #include "benchmark.h"
+#include "activation_functions.h"
+#include "convolutional_layer.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
+#include <chrono>
 #include <iostream>
 #include <vector>
 #include <memory>
@@ -173,8 +178,104 @@ void benchmark_matmul_cpu(int m, int n, int k) {
     std::cout << std::endl;
 }
 
+// the same add and matmul on every ISA this host runs, ANNOF_CPU_ISA does this across processes
+void benchmark_isa(int size) {
+    Tensor a({size, size});
+    Tensor b({size, size});
+    Tensor result({size, size});
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<> dis(-1.0, 1.0);
+    for (int i = 0; i < size * size; ++i) {
+        a.data()[i] = dis(gen);
+        b.data()[i] = dis(gen);
+    }
+
+    auto time = [](auto func, int iterations) {
+        func();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; ++i) func();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+    };
+
+    cpu::Isa original = cpu::active_isa();
+    std::cout << "ISA dispatch " << size << "x" << size << " (host supports " << cpu::isa_name(cpu::detect()) << "):" << std::endl;
+    for (cpu::Isa isa : {cpu::Isa::SSE, cpu::Isa::AVX2, cpu::Isa::AVX512}) {
+        if (!cpu::set_isa(isa)) continue;
+        double add_ms = time([&] { ops::add_cpu(a, b, result); }, 100);
+        double matmul_ms = time([&] { ops::matmul_cpu(a, b, result); }, 10);
+        double gflops = 2.0 * size * size * size / (matmul_ms * 1e6);
+        std::cout << "  " << cpu::isa_name(isa) << ": add " << add_ms << " ms, matmul " << matmul_ms << " ms ("
+                  << gflops << " GFLOP/s)" << std::endl;
+    }
+    cpu::set_isa(original);
+    std::cout << std::endl;
+}
+
+// the same kernels at 1, 2, 4, ... threads up to the pool's default
+void benchmark_thread_scaling() {
+    const int size = 1024;
+    Tensor a({size, size});
+    Tensor b({size, size});
+    Tensor result({size, size});
+    Tensor big_a({4096, 1024});
+    Tensor big_b({4096, 1024});
+    Tensor big_result({4096, 1024});
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<> dis(-1.0, 1.0);
+    for (int i = 0; i < a.size(); ++i) {
+        a.data()[i] = dis(gen);
+        b.data()[i] = dis(gen);
+    }
+    for (int i = 0; i < big_a.size(); ++i) {
+        big_a.data()[i] = dis(gen);
+        big_b.data()[i] = dis(gen);
+    }
+    ConvolutionalLayer conv(64, 64, 3, 1, 1);
+    Tensor image({8, 64, 56, 56});
+    for (int i = 0; i < image.size(); ++i) image.data()[i] = dis(gen);
+    Tensor conv_output(conv.output_shape(image.shape()));
+
+    auto time = [](auto func, int iterations) {
+        func();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; ++i) func();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+    };
+
+    ThreadPool& pool = ThreadPool::getInstance();
+    int max_threads = pool.num_threads();
+    std::vector<int> counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) counts.push_back(threads);
+    counts.push_back(max_threads);
+
+    std::cout << "Thread scaling (1 to " << max_threads << " threads, speedup and efficiency against 1):" << std::endl;
+    double base[4] = {0.0, 0.0, 0.0, 0.0};
+    for (int threads : counts) {
+        pool.set_num_threads(threads);
+        double ms[4] = {
+            time([&] { ops::matmul_cpu(a, b, result); }, 10),
+            time([&] { ops::add_cpu(big_a, big_b, big_result); }, 20),
+            time([&] { activation::sigmoid(big_a, big_result); }, 20),
+            time([&] { conv.forward(image, conv_output); }, 3),
+        };
+        const char* names[4] = {"matmul 1024", "add 4M", "sigmoid 4M", "conv 64x64 3x3 8x56x56"};
+        std::cout << "  " << threads << " threads:" << std::endl;
+        for (int i = 0; i < 4; ++i) {
+            if (threads == 1) base[i] = ms[i];
+            std::cout << "    " << names[i] << ": " << ms[i] << " ms (" << base[i] / ms[i] << " x, "
+                      << 100.0 * base[i] / ms[i] / threads << "%)" << std::endl;
+        }
+    }
+    pool.set_num_threads(max_threads);
+    std::cout << std::endl;
+}
 
 int main() {
+    benchmark_isa(512);
+    benchmark_thread_scaling();
+
     std::vector<int> sizes = {128, 256, 512, 1024};
 
     std::cout << "Benchmarking Addition:" << std::endl;
@@ -1,7 +1,66 @@
 #include "ops.h"
 #include "tensor.h"
+#include "network.h"
+#include "allocator.h"
+#include "activation_functions.h"
+#include "convolutional_layer.h"
+#include "cpu_dispatch.h"
+#include "elementwise.h"
+#include "fully_connected_layer.h"
+#include "fusion_pass.h"
+#include "gemm.h"
+#include "gpu_operations.h"
+#include "gpu_pipeline.h"
+#include "graph.h"
+#include "half.h"
+#include "half_pass.h"
+#include "layout.h"
+#include "layout_pass.h"
+#include "loss_functions.h"
+#include "opencl_gemm.h"
+#include "opencl_runtime.h"
+#include "optimization_pass.h"
+#include "optimization_pass_registrar.h"
+#include "program_cache.h"
+#include "quantization.h"
+#include "quantization_pass.h"
+#include "scheduler.h"
+#include "sparse.h"
+#include "sparsity_pass.h"
+#include "split_gemm.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cassert>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <thread>
+
+// deterministic test data: element i is offset + span * ((i * step) % period) / period
+static void fill_pattern(Tensor& t, int step, int period, float offset, float span = 1.0f) {
+    for (int i = 0; i < t.size(); ++i) t.data()[i] = offset + span * static_cast<float>((i * step) % period) / period;
+}
+
+// runs body under every ISA from SSE up to highest that the host and the build support, then
+// switches back to the one that was active
+template <typename Body>
+static void for_each_isa(Body body, cpu::Isa highest = cpu::Isa::AVX512) {
+    cpu::Isa original = cpu::active_isa();
+    for (cpu::Isa isa : {cpu::Isa::SSE, cpu::Isa::AVX2, cpu::Isa::AVX512, cpu::Isa::AVX512VNNI}) {
+        if (isa > highest || !cpu::set_isa(isa)) continue;
+        body();
+    }
+    assert(cpu::set_isa(original));
+}
+
+// relative to the expected value, absolute near zero
+static void assert_close(float value, float expected, float tolerance = 1e-5f) {
+    assert(std::abs(value - expected) <= tolerance * (1.0f + std::abs(expected)));
+}
 
 void test_add_cpu() {
     auto a = std::make_shared<Tensor>(std::vector<int>{2, 2});
@@ -23,7 +82,1648 @@ void test_add_cpu() {
     std::cout << "CPU addition test passed." << std::endl;
 }
 
+void test_matmul_cpu() {
+    // odd sizes exercise the edge tiles of the packed kernel
+    int m = 37, n = 53, k = 300;
+    Tensor a({m, k});
+    Tensor b({k, n});
+    Tensor expected({m, n});
+    Tensor result({m, n});
+
+    for (int i = 0; i < m * k; ++i) {
+        a.data()[i] = static_cast<float>((i % 17) - 8) / 8.0f;
+    }
+    for (int i = 0; i < k * n; ++i) {
+        b.data()[i] = static_cast<float>((i % 13) - 6) / 6.0f;
+    }
+
+    ops::matmul_cpu_baseline(a, b, expected);
+    ops::matmul_cpu(a, b, result);
+
+    for (int i = 0; i < m * n; ++i) {
+        assert(std::abs(result.data()[i] - expected.data()[i]) < 1e-3f);
+    }
+
+    std::cout << "CPU matmul test passed." << std::endl;
+}
+
+void test_tensor_views() {
+    Tensor t({2, 3, 4});
+    for (int i = 0; i < 24; ++i) {
+        t.data()[i] = static_cast<float>(i);
+    }
+
+    // reshape, flatten and batch slices alias the original storage
+    Tensor flat = t.flatten();
+    assert(flat.shape() == std::vector<int>({2, 12}));
+    assert(flat.shares_storage(t) && flat.data() == t.data());
+
+    Tensor second = t.slice(1, 2);
+    assert(second.shape()[0] == 1 && second.data()[0] == 12.0f);
+
+    // transpose only swaps strides, contiguous() materializes it
+    Tensor m = t.reshape({6, 4});
+    Tensor mt = m.transpose(0, 1);
+    assert(!mt.is_contiguous());
+    Tensor dense = mt.contiguous();
+    assert(dense.is_contiguous() && !dense.shares_storage(m));
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 6; ++j) {
+            assert(dense.data()[i * 6 + j] == m.data()[j * 4 + i]);
+        }
+    }
+
+    // matmul reads the transposed view without copying it
+    Tensor expected({4, 4});
+    Tensor result({4, 4});
+    ops::matmul_cpu_baseline(dense, m, expected);
+    ops::matmul_cpu(mt, m, result);
+    for (int i = 0; i < 16; ++i) {
+        assert(std::abs(result.data()[i] - expected.data()[i]) < 1e-3f);
+    }
+
+    std::cout << "Tensor view test passed." << std::endl;
+}
+
+void test_network_forward_into() {
+    Network network;
+    network.add_convolutional_layer(3, 4, 3, 1, 1);
+    network.add_fully_connected_layer(4 * 8 * 8, 10);
+
+    Tensor input({2, 3, 8, 8});
+    for (int i = 0; i < input.size(); ++i) {
+        input.data()[i] = static_cast<float>(i % 11) / 11.0f;
+    }
+
+    Tensor expected = network.forward(input);
+    Tensor output(network.output_shape(input.shape()));
+    assert(output.shape() == expected.shape());
+
+    // second call reuses the buffers sized by the first
+    for (int run = 0; run < 2; ++run) {
+        network.forward(input, output);
+        for (int i = 0; i < output.size(); ++i) {
+            assert(output.data()[i] == expected.data()[i]);
+        }
+    }
+
+    std::cout << "Network forward-into test passed." << std::endl;
+}
+
+void test_allocators() {
+    PoolAllocator pool;
+    {
+        Tensor t({33, 7}, nullptr, &pool);
+        assert(reinterpret_cast<uintptr_t>(t.data()) % Allocator::kAlignment == 0);
+    }
+    size_t system_before = pool.stats().system_allocations;
+    {
+        // same size class comes back from the free list
+        Tensor t({33, 7}, nullptr, &pool);
+    }
+    assert(pool.stats().system_allocations == system_before);
+    assert(pool.stats().bytes_in_use == 0);
+
+    ArenaAllocator arena(1024);
+    for (int run = 0; run < 2; ++run) {
+        {
+            AllocatorScope scope(arena);
+            Tensor a({64, 64});
+            Tensor b({64, 64});
+            Tensor c = a + b;
+            assert(reinterpret_cast<uintptr_t>(c.data()) % Allocator::kAlignment == 0);
+        }
+        arena.reset();
+        if (run == 0) arena.reset_stats();
+    }
+    // after the first reset the arena holds one chunk big enough for the whole pass
+    assert(arena.stats().system_allocations == 0);
+    assert(arena.stats().allocations > 0);
+
+    std::cout << "Allocator test passed." << std::endl;
+}
+
+void test_memory_planner() {
+    Network network;
+    network.add_convolutional_layer(3, 8, 3, 1, 1);
+    network.add_convolutional_layer(8, 8, 3, 1, 1);
+    network.add_convolutional_layer(8, 8, 3, 1, 1);
+    network.add_fully_connected_layer(8 * 16 * 16, 64);
+    network.add_fully_connected_layer(64, 10);
+
+    Tensor input({2, 3, 16, 16});
+    for (int i = 0; i < input.size(); ++i) {
+        input.data()[i] = static_cast<float>(i % 5) / 5.0f;
+    }
+    Tensor expected = network.forward(input);
+
+    // consecutive conv outputs ping-pong between two regions
+    const MemoryPlan& plan = network.memory_plan();
+    assert(plan.planned_bytes == plan.peak_live_bytes);
+    assert(plan.planned_bytes < plan.naive_bytes);
+    assert(plan.offsets[0] == plan.offsets[2]);
+
+    // overlapping lifetimes never share memory
+    std::vector<BufferRequest> requests = {{256, 0, 2}, {128, 1, 3}, {256, 3, 4}, {64, 2, 2}};
+    MemoryPlan manual = MemoryPlanner::plan(requests);
+    for (size_t i = 0; i < requests.size(); ++i) {
+        for (size_t j = i + 1; j < requests.size(); ++j) {
+            bool live_together = requests[i].first_use <= requests[j].last_use && requests[j].first_use <= requests[i].last_use;
+            bool disjoint = manual.offsets[i] + requests[i].bytes <= manual.offsets[j] ||
+                            manual.offsets[j] + requests[j].bytes <= manual.offsets[i];
+            assert(!live_together || disjoint);
+        }
+    }
+
+    Tensor output = network.forward(input);
+    for (int i = 0; i < output.size(); ++i) {
+        assert(output.data()[i] == expected.data()[i]);
+    }
+
+    std::cout << "Memory planner test passed." << std::endl;
+}
+
+void test_graph() {
+    // input -> reshape -> reshape -> fc -> sigmoid, plus a branch nothing reads
+    auto layer = std::make_shared<FullyConnectedLayer>(12, 5);
+    Graph graph;
+    int input = graph.add_input();
+    int flat = graph.add_reshape(input, {0, -1});
+    int same = graph.add_reshape(flat, {2, 12});
+    int fc = graph.add_fully_connected(same, layer);
+    int dead = graph.add_activation(OpType::ReLU, fc);
+    int out = graph.add_activation(OpType::Sigmoid, fc);
+    graph.set_output(out);
+    assert(graph.consumers(fc).size() == 2);
+
+    Tensor x({2, 3, 4});
+    for (int i = 0; i < x.size(); ++i) {
+        x.data()[i] = static_cast<float>(i % 7) / 7.0f - 0.5f;
+    }
+    assert(graph.output_shape({x.shape()}) == std::vector<int>({2, 5}));
+
+    Tensor expected = activation::sigmoid(layer->forward(x.reshape({2, 12})));
+    Tensor output({2, 5});
+    graph.execute(x, output);
+    for (int i = 0; i < output.size(); ++i) {
+        assert(output.data()[i] == expected.data()[i]);
+    }
+
+    LatencyReductionPass latency;
+    latency.apply(graph);
+    assert(graph.node(dead).removed);
+    MemoryReductionPass memory;
+    memory.apply(graph);
+    // the two reshapes collapse into one view of the input
+    assert(graph.node(same).inputs[0] == input);
+    assert(graph.node(flat).removed);
+
+    Tensor rewritten({2, 5});
+    graph.execute(x, rewritten);
+    for (int i = 0; i < rewritten.size(); ++i) {
+        assert(rewritten.data()[i] == expected.data()[i]);
+    }
+
+    std::cout << "Graph test passed." << std::endl;
+}
+
+void test_fused_epilogue() {
+    // k spans two packing blocks and m, n leave edge tiles
+    int m = 29, n = 45, k = 300;
+    Tensor a({m, k}), b({k, n}), row_bias({m}), col_bias({n});
+    fill_pattern(a, 1, 13, -0.5f);
+    fill_pattern(b, 1, 7, -0.5f);
+    for (int i = 0; i < m; ++i) row_bias.data()[i] = 0.1f * (i % 5) - 0.2f;
+    fill_pattern(col_bias, 1, 9, -0.2f, 0.45f);
+
+    Tensor plain({m, n});
+    gemm::sgemm(false, false, m, n, k, 1.0f, a.data(), k, b.data(), n, 0.0f, plain.data(), n);
+
+    gemm::Activation activations[] = {gemm::Activation::None, gemm::Activation::ReLU,
+                                      gemm::Activation::Sigmoid, gemm::Activation::Tanh};
+    for (gemm::Activation act : activations) {
+        for (bool per_row : {false, true}) {
+            gemm::Epilogue epilogue;
+            epilogue.bias = per_row ? row_bias.data() : col_bias.data();
+            epilogue.bias_per_row = per_row;
+            epilogue.activation = act;
+            Tensor fused({m, n});
+            gemm::sgemm(false, false, m, n, k, 1.0f, a.data(), k, b.data(), n, 0.0f, fused.data(), n, epilogue);
+
+            for (int i = 0; i < m; ++i) {
+                for (int j = 0; j < n; ++j) {
+                    float x = plain.data()[i * n + j] + (per_row ? row_bias.data()[i] : col_bias.data()[j]);
+                    float expected = x;
+                    if (act == gemm::Activation::ReLU) expected = std::max(0.0f, x);
+                    if (act == gemm::Activation::Sigmoid) expected = 1.0f / (1.0f + std::exp(-x));
+                    if (act == gemm::Activation::Tanh) expected = std::tanh(x);
+                    assert_close(fused.data()[i * n + j], expected);
+                }
+            }
+        }
+    }
+
+    // fusing the network's ReLUs leaves only the layers and the flatten view
+    Network network;
+    network.add_convolutional_layer(2, 4, 3, 1, 1);
+    network.add_fully_connected_layer(4 * 6 * 6, 8);
+    network.add_fully_connected_layer(8, 3);
+    Tensor input({2, 2, 6, 6});
+    fill_pattern(input, 1, 11, -0.3f);
+
+    Graph unfused = network.graph();
+    Tensor expected({2, 3});
+    unfused.execute(input, expected);
+
+    Tensor output = network.forward(input);
+    int live = 0;
+    for (const GraphNode& node : network.graph().nodes()) {
+        if (node.removed) continue;
+        assert(node.op != OpType::ReLU);
+        live++;
+    }
+    assert(live == 5);
+    for (int i = 0; i < output.size(); ++i) {
+        assert_close(output.data()[i], expected.data()[i]);
+    }
+
+    std::cout << "Fused epilogue test passed." << std::endl;
+}
+
+void test_cpu_dispatch() {
+    cpu::Isa isa;
+    assert(cpu::parse_isa("avx2", isa) && isa == cpu::Isa::AVX2);
+    assert(cpu::parse_isa("avx512vnni", isa) && isa == cpu::Isa::AVX512VNNI);
+    assert(!cpu::parse_isa("neon", isa));
+    assert(cpu::active_isa() <= cpu::detect());
+    assert(cpu::kernels_for(cpu::Isa::SSE));
+
+    // edge tiles in both directions for every register block, k spans two packing blocks
+    const int m = 29, n = 45, k = 300;
+    Tensor a({m, k}), b({k, n}), bias({n});
+    fill_pattern(a, 1, 13, -0.5f);
+    fill_pattern(b, 1, 7, -0.5f);
+    fill_pattern(bias, 1, 9, -0.2f, 0.45f);
+    Tensor reference({m, n});
+    ops::matmul_cpu_baseline(a, b, reference);
+
+    cpu::Isa original = cpu::active_isa();
+    for (cpu::Isa candidate : {cpu::Isa::SSE, cpu::Isa::AVX2, cpu::Isa::AVX512, cpu::Isa::AVX512VNNI}) {
+        if (!cpu::set_isa(candidate)) {
+            // only refused when the host or the compiler can't do it
+            assert(candidate > cpu::detect() || !cpu::kernels_for(candidate));
+            continue;
+        }
+        assert(cpu::active_isa() == candidate);
+
+        gemm::Epilogue epilogue;
+        epilogue.bias = bias.data();
+        epilogue.activation = gemm::Activation::Tanh;
+        Tensor c({m, n});
+        gemm::sgemm(false, false, m, n, k, 1.0f, a.data(), k, b.data(), n, 0.0f, c.data(), n, epilogue);
+        for (int i = 0; i < m; ++i) {
+            for (int j = 0; j < n; ++j) {
+                float expected = std::tanh(reference.data()[i * n + j] + bias.data()[j]);
+                assert(std::abs(c.data()[i * n + j] - expected) <= 1e-5f);
+            }
+        }
+
+        // odd lengths leave a scalar tail
+        Tensor x({37}), y({37}), sum({37});
+        for (int i = 0; i < x.size(); ++i) {
+            x.data()[i] = 0.3f * i - 5.0f;
+            y.data()[i] = 1.0f - 0.1f * i;
+        }
+        ops::add_cpu(x, y, sum);
+        Tensor s = activation::sigmoid(x);
+        for (int i = 0; i < x.size(); ++i) {
+            assert(sum.data()[i] == x.data()[i] + y.data()[i]);
+            assert(std::abs(s.data()[i] - 1.0f / (1.0f + std::exp(-x.data()[i]))) <= 1e-6f);
+        }
+
+        // one training step on the layer exercises the bias gradient kernel
+        FullyConnectedLayer layer(5, 19);
+        Tensor input({3, 5}), gradient({3, 19});
+        for (int i = 0; i < input.size(); ++i) input.data()[i] = 0.1f * i;
+        for (int i = 0; i < gradient.size(); ++i) gradient.data()[i] = 0.01f * (i % 11) - 0.05f;
+        layer.forward(input);
+        Tensor before = layer.get_bias().clone();
+        layer.backward(gradient, 0.5f);
+        for (int j = 0; j < 19; ++j) {
+            float step = 0.0f;
+            for (int i = 0; i < 3; ++i) step += gradient.data()[i * 19 + j];
+            assert(std::abs(layer.get_bias().data()[j] - (before.data()[j] - 0.5f * step)) <= 1e-6f);
+        }
+
+        // NHWC goes through the direct kernels from AVX2 up and through NCHW below
+        ConvolutionalLayer conv(5, 12, 3, 1, 1);
+        Tensor image({2, 5, 9, 7});
+        fill_pattern(image, 11, 29, -0.5f);
+        Tensor conv_expected(conv.output_shape(image.shape()));
+        conv.forward_baseline(image, conv_expected);
+        Tensor nhwc(layout::physical_shape(image.shape(), Layout::NHWC));
+        layout::convert(image, Layout::NCHW, nhwc, Layout::NHWC);
+        Tensor conv_output(layout::physical_shape(conv_expected.shape(), Layout::NHWC));
+        conv.forward(nhwc, conv_output, gemm::Activation::None, Layout::NHWC);
+        Tensor conv_result(conv_expected.shape());
+        layout::convert(conv_output, Layout::NHWC, conv_result, Layout::NCHW);
+        for (int i = 0; i < conv_result.size(); ++i) {
+            assert(std::abs(conv_result.data()[i] - conv_expected.data()[i]) < 1e-4f);
+        }
+    }
+    assert(cpu::set_isa(original));
+
+    std::cout << "CPU dispatch test passed (" << cpu::isa_name(cpu::active_isa()) << ")." << std::endl;
+}
+
+// distance in units in the last place of the float nearest the reference
+static double ulp_error(float value, double reference) {
+    float rounded = static_cast<float>(reference);
+    double ulp = static_cast<double>(std::nextafter(std::abs(rounded), INFINITY)) - std::abs(rounded);
+    return std::abs(value - reference) / ulp;
+}
+
+void test_activations() {
+    // every ISA must stay inside the bounds documented in activation_functions.h
+    std::vector<float> xs;
+    for (float x = -20.0f; x <= 20.0f; x += 0.00137f) xs.push_back(x);
+    for (float x : {-87.0f, -60.5f, -30.0f, 0.0f, 1e-7f, -1e-7f, 30.0f, 60.5f, 88.0f}) xs.push_back(x);
+    Tensor input({static_cast<int>(xs.size())});
+    std::copy(xs.begin(), xs.end(), input.data());
+
+    struct Bound {
+        cpu::MapOp op;
+        double ulps;
+        float from;
+    };
+    Bound bounds[] = {{cpu::MapOp::Sigmoid, 3.2, -87.0f}, {cpu::MapOp::Tanh, 1.4, -20.0f},
+                      {cpu::MapOp::SiLU, 3.6, -87.0f}, {cpu::MapOp::GELU, 20.0, -4.0f}};
+    auto exact = [](cpu::MapOp op, double x) {
+        switch (op) {
+            case cpu::MapOp::Sigmoid: return 1.0 / (1.0 + std::exp(-x));
+            case cpu::MapOp::Tanh: return std::tanh(x);
+            case cpu::MapOp::SiLU: return x / (1.0 + std::exp(-x));
+            default: return x / (1.0 + std::exp(-1.5957691216057308 * (x + 0.044715 * x * x * x)));
+        }
+    };
+    cpu::MapOp derivatives[] = {cpu::MapOp::ReLUDerivative, cpu::MapOp::SigmoidDerivative,
+                                cpu::MapOp::TanhDerivative, cpu::MapOp::GELUDerivative,
+                                cpu::MapOp::SiLUDerivative, cpu::MapOp::LeakyReLUDerivative};
+
+    for_each_isa([&] {
+        Tensor output(input.shape());
+        for (const Bound& bound : bounds) {
+            cpu::kernels().map(input.data(), output.data(), input.size(), bound.op, 0.0f);
+            for (int i = 0; i < input.size(); ++i) {
+                if (xs[i] < bound.from) continue;
+                double reference = exact(bound.op, xs[i]);
+                if (std::abs(reference) < 1e-30) continue;
+                assert(ulp_error(output.data()[i], reference) <= bound.ulps);
+            }
+        }
+        for (cpu::MapOp op : derivatives) {
+            cpu::kernels().map(input.data(), output.data(), input.size(), op, 0.1f);
+            for (int i = 0; i < input.size(); ++i) {
+                assert(std::abs(output.data()[i] - activation::reference(op, xs[i], 0.1f)) <= 1e-5f);
+            }
+        }
+
+        // in place matches the out-parameter and the returning forms
+        Tensor leaky = activation::leaky_relu(input, 0.2f);
+        Tensor in_place = input.clone();
+        activation::leaky_relu_inplace(in_place, 0.2f);
+        for (int i = 0; i < input.size(); ++i) {
+            assert(leaky.data()[i] == (xs[i] > 0 ? xs[i] : 0.2f * xs[i]));
+            assert(in_place.data()[i] == leaky.data()[i]);
+        }
+
+        // rows of 1, an odd width with a tail and a wide row with values far apart
+        for (int cols : {1, 13, 300}) {
+            Tensor logits({3, cols});
+            for (int i = 0; i < logits.size(); ++i) logits.data()[i] = 0.37f * ((i * 7) % 41) - 5.0f + (i % cols == 2 ? 60.0f : 0.0f);
+            Tensor expected(logits.shape());
+            activation::softmax_baseline(logits, expected);
+            Tensor probabilities = activation::softmax(logits);
+            activation::softmax_inplace(logits);
+            for (int r = 0; r < 3; ++r) {
+                float sum = 0.0f;
+                for (int j = 0; j < cols; ++j) {
+                    float p = probabilities.data()[r * cols + j];
+                    assert(std::abs(p - expected.data()[r * cols + j]) <= 1e-6f);
+                    assert(logits.data()[r * cols + j] == p);
+                    sum += p;
+                }
+                assert(std::abs(sum - 1.0f) <= 1e-5f);
+            }
+        }
+    });
+
+    std::cout << "Activation test passed." << std::endl;
+}
+
+void test_elementwise() {
+    // reference value of a op b at output index i, operands broadcast from the right
+    auto at = [](const Tensor& t, const std::vector<int>& shape, int i) {
+        const float* base = t.data();
+        int rank = static_cast<int>(shape.size());
+        int offset = 0;
+        for (int d = rank - 1; d >= 0; --d) {
+            int coord = i % shape[d];
+            i /= shape[d];
+            int td = d - (rank - static_cast<int>(t.shape().size()));
+            if (td >= 0 && t.shape()[td] != 1) offset += coord * t.strides()[td];
+        }
+        return base[offset];
+    };
+    auto fill = [](Tensor& t, int seed) {
+        for (int i = 0; i < t.size(); ++i) t.data()[i] = static_cast<float>((i * 7 + seed) % 23) / 4.0f - 2.5f;
+    };
+
+    assert(elementwise::broadcast_shape({2, 3, 4, 5}, {3, 1, 1}) == std::vector<int>({2, 3, 4, 5}));
+    assert(elementwise::broadcast_shape({4, 1}, {3}) == std::vector<int>({4, 3}));
+    bool threw = false;
+    try {
+        elementwise::broadcast_shape({2, 3}, {4});
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+    // an output of the wrong size is refused in release builds too
+    threw = false;
+    try {
+        Tensor small({2, 3});
+        elementwise::binary(cpu::BinaryOp::Add, Tensor({2, 4}), Tensor({4}), small);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // {a, b}: same shape, a conv bias over NCHW, row and column vectors, a scalar, rank mismatch
+    std::vector<std::pair<std::vector<int>, std::vector<int>>> cases = {
+        {{2, 3, 4, 5}, {2, 3, 4, 5}}, {{2, 3, 4, 5}, {3, 1, 1}}, {{7, 37}, {37}},
+        {{7, 37}, {7, 1}}, {{1}, {5, 19}}, {{4, 1, 6}, {3, 1}}};
+    for_each_isa([&] {
+        for (const auto& shapes : cases) {
+            Tensor a(shapes.first), b(shapes.second);
+            fill(a, 1);
+            fill(b, 5);
+            for (int i = 0; i < b.size(); ++i) b.data()[i] += b.data()[i] == 0.0f ? 1.0f : 0.0f;
+            std::vector<int> shape = elementwise::broadcast_shape(a.shape(), b.shape());
+            Tensor sum = a + b, difference = a - b, product = a * b, quotient = a / b;
+            Tensor reversed = b - a;
+            assert(sum.shape() == shape && reversed.shape() == shape);
+            for (int i = 0; i < sum.size(); ++i) {
+                float x = at(a, shape, i), y = at(b, shape, i);
+                assert(sum.data()[i] == x + y && difference.data()[i] == x - y);
+                assert(product.data()[i] == x * y && quotient.data()[i] == x / y);
+                assert(reversed.data()[i] == y - x);
+            }
+        }
+
+        // a transposed view is read through its strides, in place output may alias an operand
+        Tensor m({6, 9}), row({6});
+        fill(m, 3);
+        fill(row, 4);
+        Tensor mt = m.transpose(0, 1);
+        Tensor shifted = mt + row;
+        for (int i = 0; i < 9; ++i) {
+            for (int j = 0; j < 6; ++j) assert(shifted.data()[i * 6 + j] == m.data()[j * 9 + i] + row.data()[j]);
+        }
+        multiply(shifted, row, shifted);
+        for (int i = 0; i < 9; ++i) {
+            for (int j = 0; j < 6; ++j) {
+                assert(shifted.data()[i * 6 + j] == (m.data()[j * 9 + i] + row.data()[j]) * row.data()[j]);
+            }
+        }
+
+        // activations and losses cover every element of a 4-D tensor, not just the first two dims
+        Tensor conv_out({2, 3, 5, 7}), target({2, 3, 5, 7});
+        fill(conv_out, 2);
+        fill(target, 9);
+        Tensor activated = activation::relu(conv_out);
+        double squared = 0.0;
+        for (int i = 0; i < conv_out.size(); ++i) {
+            assert(activated.data()[i] == std::max(0.0f, conv_out.data()[i]));
+            double d = conv_out.data()[i] - target.data()[i];
+            squared += d * d;
+        }
+        assert(std::abs(loss::mse(conv_out, target) - squared / conv_out.size()) < 1e-5);
+        Tensor gradient = loss::mse_gradient(conv_out, target);
+        for (int i = 0; i < gradient.size(); ++i) {
+            float expected = 2.0f * (conv_out.data()[i] - target.data()[i]) / conv_out.size();
+            assert(std::abs(gradient.data()[i] - expected) <= 1e-7f);
+        }
+    });
+
+    // past the threading threshold, with a broadcast row so pieces start mid-row
+    Tensor big({300, 1001}), bias({1001});
+    fill(big, 6);
+    fill(bias, 8);
+    Tensor shifted = big + bias;
+    for (int i = 0; i < shifted.size(); ++i) assert(shifted.data()[i] == big.data()[i] + bias.data()[i % 1001]);
+    double squared = 0.0;
+    for (int i = 0; i < big.size(); ++i) {
+        double d = shifted.data()[i] - big.data()[i];
+        squared += d * d;
+    }
+    assert(std::abs(elementwise::sum_squared_difference(shifted, big) - squared) <= 1e-6 * squared);
+    // partials are added in chunk order, the same bits for any number of threads
+    ThreadPool& pool = ThreadPool::getInstance();
+    int threads = pool.num_threads();
+    pool.set_num_threads(1);
+    double serial = elementwise::sum_squared_difference(shifted, big);
+    pool.set_num_threads(4);
+    assert(elementwise::sum_squared_difference(shifted, big) == serial);
+    pool.set_num_threads(threads);
+
+    std::cout << "Elementwise test passed." << std::endl;
+}
+
+void test_thread_pool() {
+    ThreadPool& pool = ThreadPool::getInstance();
+    int original = pool.num_threads();
+    assert(ThreadPool::grain_for(1.0) == static_cast<int>(ThreadPool::kMinTaskCost));
+    assert(ThreadPool::grain_for(1e9) == 1);
+
+    // more threads than cores still has to be correct, the hosts running this may have one
+    for (int threads : {1, 3, 4}) {
+        pool.set_num_threads(threads);
+        assert(pool.num_threads() == threads);
+
+        // every index once, in whole chunks starting on the grain
+        const int begin = 5, end = 5 + 1000, grain = 7;
+        std::vector<std::atomic<int>> hits(end);
+        std::atomic<int> misaligned{0};
+        pool.parallel_for(begin, end, grain, [&](int chunk_begin, int chunk_end) {
+            if ((chunk_begin - begin) % grain != 0 || (chunk_end - chunk_begin > grain)) ++misaligned;
+            for (int i = chunk_begin; i < chunk_end; ++i) ++hits[i];
+        });
+        assert(misaligned == 0);
+        for (int i = 0; i < end; ++i) assert(hits[i] == (i >= begin ? 1 : 0));
+
+        // uneven tasks get stolen, nested calls run serially on the thread that made them. with one
+        // thread there is no parallel region and the outer loop just runs inline
+        std::atomic<int> total{0};
+        std::atomic<int> nested_outside{0};
+        pool.run(16, [&](int task) {
+            if (task < 2) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            if (!ThreadPool::in_parallel_region()) ++nested_outside;
+            pool.parallel_for(0, 100, 10, [&](int chunk_begin, int chunk_end) {
+                total += chunk_end - chunk_begin;
+            });
+        });
+        assert(total == 1600 && nested_outside == (threads == 1 ? 16 : 0));
+        assert(!ThreadPool::in_parallel_region());
+
+        // kernels built on the pool give the same answer at every thread count
+        Tensor a({300, 1001}), b({1001});
+        for (int i = 0; i < a.size(); ++i) a.data()[i] = static_cast<float>(i % 31) - 15.0f;
+        for (int i = 0; i < b.size(); ++i) b.data()[i] = static_cast<float>(i % 7);
+        Tensor sum = a + b;
+        for (int i = 0; i < sum.size(); ++i) assert(sum.data()[i] == a.data()[i] + b.data()[i % 1001]);
+
+        // a chunk that throws, the caller's first one or the last slice's on a worker, comes back
+        // to the caller after every thread is done, and the next job runs normally
+        for (int failing : {0, 990}) {
+            bool caught = false;
+            try {
+                pool.parallel_for(0, 1000, 10, [&](int chunk_begin, int) {
+                    if (chunk_begin == failing) throw std::runtime_error("task failed");
+                });
+            } catch (const std::runtime_error&) {
+                caught = true;
+            }
+            assert(caught && !ThreadPool::in_parallel_region());
+            std::atomic<int> covered{0};
+            pool.parallel_for(0, 1000, 10, [&](int chunk_begin, int chunk_end) { covered += chunk_end - chunk_begin; });
+            assert(covered == 1000);
+        }
+    }
+
+    pool.set_affinity(true);
+    assert(pool.affinity());
+    std::atomic<int> count{0};
+    pool.run(8, [&](int) { ++count; });
+    assert(count == 8);
+    pool.set_affinity(false);
+
+    pool.set_num_threads(original);
+    assert(pool.num_threads() == original);
+
+    std::cout << "Thread pool test passed." << std::endl;
+}
+
+void test_conv_gemm() {
+    // {in, out, kernel, stride, padding, batch, size}, batch 9 also takes the per-image threading path
+    int configs[][7] = {
+        {3, 8, 3, 1, 1, 2, 10},
+        {4, 6, 3, 2, 1, 3, 9},
+        {5, 7, 1, 1, 0, 2, 6},
+        {3, 4, 5, 2, 2, 1, 11},
+        {2, 5, 3, 1, 0, 9, 7},
+    };
+    for (auto& c : configs) {
+        ConvolutionalLayer layer(c[0], c[1], c[2], c[3], c[4]);
+        layer.set_algorithm(ConvAlgorithm::Im2col);
+        Tensor input({c[5], c[0], c[6], c[6] + 1});
+        for (int i = 0; i < input.size(); ++i) {
+            input.data()[i] = static_cast<float>(i % 17) / 17.0f - 0.5f;
+        }
+
+        Tensor expected(layer.output_shape(input.shape()));
+        layer.forward_baseline(input, expected);
+        Tensor output(layer.output_shape(input.shape()));
+        layer.forward(input, output);
+        for (int i = 0; i < output.size(); ++i) {
+            assert(std::abs(output.data()[i] - expected.data()[i]) <= 1e-4f * (1.0f + std::abs(expected.data()[i])));
+        }
+    }
+
+    std::cout << "Conv GEMM test passed." << std::endl;
+}
+
+void test_winograd() {
+    ConvolutionalLayer layer(16, 12, 3, 1, 1);
+    Tensor input({3, 16, 17, 18});
+    for (int i = 0; i < input.size(); ++i) {
+        input.data()[i] = static_cast<float>((i * 7) % 23) / 23.0f - 0.5f;
+    }
+    // the transforms need AVX2, below it (e.g. ANNOF_CPU_ISA=sse) everything runs im2col
+    if (cpu::active_isa() >= cpu::Isa::AVX2) {
+        assert(layer.select_algorithm(input.shape()) == ConvAlgorithm::Winograd4x4);
+        assert(layer.select_algorithm({1, 16, 5, 5}) == ConvAlgorithm::Winograd2x2);
+    }
+    ConvolutionalLayer strided(16, 12, 3, 2, 1);
+    assert(strided.select_algorithm(input.shape()) == ConvAlgorithm::Im2col);
+    ConvolutionalLayer stem(3, 12, 3, 1, 1);
+    assert(stem.select_algorithm({1, 3, 32, 32}) == ConvAlgorithm::Im2col);
+
+    Tensor expected(layer.output_shape(input.shape()));
+    layer.forward_baseline(input, expected);
+    float scale = 0.0f;
+    for (int i = 0; i < expected.size(); ++i) scale = std::max(scale, std::abs(expected.data()[i]));
+
+    // drift grows with the tile size, bound the error relative to the output range
+    std::pair<ConvAlgorithm, float> algorithms[] = {{ConvAlgorithm::Winograd2x2, 1e-5f}, {ConvAlgorithm::Winograd4x4, 1e-4f}};
+    for (auto [algorithm, tolerance] : algorithms) {
+        layer.set_algorithm(algorithm);
+        Tensor output(layer.output_shape(input.shape()));
+        layer.forward(input, output);
+        for (int i = 0; i < output.size(); ++i) {
+            assert(std::abs(output.data()[i] - expected.data()[i]) <= tolerance * scale);
+        }
+    }
+
+    // new weights must not reuse the cached transforms
+    Tensor weights = layer.weights().clone();
+    for (int i = 0; i < weights.size(); ++i) weights.data()[i] *= -2.0f;
+    layer.set_weights(weights);
+    Tensor output(layer.output_shape(input.shape()));
+    layer.forward(input, output);
+    for (int i = 0; i < output.size(); ++i) {
+        assert(std::abs(output.data()[i] + 2.0f * expected.data()[i]) <= 2e-4f * scale);
+    }
+
+    std::cout << "Winograd test passed." << std::endl;
+}
+
+void test_layouts() {
+    // 5 channels leave 3 padding lanes in the NCHW8c block
+    Tensor input({2, 5, 9, 7});
+    for (int i = 0; i < input.size(); ++i) {
+        input.data()[i] = static_cast<float>((i * 11) % 29) / 29.0f - 0.5f;
+    }
+    assert((layout::physical_shape(input.shape(), Layout::NHWC) == std::vector<int>{2, 9, 7, 5}));
+    assert((layout::physical_shape(input.shape(), Layout::NCHW8c) == std::vector<int>{2, 1, 9, 7, 8}));
+
+    Tensor nhwc(layout::physical_shape(input.shape(), Layout::NHWC));
+    Tensor blocked(layout::physical_shape(input.shape(), Layout::NCHW8c));
+    Tensor back(input.shape());
+    layout::convert(input, Layout::NCHW, nhwc, Layout::NHWC);
+    assert(nhwc.data()[((1 * 9 + 2) * 7 + 3) * 5 + 4] == input.data()[((1 * 5 + 4) * 9 + 2) * 7 + 3]);
+    layout::convert(nhwc, Layout::NHWC, blocked, Layout::NCHW8c);
+    assert(blocked.data()[((1 * 9 + 2) * 7 + 3) * 8 + 4] == input.data()[((1 * 5 + 4) * 9 + 2) * 7 + 3]);
+    assert(blocked.data()[7] == 0.0f);
+    layout::convert(blocked, Layout::NCHW8c, back, Layout::NCHW);
+    for (int i = 0; i < input.size(); ++i) {
+        assert(back.data()[i] == input.data()[i]);
+    }
+
+    // in/out channels, kernel, stride, padding: odd channel counts, strided and 1x1 kernels
+    int configs[][5] = {{5, 12, 3, 1, 1}, {5, 20, 3, 2, 1}, {16, 9, 1, 1, 0}, {5, 8, 5, 1, 2}};
+    for (auto& c : configs) {
+        ConvolutionalLayer layer(c[0], c[1], c[2], c[3], c[4]);
+        Tensor image({2, c[0], 9, 7});
+        for (int i = 0; i < image.size(); ++i) image.data()[i] = input.data()[i % input.size()];
+        Tensor expected(layer.output_shape(image.shape()));
+        layer.forward_baseline(image, expected);
+
+        for (Layout l : {Layout::NHWC, Layout::NCHW8c}) {
+            Tensor converted(layout::physical_shape(image.shape(), l));
+            layout::convert(image, Layout::NCHW, converted, l);
+            Tensor output(layout::physical_shape(expected.shape(), l));
+            layer.forward(converted, output, gemm::Activation::ReLU, l);
+            Tensor result(expected.shape());
+            layout::convert(output, l, result, Layout::NCHW);
+            for (int i = 0; i < result.size(); ++i) {
+                assert(std::abs(result.data()[i] - std::max(0.0f, expected.data()[i])) < 1e-4f);
+            }
+        }
+    }
+
+    // conv layers run in NHWC, converted once after the input and once before the flatten
+    Network network;
+    network.add_convolutional_layer(5, 12, 3, 1, 1);
+    network.add_convolutional_layer(12, 8, 3, 2, 1);
+    network.add_fully_connected_layer(8 * 5 * 4, 10);
+    Tensor reference = network.forward(input);
+
+    LayoutPropagationPass pass;
+    network.apply_pass(pass);
+    Tensor output = network.forward(input);
+    int conversions = 0;
+    for (const GraphNode& node : network.graph().nodes()) {
+        if (node.removed || node.op != OpType::LayoutConvert) continue;
+        conversions++;
+    }
+    assert(conversions == 2);
+    for (int i = 0; i < output.size(); ++i) {
+        assert(std::abs(output.data()[i] - reference.data()[i]) < 1e-4f);
+    }
+
+    std::cout << "Layout test passed." << std::endl;
+}
+
+void test_quantization() {
+    // edge tiles in both directions for every int8 block, k not a multiple of 4
+    const int m = 29, n = 45, k = 301;
+    Tensor x({m, k}), w({k, n}), bias({n});
+    fill_pattern(x, 7, 31, -0.3f);
+    fill_pattern(w, 5, 17, -0.5f);
+    fill_pattern(bias, 1, 9, -0.2f, 0.45f);
+    // row 0 times column 0 multiplies the largest codes on both sides, the integer check below
+    // fails if a pair sum saturates
+    for (int p = 0; p < k; ++p) {
+        x.data()[p] = 2.0f;
+        w.data()[p * n] = 1.0f;
+    }
+    x.data()[1] = -0.3f;
+
+    quant::ActivationParams params = quant::activation_params(-0.3f, 2.0f);
+    assert(params.zero > 0.0f && params.zero == std::round(params.zero));
+    uint8_t zero_code;
+    float zero_value = 0.0f;
+    quant::quantize(&zero_value, 1, params, &zero_code);
+    assert(zero_code == params.zero);
+
+    quant::QuantizedWeights qw;
+    quant::quantize_weights(w.data(), k, n, n, 1, bias.data(), qw);
+    assert(qw.k_groups == 76 && qw.panels() == 3);
+    auto weight_code = [&](int p, int j) {
+        return qw.packed[((j / cpu::kInt8Panel) * qw.k_groups + p / 4) * cpu::kInt8Panel * 4 + (j % cpu::kInt8Panel) * 4 + p % 4];
+    };
+    assert(weight_code(0, 0) == quant::kMaxWeight);
+
+    Tensor reference({m, n});
+    ops::matmul_cpu_baseline(x, w, reference);
+    float range = 0.0f;
+    for (int i = 0; i < reference.size(); ++i) range = std::max(range, std::abs(reference.data()[i]));
+
+    for_each_isa([&] {
+        quant::QuantizedActivations qa;
+        quant::quantize_rows(x.data(), m, k, k, nullptr, qa);
+        assert(qa.mr == cpu::kernels().int8_mr && qa.row(0)[0] == quant::kMaxActivation);
+        Tensor c({m, n});
+        quant::gemm(qa, qw, gemm::Activation::ReLU, c.data(), n);
+
+        // every ISA does the same integer arithmetic, checked against it in double
+        for (int i = 0; i < m; ++i) {
+            for (int j = 0; j < n; ++j) {
+                double dot = 0.0;
+                for (int p = 0; p < k; ++p) {
+                    dot += (static_cast<double>(qa.row(i)[p / 4 * qa.group_stride() + p % 4]) - qa.zeros[i]) * weight_code(p, j);
+                }
+                double exact = std::max(0.0, dot * qa.scales[i] * qw.scales[j] + bias.data()[j]);
+                float result = c.data()[i * n + j];
+                assert(std::abs(result - exact) <= 1e-4 * (1.0 + std::abs(exact)));
+                // and close to the float product
+                float expected = std::max(0.0f, reference.data()[i * n + j] + bias.data()[j]);
+                assert(std::abs(result - expected) <= 0.02f * range);
+            }
+        }
+    }, cpu::Isa::AVX512VNNI);
+
+    // the layer against its own float forward, and requantized after a training step
+    FullyConnectedLayer layer(k, n);
+    Tensor float_output = layer.forward_cpu(x);
+    layer.quantize_int8();
+    assert(layer.is_quantized());
+    Tensor int8_output = layer.forward_cpu(x);
+    float scale = 0.0f;
+    for (int i = 0; i < float_output.size(); ++i) scale = std::max(scale, std::abs(float_output.data()[i]));
+    for (int i = 0; i < int8_output.size(); ++i) {
+        assert(std::abs(int8_output.data()[i] - float_output.data()[i]) <= 0.03f * scale);
+    }
+    Tensor gradient({m, n});
+    for (int i = 0; i < gradient.size(); ++i) gradient.data()[i] = 0.5f;
+    layer.backward(gradient, 0.1f);
+    int8_output = layer.forward_cpu(x);
+    layer.dequantize();
+    float_output = layer.forward_cpu(x);
+    scale = 0.0f;
+    for (int i = 0; i < float_output.size(); ++i) scale = std::max(scale, std::abs(float_output.data()[i]));
+    for (int i = 0; i < int8_output.size(); ++i) {
+        assert(std::abs(int8_output.data()[i] - float_output.data()[i]) <= 0.03f * scale);
+    }
+
+    // convolution with padding taps at the zero point, strided, and a 1x1 kernel
+    int configs[][5] = {{5, 12, 3, 1, 1}, {4, 20, 3, 2, 1}, {16, 9, 1, 1, 0}};
+    for (auto& c : configs) {
+        ConvolutionalLayer conv(c[0], c[1], c[2], c[3], c[4]);
+        Tensor image({2, c[0], 9, 7});
+        fill_pattern(image, 11, 29, -0.3f);
+        Tensor expected(conv.output_shape(image.shape()));
+        conv.forward_baseline(image, expected);
+        float conv_scale = 0.0f;
+        for (int i = 0; i < expected.size(); ++i) conv_scale = std::max(conv_scale, std::abs(expected.data()[i]));
+        conv.quantize_int8();
+        Tensor output(expected.shape());
+        conv.forward(image, output, gemm::Activation::ReLU);
+        for (int i = 0; i < output.size(); ++i) {
+            assert(std::abs(output.data()[i] - std::max(0.0f, expected.data()[i])) <= 0.03f * conv_scale);
+        }
+    }
+
+    // the registered pass, calibrated on the inputs it is then run on
+    Network network;
+    network.add_convolutional_layer(5, 12, 3, 1, 1);
+    network.add_fully_connected_layer(12 * 9 * 7, 32);
+    network.add_fully_connected_layer(32, 10);
+    Tensor input({2, 5, 9, 7});
+    fill_pattern(input, 11, 29, -0.5f);
+    Tensor fp32 = network.forward(input);
+    assert(OptimizationPassRegistrar::getInstance().createPass("quantize_int8"));
+    QuantizationPass pass({input});
+    network.apply_pass(pass);
+    for (const auto& fc : network.fully_connected_layers()) assert(fc->is_quantized());
+    assert(network.convolutional_layers()[0]->is_quantized());
+    Tensor quantized = network.forward(input);
+    float network_scale = 0.0f;
+    for (int i = 0; i < fp32.size(); ++i) network_scale = std::max(network_scale, std::abs(fp32.data()[i]));
+    // three layers of rounding on random weights
+    for (int i = 0; i < fp32.size(); ++i) {
+        assert(std::abs(quantized.data()[i] - fp32.data()[i]) <= 0.1f * network_scale);
+    }
+
+    std::cout << "Quantization test passed." << std::endl;
+}
+
+void test_half_precision() {
+    std::vector<uint16_t> patterns(65536);
+    for (int i = 0; i < 65536; ++i) patterns[i] = static_cast<uint16_t>(i);
+    std::vector<float> values(65536);
+    std::vector<uint16_t> back(65536);
+    for_each_isa([&] {
+        const cpu::Kernels& kernels = cpu::kernels();
+        for (cpu::HalfFormat format : {cpu::HalfFormat::Float16, cpu::HalfFormat::BFloat16}) {
+            // every 16-bit value widens exactly and narrows back to itself, NaNs stay NaN.
+            // 37 at a time so every call ends in a partial register
+            for (int i = 0; i < 65536; i += 37) {
+                int count = std::min(37, 65536 - i);
+                kernels.from_half(patterns.data() + i, values.data() + i, count, format);
+                kernels.to_half(values.data() + i, back.data() + i, count, format);
+            }
+            for (int i = 0; i < 65536; ++i) {
+                if (std::isnan(values[i])) {
+                    assert(std::isnan(half::to_float(back[i], format)));
+                } else {
+                    assert(back[i] == patterns[i]);
+                }
+            }
+        }
+
+        auto fp16 = [](float x) { return half::from_float(x, cpu::HalfFormat::Float16); };
+        auto bf16 = [](float x) { return half::from_float(x, cpu::HalfFormat::BFloat16); };
+        assert(fp16(1.0f) == 0x3c00 && fp16(-2.0f) == 0xc000 && fp16(0.1f) == 0x2e66);
+        assert(fp16(65504.0f) == 0x7bff && fp16(65519.0f) == 0x7bff && fp16(65520.0f) == 0x7c00);
+        assert(fp16(std::ldexp(1.0f, -24)) == 0x0001 && fp16(std::ldexp(1.0f, -26)) == 0x0000);
+        assert(fp16(std::ldexp(3.0f, -25)) == 0x0002);
+        // ties to even
+        assert(fp16(1.0f + std::ldexp(1.0f, -11)) == 0x3c00 && fp16(1.0f + std::ldexp(3.0f, -11)) == 0x3c02);
+        assert(bf16(1.0f) == 0x3f80 && bf16(-2.0f) == 0xc000);
+        assert(bf16(1.0f + std::ldexp(1.0f, -8)) == 0x3f80 && bf16(1.0f + std::ldexp(3.0f, -8)) == 0x3f82);
+        assert(bf16(3.4e38f) == 0x7f80 && bf16(INFINITY) == 0x7f80 && fp16(-INFINITY) == 0xfc00);
+        assert(std::isnan(half::to_float(bf16(NAN), cpu::HalfFormat::BFloat16)));
+        assert(std::isnan(half::to_float(fp16(NAN), cpu::HalfFormat::Float16)));
+    });
+
+    // the 16-bit tensor, its views and conversions
+    Tensor x({4, 6});
+    for (int i = 0; i < x.size(); ++i) x.data()[i] = 0.25f * i - 2.0f;
+    Tensor h = x.to(DType::Float16);
+    assert(h.dtype() == DType::Float16 && h.shape() == x.shape() && dtype_size(h.dtype()) == 2);
+    Tensor column = h.transpose(0, 1).slice(2, 3).clone();
+    assert(column.dtype() == DType::Float16 && column.size() == 4 && column.is_contiguous());
+    Tensor widened = column.to(DType::Float32);
+    for (int i = 0; i < 4; ++i) assert(widened.data()[i] == x.data()[i * 6 + 2]);
+    Tensor b = h.to(DType::BFloat16).to(DType::Float32);
+    for (int i = 0; i < x.size(); ++i) assert(b.data()[i] == x.data()[i]);
+    Tensor zeros({3}, DType::BFloat16);
+    for (int i = 0; i < 3; ++i) assert(zeros.half_data()[i] == 0);
+
+    // the streaming kernel and the widen + sgemm path against float weights holding the same
+    // rounded values, full column blocks and tails, every row count
+    const int n = 150, k = 33;
+    Tensor w({k, n}), bias({n});
+    fill_pattern(w, 5, 17, -0.5f);
+    fill_pattern(bias, 1, 9, -0.2f, 0.45f);
+    for (DType dtype : {DType::Float16, DType::BFloat16}) {
+        Tensor stored = w.to(dtype);
+        Tensor rounded = stored.to(DType::Float32);
+        for_each_isa([&] {
+            for (int m : {1, 2, 3, 4, 7, 40}) {
+                Tensor a({m, k});
+                fill_pattern(a, 7, 31, -0.3f);
+                Tensor expected({m, n});
+                ops::matmul_cpu_baseline(a, rounded, expected);
+                Tensor c({m, n});
+                gemm::Epilogue epilogue;
+                epilogue.bias = bias.data();
+                epilogue.activation = gemm::Activation::ReLU;
+                half::gemm(m, n, k, a.data(), k, stored.half_data(), n, half::format_of(dtype), c.data(), n, epilogue);
+                for (int i = 0; i < m; ++i) {
+                    for (int j = 0; j < n; ++j) {
+                        float value = std::max(0.0f, expected.data()[i * n + j] + bias.data()[j]);
+                        assert_close(c.data()[i * n + j], value);
+                    }
+                }
+            }
+        });
+    }
+
+    // the layer against its own float forward, within the rounding of its weights, and trained
+    // through the float copy
+    FullyConnectedLayer layer(k, n);
+    Tensor input({3, k});
+    fill_pattern(input, 7, 31, -0.3f);
+    Tensor float_output = layer.forward_cpu(input);
+    float scale = 0.0f;
+    for (int i = 0; i < float_output.size(); ++i) scale = std::max(scale, std::abs(float_output.data()[i]));
+    for (DType dtype : {DType::Float16, DType::BFloat16}) {
+        layer.set_weight_dtype(dtype);
+        assert(layer.weight_dtype() == dtype && layer.get_weights().dtype() == dtype);
+        Tensor output = layer.forward_cpu(input);
+        float tolerance = dtype == DType::Float16 ? 2e-3f : 2e-2f;
+        for (int i = 0; i < output.size(); ++i) {
+            assert(std::abs(output.data()[i] - float_output.data()[i]) <= tolerance * scale);
+        }
+        layer.set_weight_dtype(DType::Float32);
+    }
+    layer.set_weight_dtype(DType::Float16);
+    Tensor before = layer.get_weights().to(DType::Float32);
+    Tensor gradient({3, n});
+    for (int i = 0; i < gradient.size(); ++i) gradient.data()[i] = 0.5f;
+    Tensor input_gradient = layer.backward(gradient, 0.1f);
+    assert(input_gradient.shape() == input.shape() && layer.weight_dtype() == DType::Float16);
+    Tensor after = layer.get_weights().to(DType::Float32);
+    // each weight moves by -0.1 * 0.5 * column sum of the input
+    for (int p = 0; p < k; ++p) {
+        float sum = input.data()[p] + input.data()[k + p] + input.data()[2 * k + p];
+        float step = after.data()[p * n] - before.data()[p * n];
+        assert(std::abs(step + 0.05f * sum) <= 2e-3f * (1.0f + std::abs(before.data()[p * n])));
+    }
+
+    // the registered passes on a network
+    Network network;
+    network.add_fully_connected_layer(k, 64);
+    network.add_fully_connected_layer(64, 10);
+    Tensor fp32 = network.forward(input);
+    register_half_passes();
+    std::unique_ptr<OptimizationPass> pass = OptimizationPassRegistrar::getInstance().createPass("convert_bf16");
+    assert(pass && OptimizationPassRegistrar::getInstance().createPass("convert_fp16"));
+    network.apply_pass(*pass);
+    for (const auto& fc : network.fully_connected_layers()) assert(fc->weight_dtype() == DType::BFloat16);
+    Tensor bf16_output = network.forward(input);
+    float network_scale = 0.0f;
+    for (int i = 0; i < fp32.size(); ++i) network_scale = std::max(network_scale, std::abs(fp32.data()[i]));
+    for (int i = 0; i < fp32.size(); ++i) {
+        assert(std::abs(bf16_output.data()[i] - fp32.data()[i]) <= 3e-2f * network_scale);
+    }
+
+    std::cout << "Half precision test passed." << std::endl;
+}
+
+void test_block_sparse() {
+    // a partial last block row and a partial last panel
+    const int k = 37, n = 45;
+    Tensor dense({k, n}), bias({n});
+    fill_pattern(dense, 5, 17, -0.45f);
+    fill_pattern(bias, 1, 9, -0.2f, 0.45f);
+    for (int block_rows : {1, 4}) {
+        Tensor w = dense.clone();
+        int groups = (k + block_rows - 1) / block_rows, panels = (n + 7) / 8;
+        assert(sparse::block_density(w.data(), k, n, block_rows) == 1.0);
+        sparse::prune(w.data(), k, n, block_rows, 0.6f);
+        int zeroed = static_cast<int>(0.6f * groups * panels + 0.5f);
+        double density = sparse::block_density(w.data(), k, n, block_rows);
+        assert(std::abs(density - (1.0 - static_cast<double>(zeroed) / (groups * panels))) < 1e-9);
+
+        sparse::BlockSparseWeights bsr;
+        sparse::from_dense(w.data(), k, n, block_rows, bsr);
+        assert(bsr.block_rows == block_rows && bsr.panels() == panels && std::abs(bsr.density() - density) < 1e-9);
+        assert(bsr.values.size() == static_cast<size_t>(bsr.blocks()) * block_rows * 8);
+        for (int start : bsr.block_starts) assert(start >= 0 && start + block_rows <= k);
+
+        for_each_isa([&] {
+            for (int m : {1, 2, 3, 4, 9}) {
+                Tensor a({m, k});
+                fill_pattern(a, 7, 31, -0.3f);
+                Tensor expected({m, n});
+                ops::matmul_cpu_baseline(a, w, expected);
+                Tensor c({m, n});
+                gemm::Epilogue epilogue;
+                epilogue.bias = bias.data();
+                epilogue.activation = gemm::Activation::ReLU;
+                sparse::gemm(m, a.data(), k, bsr, c.data(), n, epilogue);
+                for (int i = 0; i < m * n; ++i) {
+                    float value = std::max(0.0f, expected.data()[i] + bias.data()[i % n]);
+                    assert_close(c.data()[i], value);
+                }
+            }
+        });
+    }
+    bool threw = false;
+    try {
+        sparse::BlockSparseWeights bsr;
+        sparse::from_dense(dense.data(), k, n, 2, bsr);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // the layer against its own dense forward, before and after a training step
+    FullyConnectedLayer layer(64, 40);
+    layer.prune(0.75f, 4);
+    assert(std::abs(layer.weight_density(4) - 0.25) < 0.01);
+    Tensor input({3, 64});
+    fill_pattern(input, 7, 31, -0.3f);
+    for (int step = 0; step < 2; ++step) {
+        Tensor expected = layer.forward_cpu(input);
+        layer.set_sparse(4);
+        assert(layer.is_sparse());
+        Tensor output = layer.forward_cpu(input);
+        for (int i = 0; i < output.size(); ++i) {
+            assert_close(output.data()[i], expected.data()[i]);
+        }
+        Tensor gradient({3, 40});
+        for (int i = 0; i < gradient.size(); ++i) gradient.data()[i] = 0.5f;
+        layer.backward(gradient, 0.1f);
+        // the step filled the pruned weights in, the sparse copy follows
+        expected = layer.forward_cpu(input);
+        layer.set_sparse(0);
+        Tensor dense_output = layer.forward_cpu(input);
+        for (int i = 0; i < output.size(); ++i) {
+            assert_close(dense_output.data()[i], expected.data()[i]);
+        }
+        assert(layer.weight_density(4) == 1.0);
+        layer.prune(0.75f, 4);
+    }
+
+    // the pass prunes, times both ways and keeps the faster, the outputs agree either way
+    Network network;
+    network.add_fully_connected_layer(256, 256);
+    network.add_fully_connected_layer(256, 10);
+    register_sparsity_passes();
+    assert(OptimizationPassRegistrar::getInstance().createPass("sparsify"));
+    SparsityPass pass(0.9f, 4, 1);
+    network.apply_pass(pass);
+    assert(pass.decisions().size() == 2);
+    for (const SparsityPass::Decision& decision : pass.decisions()) {
+        assert(decision.density < 0.11 && decision.dense_ms > 0.0 && decision.sparse_ms > 0.0);
+    }
+    Tensor batch({2, 256});
+    fill_pattern(batch, 11, 29, -0.5f);
+    Tensor chosen = network.forward(batch);
+    for (const auto& fc : network.fully_connected_layers()) fc->set_sparse(0);
+    Tensor reference = network.forward(batch);
+    for (int i = 0; i < chosen.size(); ++i) {
+        assert_close(chosen.data()[i], reference.data()[i], 1e-4f);
+    }
+
+    std::cout << "Block sparse test passed." << std::endl;
+}
+
+void test_prepacked_weights() {
+    // k crosses a cache block, n ends in a partial sliver and m in a partial row block
+    const int k = 300, n = 45;
+    Tensor b({k, n}), bt({n, k}), bias({n});
+    fill_pattern(b, 5, 17, -0.45f);
+    for (int p = 0; p < k; ++p) {
+        for (int j = 0; j < n; ++j) bt.data()[j * k + p] = b.data()[p * n + j];
+    }
+    fill_pattern(bias, 1, 9, -0.2f, 0.45f);
+    gemm::Epilogue epilogue;
+    epilogue.bias = bias.data();
+    epilogue.activation = gemm::Activation::ReLU;
+    cpu::Isa original = cpu::active_isa();
+    for_each_isa([&] {
+        for (bool trans_b : {false, true}) {
+            gemm::PackedB packed;
+            gemm::pack_b(trans_b, k, n, trans_b ? bt.data() : b.data(), trans_b ? k : n, packed);
+            assert(packed.k == k && packed.n == n && packed.nr == cpu::kernels().nr);
+            for (int m : {1, 7, 80}) {
+                Tensor a({m, k});
+                fill_pattern(a, 7, 31, -0.3f);
+                Tensor expected({m, n}), c({m, n});
+                gemm::sgemm(false, false, m, n, k, 0.5f, a.data(), k, b.data(), n, 0.0f, expected.data(), n, epilogue);
+                gemm::sgemm_packed(false, m, 0.5f, a.data(), k, packed, 0.0f, c.data(), n, epilogue);
+                for (int i = 0; i < m * n; ++i) {
+                    assert_close(c.data()[i], expected.data()[i]);
+                }
+            }
+        }
+    });
+
+    // packed for one register block, refused by another
+    gemm::PackedB packed;
+    assert(cpu::set_isa(cpu::Isa::SSE));
+    gemm::pack_b(false, k, n, b.data(), n, packed);
+    if (cpu::set_isa(original) && cpu::kernels().nr != packed.nr) {
+        Tensor a({1, k}), c({1, n});
+        bool threw = false;
+        try {
+            gemm::sgemm_packed(false, 1, 1.0f, a.data(), k, packed, 0.0f, c.data(), n);
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+    assert(cpu::set_isa(original));
+
+    // the layer against a plain sgemm of its weights, across training steps and an ISA switch
+    FullyConnectedLayer layer(300, 70);
+    Tensor input({5, 300});
+    fill_pattern(input, 7, 31, -0.3f);
+    layer.set_prepacked(true);
+    assert(layer.is_prepacked());
+    for (int step = 0; step < 3; ++step) {
+        // the packed copy is only rebuilt by forward, after the update or for the new ISA
+        if (step == 2) assert(cpu::set_isa(cpu::Isa::SSE));
+        Tensor output = layer.forward_cpu(input);
+        Tensor expected({5, 70});
+        gemm::sgemm(false, false, 5, 70, 300, 1.0f, input.data(), 300, layer.get_weights().data(), 70, 0.0f,
+                    expected.data(), 70);
+        for (int i = 0; i < output.size(); ++i) {
+            float value = expected.data()[i] + layer.get_bias().data()[i % 70];
+            assert_close(output.data()[i], value);
+        }
+        Tensor gradient({5, 70});
+        for (int i = 0; i < gradient.size(); ++i) gradient.data()[i] = 0.25f;
+        layer.backward(gradient, 0.1f);
+    }
+    layer.set_prepacked(false);
+    assert(!layer.is_prepacked());
+    assert(cpu::set_isa(original));
+
+    std::cout << "Prepacked weights test passed." << std::endl;
+}
+
+void test_gemv() {
+    // a full strip, partial registers, and row blocks past one kernel call
+    const int k = 37;
+    for (int n : {45, 150}) {
+        Tensor b({k, n}), bias({n});
+        fill_pattern(b, 5, 17, -0.45f);
+        fill_pattern(bias, 1, 9, -0.2f, 0.45f);
+        gemm::Epilogue epilogue;
+        epilogue.bias = bias.data();
+        epilogue.activation = gemm::Activation::ReLU;
+        for_each_isa([&] {
+            for (int m : {1, 2, 3, 4, 5, 9}) {
+                Tensor a({m, k});
+                fill_pattern(a, 7, 31, -0.3f);
+                Tensor expected({m, n});
+                ops::matmul_cpu_baseline(a, b, expected);
+                // c with a wider row stride, the columns past n stay untouched
+                Tensor c({m, n + 3});
+                for (int i = 0; i < c.size(); ++i) c.data()[i] = -7.0f;
+                gemm::gemv(m, n, k, a.data(), k, b.data(), n, c.data(), n + 3, epilogue);
+                for (int i = 0; i < m; ++i) {
+                    for (int j = 0; j < n; ++j) {
+                        float value = std::max(0.0f, expected.data()[i * n + j] + bias.data()[j]);
+                        assert_close(c.data()[i * (n + 3) + j], value);
+                    }
+                    for (int j = n; j < n + 3; ++j) assert(c.data()[i * (n + 3) + j] == -7.0f);
+                }
+            }
+        });
+    }
+
+    // the layer picks gemv for small batches, the result matches a plain sgemm of its weights
+    FullyConnectedLayer layer(300, 70);
+    for (int m : {1, 4, 6}) {
+        Tensor input({m, 300});
+        fill_pattern(input, 7, 31, -0.3f);
+        Tensor output({m, 70});
+        layer.forward_cpu(input, output, gemm::Activation::Tanh);
+        Tensor expected({m, 70});
+        gemm::Epilogue epilogue;
+        epilogue.bias = layer.get_bias().data();
+        epilogue.activation = gemm::Activation::Tanh;
+        gemm::sgemm(false, false, m, 70, 300, 1.0f, input.data(), 300, layer.get_weights().data(), 70, 0.0f,
+                    expected.data(), 70, epilogue);
+        for (int i = 0; i < output.size(); ++i) {
+            assert_close(output.data()[i], expected.data()[i]);
+        }
+    }
+
+    std::cout << "GEMV test passed." << std::endl;
+}
+
+void test_program_cache() {
+    // the cache itself needs no device, a fake binary stands in for a compiled program
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "annof_program_cache_test";
+    std::filesystem::remove_all(directory);
+    ProgramBinaryCache cache(directory.string());
+    assert(cache.enabled());
+
+    std::string key = ProgramBinaryCache::key("device", "1.0", "__kernel void k() {}", "-cl-fast-relaxed-math");
+    assert(key != ProgramBinaryCache::key("device", "1.1", "__kernel void k() {}", "-cl-fast-relaxed-math"));
+    assert(key != ProgramBinaryCache::key("device", "1.0", "__kernel void k2() {}", "-cl-fast-relaxed-math"));
+    assert(key != ProgramBinaryCache::key("device", "1.0", "__kernel void k() {}", ""));
+    assert(key != ProgramBinaryCache::key("other", "1.0", "__kernel void k() {}", "-cl-fast-relaxed-math"));
+
+    std::vector<unsigned char> binary(1000);
+    for (size_t i = 0; i < binary.size(); ++i) binary[i] = static_cast<unsigned char>(i * 7);
+    std::vector<unsigned char> loaded;
+    assert(!cache.load(key, loaded));
+    assert(cache.store(key, binary));
+    assert(cache.load(key, loaded));
+    assert(loaded == binary);
+
+    // a truncated entry is a miss, the caller rebuilds from source and stores again
+    std::filesystem::resize_file(cache.path(key), 100);
+    assert(!cache.load(key, loaded));
+    { std::ofstream(cache.path(key), std::ios::binary) << "not a program binary"; }
+    assert(!cache.load(key, loaded));
+    assert(cache.store(key, binary));
+    assert(cache.load(key, loaded) && loaded == binary);
+
+    // so is a binary length past the end of the file, read before anything is allocated for it
+    {
+        std::fstream file(cache.path(key), std::ios::binary | std::ios::in | std::ios::out);
+        uint64_t huge = uint64_t(1) << 62;
+        // past the magic, the key length and the key
+        file.seekp(sizeof(uint64_t) * 2 + key.size());
+        file.write(reinterpret_cast<const char*>(&huge), sizeof(huge));
+    }
+    assert(!cache.load(key, loaded));
+    assert(cache.store(key, binary));
+    assert(cache.load(key, loaded) && loaded == binary);
+
+    ProgramBinaryCache disabled("");
+    assert(!disabled.enabled());
+    assert(!disabled.store(key, binary));
+    assert(!disabled.load(key, loaded));
+
+    std::filesystem::remove_all(directory);
+    std::cout << "Program cache test passed." << std::endl;
+}
+
+void test_scheduler() {
+    // a made-up machine whose GPU is 10x faster at GEMM but sits behind a 1 GB/s bus
+    DeviceProfile profile;
+    profile.cpu = "test cpu";
+    profile.gpu = "test gpu";
+    profile.cpu_threads = 4;
+    profile.cpu_gemm_flops = 50e6;
+    profile.cpu_elementwise_bytes = 10e6;
+    profile.gpu_gemm_flops = 500e6;
+    profile.gpu_elementwise_bytes = 100e6;
+    profile.upload_bytes = 1e6;
+    profile.download_bytes = 1e6;
+    profile.gpu_launch = 0.05;
+
+    Scheduler scheduler(profile);
+    Tensor small({16, 16});
+    Tensor large({1024, 1024});
+    Tensor vector({1 << 20});
+    assert(scheduler.select(OpCost::matmul(small, small)) == Device::CPU);
+    assert(scheduler.select(OpCost::matmul(large, large)) == Device::GPU);
+    // an add moves 12 bytes for one flop, the bus costs more than the CPU takes
+    assert(scheduler.select(OpCost::add(vector, vector)) == Device::CPU);
+    // the same layer, once with its weights still to upload and once resident
+    OpCost cold = OpCost::fully_connected(4, 4096, 4096, false);
+    OpCost resident = OpCost::fully_connected(4, 4096, 4096, true);
+    assert(scheduler.estimate_gpu(resident) < scheduler.estimate_gpu(cold));
+    assert(scheduler.select(cold) == Device::CPU);
+    assert(scheduler.select(resident) == Device::GPU);
+
+    // every decision is kept with both estimates and the reason
+    std::vector<SchedulingDecision> decisions = scheduler.decisions();
+    assert(decisions.size() == 5);
+    assert(decisions[1].cost.op == "matmul" && decisions[1].device == Device::GPU);
+    assert(decisions[1].gpu_ms < decisions[1].cpu_ms && !decisions[1].reason.empty());
+    scheduler.clear_decisions();
+    assert(scheduler.decisions().empty());
+
+    // without a GPU everything stays on the CPU
+    DeviceProfile cpu_only = profile;
+    cpu_only.gpu_gemm_flops = 0.0;
+    Scheduler fallback(cpu_only);
+    assert(fallback.select(OpCost::matmul(large, large)) == Device::CPU);
+
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "annof_scheduler_profile_test.txt";
+    assert(profile.save(path.string()));
+    DeviceProfile loaded;
+    assert(loaded.load(path.string()));
+    assert(loaded.gpu == "test gpu" && loaded.cpu_threads == 4 && loaded.has_gpu());
+    assert(std::abs(loaded.upload_bytes - profile.upload_bytes) < 1.0);
+    std::filesystem::remove(path);
+    assert(!loaded.load(path.string()));
+
+    std::cout << "Scheduler test passed." << std::endl;
+}
+
+void test_opencl_runtime() {
+    // any OpenCL device will do, a CPU implementation such as PoCL included
+    if (!OpenCLRuntime::available()) {
+        std::cout << "OpenCL runtime test skipped, no OpenCL device." << std::endl;
+        return;
+    }
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+
+    // the program is compiled by the first call only
+    Tensor a({1000});
+    Tensor b({1000});
+    Tensor sum({1000});
+    for (int i = 0; i < 1000; ++i) {
+        a.data()[i] = static_cast<float>(i);
+        b.data()[i] = static_cast<float>(2 * i);
+    }
+    size_t builds = runtime.program_builds();
+    ops::add_gpu(a, b, sum);
+    ops::add_gpu(a, b, sum);
+    assert(runtime.program_builds() == builds + 1);
+    for (int i = 0; i < 1000; ++i) {
+        assert(sum.data()[i] == static_cast<float>(3 * i));
+    }
+
+    // weights and bias are uploaded once and stay resident until backward changes them
+    FullyConnectedLayer layer(64, 32);
+    Tensor input({4, 64});
+    for (int i = 0; i < input.size(); ++i) input.data()[i] = static_cast<float>(i % 13) / 13.0f;
+    size_t uploads = runtime.resident_uploads();
+    Tensor expected = layer.forward_cpu(input);
+    for (int pass = 0; pass < 2; ++pass) {
+        Tensor output = layer.forward_gpu(input);
+        for (int i = 0; i < output.size(); ++i) {
+            assert(std::abs(output.data()[i] - expected.data()[i]) < 1e-4f);
+        }
+    }
+    assert(runtime.resident_uploads() == uploads + 2);
+
+    Tensor gradient({4, 32});
+    for (int i = 0; i < gradient.size(); ++i) gradient.data()[i] = static_cast<float>(i % 5) - 2.0f;
+    layer.backward(gradient, 0.01f);
+    expected = layer.forward_cpu(input);
+    Tensor output = layer.forward_gpu(input);
+    assert(runtime.resident_uploads() == uploads + 4);
+    for (int i = 0; i < output.size(); ++i) {
+        assert(std::abs(output.data()[i] - expected.data()[i]) < 1e-4f);
+    }
+    // the out-parameter form downloads into the caller's tensor, from the same resident parameters
+    Tensor into({4, 32});
+    layer.forward_gpu(input, into);
+    assert(runtime.resident_uploads() == uploads + 4);
+    for (int i = 0; i < into.size(); ++i) assert(into.data()[i] == output.data()[i]);
+
+    // parameters the caller does not hand over are uploaded per call, never cached: new values in
+    // the same storage are picked up
+    Tensor weights = layer.get_weights().clone();
+    Tensor bias = layer.get_bias().clone();
+    uploads = runtime.resident_uploads();
+    for (int pass = 0; pass < 2; ++pass) {
+        Tensor free_output = gpu_operations::fully_connected_forward(input, weights, bias);
+        Tensor reference({4, 32});
+        ops::matmul_cpu_baseline(input, weights, reference);
+        for (int i = 0; i < reference.size(); ++i) {
+            assert(std::abs(free_output.data()[i] - reference.data()[i] - bias.data()[i % 32]) < 1e-4f);
+        }
+        for (int i = 0; i < weights.size(); ++i) weights.data()[i] *= -0.5f;
+    }
+    assert(runtime.resident_uploads() == uploads);
+
+    std::cout << "OpenCL runtime test passed on " << runtime.device_name() << "." << std::endl;
+}
+
+void test_opencl_gemm() {
+    // candidate filtering needs no device
+    for (const opencl_gemm::TileConfig& config : opencl_gemm::candidates(64, 8192)) {
+        assert(config.local_m() * config.local_n() <= 64);
+        assert(config.local_bytes() <= 8192);
+        assert(config.tile_m % config.work_m == 0 && config.tile_n % config.work_n == 0);
+    }
+    assert(!opencl_gemm::candidates(1024, 32768).empty());
+    assert(opencl_gemm::candidates(16, 32768).empty());
+
+    if (!OpenCLRuntime::available()) {
+        std::cout << "OpenCL GEMM test skipped, no OpenCL device." << std::endl;
+        return;
+    }
+    OpenCLRuntime& runtime = OpenCLRuntime::getInstance();
+
+    // ragged in every dimension so each config runs its edge guards
+    const int m = 37, n = 70, k = 45;
+    Tensor a({m, k});
+    Tensor b({k, n});
+    Tensor bias({1, n});
+    for (int i = 0; i < a.size(); ++i) a.data()[i] = static_cast<float>(i % 11) / 11.0f - 0.5f;
+    for (int i = 0; i < b.size(); ++i) b.data()[i] = static_cast<float>(i % 7) / 7.0f - 0.5f;
+    for (int i = 0; i < n; ++i) bias.data()[i] = static_cast<float>(i % 3);
+    Tensor expected({m, n});
+    ops::matmul_cpu(a, b, expected);
+
+    cl_mem a_buffer = runtime.scratch("test.a", a.size() * sizeof(float));
+    cl_mem b_buffer = runtime.scratch("test.b", b.size() * sizeof(float));
+    cl_mem bias_buffer = runtime.scratch("test.bias", bias.size() * sizeof(float));
+    cl_mem c_buffer = runtime.scratch("test.c", expected.size() * sizeof(float));
+    runtime.upload(a_buffer, a.data(), a.size());
+    runtime.upload(b_buffer, b.data(), b.size());
+    runtime.upload(bias_buffer, bias.data(), bias.size());
+
+    size_t max_work_group_size = 0;
+    cl_ulong local_memory = 0;
+    clGetDeviceInfo(runtime.device(), CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_work_group_size), &max_work_group_size, nullptr);
+    clGetDeviceInfo(runtime.device(), CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_memory), &local_memory, nullptr);
+    Tensor c({m, n});
+    for (const opencl_gemm::TileConfig& config : opencl_gemm::candidates(max_work_group_size, local_memory)) {
+        opencl_gemm::sgemm(config, m, n, k, a_buffer, b_buffer, bias_buffer, c_buffer);
+        runtime.download(c_buffer, c.data(), c.size());
+        for (int i = 0; i < m; ++i) {
+            for (int j = 0; j < n; ++j) {
+                assert(std::abs(c.data()[i * n + j] - expected.data()[i * n + j] - bias.data()[j]) < 1e-4f);
+            }
+        }
+    }
+
+    // a tuned shape is timed once and read back by the next tuner on the same file
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "annof_gemm_tuning_test.txt";
+    std::filesystem::remove(path);
+    OpenCLGemmTuner tuner(path.string());
+    opencl_gemm::TileConfig chosen = tuner.config(m, n, k);
+    assert(tuner.config(m, n, k) == chosen);
+    assert(tuner.config(60, 100, 50) == chosen);
+    assert(tuner.tunings() == 1);
+    OpenCLGemmTuner reloaded(path.string());
+    assert(reloaded.tuned(m, n, k));
+    assert(reloaded.config(m, n, k) == chosen);
+    assert(reloaded.tunings() == 0);
+    std::filesystem::remove(path);
+
+    Tensor result({m, n});
+    ops::matmul_gpu(a, b, result);
+    for (int i = 0; i < result.size(); ++i) {
+        assert(std::abs(result.data()[i] - expected.data()[i]) < 1e-4f);
+    }
+
+    std::cout << "OpenCL GEMM test passed, tuned " << chosen.name() << " on " << runtime.device_name() << "." << std::endl;
+}
+
+void test_gpu_async() {
+    if (!OpenCLRuntime::available()) {
+        std::cout << "GPU async test skipped, no OpenCL device." << std::endl;
+        return;
+    }
+
+    // two calls in flight at once, each future covers its own result
+    Tensor a({4096});
+    Tensor b({4096});
+    Tensor first({4096});
+    Tensor second({4096});
+    for (int i = 0; i < 4096; ++i) {
+        a.data()[i] = static_cast<float>(i);
+        b.data()[i] = 1.0f;
+    }
+    GpuFuture first_done = ops::add_gpu_async(a, b, first);
+    GpuFuture second_done = ops::add_gpu_async(b, b, second);
+    second_done.wait();
+    first_done.wait();
+    assert(first_done.ready());
+    for (int i = 0; i < 4096; ++i) {
+        assert(first.data()[i] == static_cast<float>(i + 1));
+        assert(second.data()[i] == 2.0f);
+    }
+
+    // the pipeline matches the network's CPU forward, with every layer chained on the device
+    Network network;
+    network.add_fully_connected_layer(48, 64);
+    network.add_fully_connected_layer(64, 40);
+    network.add_fully_connected_layer(40, 10);
+    GpuPipeline pipeline(network);
+    assert(pipeline.size() == 3);
+
+    std::vector<Tensor> inputs;
+    std::vector<Tensor> outputs;
+    for (int batch = 0; batch < 5; ++batch) {
+        Tensor input({3 + batch, 48});
+        for (int i = 0; i < input.size(); ++i) input.data()[i] = static_cast<float>((i + batch) % 9) / 9.0f - 0.4f;
+        inputs.push_back(input);
+        outputs.emplace_back(std::vector<int>{3 + batch, 10});
+    }
+    Tensor single({3, 10});
+    pipeline.forward_async(inputs[0], single).wait();
+    pipeline.forward_stream(inputs, outputs);
+    for (size_t batch = 0; batch < inputs.size(); ++batch) {
+        Tensor expected = network.forward(inputs[batch]);
+        for (int i = 0; i < expected.size(); ++i) {
+            assert(std::abs(outputs[batch].data()[i] - expected.data()[i]) < 1e-4f);
+            if (batch == 0) assert(std::abs(single.data()[i] - expected.data()[i]) < 1e-4f);
+        }
+    }
+
+    std::cout << "GPU async test passed." << std::endl;
+}
+
+void test_split_gemm() {
+    // runs anywhere: without a device every row goes to the CPU. ANNOF_OPENCL_DEVICE=cpu
+    // with a CPU OpenCL driver exercises the real split
+    const int m = 67, n = 48, k = 80;
+    Tensor a({m, k});
+    Tensor b({k, n});
+    for (int i = 0; i < a.size(); ++i) a.data()[i] = static_cast<float>(i % 13) / 13.0f - 0.5f;
+    for (int i = 0; i < b.size(); ++i) b.data()[i] = static_cast<float>(i % 5) / 5.0f - 0.5f;
+    Tensor expected({m, n});
+    ops::matmul_cpu(a, b, expected);
+
+    SplitGemm& split = SplitGemm::getInstance();
+    for (int call = 0; call < 4; ++call) {
+        Tensor result({m, n});
+        ops::matmul_split(a, b, result);
+        for (int i = 0; i < result.size(); ++i) {
+            assert(std::abs(result.data()[i] - expected.data()[i]) < 1e-4f);
+        }
+        SplitGemm::Split last = split.last_split();
+        assert(last.gpu_rows + last.cpu_rows == m);
+        if (OpenCLRuntime::available()) {
+            assert(last.gpu_rows > 0 && last.cpu_rows > 0);
+            assert(last.next_share >= SplitGemm::kMinShare && last.next_share <= 1.0 - SplitGemm::kMinShare);
+        } else {
+            assert(last.gpu_rows == 0);
+        }
+    }
+
+    // the layer keeps bias and activation, whichever side computes a row
+    FullyConnectedLayer layer(k, n);
+    Tensor fused({m, n});
+    Tensor reference({m, n});
+    layer.forward_cpu(a, reference, gemm::Activation::ReLU);
+    layer.forward_split(a, fused, gemm::Activation::ReLU);
+    for (int i = 0; i < fused.size(); ++i) {
+        assert(std::abs(fused.data()[i] - reference.data()[i]) < 1e-4f);
+    }
+
+    // calls from several threads at once share the device buffers, each still gets its own rows
+    std::vector<Tensor> results;
+    for (int caller = 0; caller < 4; ++caller) results.emplace_back(std::vector<int>{m, n});
+    std::vector<std::thread> callers;
+    for (Tensor& result : results) {
+        callers.emplace_back([&] { split.run(a, b, nullptr, result); });
+    }
+    for (std::thread& caller : callers) caller.join();
+    for (const Tensor& result : results) {
+        for (int i = 0; i < result.size(); ++i) assert(std::abs(result.data()[i] - expected.data()[i]) < 1e-4f);
+    }
+
+    std::cout << "Split GEMM test passed." << std::endl;
+}
+
 int main() {
     test_add_cpu();
+    test_matmul_cpu();
+    test_tensor_views();
+    test_network_forward_into();
+    test_allocators();
+    test_memory_planner();
+    test_graph();
+    test_fused_epilogue();
+    test_cpu_dispatch();
+    test_activations();
+    test_elementwise();
+    test_thread_pool();
+    test_conv_gemm();
+    test_winograd();
+    test_layouts();
+    test_quantization();
+    test_half_precision();
+    test_block_sparse();
+    test_prepacked_weights();
+    test_gemv();
+    test_program_cache();
+    test_scheduler();
+    test_opencl_runtime();
+    test_opencl_gemm();
+    test_gpu_async();
+    test_split_gemm();
     return 0;
 }
\ No newline at end of file